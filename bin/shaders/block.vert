@@ -1,10 +1,10 @@
 #version 330
 
+// Decodes render::Vertex. Positions are fixed point and relative to chunkOffset, which is the chunk position relative
+// to the camera. The view matrix has no translation, so world coordinates never reach the GPU as floats.
 layout (location = 0) in vec3 position;
-layout (location = 1) in vec2 texCoord;
-layout (location = 2) in uint inTexIndex;
-layout (location = 3) in vec3 tint;
-layout (location = 4) in uint ambientOcclusion;
+layout (location = 1) in uint inTexIndex;
+layout (location = 2) in uint data;
 
 out vec2 TexCoord;
 flat out uint texIndex;
@@ -13,14 +13,33 @@ out vec3 varyingTint;
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+uniform vec3 chunkOffset;
+
+// Indexed by the tint index of the vertex. Index 0 is untinted.
+const vec3 tints[4] = vec3[4](
+	vec3(1.0, 1.0, 1.0),
+	vec3(137.0 / 255.0, 191.0 / 255.0, 98.0 / 255.0), // Grass
+	vec3(0.22, 0.60, 0.21), // Leaves
+	vec3(1.0, 1.0, 1.0)
+);
 
 void main() {
-	vec4 worldPos = model * vec4(position, 1.0f);
+	vec3 localPos = position / 2048.0 - 8.0;
+	vec4 worldPos = model * vec4(localPos + chunkOffset, 1.0f);
 	vec4 viewPos = view * worldPos;
 
 	gl_Position = projection * viewPos;
 
-	TexCoord = texCoord;
+	TexCoord = vec2(float(data & 1023u), float((data >> 10) & 1023u)) / 32.0;
 	texIndex = inTexIndex;
-	varyingTint = tint * (0.55 + float(ambientOcclusion) * 0.15);
+
+	vec3 tint = tints[(data >> 20) & 3u];
+	uint ambientOcclusion = (data >> 22) & 3u;
+	uint light = data >> 24;
+
+	// Each light level is 80% as bright as the one above it.
+	float level = float(max(light >> 4u, light & 15u));
+	float brightness = pow(0.8, 15.0 - level);
+
+	varyingTint = tint * (0.55 + float(ambientOcclusion) * 0.15) * brightness;
 }
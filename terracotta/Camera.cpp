@@ -68,6 +68,10 @@ glm::mat4 Camera::GetViewMatrix() const {
     return glm::lookAt(m_Position, m_Position + m_Front, m_Up);
 }
 
+glm::mat4 Camera::GetRotationMatrix() const {
+    return glm::lookAt(glm::vec3(0.0f), m_Front, m_Up);
+}
+
 glm::mat4 Camera::GetPerspectiveMatrix() const {
     return glm::perspective(m_Fov, m_AspectRatio, m_Near, m_Far);
 }
@@ -32,6 +32,8 @@ public:
     glm::vec3 GetRight() const { return m_Right; }
     float GetZoom() const { return m_Zoom; }
     glm::mat4 GetViewMatrix() const;
+    // The view matrix without the translation, for positions that are already relative to the camera.
+    glm::mat4 GetRotationMatrix() const;
     glm::mat4 GetPerspectiveMatrix() const;
 
     void SetPosition(glm::vec3 pos) { m_Position = pos; }
@@ -1,24 +1,139 @@
 #include "Chunk.h"
+#include "EpochManager.h"
 
 #include <algorithm>
 
 namespace terra {
 
-Chunk::Chunk() {
-    auto block = mc::block::BlockRegistry::GetInstance()->GetBlock(0);
+// Chunks are created and destroyed constantly while moving around, so their storage is recycled.
+// The pools are never destroyed because chunks can still be released while static objects are torn down.
+static VectorPool<mc::block::BlockPtr>& GetPalettePool() {
+    static VectorPool<mc::block::BlockPtr>* pool = new VectorPool<mc::block::BlockPtr>();
+    return *pool;
+}
 
-    for (int y = 0; y < 16; ++y) {
-        for (int z = 0; z < 16; ++z) {
-            for (int x = 0; x < 16; ++x) {
-                m_Blocks[y * 16 * 16 + z * 16 + x] = block;
-            }
+static VectorPool<u8>& GetPaletteFlagsPool() {
+    static VectorPool<u8>* pool = new VectorPool<u8>();
+    return *pool;
+}
+
+static VectorPool<u64>& GetDataPool() {
+    static VectorPool<u64>* pool = new VectorPool<u64>();
+    return *pool;
+}
+
+ObjectPool<Chunk::Masks>& Chunk::GetMaskPool() {
+    static ObjectPool<Masks>* pool = new ObjectPool<Masks>();
+    return *pool;
+}
+
+static const Chunk::BlockMask& GetEmptyMask() {
+    static const Chunk::BlockMask mask = {};
+    return mask;
+}
+
+static const Chunk::BlockMask& GetFullMask() {
+    static const Chunk::BlockMask mask = [] {
+        Chunk::BlockMask full;
+        full.fill(~0ULL);
+        return full;
+    }();
+
+    return mask;
+}
+
+u8 Chunk::GetBlockFlags(mc::block::BlockPtr block) {
+    if (block == nullptr) return 0;
+
+    u8 flags = 0;
+    const std::string& name = block->GetName();
+
+    if (block->GetType() == 0 || name == "minecraft:cave_air" || name == "minecraft:void_air") {
+        flags |= AirFlag;
+    }
+
+    if (block->IsSolid()) {
+        flags |= SolidFlag;
+
+        mc::AABB bounds = block->GetBoundingBox(mc::Vector3i(0, 0, 0));
+        bool full_cube = bounds.min.x == 0 && bounds.min.y == 0 && bounds.min.z == 0 && bounds.max.x == 1 && bounds.max.y == 1 && bounds.max.z == 1;
+
+        if (full_cube && block->IsOpaque()) {
+            flags |= OpaqueCubeFlag;
         }
     }
+
+    return flags;
+}
+
+Chunk::Chunk()
+    : m_Palette(GetPalettePool().Acquire(1)),
+      m_BitsPerBlock(0),
+      m_PaletteFlags(GetPaletteFlagsPool().Acquire(1)),
+      m_Masks(nullptr),
+      m_Published(false)
+{
+    m_Palette.push_back(mc::block::BlockRegistry::GetInstance()->GetBlock(0));
+    m_PaletteFlags.push_back(GetBlockFlags(m_Palette[0]));
+
+    SetUniformMasks();
+}
+
+u8 Chunk::GetRequiredBits(std::size_t palette_size) {
+    u8 bits_per_block = 0;
+
+    while (palette_size > (1ULL << bits_per_block)) {
+        bits_per_block = bits_per_block == 0 ? 1 : bits_per_block * 2;
+    }
+
+    return bits_per_block;
 }
 
-Chunk::Chunk(const mc::world::Chunk& other) {
+Chunk::Chunk(const Chunk& other)
+    : m_Palette(GetPalettePool().Acquire(other.m_Palette.size())),
+      m_Data(GetDataPool().Acquire(other.m_Data.size())),
+      m_BitsPerBlock(other.m_BitsPerBlock),
+      m_PaletteFlags(GetPaletteFlagsPool().Acquire(other.m_PaletteFlags.size())),
+      m_Masks(nullptr),
+      m_SolidMask(other.m_SolidMask),
+      m_OpaqueMask(other.m_OpaqueMask),
+      m_NonAirCount(other.m_NonAirCount),
+      m_Published(false)
+{
+    m_Palette.assign(other.m_Palette.begin(), other.m_Palette.end());
+    m_Data.assign(other.m_Data.begin(), other.m_Data.end());
+    m_PaletteFlags.assign(other.m_PaletteFlags.begin(), other.m_PaletteFlags.end());
+
+    if (other.m_Masks != nullptr) {
+        m_Masks = GetMaskPool().Acquire(*other.m_Masks);
+        m_SolidMask = &m_Masks->solid;
+        m_OpaqueMask = &m_Masks->opaque;
+    }
+}
+
+Chunk::~Chunk() {
+    GetMaskPool().Release(m_Masks);
+    GetPalettePool().Release(std::move(m_Palette));
+    GetPaletteFlagsPool().Release(std::move(m_PaletteFlags));
+    GetDataPool().Release(std::move(m_Data));
+}
+
+Chunk::Chunk(const mc::world::Chunk& other)
+    : m_Palette(GetPalettePool().Acquire(16)),
+      m_BitsPerBlock(0),
+      m_PaletteFlags(GetPaletteFlagsPool().Acquire(16)),
+      m_Masks(nullptr),
+      m_Published(false)
+{
     static const mc::block::BlockPtr air = mc::block::BlockRegistry::GetInstance()->GetBlock(0);
 
+    // Build the palette and the indices in one pass and pack them once at the final width.
+    // Neighboring blocks are usually the same, so remember the last block to skip most palette searches.
+    PaletteIndices indices;
+    mc::block::BlockPtr last_block = nullptr;
+    u16 last_index = 0;
+    std::size_t index = 0;
+
     for (int y = 0; y < 16; ++y) {
         for (int z = 0; z < 16; ++z) {
             for (int x = 0; x < 16; ++x) {
@@ -28,10 +143,182 @@ Chunk::Chunk(const mc::world::Chunk& other) {
                     block = air;
                 }
 
-                m_Blocks[y * 16 * 16 + z * 16 + x] = block;
+                if (block != last_block || m_Palette.empty()) {
+                    auto iter = std::find(m_Palette.begin(), m_Palette.end(), block);
+
+                    last_index = static_cast<u16>(std::distance(m_Palette.begin(), iter));
+
+                    if (iter == m_Palette.end()) {
+                        m_Palette.push_back(block);
+                    }
+
+                    last_block = block;
+                }
+
+                indices[index++] = last_index;
             }
         }
     }
+
+    Pack(indices, GetRequiredBits(m_Palette.size()));
+
+    for (mc::block::BlockPtr block : m_Palette) {
+        m_PaletteFlags.push_back(GetBlockFlags(block));
+    }
+
+    BuildMasks(indices);
+}
+
+Chunk::Chunk(std::vector<mc::block::BlockPtr> palette, u8 bits_per_block, const u64* data)
+    : m_Palette(std::move(palette)),
+      m_Data(GetDataPool().Acquire(16 * 16 * 16 * bits_per_block / 64)),
+      m_BitsPerBlock(bits_per_block),
+      m_PaletteFlags(GetPaletteFlagsPool().Acquire(m_Palette.size())),
+      m_Masks(nullptr),
+      m_Published(false)
+{
+    m_Data.assign(data, data + 16 * 16 * 16 * bits_per_block / 64);
+
+    for (mc::block::BlockPtr block : m_Palette) {
+        m_PaletteFlags.push_back(GetBlockFlags(block));
+    }
+
+    if (IsUniform()) {
+        SetUniformMasks();
+        return;
+    }
+
+    PaletteIndices indices;
+
+    for (std::size_t i = 0; i < indices.size(); ++i) {
+        indices[i] = static_cast<u16>(GetPaletteIndex(i));
+    }
+
+    BuildMasks(indices);
+}
+
+std::size_t Chunk::GetOrAddPaletteEntry(mc::block::BlockPtr block) {
+    auto iter = std::find(m_Palette.begin(), m_Palette.end(), block);
+
+    if (iter != m_Palette.end()) {
+        return std::distance(m_Palette.begin(), iter);
+    }
+
+    m_Palette.push_back(block);
+    m_PaletteFlags.push_back(GetBlockFlags(block));
+
+    u8 bits_per_block = GetRequiredBits(m_Palette.size());
+
+    if (bits_per_block != m_BitsPerBlock) {
+        PaletteIndices indices;
+
+        for (std::size_t i = 0; i < indices.size(); ++i) {
+            indices[i] = static_cast<u16>(GetPaletteIndex(i));
+        }
+
+        Pack(indices, bits_per_block);
+    }
+
+    return m_Palette.size() - 1;
+}
+
+void Chunk::Pack(const PaletteIndices& indices, u8 bits_per_block) {
+    std::size_t words = indices.size() * bits_per_block / 64;
+
+    m_BitsPerBlock = bits_per_block;
+
+    if (m_Data.capacity() < words) {
+        GetDataPool().Release(std::move(m_Data));
+        m_Data = GetDataPool().Acquire(words);
+    }
+
+    m_Data.assign(words, 0);
+
+    if (bits_per_block == 0) return;
+
+    const std::size_t indices_per_word = 64 / bits_per_block;
+
+    for (std::size_t word = 0; word < m_Data.size(); ++word) {
+        const u16* source = &indices[word * indices_per_word];
+        u64 value = 0;
+
+        for (std::size_t i = 0; i < indices_per_word; ++i) {
+            value |= static_cast<u64>(source[i]) << (i * bits_per_block);
+        }
+
+        m_Data[word] = value;
+    }
+}
+
+void Chunk::SetUniformMasks() {
+    u8 flags = m_PaletteFlags[0];
+
+    m_SolidMask = (flags & SolidFlag) ? &GetFullMask() : &GetEmptyMask();
+    m_OpaqueMask = (flags & OpaqueCubeFlag) ? &GetFullMask() : &GetEmptyMask();
+    m_NonAirCount = (flags & AirFlag) ? 0 : 16 * 16 * 16;
+}
+
+void Chunk::BuildMasks(const PaletteIndices& indices) {
+    if (IsUniform()) {
+        SetUniformMasks();
+        return;
+    }
+
+    if (m_Masks == nullptr) {
+        m_Masks = GetMaskPool().Acquire();
+        m_SolidMask = &m_Masks->solid;
+        m_OpaqueMask = &m_Masks->opaque;
+    }
+
+    m_Masks->solid.fill(0);
+    m_Masks->opaque.fill(0);
+    m_NonAirCount = 0;
+
+    for (std::size_t i = 0; i < indices.size(); ++i) {
+        u8 flags = m_PaletteFlags[indices[i]];
+        u64 bit = 1ULL << (i & 63);
+
+        if (flags & SolidFlag) {
+            m_Masks->solid[i >> 6] |= bit;
+        }
+
+        if (flags & OpaqueCubeFlag) {
+            m_Masks->opaque[i >> 6] |= bit;
+        }
+
+        if (!(flags & AirFlag)) {
+            ++m_NonAirCount;
+        }
+    }
+}
+
+void Chunk::UpdateMasks(std::size_t index, u8 old_flags, u8 new_flags) {
+    u64 bit = 1ULL << (index & 63);
+
+    if (m_Masks == nullptr) {
+        // The chunk was uniform until now, so its masks start out as copies of the shared ones.
+        m_Masks = GetMaskPool().Acquire(Masks{ *m_SolidMask, *m_OpaqueMask });
+        m_SolidMask = &m_Masks->solid;
+        m_OpaqueMask = &m_Masks->opaque;
+    }
+
+    if (new_flags & SolidFlag) {
+        m_Masks->solid[index >> 6] |= bit;
+    } else {
+        m_Masks->solid[index >> 6] &= ~bit;
+    }
+
+    if (new_flags & OpaqueCubeFlag) {
+        m_Masks->opaque[index >> 6] |= bit;
+    } else {
+        m_Masks->opaque[index >> 6] &= ~bit;
+    }
+
+    if ((old_flags & AirFlag) && !(new_flags & AirFlag)) {
+        ++m_NonAirCount;
+    } else if (!(old_flags & AirFlag) && (new_flags & AirFlag)) {
+        --m_NonAirCount;
+    }
 }
 
 mc::block::BlockPtr Chunk::GetBlock(const mc::Vector3i& chunkPosition) const {
@@ -41,11 +328,24 @@ mc::block::BlockPtr Chunk::GetBlock(const mc::Vector3i& chunkPosition) const {
         return nullptr;
     }
 
-    return m_Blocks[index];
+    return m_Palette[GetPaletteIndex(index)];
 }
 
 void Chunk::SetBlock(mc::Vector3i chunkPosition, mc::block::BlockPtr block) {
-    m_Blocks[chunkPosition.y * 16 * 16 + chunkPosition.z * 16 + chunkPosition.x] = block;
+    if (IsUniform() && m_Palette[0] == block) return;
+
+    std::size_t index = chunkPosition.y * 16 * 16 + chunkPosition.z * 16 + chunkPosition.x;
+    u8 old_flags = m_PaletteFlags[GetPaletteIndex(index)];
+    std::size_t palette_index = GetOrAddPaletteEntry(block);
+
+    SetPaletteIndex(index, palette_index);
+    UpdateMasks(index, old_flags, m_PaletteFlags[palette_index]);
+}
+
+std::size_t Chunk::GetMemoryUsage() const {
+    std::size_t masks = m_Masks != nullptr ? sizeof(Masks) : 0;
+
+    return sizeof(Chunk) + masks + m_Palette.capacity() * sizeof(mc::block::BlockPtr) + m_PaletteFlags.capacity() + m_Data.capacity() * sizeof(u64);
 }
 
 ChunkColumn::ChunkColumn(const mc::world::ChunkColumn& rhs) 
@@ -55,9 +355,11 @@ ChunkColumn::ChunkColumn(const mc::world::ChunkColumn& rhs)
         m_Chunks[i] = nullptr;
 
         if (rhs[i] != nullptr) {
-            m_Chunks[i] = std::make_shared<Chunk>(*rhs[i]);
+            m_Chunks[i] = MakeChunk(*rhs[i]);
         }
     }
+
+    BuildHeightmaps();
 }
 
 ChunkColumn::ChunkColumn(ChunkColumnMetadata metadata)
@@ -65,6 +367,9 @@ ChunkColumn::ChunkColumn(ChunkColumnMetadata metadata)
 {
     for (std::size_t i = 0; i < m_Chunks.size(); ++i)
         m_Chunks[i] = nullptr;
+
+    m_SolidHeights.fill(-1);
+    m_OpaqueHeights.fill(-1);
 }
 
 mc::block::BlockPtr ChunkColumn::GetBlock(const mc::Vector3i& position) {
@@ -78,19 +383,214 @@ mc::block::BlockPtr ChunkColumn::GetBlock(const mc::Vector3i& position) {
     return m_Chunks[chunkIndex]->GetBlock(relativePosition);
 }
 
+void ChunkColumn::SetBlock(const mc::Vector3i& position, mc::block::BlockPtr block) {
+    if (position.y < 0 || position.y >= 16 * ChunksPerColumn) return;
+
+    ChunkPtr& chunk = m_Chunks[position.y / 16];
+
+    if (chunk == nullptr) {
+        // Missing sections are already air, so clearing a block in the sky doesn't need one.
+        if (block == nullptr || block->GetType() == 0) return;
+
+        chunk = MakeChunk();
+    } else if (chunk->IsPublished()) {
+        // Snapshot readers may still be using the published chunk, so changes go to a new version of it.
+        chunk = MakeChunk(*chunk);
+    }
+
+    chunk->SetBlock(mc::Vector3i(position.x, position.y % 16, position.z), block);
+
+    UpdateHeightmaps(static_cast<s32>(position.x), static_cast<s32>(position.y), static_cast<s32>(position.z));
+}
+
+void ChunkColumn::BuildHeightmaps() {
+    m_SolidHeights.fill(-1);
+    m_OpaqueHeights.fill(-1);
+
+    std::size_t remaining_solid = m_SolidHeights.size();
+    std::size_t remaining_opaque = m_OpaqueHeights.size();
+
+    // Sweep down from the top one row of 16 blocks at a time and fill in any (x, z) that doesn't have a height yet.
+    for (s32 index = ChunksPerColumn - 1; index >= 0 && (remaining_solid > 0 || remaining_opaque > 0); --index) {
+        if (IsChunkEmpty(index)) continue;
+
+        const Chunk::BlockMask& solid_mask = m_Chunks[index]->GetSolidMask();
+        const Chunk::BlockMask& opaque_mask = m_Chunks[index]->GetOpaqueMask();
+
+        for (s32 y = 15; y >= 0; --y) {
+            for (s32 z = 0; z < 16; ++z) {
+                std::size_t word = y * 4 + z / 4;
+                std::size_t shift = (z & 3) * 16;
+                u32 solid_row = static_cast<u32>((solid_mask[word] >> shift) & 0xFFFF);
+                u32 opaque_row = static_cast<u32>((opaque_mask[word] >> shift) & 0xFFFF);
+
+                for (s32 x = 0; x < 16 && (solid_row | opaque_row) != 0; ++x, solid_row >>= 1, opaque_row >>= 1) {
+                    s16 height = static_cast<s16>(index * 16 + y);
+
+                    if ((solid_row & 1) && m_SolidHeights[z * 16 + x] == -1) {
+                        m_SolidHeights[z * 16 + x] = height;
+                        --remaining_solid;
+                    }
+
+                    if ((opaque_row & 1) && m_OpaqueHeights[z * 16 + x] == -1) {
+                        m_OpaqueHeights[z * 16 + x] = height;
+                        --remaining_opaque;
+                    }
+                }
+            }
+        }
+    }
+}
+
+s16 ChunkColumn::FindHighestBlock(s32 x, s32 start_y, s32 z, bool opaque) const {
+    for (s32 y = start_y; y >= 0; --y) {
+        if (IsChunkEmpty(y / 16)) {
+            // Jump to the top of the chunk below.
+            y = (y / 16) * 16;
+            continue;
+        }
+
+        mc::Vector3i position(x, y, z);
+
+        if (opaque ? IsOpaqueCube(position) : IsSolid(position)) {
+            return static_cast<s16>(y);
+        }
+    }
+
+    return -1;
+}
+
+void ChunkColumn::UpdateHeightmaps(s32 x, s32 y, s32 z) {
+    mc::Vector3i position(x, y, z);
+    std::size_t index = z * 16 + x;
+
+    if (IsSolid(position)) {
+        m_SolidHeights[index] = std::max(m_SolidHeights[index], static_cast<s16>(y));
+    } else if (m_SolidHeights[index] == y) {
+        m_SolidHeights[index] = FindHighestBlock(x, y - 1, z, false);
+    }
+
+    if (IsOpaqueCube(position)) {
+        m_OpaqueHeights[index] = std::max(m_OpaqueHeights[index], static_cast<s16>(y));
+    } else if (m_OpaqueHeights[index] == y) {
+        m_OpaqueHeights[index] = FindHighestBlock(x, y - 1, z, true);
+    }
+}
+
+bool ChunkColumn::IsSolid(const mc::Vector3i& position) const {
+    if (position.y < 0 || position.y >= 16 * ChunksPerColumn) return false;
+
+    const ChunkPtr& chunk = m_Chunks[position.y / 16];
+    if (chunk == nullptr) return false;
+
+    return chunk->IsSolid(mc::Vector3i(position.x, position.y % 16, position.z));
+}
+
+bool ChunkColumn::IsOpaqueCube(const mc::Vector3i& position) const {
+    if (position.y < 0 || position.y >= 16 * ChunksPerColumn) return false;
+
+    const ChunkPtr& chunk = m_Chunks[position.y / 16];
+    if (chunk == nullptr) return false;
+
+    return chunk->IsOpaqueCube(mc::Vector3i(position.x, position.y % 16, position.z));
+}
+
+std::size_t ChunkColumn::GetChunkCount() const {
+    return std::count_if(m_Chunks.begin(), m_Chunks.end(), [](const ChunkPtr& chunk) {
+        return chunk != nullptr;
+    });
+}
+
+std::size_t ChunkColumn::GetUniformChunkCount() const {
+    return std::count_if(m_Chunks.begin(), m_Chunks.end(), [](const ChunkPtr& chunk) {
+        return chunk != nullptr && chunk->IsUniform();
+    });
+}
+
+std::size_t ChunkColumn::GetMemoryUsage() const {
+    std::size_t usage = sizeof(ChunkColumn) + m_BlockEntities.capacity() * sizeof(m_BlockEntities[0]);
+
+    for (const ChunkPtr& chunk : m_Chunks) {
+        if (chunk != nullptr) {
+            usage += chunk->GetMemoryUsage();
+        }
+    }
+
+    return usage;
+}
+
+using BlockEntityEntry = std::pair<u16, mc::block::BlockEntityPtr>;
+
+static bool CompareBlockEntityKey(const BlockEntityEntry& entry, u16 key) {
+    return entry.first < key;
+}
+
+void ChunkColumn::AddBlockEntity(mc::block::BlockEntityPtr blockEntity) {
+    u16 key = GetBlockEntityKey(blockEntity->GetPosition());
+    auto iter = std::lower_bound(m_BlockEntities.begin(), m_BlockEntities.end(), key, CompareBlockEntityKey);
+
+    if (iter != m_BlockEntities.end() && iter->first == key) {
+        iter->second = blockEntity;
+        return;
+    }
+
+    m_BlockEntities.insert(iter, std::make_pair(key, blockEntity));
+}
+
+void ChunkColumn::RemoveBlockEntity(mc::Vector3i pos) {
+    u16 key = GetBlockEntityKey(pos);
+    auto iter = std::lower_bound(m_BlockEntities.begin(), m_BlockEntities.end(), key, CompareBlockEntityKey);
+
+    if (iter != m_BlockEntities.end() && iter->first == key) {
+        m_BlockEntities.erase(iter);
+    }
+}
+
 mc::block::BlockEntityPtr ChunkColumn::GetBlockEntity(mc::Vector3i worldPos) {
-    auto iter = m_BlockEntities.find(worldPos);
-    if (iter == m_BlockEntities.end()) return nullptr;
+    u16 key = GetBlockEntityKey(worldPos);
+    auto iter = std::lower_bound(m_BlockEntities.begin(), m_BlockEntities.end(), key, CompareBlockEntityKey);
+
+    if (iter == m_BlockEntities.end() || iter->first != key) return nullptr;
     return iter->second;
 }
 
 std::vector<mc::block::BlockEntityPtr> ChunkColumn::GetBlockEntities() {
     std::vector<mc::block::BlockEntityPtr> blockEntities;
 
-    for (auto iter = m_BlockEntities.begin(); iter != m_BlockEntities.end(); ++iter)
-        blockEntities.push_back(iter->second);
+    blockEntities.reserve(m_BlockEntities.size());
+    ForEachBlockEntity([&blockEntities](const mc::block::BlockEntityPtr& entity) {
+        blockEntities.push_back(entity);
+    });
 
     return blockEntities;
 }
 
+ObjectPool<Chunk>& GetChunkPool() {
+    static ObjectPool<Chunk>* pool = new ObjectPool<Chunk>();
+    return *pool;
+}
+
+void ReleaseChunk(Chunk* chunk) {
+    if (chunk == nullptr) return;
+
+    if (!chunk->IsPublished()) {
+        GetChunkPool().Release(chunk);
+        return;
+    }
+
+    GetEpochManager().Retire([chunk]() {
+        GetChunkPool().Release(chunk);
+    });
+}
+
+ObjectPool<ChunkColumn>& GetChunkColumnPool() {
+    static ObjectPool<ChunkColumn>* pool = new ObjectPool<ChunkColumn>();
+    return *pool;
+}
+
+ObjectPool<ChunkRefCounts>& GetChunkRefCountPool() {
+    static ObjectPool<ChunkRefCounts>* pool = new ObjectPool<ChunkRefCounts>();
+    return *pool;
+}
+
 } // ns terra
@@ -7,9 +7,12 @@
 #include <mclib/nbt/NBT.h>
 #include <mclib/world/Chunk.h>
 
+#include "ObjectPool.h"
+
+#include <algorithm>
 #include <array>
-#include <map>
 #include <memory>
+#include <vector>
 
 namespace terra {
 
@@ -33,18 +36,97 @@ struct ChunkColumnMetadata {
 
 /**
  * A 16x16x16 area. A ChunkColumn is made up of 16 of these
+ *
+ * Blocks are stored as indices into a palette of the distinct blocks in this chunk.
+ * The indices are bit-packed and the width grows from 1 to 2, 4, 8 and then 16 bits
+ * as new blocks are added to the palette. 16 bits is the direct storage mode where
+ * every block gets a full u16 index.
+ *
+ * A chunk that is entirely one block uses a width of 0 and has no index storage at all.
+ * It's expanded into packed storage on the first SetBlock with a different block.
+ *
+ * Each chunk also keeps one bit per block for solid blocks and for opaque full cubes, plus a count
+ * of the non-air blocks, so consumers can test 64 blocks at a time and skip empty chunks entirely.
+ * Uniform chunks share constant masks instead of storing their own.
  */
 class Chunk {
+public:
+    // One bit per block, indexed the same as the block storage (y * 256 + z * 16 + x).
+    using BlockMask = std::array<u64, 16 * 16 * 16 / 64>;
+
 private:
-    std::array<mc::block::BlockPtr, 16 * 16 * 16> m_Blocks;
+    using PaletteIndices = std::array<u16, 16 * 16 * 16>;
+
+    enum { SolidFlag = 1 << 0, OpaqueCubeFlag = 1 << 1, AirFlag = 1 << 2 };
+
+    // Maps palette index to the block that it represents.
+    std::vector<mc::block::BlockPtr> m_Palette;
+    // Packed palette indices. The width is always a power of two, so an index never crosses a u64 boundary.
+    std::vector<u64> m_Data;
+    u8 m_BitsPerBlock;
+
+    struct Masks {
+        BlockMask solid;
+        BlockMask opaque;
+    };
+
+    // The mask flags of each palette entry, so updating the masks never has to query the block.
+    std::vector<u8> m_PaletteFlags;
+    // Only chunks with block storage own their masks. Uniform chunks point at shared all-set or all-clear masks.
+    Masks* m_Masks;
+    const BlockMask* m_SolidMask;
+    const BlockMask* m_OpaqueMask;
+    u16 m_NonAirCount;
+    bool m_Published;
+
+    std::size_t GetPaletteIndex(std::size_t index) const {
+        if (m_BitsPerBlock == 0) return 0;
+
+        std::size_t bit_index = index * m_BitsPerBlock;
+        u64 mask = (1ULL << m_BitsPerBlock) - 1;
+
+        return static_cast<std::size_t>((m_Data[bit_index >> 6] >> (bit_index & 63)) & mask);
+    }
+
+    void SetPaletteIndex(std::size_t index, std::size_t palette_index) {
+        if (m_BitsPerBlock == 0) return;
+
+        std::size_t bit_index = index * m_BitsPerBlock;
+        u64 mask = ((1ULL << m_BitsPerBlock) - 1) << (bit_index & 63);
+        u64& word = m_Data[bit_index >> 6];
+
+        word = (word & ~mask) | ((static_cast<u64>(palette_index) << (bit_index & 63)) & mask);
+    }
+
+    // Finds the palette index for the block, adding it to the palette and growing the storage if needed.
+    std::size_t GetOrAddPaletteEntry(mc::block::BlockPtr block);
+    // Replaces the block storage with the indices packed at the given width.
+    void Pack(const PaletteIndices& indices, u8 bits_per_block);
+    static u8 GetBlockFlags(mc::block::BlockPtr block);
+    static ObjectPool<Masks>& GetMaskPool();
+    // Points the masks at the shared masks and sets the non-air count for the single palette entry.
+    void SetUniformMasks();
+    // Rebuilds the masks and the non-air count from scratch.
+    void BuildMasks(const PaletteIndices& indices);
+    void UpdateMasks(std::size_t index, u8 old_flags, u8 new_flags);
 
 public:
     Chunk();
 
-    Chunk(const Chunk& other) = delete;
+    // Copies the blocks of another chunk. The copy isn't published.
+    Chunk(const Chunk& other);
     Chunk& operator=(const Chunk& other) = delete;
+    // Returns the palette and block storage to the pools that new chunks take their storage from.
+    ~Chunk();
 
     Chunk(const mc::world::Chunk& other);
+    // Builds a chunk from packed palette indices, such as the ones stored in the region cache.
+    // Every index must be inside of the palette and bits_per_block must be the width that the palette needs.
+    Chunk(std::vector<mc::block::BlockPtr> palette, u8 bits_per_block, const u64* data);
+
+    // A published chunk is visible to other threads through a WorldSnapshot and must not be changed anymore.
+    bool IsPublished() const { return m_Published; }
+    void Publish() { m_Published = true; }
 
     /**
      * Position is relative to this chunk position
@@ -55,6 +137,94 @@ public:
     * Position is relative to this chunk position
     */
     void SetBlock(mc::Vector3i chunkPosition, mc::block::BlockPtr block);
+
+    // A uniform chunk is entirely filled with GetUniformBlock() and has no per-block storage.
+    bool IsUniform() const { return m_BitsPerBlock == 0; }
+    mc::block::BlockPtr GetUniformBlock() const { return IsUniform() ? m_Palette[0] : nullptr; }
+
+    /**
+     * Position is relative to this chunk position and must be inside of the chunk.
+     */
+    bool IsSolid(const mc::Vector3i& chunkPosition) const {
+        std::size_t index = chunkPosition.y * 16 * 16 + chunkPosition.z * 16 + chunkPosition.x;
+
+        return ((*m_SolidMask)[index >> 6] >> (index & 63)) & 1;
+    }
+
+    bool IsOpaqueCube(const mc::Vector3i& chunkPosition) const {
+        std::size_t index = chunkPosition.y * 16 * 16 + chunkPosition.z * 16 + chunkPosition.x;
+
+        return ((*m_OpaqueMask)[index >> 6] >> (index & 63)) & 1;
+    }
+
+    /**
+     * Position is relative to this chunk position and must be inside of the chunk.
+     * Returns the block if it's solid and null otherwise, with a single storage lookup.
+     */
+    mc::block::BlockPtr GetSolidBlock(const mc::Vector3i& chunkPosition) const {
+        std::size_t palette_index = GetPaletteIndex(chunkPosition.y * 16 * 16 + chunkPosition.z * 16 + chunkPosition.x);
+
+        return (m_PaletteFlags[palette_index] & SolidFlag) ? m_Palette[palette_index] : nullptr;
+    }
+
+    /**
+     * Calls callback(const mc::Vector3i& chunkPosition, mc::block::BlockPtr block) for every non-air block inside of [min, max].
+     * The range is relative to this chunk position and must be inside of the chunk. Visits in y, z, x order.
+     */
+    template <typename Callback>
+    void ForEachBlockInRange(const mc::Vector3i& min, const mc::Vector3i& max, Callback&& callback) const {
+        if (IsEmpty()) return;
+
+        for (s64 y = min.y; y <= max.y; ++y) {
+            for (s64 z = min.z; z <= max.z; ++z) {
+                for (s64 x = min.x; x <= max.x; ++x) {
+                    std::size_t palette_index = GetPaletteIndex(y * 16 * 16 + z * 16 + x);
+
+                    if (m_PaletteFlags[palette_index] & AirFlag) continue;
+
+                    callback(mc::Vector3i(x, y, z), m_Palette[palette_index]);
+                }
+            }
+        }
+    }
+
+    // Same as ForEachBlockInRange, but only visits the blocks set in the solid mask. Rows without solid blocks are skipped.
+    template <typename Callback>
+    void ForEachSolidBlockInRange(const mc::Vector3i& min, const mc::Vector3i& max, Callback&& callback) const {
+        if (IsEmpty()) return;
+
+        u32 row_mask = ((1u << (max.x - min.x + 1)) - 1) << min.x;
+
+        for (s64 y = min.y; y <= max.y; ++y) {
+            for (s64 z = min.z; z <= max.z; ++z) {
+                std::size_t row_index = y * 16 * 16 + z * 16;
+                // Rows are 16 bits and start at a multiple of 16, so a row never crosses a u64 boundary.
+                u32 row = static_cast<u32>((*m_SolidMask)[row_index >> 6] >> (row_index & 63)) & row_mask;
+
+                for (s64 x = min.x; row != 0; ++x) {
+                    if (!(row & (1u << x))) continue;
+
+                    row &= ~(1u << x);
+                    callback(mc::Vector3i(x, y, z), m_Palette[GetPaletteIndex(row_index + x)]);
+                }
+            }
+        }
+    }
+
+    const BlockMask& GetSolidMask() const { return *m_SolidMask; }
+    const BlockMask& GetOpaqueMask() const { return *m_OpaqueMask; }
+    u16 GetNonAirCount() const { return m_NonAirCount; }
+    bool IsEmpty() const { return m_NonAirCount == 0; }
+
+    std::size_t GetPaletteSize() const { return m_Palette.size(); }
+    mc::block::BlockPtr GetPaletteEntry(std::size_t index) const { return m_Palette[index]; }
+    u8 GetBitsPerBlock() const { return m_BitsPerBlock; }
+    // The packed palette indices. Empty for uniform chunks.
+    const std::vector<u64>& GetPackedData() const { return m_Data; }
+    // Gets the smallest power of two width that can index every entry in a palette of the given size.
+    static u8 GetRequiredBits(std::size_t palette_size);
+    // Approximate number of bytes used by this chunk, including the palette and block storage.
+    std::size_t GetMemoryUsage() const;
 };
 
 typedef std::shared_ptr<Chunk> ChunkPtr;
@@ -75,7 +245,15 @@ public:
 private:
     std::array<ChunkPtr, ChunksPerColumn> m_Chunks;
     ChunkColumnMetadata m_Metadata;
-    std::map<mc::Vector3i, mc::block::BlockEntityPtr> m_BlockEntities;
+    // Block entities sorted by their packed column relative position (y << 8 | z << 4 | x).
+    std::vector<std::pair<u16, mc::block::BlockEntityPtr>> m_BlockEntities;
+
+    // The y of the highest solid and opaque block of each (x, z), indexed by z * 16 + x. -1 means there is none.
+    std::array<s16, 16 * 16> m_SolidHeights;
+    std::array<s16, 16 * 16> m_OpaqueHeights;
+
+    s16 FindHighestBlock(s32 x, s32 start_y, s32 z, bool opaque) const;
+    void UpdateHeightmaps(s32 x, s32 y, s32 z);
 
 public:
     ChunkColumn(ChunkColumnMetadata metadata);
@@ -111,13 +289,13 @@ public:
         return m_Chunks[index];
     }
 
-    void AddBlockEntity(mc::block::BlockEntityPtr blockEntity) {
-        m_BlockEntities.insert(std::make_pair(blockEntity->GetPosition(), blockEntity));
+    // Packs a world position into the key used to sort the block entities of this column.
+    static u16 GetBlockEntityKey(const mc::Vector3i& worldPos) {
+        return static_cast<u16>(((worldPos.y & 0xFF) << 8) | ((worldPos.z & 15) << 4) | (worldPos.x & 15));
     }
 
-    void RemoveBlockEntity(mc::Vector3i pos) {
-        m_BlockEntities.erase(pos);
-    }
+    void AddBlockEntity(mc::block::BlockEntityPtr blockEntity);
+    void RemoveBlockEntity(mc::Vector3i pos);
 
     /**
      * Position is relative to this ChunkColumn position.
@@ -125,12 +303,111 @@ public:
     mc::block::BlockPtr GetBlock(const mc::Vector3i& position);
     const ChunkColumnMetadata& GetMetadata() const { return m_Metadata; }
 
+    /**
+     * Position is relative to this ChunkColumn position.
+     * Creates the chunk if it doesn't exist yet and keeps the heightmaps up to date.
+     */
+    void SetBlock(const mc::Vector3i& position, mc::block::BlockPtr block);
+
+    // Recalculates the heightmaps. This needs to be called after replacing chunks directly.
+    void BuildHeightmaps();
+
+    // Gets the y of the highest solid or opaque block at the column relative x, z. Returns -1 if there is none.
+    s32 GetHighestSolidBlock(s32 x, s32 z) const { return m_SolidHeights[z * 16 + x]; }
+    s32 GetHighestOpaqueBlock(s32 x, s32 z) const { return m_OpaqueHeights[z * 16 + x]; }
+
+    /**
+     * Position is relative to this ChunkColumn position. Positions outside of the column are not solid.
+     */
+    bool IsSolid(const mc::Vector3i& position) const;
+    bool IsOpaqueCube(const mc::Vector3i& position) const;
+
+    // Returns true if the chunk at the index doesn't contain anything but air.
+    bool IsChunkEmpty(std::size_t index) const {
+        return m_Chunks[index] == nullptr || m_Chunks[index]->IsEmpty();
+    }
+
+    // Number of non-null chunks in this column and how many of them are uniform.
+    std::size_t GetChunkCount() const;
+    std::size_t GetUniformChunkCount() const;
+    // Approximate number of bytes used by this column and its chunks.
+    std::size_t GetMemoryUsage() const;
+
     mc::block::BlockEntityPtr GetBlockEntity(mc::Vector3i worldPos);
     std::vector<mc::block::BlockEntityPtr> GetBlockEntities();
+
+    std::size_t GetBlockEntityCount() const { return m_BlockEntities.size(); }
+
+    // Calls callback(const mc::block::BlockEntityPtr&) for each block entity in y, z, x order.
+    template <typename Callback>
+    void ForEachBlockEntity(Callback&& callback) const {
+        for (const auto& entry : m_BlockEntities) {
+            callback(entry.second);
+        }
+    }
+
+    // Calls callback(const mc::block::BlockEntityPtr&) for each block entity with a world position inside of [min, max].
+    template <typename Callback>
+    void ForEachBlockEntityInRange(const mc::Vector3i& min, const mc::Vector3i& max, Callback&& callback) const {
+        if (max.y < 0 || min.y > 255) return;
+
+        // Work in column relative coordinates so the range can be tested against the packed keys directly.
+        s64 base_x = static_cast<s64>(m_Metadata.x) * 16;
+        s64 base_z = static_cast<s64>(m_Metadata.z) * 16;
+        s64 min_x = std::max<s64>(min.x - base_x, 0);
+        s64 max_x = std::min<s64>(max.x - base_x, 15);
+        s64 min_z = std::max<s64>(min.z - base_z, 0);
+        s64 max_z = std::min<s64>(max.z - base_z, 15);
+
+        if (min_x > max_x || min_z > max_z) return;
+
+        u16 start_key = static_cast<u16>(std::max<s64>(min.y, 0) << 8);
+        s64 max_y = std::min<s64>(max.y, 255);
+        auto iter = std::lower_bound(m_BlockEntities.begin(), m_BlockEntities.end(), start_key,
+            [](const std::pair<u16, mc::block::BlockEntityPtr>& entry, u16 key) {
+                return entry.first < key;
+            });
+
+        for (; iter != m_BlockEntities.end(); ++iter) {
+            u16 key = iter->first;
+
+            if ((key >> 8) > max_y) break;
+
+            s64 x = key & 15;
+            s64 z = (key >> 4) & 15;
+
+            if (x >= min_x && x <= max_x && z >= min_z && z <= max_z) {
+                callback(iter->second);
+            }
+        }
+    }
 };
 
 typedef std::shared_ptr<ChunkColumn> ChunkColumnPtr;
 
+// Chunks and columns are all the same size, so they are allocated from pools that reuse the memory of unloaded ones.
+ObjectPool<Chunk>& GetChunkPool();
+ObjectPool<ChunkColumn>& GetChunkColumnPool();
+
+// Storage for the shared_ptr control block of a chunk. Chunks outlive their last reference until the epoch manager
+// releases them, so the control block can't share the chunk's slot and comes from its own pool instead.
+// The pool's allocator checks that the control block fits in one of its slots.
+struct ChunkRefCounts {
+    void* words[2];
+};
+
+ObjectPool<ChunkRefCounts>& GetChunkRefCountPool();
+
+// Returns the chunk to the pool. Published chunks can still be read by snapshot readers, so they go through the epoch manager.
+void ReleaseChunk(Chunk* chunk);
+
+template <typename... Args>
+ChunkPtr MakeChunk(Args&&... args) {
+    ObjectPool<ChunkRefCounts>::Allocator<Chunk> allocator(&GetChunkRefCountPool());
+
+    return ChunkPtr(GetChunkPool().Acquire(std::forward<Args>(args)...), ReleaseChunk, allocator);
+}
+
 } // ns terra
 
 #endif
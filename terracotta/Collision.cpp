@@ -1,5 +1,6 @@
 #include "Collision.h"
 #include "Transform.h"
+#include "WorldCursor.h"
 
 #include <iostream>
 
@@ -53,15 +54,20 @@ bool CollisionDetector::DetectCollision(Vector3d from, Vector3d rayVector, Colli
     if (collision)
         * collision = Collision();
 
+    WorldCursor cursor(*m_World, mc::ToVector3i(from));
+
     for (double i = 0; i < length; ++i) {
         Vector3d position = from + direction * i;
 
         // Look for collisions in any blocks surrounding the ray
         for (Vector3d checkDirection : directions) {
             Vector3d checkPos = position + checkDirection;
-            mc::block::BlockPtr block = m_World->GetBlock(mc::ToVector3i(checkPos));
 
-            if (block && block->IsSolid()) {
+            cursor.MoveTo(mc::ToVector3i(checkPos));
+
+            mc::block::BlockPtr block = cursor.GetSolidBlock();
+
+            if (block) {
                 AABB bounds = block->GetBoundingBox(checkPos);
                 double distance;
 
@@ -83,21 +89,6 @@ bool CollisionDetector::DetectCollision(Vector3d from, Vector3d rayVector, Colli
     return false;
 }
 
-std::vector<Vector3i> CollisionDetector::GetSurroundingLocations(AABB bounds) {
-    std::vector<Vector3i> locs;
-
-    s32 radius = 2;
-    for (s32 y = (s32)bounds.min.y - radius; y < (s32)bounds.max.y + radius; ++y) {
-        for (s32 z = (s32)bounds.min.z - radius; z < (s32)bounds.max.z + radius; ++z) {
-            for (s32 x = (s32)bounds.min.x - radius; x < (s32)bounds.max.x + radius; ++x) {
-                locs.emplace_back(x, y, z);
-            }
-        }
-    }
-
-    return locs;
-}
-
 void CollisionDetector::ResolveCollisions(Transform* transform, double dt, bool* onGround) {
     const s32 MaxIterations = 10;
     bool collisions = true;
@@ -119,35 +110,29 @@ void CollisionDetector::ResolveCollisions(Transform* transform, double dt, bool*
             playerBounds.min += position;
             playerBounds.max += position;
 
-            std::vector<Vector3i> surrounding = GetSurroundingLocations(playerBounds);
-
-            for (Vector3i checkPos : surrounding) {
-                mc::block::BlockPtr block = m_World->GetBlock(checkPos);
+            m_Boxes.clear();
+            m_World->CollectSolidBoxes(playerBounds, m_Boxes);
 
-                if (block && block->IsSolid()) {
-                    AABB blockBounds = block->GetBoundingBox(checkPos);
+            if (!m_Boxes.empty()) {
+                const AABB& blockBounds = m_Boxes.front();
 
-                    if (playerBounds.Intersects(blockBounds)) {
-                        if (onGround != nullptr && i == 1 && checkPos.y < transform->position.y) {
-                            *onGround = true;
-                        }
-
-                        velocity[i] = 0;
-                        input_velocity[i] = 0;
+                if (onGround != nullptr && i == 1 && std::floor(blockBounds.min.y) < transform->position.y) {
+                    *onGround = true;
+                }
 
-                        double penetrationDepth;
+                velocity[i] = 0;
+                input_velocity[i] = 0;
 
-                        if (playerBounds.min[i] < blockBounds.min[i]) {
-                            penetrationDepth = playerBounds.max[i] - blockBounds.min[i];
-                        } else {
-                            penetrationDepth = playerBounds.min[i] - blockBounds.max[i];
-                        }
+                double penetrationDepth;
 
-                        position[i] -= penetrationDepth;
-                        collisions = true;
-                        break;
-                    }
+                if (playerBounds.min[i] < blockBounds.min[i]) {
+                    penetrationDepth = playerBounds.max[i] - blockBounds.min[i];
+                } else {
+                    penetrationDepth = playerBounds.min[i] - blockBounds.max[i];
                 }
+
+                position[i] -= penetrationDepth;
+                collisions = true;
             }
         }
 
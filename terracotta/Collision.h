@@ -24,8 +24,8 @@ public:
 class CollisionDetector {
 private:
     terra::World* m_World;
-
-    std::vector<mc::Vector3i> GetSurroundingLocations(mc::AABB bounds);
+    // Reused between resolves so collecting the boxes doesn't allocate.
+    std::vector<mc::AABB> m_Boxes;
 
 public:
     CollisionDetector(terra::World* world) noexcept : m_World(world) { }
@@ -0,0 +1,97 @@
+#include "EpochManager.h"
+
+#include <algorithm>
+#include <limits>
+#include <thread>
+
+namespace terra {
+
+EpochManager::ReadGuard::ReadGuard(EpochManager& manager) : m_Manager(manager), m_Slot(0) {
+    while (true) {
+        for (std::size_t i = 0; i < MaxReaders; ++i) {
+            u64 epoch = manager.m_Epoch.load();
+            u64 expected = 0;
+
+            if (!manager.m_Readers[i].compare_exchange_strong(expected, epoch)) continue;
+
+            // The epoch may have advanced before the slot was claimed, so republish until it's stable.
+            u64 current = manager.m_Epoch.load();
+
+            while (current != epoch) {
+                epoch = current;
+                manager.m_Readers[i].store(epoch);
+                current = manager.m_Epoch.load();
+            }
+
+            m_Slot = i;
+            return;
+        }
+
+        std::this_thread::yield();
+    }
+}
+
+EpochManager::ReadGuard::~ReadGuard() {
+    m_Manager.m_Readers[m_Slot].store(0);
+}
+
+EpochManager::EpochManager() : m_Epoch(1) {
+    for (auto& reader : m_Readers) {
+        reader.store(0);
+    }
+}
+
+void EpochManager::Retire(std::function<void()> reclaim) {
+    u64 epoch = m_Epoch.load();
+
+    std::lock_guard<std::mutex> lock(m_RetireMutex);
+    m_Retired.emplace_back(epoch, std::move(reclaim));
+}
+
+void EpochManager::Collect() {
+    m_Epoch.fetch_add(1);
+
+    u64 oldest = std::numeric_limits<u64>::max();
+
+    for (auto& reader : m_Readers) {
+        u64 epoch = reader.load();
+
+        if (epoch != 0 && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+
+    std::vector<std::function<void()>> reclaims;
+
+    {
+        std::lock_guard<std::mutex> lock(m_RetireMutex);
+
+        // Data retired in an epoch older than every active reader was unlinked before any of them started.
+        auto iter = std::partition(m_Retired.begin(), m_Retired.end(), [oldest](const std::pair<u64, std::function<void()>>& retired) {
+            return retired.first >= oldest;
+        });
+
+        for (auto it = iter; it != m_Retired.end(); ++it) {
+            reclaims.push_back(std::move(it->second));
+        }
+
+        m_Retired.erase(iter, m_Retired.end());
+    }
+
+    // Reclaiming can retire more data, so it runs outside of the lock.
+    for (auto& reclaim : reclaims) {
+        reclaim();
+    }
+}
+
+std::size_t EpochManager::GetRetiredCount() {
+    std::lock_guard<std::mutex> lock(m_RetireMutex);
+    return m_Retired.size();
+}
+
+EpochManager& GetEpochManager() {
+    static EpochManager manager;
+    return manager;
+}
+
+} // ns terra
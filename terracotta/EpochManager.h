@@ -0,0 +1,63 @@
+#ifndef TERRACOTTA_EPOCH_MANAGER_H_
+#define TERRACOTTA_EPOCH_MANAGER_H_
+
+#include <mclib/common/Types.h>
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace terra {
+
+/**
+ * Epoch based reclamation for data that is read by other threads without locks.
+ * Readers hold a ReadGuard while they use shared data. Writers unlink old data and Retire it,
+ * and it's only reclaimed by Collect once every reader that could have seen it is gone.
+ */
+class EpochManager {
+public:
+    enum { MaxReaders = 64 };
+
+    class ReadGuard {
+    public:
+        ReadGuard(EpochManager& manager);
+        ~ReadGuard();
+
+        ReadGuard(const ReadGuard& other) = delete;
+        ReadGuard& operator=(const ReadGuard& other) = delete;
+
+    private:
+        EpochManager& m_Manager;
+        std::size_t m_Slot;
+    };
+
+    EpochManager();
+
+    EpochManager(const EpochManager& other) = delete;
+    EpochManager& operator=(const EpochManager& other) = delete;
+
+    // Queues reclaim to run once no reader can still reference the retired data. Can be called from any thread.
+    void Retire(std::function<void()> reclaim);
+    // Advances the epoch and runs every reclaim that is safe now. Should be called regularly by the writer.
+    void Collect();
+
+    std::size_t GetRetiredCount();
+
+private:
+    std::atomic<u64> m_Epoch;
+    // The epoch that each active reader entered at, 0 for free slots.
+    std::array<std::atomic<u64>, MaxReaders> m_Readers;
+
+    std::mutex m_RetireMutex;
+    std::vector<std::pair<u64, std::function<void()>>> m_Retired;
+};
+
+// The epoch manager shared by the world and everything that reads its snapshots.
+EpochManager& GetEpochManager();
+
+} // ns terra
+
+#endif
@@ -3,12 +3,13 @@
 #include <GLFW/glfw3.h>
 #include <mclib/util/Utility.h>
 #include <mclib/util/Utility.h>
-#include <mclib/world/World.h>
 #include <mclib/common/AABB.h>
 #include <mclib/inventory/Inventory.h>
 #include <mclib/protocol/packets/Packet.h>
 #include "math/Plane.h"
 #include "math/TypeUtil.h"
+#include "World.h"
+#include "WorldCursor.h"
 #include <iostream>
 #include <limits>
 
@@ -74,13 +75,15 @@ void Player::Update(float dt) {
     m_Transform.rotation = 0.0f;
 }
 
-Game::Game(mc::protocol::packets::PacketDispatcher* dispatcher, GameWindow& window, const Camera& camera)
+Game::Game(mc::protocol::packets::PacketDispatcher* dispatcher, GameWindow& window, const Camera& camera, s32 view_distance)
     : mc::protocol::packets::PacketHandler(dispatcher),
       m_NetworkClient(dispatcher, mc::protocol::Version::Minecraft_1_13_2),
       m_Window(window),
       m_Camera(camera),
       m_Sprinting(false),
-      m_LastPositionTime(0)
+      m_LastPositionTime(0),
+      m_World(nullptr),
+      m_ViewDistance(view_distance)
 {
     window.RegisterMouseChange(std::bind(&Game::OnMouseChange, this, std::placeholders::_1, std::placeholders::_2));
     window.RegisterMouseScroll(std::bind(&Game::OnMouseScroll, this, std::placeholders::_1, std::placeholders::_2));
@@ -89,7 +92,7 @@ Game::Game(mc::protocol::packets::PacketDispatcher* dispatcher, GameWindow& wind
     m_NetworkClient.GetPlayerController()->SetHandleFall(true);
     m_NetworkClient.GetConnection()->GetSettings()
         .SetMainHand(mc::MainHand::Right)
-        .SetViewDistance(4);
+        .SetViewDistance(static_cast<u8>(m_ViewDistance));
 
     m_NetworkClient.GetPlayerManager()->RegisterListener(this);
 
@@ -99,6 +102,7 @@ Game::Game(mc::protocol::packets::PacketDispatcher* dispatcher, GameWindow& wind
 }
 
 void Game::CreatePlayer(terra::World* world) {
+    m_World = world;
     m_Player = std::make_unique<terra::Player>(world);
 }
 
@@ -106,6 +110,10 @@ mc::Vector3d Game::GetPosition() {
     return m_Player->GetTransform().position;
 }
 
+mc::Vector3d Game::GetEyePosition() {
+    return m_Player->GetTransform().position + mc::Vector3d(0, 1.6, 0);
+}
+
 void Game::Update() {
     UpdateClient();
 
@@ -175,9 +183,7 @@ void Game::Update() {
 
     m_Player->Update(m_DeltaTime);
 
-    glm::vec3 eye = math::VecToGLM(m_Player->GetTransform().position) + glm::vec3(0, 1.6, 0);
-
-    m_Camera.SetPosition(eye);
+    m_Camera.SetPosition(math::VecToGLM(GetEyePosition()));
 
     constexpr float kTickTime = 1000.0f / 20.0f / 1000.0f;
 
@@ -299,7 +305,7 @@ std::pair<mc::Vector3d, mc::Face> GetClosestNormal(const mc::Vector3d& pos, mc::
 }
 
 // TODO: Temporary fun code
-bool RayCast(mc::world::World& world, mc::Vector3d from, mc::Vector3d direction, double range, mc::Vector3d& hit, mc::Vector3d& normal, mc::Face& face) {
+bool RayCast(terra::World& world, mc::Vector3d from, mc::Vector3d direction, double range, mc::Vector3d& hit, mc::Vector3d& normal, mc::Face& face) {
     static const std::vector<mc::Vector3d> directions = {
         mc::Vector3d(0, 0, 0), 
         mc::Vector3d(1, 0, 0), mc::Vector3d(-1, 0, 0), 
@@ -321,12 +327,16 @@ bool RayCast(mc::world::World& world, mc::Vector3d from, mc::Vector3d direction,
     mc::AABB closest_aabb;
     bool collided = false;
 
+    terra::WorldCursor cursor(world, mc::ToVector3i(from));
+
     for (double i = 0; i < range + 1; ++i) {
         mc::Vector3d position = from + direction * i;
 
         for (mc::Vector3d checkDirection : directions) {
             mc::Vector3d checkPos = position + checkDirection;
-            mc::block::BlockPtr block = world.GetBlock(checkPos);
+
+            cursor.MoveTo(mc::ToVector3i(checkPos));
+            mc::block::BlockPtr block = cursor.GetBlock();
 
             if (block->IsOpaque()) {
                 mc::AABB bounds = block->GetBoundingBox(checkPos);
@@ -357,10 +367,12 @@ bool RayCast(mc::world::World& world, mc::Vector3d from, mc::Vector3d direction,
 
 // TODO: Temporary fun code
 void Game::OnMousePress(int button, int action, int mods) {
+    if (m_World == nullptr) return;
+
     if (button == GLFW_MOUSE_BUTTON_1 && action == GLFW_PRESS) {
         using namespace mc::protocol::packets::out;
 
-        auto& world = *m_NetworkClient.GetWorld();
+        auto& world = *m_World;
         mc::Vector3d position(m_Camera.GetPosition().x, m_Camera.GetPosition().y, m_Camera.GetPosition().z);
         mc::Vector3d forward(m_Camera.GetFront().x, m_Camera.GetFront().y, m_Camera.GetFront().z);
         mc::Vector3d hit;
@@ -388,7 +400,7 @@ void Game::OnMousePress(int button, int action, int mods) {
         m_NetworkClient.GetConnection()->SendPacket(&animation);
         
     } else if (button == GLFW_MOUSE_BUTTON_2 && action == GLFW_PRESS) {
-        auto& world = *m_NetworkClient.GetWorld();
+        auto& world = *m_World;
         mc::Vector3d position(m_Camera.GetPosition().x, m_Camera.GetPosition().y, m_Camera.GetPosition().z);
         mc::Vector3d forward(m_Camera.GetFront().x, m_Camera.GetFront().y, m_Camera.GetFront().z);
         mc::Vector3d hit;
@@ -39,7 +39,10 @@ private:
 
 class Game : public mc::protocol::packets::PacketHandler, mc::core::PlayerListener {
 public:
-    Game(mc::protocol::packets::PacketDispatcher* dispatcher, GameWindow& window, const Camera& camera);
+    enum { DefaultViewDistance = 4 };
+
+    // The view distance in chunks is sent to the server in the client settings.
+    Game(mc::protocol::packets::PacketDispatcher* dispatcher, GameWindow& window, const Camera& camera, s32 view_distance = DefaultViewDistance);
 
     void OnMouseChange(double x, double y);
     void OnMouseScroll(double offset_x, double offset_y);
@@ -58,7 +61,10 @@ public:
 
     Camera& GetCamera() { return m_Camera; }
     mc::Vector3d GetPosition();
+    // The camera position in double precision, which chunks are drawn relative to.
+    mc::Vector3d GetEyePosition();
     mc::core::Client& GetNetworkClient() { return m_NetworkClient; }
+    s32 GetViewDistance() const { return m_ViewDistance; }
 
 private:
     mc::core::Client m_NetworkClient;
@@ -69,6 +75,8 @@ private:
     float m_LastFrame;
     float m_LastPositionTime;
     bool m_Sprinting;
+    terra::World* m_World;
+    s32 m_ViewDistance;
 };
 
 } // ns terra
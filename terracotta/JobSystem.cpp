@@ -0,0 +1,163 @@
+#include "JobSystem.h"
+
+#include <iostream>
+
+namespace terra {
+
+// The job system and worker index of the worker running on this thread.
+static thread_local const JobSystem* t_JobSystem = nullptr;
+static thread_local int t_WorkerIndex = -1;
+
+JobSystem::JobSystem(std::size_t worker_count)
+    : m_NextQueue(0),
+      m_Queued(0),
+      m_Running(true)
+{
+    if (worker_count == 0) {
+        worker_count = GetDefaultWorkerCount();
+    }
+
+    std::cout << "Creating " << worker_count << " job worker threads." << std::endl;
+
+    for (std::size_t i = 0; i < worker_count; ++i) {
+        m_Queues.push_back(std::make_unique<WorkerQueue>());
+    }
+
+    for (std::size_t i = 0; i < worker_count; ++i) {
+        m_Workers.emplace_back(&JobSystem::WorkerUpdate, this, i);
+    }
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(m_SleepMutex);
+        m_Running.store(false, std::memory_order_release);
+    }
+
+    m_SleepCV.notify_all();
+
+    for (auto& worker : m_Workers) {
+        worker.join();
+    }
+
+    // Release anything waiting on the jobs that never ran.
+    for (auto& queue : m_Queues) {
+        for (auto& tasks : queue->tasks) {
+            for (Task& task : tasks) {
+                Finish(task);
+            }
+        }
+    }
+}
+
+std::size_t JobSystem::GetDefaultWorkerCount() {
+    // hardware_concurrency returns 0 when it can't tell.
+    unsigned int threads = std::thread::hardware_concurrency();
+
+    return threads > 1 ? threads - 1 : 1;
+}
+
+int JobSystem::GetWorkerIndex() const {
+    return t_JobSystem == this ? t_WorkerIndex : -1;
+}
+
+void JobSystem::Submit(Job job, JobPriority priority) {
+    Push(Task{ std::move(job), nullptr }, priority);
+}
+
+void JobSystem::Submit(Job job, JobPriority priority, const JobToken& token) {
+    token.m_State->pending.fetch_add(1, std::memory_order_relaxed);
+
+    Push(Task{ std::move(job), token.m_State }, priority);
+}
+
+void JobSystem::Push(Task task, JobPriority priority) {
+    int worker_index = GetWorkerIndex();
+    // Jobs submitted from a job stay on that worker's queue. The others are spread over all of the queues.
+    std::size_t index = worker_index >= 0 ? static_cast<std::size_t>(worker_index) : m_NextQueue.fetch_add(1, std::memory_order_relaxed) % m_Queues.size();
+    WorkerQueue& queue = *m_Queues[index];
+
+    m_Queued.fetch_add(1, std::memory_order_acq_rel);
+
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks[static_cast<std::size_t>(priority)].push_back(std::move(task));
+    }
+
+    {
+        // Taking the lock orders this with a worker that checked m_Queued and is about to wait.
+        std::lock_guard<std::mutex> lock(m_SleepMutex);
+    }
+
+    m_SleepCV.notify_one();
+}
+
+bool JobSystem::TryTake(std::size_t index, Task& task) {
+    const std::size_t count = m_Queues.size();
+
+    for (std::size_t priority = 0; priority < static_cast<std::size_t>(JobPriority::Count); ++priority) {
+        // Workers take the oldest job of their own queue and steal the newest job of another, which its owner would run last.
+        for (std::size_t i = 0; i < count; ++i) {
+            WorkerQueue& queue = *m_Queues[(index + i) % count];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            std::deque<Task>& tasks = queue.tasks[priority];
+
+            if (tasks.empty()) continue;
+
+            if (i == 0) {
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            } else {
+                task = std::move(tasks.back());
+                tasks.pop_back();
+            }
+
+            m_Queued.fetch_sub(1, std::memory_order_acq_rel);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void JobSystem::Finish(Task& task) {
+    if (task.token == nullptr) return;
+
+    if (task.token->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        std::lock_guard<std::mutex> lock(task.token->mutex);
+        task.token->finished_cv.notify_all();
+    }
+}
+
+void JobSystem::Wait(const JobToken& token) {
+    JobToken::State& state = *token.m_State;
+    std::unique_lock<std::mutex> lock(state.mutex);
+
+    state.finished_cv.wait(lock, [&state] { return state.pending.load(std::memory_order_acquire) == 0; });
+}
+
+void JobSystem::WorkerUpdate(std::size_t index) {
+    t_JobSystem = this;
+    t_WorkerIndex = static_cast<int>(index);
+
+    while (m_Running.load(std::memory_order_acquire)) {
+        Task task;
+
+        if (TryTake(index, task)) {
+            if (task.token == nullptr || !task.token->cancelled.load(std::memory_order_acquire)) {
+                task.job();
+            }
+
+            // Drop anything the job holds before anyone waiting on it is released.
+            task.job = nullptr;
+            Finish(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_SleepMutex);
+
+        m_SleepCV.wait(lock, [this] { return !m_Running.load(std::memory_order_acquire) || m_Queued.load(std::memory_order_acquire) > 0; });
+    }
+}
+
+} // ns terra
@@ -0,0 +1,107 @@
+#ifndef TERRACOTTA_JOB_SYSTEM_H_
+#define TERRACOTTA_JOB_SYSTEM_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace terra {
+
+enum class JobPriority {
+    High,
+    Normal,
+    Low,
+
+    Count
+};
+
+// Groups the jobs that are submitted with it so they can be cancelled and waited on together.
+class JobToken {
+public:
+    JobToken() : m_State(std::make_shared<State>()) { }
+
+    // Jobs that haven't started yet are skipped. Jobs that are already running finish normally.
+    void Cancel() { m_State->cancelled.store(true, std::memory_order_release); }
+    bool IsCancelled() const { return m_State->cancelled.load(std::memory_order_acquire); }
+
+private:
+    struct State {
+        std::atomic<bool> cancelled{ false };
+        // Jobs submitted with the token that haven't finished or been skipped.
+        std::atomic<std::size_t> pending{ 0 };
+        std::mutex mutex;
+        std::condition_variable finished_cv;
+    };
+
+    std::shared_ptr<State> m_State;
+
+    friend class JobSystem;
+};
+
+/**
+ * Runs jobs on a fixed set of worker threads. Every worker has its own queue for each priority.
+ * Jobs are spread over the queues, and a worker whose queues are empty steals from the others.
+ * Higher priority jobs are always taken before lower priority ones.
+ */
+class JobSystem {
+public:
+    using Job = std::function<void()>;
+
+    // A worker count of 0 uses GetDefaultWorkerCount.
+    JobSystem(std::size_t worker_count = 0);
+    // Waits for the running jobs and skips the ones that are still queued, releasing anything waiting on them.
+    ~JobSystem();
+
+    JobSystem(const JobSystem& rhs) = delete;
+    JobSystem& operator=(const JobSystem& rhs) = delete;
+
+    void Submit(Job job, JobPriority priority = JobPriority::Normal);
+    void Submit(Job job, JobPriority priority, const JobToken& token);
+
+    // Blocks until every job submitted with the token has finished or been skipped. Must not be called from a job.
+    void Wait(const JobToken& token);
+
+    std::size_t GetWorkerCount() const { return m_Workers.size(); }
+    // Returns the index of the worker running the calling thread, or -1 if the thread isn't one of the workers.
+    int GetWorkerIndex() const;
+
+    // One worker per hardware thread besides the main thread, and at least one.
+    static std::size_t GetDefaultWorkerCount();
+
+private:
+    struct Task {
+        Job job;
+        std::shared_ptr<JobToken::State> token;
+    };
+
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks[static_cast<std::size_t>(JobPriority::Count)];
+    };
+
+    void Push(Task task, JobPriority priority);
+    bool TryTake(std::size_t index, Task& task);
+    void Finish(Task& task);
+    void WorkerUpdate(std::size_t index);
+
+    std::vector<std::unique_ptr<WorkerQueue>> m_Queues;
+    std::vector<std::thread> m_Workers;
+    std::atomic<std::size_t> m_NextQueue;
+
+    // Counts a job before it's pushed and until it's taken, so a worker never sleeps while a job is queued.
+    std::atomic<std::size_t> m_Queued;
+    std::mutex m_SleepMutex;
+    std::condition_variable m_SleepCV;
+    // Cleared under m_SleepMutex so sleeping workers can't miss it. Workers check it before taking every job.
+    std::atomic<bool> m_Running;
+};
+
+} // ns terra
+
+#endif
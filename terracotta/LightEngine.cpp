@@ -0,0 +1,826 @@
+#include "LightEngine.h"
+
+#include "EpochManager.h"
+#include "assets/AssetCache.h"
+
+#include <algorithm>
+
+namespace terra {
+
+namespace {
+
+const s32 kOffsets[6][3] = {
+    { 0, 1, 0 }, { 0, -1, 0 }, { 1, 0, 0 }, { -1, 0, 0 }, { 0, 0, 1 }, { 0, 0, -1 }
+};
+
+// Index of the downward offset. Full sky light keeps its level while it travels down.
+const std::size_t kDown = 1;
+
+const s32 kWorldHeight = 16 * ChunkColumn::ChunksPerColumn;
+
+std::size_t GetIndex(s32 x, s32 y, s32 z) {
+    return ((y & 15) << 8) | ((z & 15) << 4) | (x & 15);
+}
+
+} // ns
+
+LightSection::LightSection(u8 sky_level, u8 block_level) : published(false) {
+    sky.fill(static_cast<u8>(sky_level | (sky_level << 4)));
+    block.fill(static_cast<u8>(block_level | (block_level << 4)));
+}
+
+LightSection::LightSection(const LightSection& other) : sky(other.sky), block(other.block), published(false) {
+
+}
+
+u8 LightSnapshot::GetLight(const Column* column, const mc::Vector3i& pos) {
+    if (column == nullptr) return MaxLightLevel << 4;
+    if (pos.y < 0) return 0;
+
+    u8 sky = column->skylight ? MaxLightLevel : 0;
+
+    if (pos.y >= kWorldHeight) return sky << 4;
+
+    const LightSection* section = column->sections[pos.y >> 4];
+
+    if (section == nullptr) return sky << 4;
+
+    std::size_t index = GetIndex((s32)pos.x, (s32)pos.y, (s32)pos.z);
+
+    return (LightSection::Get(section->sky, index) << 4) | LightSection::Get(section->block, index);
+}
+
+LightEngine::LightEngine(World* world)
+    : m_World(world),
+      m_Working(true),
+      m_Snapshot(nullptr),
+      m_SectionCount(0),
+      m_Blocks(nullptr),
+      m_CachedCoord(0, 0),
+      m_CachedColumn(nullptr)
+{
+    world->RegisterListener(this);
+
+    m_Worker = std::thread(&LightEngine::WorkerUpdate, this);
+}
+
+LightEngine::~LightEngine() {
+    m_World->UnregisterListener(this);
+
+    {
+        std::lock_guard<std::mutex> lock(m_TaskMutex);
+        m_Working = false;
+    }
+
+    m_TaskCV.notify_all();
+    m_Worker.join();
+
+    // Nothing reads the snapshot anymore, so everything can be freed right away.
+    delete m_Snapshot.exchange(nullptr);
+
+    for (LightSection* section : m_Released) {
+        delete section;
+    }
+
+    m_Released.clear();
+
+    DropColumns(m_Columns);
+
+    for (auto& kv : m_StashedDimensions) {
+        DropColumns(kv.second);
+    }
+
+    for (LightSection* section : m_Released) {
+        delete section;
+    }
+}
+
+void LightEngine::OnChunkLoad(ChunkPtr chunk, const ChunkColumnMetadata& meta, u16 index_y) {
+    ChunkCoord coord(meta.x, meta.z);
+
+    // Every section of a column is loaded at once, so the column is only lit once.
+    if (!m_PendingLoads.insert(coord).second) return;
+
+    Task task;
+
+    task.type = Task::Type::Load;
+    task.coord = coord;
+
+    m_PendingTasks.push_back(std::move(task));
+}
+
+void LightEngine::OnChunkUnload(ChunkColumnPtr chunk) {
+    if (chunk == nullptr) return;
+
+    Task task;
+
+    task.type = Task::Type::Unload;
+    task.coord = ChunkCoord(chunk->GetMetadata().x, chunk->GetMetadata().z);
+
+    m_PendingLoads.erase(task.coord);
+    m_PendingTasks.push_back(std::move(task));
+}
+
+void LightEngine::OnBlockChangeBatch(const BlockChangeBatch& batch) {
+    Task task;
+
+    task.type = Task::Type::Change;
+    task.positions.reserve(batch.changes.size());
+
+    for (const BlockChange& change : batch.changes) {
+        task.positions.push_back(change.position);
+    }
+
+    m_PendingTasks.push_back(std::move(task));
+}
+
+void LightEngine::OnDimensionStash(s32 dimension, const std::vector<ChunkColumnPtr>& columns) {
+    Task task;
+
+    task.type = Task::Type::Stash;
+    task.dimension = dimension;
+
+    m_PendingLoads.clear();
+    m_PendingTasks.push_back(std::move(task));
+}
+
+void LightEngine::OnDimensionRestore(s32 dimension, const std::vector<ChunkColumnPtr>& columns) {
+    Task task;
+
+    task.type = Task::Type::Restore;
+    task.dimension = dimension;
+
+    for (const ChunkColumnPtr& column : columns) {
+        task.columns.emplace_back(column->GetMetadata().x, column->GetMetadata().z);
+    }
+
+    m_PendingTasks.push_back(std::move(task));
+}
+
+void LightEngine::OnDimensionEvict(s32 dimension) {
+    Task task;
+
+    task.type = Task::Type::Evict;
+    task.dimension = dimension;
+
+    m_PendingTasks.push_back(std::move(task));
+}
+
+void LightEngine::Update() {
+    if (m_PendingTasks.empty()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_TaskMutex);
+
+        for (Task& task : m_PendingTasks) {
+            m_Tasks.push_back(std::move(task));
+        }
+    }
+
+    m_PendingTasks.clear();
+    m_PendingLoads.clear();
+
+    m_TaskCV.notify_one();
+}
+
+void LightEngine::TakeDirtySections(std::vector<mc::Vector3i>& sections) {
+    std::lock_guard<std::mutex> lock(m_DirtyMutex);
+
+    sections.insert(sections.end(), m_DirtySections.begin(), m_DirtySections.end());
+    m_DirtySections.clear();
+}
+
+void LightEngine::WorkerUpdate() {
+    while (true) {
+        std::deque<Task> tasks;
+
+        {
+            std::unique_lock<std::mutex> lock(m_TaskMutex);
+
+            m_TaskCV.wait(lock, [this] { return !m_Working || !m_Tasks.empty(); });
+
+            if (!m_Working) return;
+
+            tasks.swap(m_Tasks);
+        }
+
+        {
+            // Blocks are only read while the guard is held, so the column block pointers are refreshed for every batch.
+            EpochManager::ReadGuard guard(GetEpochManager());
+
+            m_Blocks = m_World->GetSnapshot();
+
+            for (auto& kv : m_Columns) {
+                kv.second.blocks = m_Blocks ? m_Blocks->GetColumn(kv.first.first, kv.first.second) : nullptr;
+            }
+
+            for (Task& task : tasks) {
+                ProcessTask(task);
+            }
+
+            for (auto& kv : m_Columns) {
+                kv.second.blocks = nullptr;
+            }
+
+            m_Blocks = nullptr;
+        }
+
+        if (!m_ChangedColumns.empty() || !m_Released.empty()) {
+            Publish();
+        }
+
+        if (!m_Changed.empty()) {
+            std::lock_guard<std::mutex> lock(m_DirtyMutex);
+
+            m_DirtySections.insert(m_Changed.begin(), m_Changed.end());
+            m_Changed.clear();
+        }
+    }
+}
+
+void LightEngine::ProcessTask(Task& task) {
+    switch (task.type) {
+        case Task::Type::Load:
+        {
+            LightColumn(task.coord);
+        }
+        break;
+        case Task::Type::Unload:
+        {
+            auto iter = m_Columns.find(task.coord);
+
+            if (iter == m_Columns.end()) break;
+
+            for (auto& section : iter->second.sections) {
+                ReleaseSection(section);
+            }
+
+            m_Columns.erase(iter);
+            m_CachedColumn = nullptr;
+            m_ChangedColumns.insert(task.coord);
+        }
+        break;
+        case Task::Type::Change:
+        {
+            for (const mc::Vector3i& position : task.positions) {
+                UpdateBlock((s32)position.x, (s32)position.y, (s32)position.z);
+
+                // The block's own faces change even if the light around it doesn't.
+                MarkSection((s32)position.x, (s32)position.y, (s32)position.z);
+            }
+        }
+        break;
+        case Task::Type::Stash:
+        {
+            ColumnMap& stash = m_StashedDimensions[task.dimension];
+
+            for (auto& kv : m_Columns) {
+                m_ChangedColumns.insert(kv.first);
+            }
+
+            DropColumns(stash);
+            stash = std::move(m_Columns);
+            m_Columns.clear();
+            m_CachedColumn = nullptr;
+        }
+        break;
+        case Task::Type::Restore:
+        {
+            auto stash = m_StashedDimensions.find(task.dimension);
+
+            for (const ChunkCoord& coord : task.columns) {
+                if (stash != m_StashedDimensions.end()) {
+                    auto iter = stash->second.find(coord);
+
+                    if (iter != stash->second.end()) {
+                        Column& column = m_Columns[coord];
+
+                        for (auto& section : column.sections) {
+                            ReleaseSection(section);
+                        }
+
+                        column = std::move(iter->second);
+                        column.blocks = m_Blocks ? m_Blocks->GetColumn(coord.first, coord.second) : nullptr;
+                        stash->second.erase(iter);
+                        m_ChangedColumns.insert(coord);
+                        continue;
+                    }
+                }
+
+                LightColumn(coord);
+            }
+
+            if (stash != m_StashedDimensions.end()) {
+                DropColumns(stash->second);
+                m_StashedDimensions.erase(stash);
+            }
+        }
+        break;
+        case Task::Type::Evict:
+        {
+            auto stash = m_StashedDimensions.find(task.dimension);
+
+            if (stash == m_StashedDimensions.end()) break;
+
+            DropColumns(stash->second);
+            m_StashedDimensions.erase(stash);
+        }
+        break;
+    }
+}
+
+void LightEngine::Publish() {
+    std::vector<LightSnapshot::Column> captured;
+    std::vector<SnapshotMap<LightSnapshot::Column>::Change> changes;
+
+    // Reserved up front, so the changes can point into it.
+    captured.reserve(m_ChangedColumns.size());
+    changes.reserve(m_ChangedColumns.size());
+
+    for (const ChunkCoord& coord : m_ChangedColumns) {
+        auto iter = m_Columns.find(coord);
+
+        if (iter == m_Columns.end()) {
+            changes.emplace_back(coord, nullptr);
+            continue;
+        }
+
+        LightSnapshot::Column column{ {}, iter->second.skylight };
+
+        for (s32 i = 0; i < ChunkColumn::ChunksPerColumn; ++i) {
+            LightSection* section = iter->second.sections[i].get();
+
+            if (section != nullptr) {
+                section->published = true;
+            }
+
+            column.sections[i] = section;
+        }
+
+        captured.push_back(column);
+        changes.emplace_back(coord, &captured.back());
+    }
+
+    m_ChangedColumns.clear();
+
+    const LightSnapshot* old = nullptr;
+
+    // Sections of stashed dimensions can be dropped without changing the current columns, which doesn't need a new snapshot.
+    if (!changes.empty()) {
+        const LightSnapshot* current = m_Snapshot.load(std::memory_order_relaxed);
+
+        old = m_Snapshot.exchange(new LightSnapshot(current, changes), std::memory_order_acq_rel);
+    }
+
+    // The replaced sections were only reachable through the old snapshots, so they go with them.
+    std::vector<LightSection*> released = std::move(m_Released);
+
+    m_Released.clear();
+
+    if (old != nullptr || !released.empty()) {
+        GetEpochManager().Retire([old, released]() {
+            delete old;
+
+            for (LightSection* section : released) {
+                delete section;
+            }
+        });
+    }
+}
+
+LightEngine::Column* LightEngine::GetColumn(s32 chunk_x, s32 chunk_z) {
+    if (m_CachedColumn != nullptr && m_CachedCoord.first == chunk_x && m_CachedCoord.second == chunk_z) {
+        return m_CachedColumn;
+    }
+
+    auto iter = m_Columns.find(ChunkCoord(chunk_x, chunk_z));
+
+    if (iter == m_Columns.end()) return nullptr;
+
+    m_CachedCoord = iter->first;
+    m_CachedColumn = &iter->second;
+
+    return m_CachedColumn;
+}
+
+void LightEngine::DropColumns(ColumnMap& columns) {
+    for (auto& kv : columns) {
+        for (auto& section : kv.second.sections) {
+            ReleaseSection(section);
+        }
+    }
+
+    columns.clear();
+    m_CachedColumn = nullptr;
+}
+
+void LightEngine::ReleaseSection(std::unique_ptr<LightSection>& section) {
+    if (section == nullptr) return;
+
+    m_SectionCount.fetch_sub(1, std::memory_order_relaxed);
+
+    // Published sections can still be read until the snapshot that has them is replaced.
+    if (section->published) {
+        m_Released.push_back(section.release());
+    } else {
+        section.reset();
+    }
+}
+
+bool LightEngine::IsOpaque(const Column* column, s32 x, s32 y, s32 z) const {
+    if (column == nullptr || column->blocks == nullptr) return true;
+    if (y < 0 || y >= kWorldHeight) return false;
+
+    const Chunk* chunk = column->blocks->chunks[y >> 4];
+
+    if (chunk == nullptr) return false;
+
+    return chunk->IsOpaqueCube(mc::Vector3i(x & 15, y & 15, z & 15));
+}
+
+u8 LightEngine::GetEmission(const Column* column, s32 x, s32 y, s32 z) const {
+    if (column == nullptr || column->blocks == nullptr || y < 0 || y >= kWorldHeight) return 0;
+
+    const Chunk* chunk = column->blocks->chunks[y >> 4];
+
+    if (chunk == nullptr) return 0;
+
+    return g_AssetCache->GetStateProperties(chunk->GetBlock(mc::Vector3i(x & 15, y & 15, z & 15))->GetType()).light_emission;
+}
+
+u8 LightEngine::GetLevel(const Column* column, Channel channel, s32 x, s32 y, s32 z) const {
+    if (column == nullptr || y < 0) return 0;
+
+    u8 fill = (channel == Channel::Sky && column->skylight) ? MaxLightLevel : 0;
+
+    if (y >= kWorldHeight) return fill;
+
+    const LightSection* section = column->sections[y >> 4].get();
+
+    if (section == nullptr) return fill;
+
+    return LightSection::Get(channel == Channel::Sky ? section->sky : section->block, GetIndex(x, y, z));
+}
+
+void LightEngine::SetLevel(Column* column, Channel channel, s32 x, s32 y, s32 z, u8 level) {
+    if (column == nullptr || y < 0 || y >= kWorldHeight) return;
+
+    std::unique_ptr<LightSection>& section = column->sections[y >> 4];
+    u8 sky_fill = column->skylight ? MaxLightLevel : 0;
+
+    if (section == nullptr) {
+        u8 fill = channel == Channel::Sky ? sky_fill : 0;
+
+        if (level == fill) return;
+
+        section = std::make_unique<LightSection>(sky_fill, 0);
+        m_SectionCount.fetch_add(1, std::memory_order_relaxed);
+        m_ChangedColumns.insert(ChunkCoord(x >> 4, z >> 4));
+    } else if (section->published) {
+        // Copy on write, like the chunks in the world snapshots.
+        std::unique_ptr<LightSection> copy = std::make_unique<LightSection>(*section);
+
+        ReleaseSection(section);
+        section = std::move(copy);
+        m_SectionCount.fetch_add(1, std::memory_order_relaxed);
+        m_ChangedColumns.insert(ChunkCoord(x >> 4, z >> 4));
+    }
+
+    // Sections that aren't published yet belong to a column that is already waiting to be published.
+    LightSection::Set(channel == Channel::Sky ? section->sky : section->block, GetIndex(x, y, z), level);
+    MarkSection(x, y, z);
+}
+
+void LightEngine::MarkSection(s32 x, s32 y, s32 z) {
+    // The meshes of the neighboring sections sample the light on this section's border.
+    s32 chunk_x = x >> 4;
+    s32 chunk_y = y >> 4;
+    s32 chunk_z = z >> 4;
+
+    m_Changed.insert(mc::Vector3i(chunk_x, chunk_y, chunk_z));
+
+    if ((x & 15) == 0) m_Changed.insert(mc::Vector3i(chunk_x - 1, chunk_y, chunk_z));
+    if ((x & 15) == 15) m_Changed.insert(mc::Vector3i(chunk_x + 1, chunk_y, chunk_z));
+    if ((y & 15) == 0 && chunk_y > 0) m_Changed.insert(mc::Vector3i(chunk_x, chunk_y - 1, chunk_z));
+    if ((y & 15) == 15 && chunk_y < ChunkColumn::ChunksPerColumn - 1) m_Changed.insert(mc::Vector3i(chunk_x, chunk_y + 1, chunk_z));
+    if ((z & 15) == 0) m_Changed.insert(mc::Vector3i(chunk_x, chunk_y, chunk_z - 1));
+    if ((z & 15) == 15) m_Changed.insert(mc::Vector3i(chunk_x, chunk_y, chunk_z + 1));
+}
+
+void LightEngine::Propagate(Channel channel) {
+    for (std::size_t i = 0; i < m_AddQueue.size(); ++i) {
+        LightNode node = m_AddQueue[i];
+        Column* column = GetColumn(node.x >> 4, node.z >> 4);
+        u8 level = GetLevel(column, channel, node.x, node.y, node.z);
+
+        if (level <= 1) continue;
+
+        for (std::size_t j = 0; j < 6; ++j) {
+            s32 x = node.x + kOffsets[j][0];
+            s32 y = node.y + kOffsets[j][1];
+            s32 z = node.z + kOffsets[j][2];
+
+            if (y < 0 || y >= kWorldHeight) continue;
+
+            Column* neighbor = GetColumn(x >> 4, z >> 4);
+
+            if (IsOpaque(neighbor, x, y, z)) continue;
+
+            u8 target = (channel == Channel::Sky && j == kDown && level == MaxLightLevel) ? level : level - 1;
+
+            if (GetLevel(neighbor, channel, x, y, z) >= target) continue;
+
+            SetLevel(neighbor, channel, x, y, z, target);
+            m_AddQueue.push_back(LightNode{ x, y, z, target });
+        }
+    }
+
+    m_AddQueue.clear();
+}
+
+void LightEngine::Unpropagate(Channel channel) {
+    for (std::size_t i = 0; i < m_RemoveQueue.size(); ++i) {
+        LightNode node = m_RemoveQueue[i];
+
+        for (std::size_t j = 0; j < 6; ++j) {
+            s32 x = node.x + kOffsets[j][0];
+            s32 y = node.y + kOffsets[j][1];
+            s32 z = node.z + kOffsets[j][2];
+
+            if (y < 0 || y >= kWorldHeight) continue;
+
+            Column* neighbor = GetColumn(x >> 4, z >> 4);
+
+            if (neighbor == nullptr || neighbor->blocks == nullptr) continue;
+
+            u8 level = GetLevel(neighbor, channel, x, y, z);
+
+            if (level == 0) continue;
+
+            bool from_node = level < node.level || (channel == Channel::Sky && j == kDown && node.level == MaxLightLevel);
+
+            if (!from_node) {
+                // This light came from somewhere else, so it spreads back into the removed area.
+                m_AddQueue.push_back(LightNode{ x, y, z, level });
+                continue;
+            }
+
+            SetLevel(neighbor, channel, x, y, z, 0);
+            m_RemoveQueue.push_back(LightNode{ x, y, z, level });
+
+            if (channel == Channel::Block) {
+                u8 emission = GetEmission(neighbor, x, y, z);
+
+                if (emission > 0) {
+                    SetLevel(neighbor, channel, x, y, z, emission);
+                    m_AddQueue.push_back(LightNode{ x, y, z, emission });
+                }
+            }
+        }
+    }
+
+    m_RemoveQueue.clear();
+}
+
+void LightEngine::LightColumn(const ChunkCoord& coord) {
+    const WorldSnapshot::Column* blocks = m_Blocks ? m_Blocks->GetColumn(coord.first, coord.second) : nullptr;
+    const s32 base_x = coord.first * 16;
+    const s32 base_z = coord.second * 16;
+    auto iter = m_Columns.find(coord);
+
+    if (iter != m_Columns.end()) {
+        Column& column = iter->second;
+
+        // Remove the light that the old version of the column spread into its neighbors. The column itself is
+        // cut off from the world while this happens, so only the neighbors are touched.
+        column.blocks = nullptr;
+
+        for (Channel channel : { Channel::Sky, Channel::Block }) {
+            const s32 neighbors[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+
+            for (const auto& offset : neighbors) {
+                Column* neighbor = GetColumn(coord.first + offset[0], coord.second + offset[1]);
+
+                if (neighbor == nullptr || neighbor->blocks == nullptr) continue;
+
+                for (s32 y = 0; y < kWorldHeight; ++y) {
+                    for (s32 i = 0; i < 16; ++i) {
+                        s32 x = offset[0] == 0 ? base_x + i : (offset[0] < 0 ? base_x : base_x + 15);
+                        s32 z = offset[1] == 0 ? base_z + i : (offset[1] < 0 ? base_z : base_z + 15);
+                        u8 level = GetLevel(&column, channel, x, y, z);
+
+                        // The neighbor can only have gotten light from this position if it's darker.
+                        if (level > GetLevel(neighbor, channel, x + offset[0], y, z + offset[1])) {
+                            m_RemoveQueue.push_back(LightNode{ x, y, z, level });
+                        }
+                    }
+                }
+            }
+
+            Unpropagate(channel);
+            Propagate(channel);
+        }
+
+        for (auto& section : column.sections) {
+            ReleaseSection(section);
+        }
+
+        if (blocks == nullptr) {
+            m_Columns.erase(iter);
+            m_CachedColumn = nullptr;
+            m_ChangedColumns.insert(coord);
+            return;
+        }
+    } else if (blocks == nullptr) {
+        return;
+    }
+
+    Column& column = m_Columns[coord];
+
+    column.blocks = blocks;
+    column.skylight = blocks->meta.skylight;
+    m_ChangedColumns.insert(coord);
+
+    // The y above the highest opaque cube of each x, z. Everything from there up has full sky light.
+    std::array<s32, 16 * 16> heights;
+    s32 top_section = -1;
+
+    heights.fill(0);
+
+    for (s32 chunk_y = ChunkColumn::ChunksPerColumn - 1; chunk_y >= 0; --chunk_y) {
+        const Chunk* chunk = blocks->chunks[chunk_y];
+
+        if (chunk == nullptr) continue;
+
+        const Chunk::BlockMask& mask = chunk->GetOpaqueMask();
+
+        for (s32 y = 15; y >= 0; --y) {
+            for (s32 i = 0; i < 16 * 16; ++i) {
+                std::size_t index = (y << 8) | i;
+
+                if (heights[i] == 0 && ((mask[index >> 6] >> (index & 63)) & 1)) {
+                    heights[i] = chunk_y * 16 + y + 1;
+                    top_section = std::max(top_section, chunk_y);
+                }
+            }
+        }
+    }
+
+    // Sections above the highest opaque cube keep the default full sky light, so they don't need storage.
+    for (s32 chunk_y = 0; chunk_y <= top_section; ++chunk_y) {
+        column.sections[chunk_y] = std::make_unique<LightSection>(0, 0);
+        m_SectionCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // A new column changes the faces and light on the borders of its neighbors too.
+    for (s32 chunk_y = 0; chunk_y < ChunkColumn::ChunksPerColumn; ++chunk_y) {
+        m_Changed.insert(mc::Vector3i(coord.first, chunk_y, coord.second));
+        m_Changed.insert(mc::Vector3i(coord.first - 1, chunk_y, coord.second));
+        m_Changed.insert(mc::Vector3i(coord.first + 1, chunk_y, coord.second));
+        m_Changed.insert(mc::Vector3i(coord.first, chunk_y, coord.second - 1));
+        m_Changed.insert(mc::Vector3i(coord.first, chunk_y, coord.second + 1));
+    }
+
+    if (column.skylight) {
+        const s32 sky_top = (top_section + 1) * 16;
+
+        for (s32 z = 0; z < 16; ++z) {
+            for (s32 x = 0; x < 16; ++x) {
+                s32 height = heights[z * 16 + x];
+
+                for (s32 y = height; y < sky_top; ++y) {
+                    LightSection::Set(column.sections[y >> 4]->sky, GetIndex(x, y, z), MaxLightLevel);
+                }
+
+                // Sky light only has to spread sideways where a neighbor in the column is covered at the same height.
+                s32 neighbor_height = height;
+
+                if (x > 0) neighbor_height = std::max(neighbor_height, heights[z * 16 + x - 1]);
+                if (x < 15) neighbor_height = std::max(neighbor_height, heights[z * 16 + x + 1]);
+                if (z > 0) neighbor_height = std::max(neighbor_height, heights[(z - 1) * 16 + x]);
+                if (z < 15) neighbor_height = std::max(neighbor_height, heights[(z + 1) * 16 + x]);
+
+                for (s32 y = height; y < neighbor_height; ++y) {
+                    m_AddQueue.push_back(LightNode{ base_x + x, y, base_z + z, MaxLightLevel });
+                }
+            }
+        }
+    }
+
+    QueueBorderLight(coord, column, Channel::Sky);
+    Propagate(Channel::Sky);
+
+    for (s32 chunk_y = 0; chunk_y < ChunkColumn::ChunksPerColumn; ++chunk_y) {
+        const Chunk* chunk = blocks->chunks[chunk_y];
+
+        if (chunk == nullptr) continue;
+
+        // Most chunks don't have any light sources, which the palette shows without looking at the blocks.
+        bool emits = false;
+
+        for (std::size_t i = 0; i < chunk->GetPaletteSize() && !emits; ++i) {
+            emits = g_AssetCache->GetStateProperties(chunk->GetPaletteEntry(i)->GetType()).light_emission > 0;
+        }
+
+        if (!emits) continue;
+
+        for (s32 y = chunk_y * 16; y < chunk_y * 16 + 16; ++y) {
+            for (s32 z = base_z; z < base_z + 16; ++z) {
+                for (s32 x = base_x; x < base_x + 16; ++x) {
+                    u8 emission = GetEmission(&column, x, y, z);
+
+                    if (emission == 0) continue;
+
+                    SetLevel(&column, Channel::Block, x, y, z, emission);
+                    m_AddQueue.push_back(LightNode{ x, y, z, emission });
+                }
+            }
+        }
+    }
+
+    QueueBorderLight(coord, column, Channel::Block);
+    Propagate(Channel::Block);
+}
+
+void LightEngine::QueueBorderLight(const ChunkCoord& coord, Column& column, Channel channel) {
+    const s32 base_x = coord.first * 16;
+    const s32 base_z = coord.second * 16;
+    const s32 neighbors[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+
+    for (const auto& offset : neighbors) {
+        Column* neighbor = GetColumn(coord.first + offset[0], coord.second + offset[1]);
+
+        if (neighbor == nullptr || neighbor->blocks == nullptr) continue;
+
+        for (s32 y = 0; y < kWorldHeight; ++y) {
+            for (s32 i = 0; i < 16; ++i) {
+                s32 x = offset[0] == 0 ? base_x + i : (offset[0] < 0 ? base_x : base_x + 15);
+                s32 z = offset[1] == 0 ? base_z + i : (offset[1] < 0 ? base_z : base_z + 15);
+                s32 neighbor_x = x + offset[0];
+                s32 neighbor_z = z + offset[1];
+
+                u8 level = GetLevel(&column, channel, x, y, z);
+                u8 neighbor_level = GetLevel(neighbor, channel, neighbor_x, y, neighbor_z);
+
+                if (level > neighbor_level + 1) {
+                    m_AddQueue.push_back(LightNode{ x, y, z, level });
+                } else if (neighbor_level > level + 1) {
+                    m_AddQueue.push_back(LightNode{ neighbor_x, y, neighbor_z, neighbor_level });
+                }
+            }
+        }
+    }
+}
+
+void LightEngine::UpdateBlock(s32 x, s32 y, s32 z) {
+    if (y < 0 || y >= kWorldHeight) return;
+
+    Column* column = GetColumn(x >> 4, z >> 4);
+
+    if (column == nullptr || column->blocks == nullptr) return;
+
+    for (Channel channel : { Channel::Sky, Channel::Block }) {
+        u8 level = GetLevel(column, channel, x, y, z);
+
+        if (level > 0) {
+            SetLevel(column, channel, x, y, z, 0);
+            m_RemoveQueue.push_back(LightNode{ x, y, z, level });
+            Unpropagate(channel);
+        }
+
+        if (channel == Channel::Block) {
+            u8 emission = GetEmission(column, x, y, z);
+
+            if (emission > 0) {
+                SetLevel(column, channel, x, y, z, emission);
+                m_AddQueue.push_back(LightNode{ x, y, z, emission });
+            }
+        } else if (y == kWorldHeight - 1 && column->skylight && !IsOpaque(column, x, y, z)) {
+            SetLevel(column, channel, x, y, z, MaxLightLevel);
+            m_AddQueue.push_back(LightNode{ x, y, z, MaxLightLevel });
+        }
+
+        // The neighbors spread their light back in if the new block lets it through.
+        for (std::size_t j = 0; j < 6; ++j) {
+            s32 neighbor_x = x + kOffsets[j][0];
+            s32 neighbor_y = y + kOffsets[j][1];
+            s32 neighbor_z = z + kOffsets[j][2];
+
+            if (neighbor_y < 0 || neighbor_y >= kWorldHeight) continue;
+
+            Column* neighbor = GetColumn(neighbor_x >> 4, neighbor_z >> 4);
+
+            if (neighbor == nullptr || neighbor->blocks == nullptr) continue;
+
+            u8 neighbor_level = GetLevel(neighbor, channel, neighbor_x, neighbor_y, neighbor_z);
+
+            if (neighbor_level > 1) {
+                m_AddQueue.push_back(LightNode{ neighbor_x, neighbor_y, neighbor_z, neighbor_level });
+            }
+        }
+
+        Propagate(channel);
+    }
+}
+
+} // ns terra
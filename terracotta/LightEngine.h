@@ -0,0 +1,225 @@
+#ifndef TERRACOTTA_LIGHT_ENGINE_H_
+#define TERRACOTTA_LIGHT_ENGINE_H_
+
+#include "SnapshotMap.h"
+#include "World.h"
+#include "WorldSnapshot.h"
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace terra {
+
+enum { MaxLightLevel = 15 };
+
+// The sky and block light of a 16x16x16 section. Each level is a nibble, indexed the same as the block storage (y * 256 + z * 16 + x).
+struct LightSection {
+    std::array<u8, 16 * 16 * 16 / 2> sky;
+    std::array<u8, 16 * 16 * 16 / 2> block;
+    // Published sections can be read by other threads through a LightSnapshot and are copied before they are changed.
+    bool published;
+
+    // Creates a section that is filled with the given levels.
+    LightSection(u8 sky_level, u8 block_level);
+    LightSection(const LightSection& other);
+
+    static u8 Get(const std::array<u8, 16 * 16 * 16 / 2>& levels, std::size_t index) {
+        return (levels[index >> 1] >> ((index & 1) * 4)) & 0x0F;
+    }
+
+    static void Set(std::array<u8, 16 * 16 * 16 / 2>& levels, std::size_t index, u8 value) {
+        u8& pair = levels[index >> 1];
+        u8 shift = (index & 1) * 4;
+
+        pair = static_cast<u8>((pair & ~(0x0F << shift)) | ((value & 0x0F) << shift));
+    }
+};
+
+/**
+ * An immutable view of the light of the loaded columns, read the same way as a WorldSnapshot.
+ * Readers get it from LightEngine::GetSnapshot while holding an EpochManager::ReadGuard.
+ */
+class LightSnapshot {
+public:
+    struct Column {
+        // Null sections were never darkened, so they have full sky light if the column has sky light and no block light.
+        std::array<const LightSection*, ChunkColumn::ChunksPerColumn> sections;
+        bool skylight;
+    };
+
+    // Applies the changed columns on top of previous, which can be null. A null column in changes removes it.
+    LightSnapshot(const LightSnapshot* previous, const std::vector<SnapshotMap<Column>::Change>& changes)
+        : m_Columns(previous ? &previous->m_Columns : nullptr, changes)
+    {
+
+    }
+
+    LightSnapshot(const LightSnapshot& other) = delete;
+    LightSnapshot& operator=(const LightSnapshot& other) = delete;
+
+    // Returns null if the column doesn't have any light yet.
+    const Column* GetColumn(s32 chunk_x, s32 chunk_z) const {
+        return m_Columns.Find(chunk_x, chunk_z);
+    }
+
+    /**
+     * Gets the light at the world position packed as sky << 4 | block.
+     * Positions above the world and in columns without light have full sky light.
+     */
+    static u8 GetLight(const Column* column, const mc::Vector3i& pos);
+
+    u8 GetLight(const mc::Vector3i& pos) const {
+        return GetLight(GetColumn((s32)(pos.x >> 4), (s32)(pos.z >> 4)), pos);
+    }
+
+private:
+    SnapshotMap<Column> m_Columns;
+};
+
+/**
+ * Calculates sky and block light for the loaded columns by flood filling it with breadth-first queues.
+ * Columns are lit when they are loaded, and block changes only update the light around them by removing the old light
+ * and spreading the remaining light back in. The work is done on a worker thread that reads the world snapshots.
+ *
+ * Sections whose light or blocks changed, along with the neighbors that sample their border, are reported through
+ * TakeDirtySections so only those are remeshed.
+ */
+class LightEngine : public WorldListener {
+public:
+    LightEngine(World* world);
+    ~LightEngine();
+
+    LightEngine(const LightEngine& other) = delete;
+    LightEngine& operator=(const LightEngine& other) = delete;
+
+    void OnChunkLoad(ChunkPtr chunk, const ChunkColumnMetadata& meta, u16 index_y) override;
+    void OnChunkUnload(ChunkColumnPtr chunk) override;
+    void OnBlockChangeBatch(const BlockChangeBatch& batch) override;
+    void OnDimensionStash(s32 dimension, const std::vector<ChunkColumnPtr>& columns) override;
+    void OnDimensionRestore(s32 dimension, const std::vector<ChunkColumnPtr>& columns) override;
+    void OnDimensionEvict(s32 dimension) override;
+
+    // Hands the changes since the last update to the worker. Must be called on the main thread after World::PublishSnapshot.
+    void Update();
+
+    /**
+     * Gets the latest published light, which can be null before the first column is lit.
+     * Must only be called while holding an EpochManager::ReadGuard from GetEpochManager().
+     */
+    const LightSnapshot* GetSnapshot() const { return m_Snapshot.load(std::memory_order_acquire); }
+
+    // Moves the chunk coordinates of the sections that need to be remeshed into sections. Can be called from any thread.
+    void TakeDirtySections(std::vector<mc::Vector3i>& sections);
+
+    // Number of light sections held by the engine, including the ones of stashed dimensions.
+    std::size_t GetSectionCount() const { return m_SectionCount.load(std::memory_order_relaxed); }
+
+private:
+    struct Task {
+        enum class Type { Load, Unload, Change, Stash, Restore, Evict };
+
+        Type type;
+        ChunkCoord coord;
+        s32 dimension;
+        // The changed blocks of a Change.
+        std::vector<mc::Vector3i> positions;
+        // The columns of a Restore.
+        std::vector<ChunkCoord> columns;
+    };
+
+    struct Column {
+        std::array<std::unique_ptr<LightSection>, ChunkColumn::ChunksPerColumn> sections;
+        bool skylight;
+        // The blocks of the column in the snapshot that the current batch is using. Null if the world doesn't have it.
+        const WorldSnapshot::Column* blocks;
+    };
+
+    using ColumnMap = std::unordered_map<ChunkCoord, Column>;
+
+    struct LightNode {
+        s32 x;
+        s32 y;
+        s32 z;
+        u8 level;
+    };
+
+    enum class Channel { Sky, Block };
+
+    World* m_World;
+
+    // Filled on the main thread and handed to the worker by Update.
+    std::vector<Task> m_PendingTasks;
+    // Columns with a Load in m_PendingTasks, so a column's sections only queue one.
+    std::unordered_set<ChunkCoord> m_PendingLoads;
+
+    std::mutex m_TaskMutex;
+    std::condition_variable m_TaskCV;
+    std::deque<Task> m_Tasks;
+    bool m_Working;
+    std::thread m_Worker;
+
+    std::mutex m_DirtyMutex;
+    std::unordered_set<mc::Vector3i> m_DirtySections;
+
+    std::atomic<const LightSnapshot*> m_Snapshot;
+    std::atomic<std::size_t> m_SectionCount;
+
+    // Everything below is only used by the worker.
+    ColumnMap m_Columns;
+    std::unordered_map<s32, ColumnMap> m_StashedDimensions;
+    const WorldSnapshot* m_Blocks;
+    // Sections changed by the current batch.
+    std::unordered_set<mc::Vector3i> m_Changed;
+    // The most recently used column, because neighboring positions are usually in the same one.
+    ChunkCoord m_CachedCoord;
+    Column* m_CachedColumn;
+    // Published sections that were replaced or dropped. They are freed along with the snapshot that has them.
+    std::vector<LightSection*> m_Released;
+    // Columns that were added, removed or got new section pointers since the last publish. Only these are captured.
+    std::unordered_set<ChunkCoord> m_ChangedColumns;
+
+    // Reused between updates so the queues don't have to grow again.
+    std::vector<LightNode> m_AddQueue;
+    std::vector<LightNode> m_RemoveQueue;
+
+    void WorkerUpdate();
+    void ProcessTask(Task& task);
+    void Publish();
+
+    Column* GetColumn(s32 chunk_x, s32 chunk_z);
+    void DropColumns(ColumnMap& columns);
+    void ReleaseSection(std::unique_ptr<LightSection>& section);
+
+    // Opaque cubes block light. Positions in columns without blocks also block it, so light doesn't spread into them.
+    bool IsOpaque(const Column* column, s32 x, s32 y, s32 z) const;
+    u8 GetEmission(const Column* column, s32 x, s32 y, s32 z) const;
+
+    u8 GetLevel(const Column* column, Channel channel, s32 x, s32 y, s32 z) const;
+    void SetLevel(Column* column, Channel channel, s32 x, s32 y, s32 z, u8 level);
+    // Reports the section of the position for remeshing, along with the neighbors that sample its border.
+    void MarkSection(s32 x, s32 y, s32 z);
+
+    // Lights a column from scratch, first removing the light that an older version of it spread into its neighbors.
+    void LightColumn(const ChunkCoord& coord);
+    // Queues the positions on both sides of the column's border where light has to spread across it.
+    void QueueBorderLight(const ChunkCoord& coord, Column& column, Channel channel);
+    void UpdateBlock(s32 x, s32 y, s32 z);
+
+    // Spreads the light of every node in the add queue.
+    void Propagate(Channel channel);
+    // Removes the light that came from the nodes in the remove queue, queueing the light that is left at the edges to spread back in.
+    void Unpropagate(Channel channel);
+};
+
+} // ns terra
+
+#endif
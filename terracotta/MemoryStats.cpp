@@ -0,0 +1,137 @@
+#include "MemoryStats.h"
+
+#include "LightEngine.h"
+#include "RegionCache.h"
+#include "assets/TextureArray.h"
+#include "lib/imgui/imgui.h"
+
+#include <fstream>
+
+namespace terra {
+
+static float ToMegabytes(u64 bytes) {
+    return bytes / (1024.0f * 1024.0f);
+}
+
+static mc::json PoolStatsToJson(const PoolStats& stats) {
+    mc::json node;
+
+    node["live"] = stats.live;
+    node["free"] = stats.free;
+    node["high_water"] = stats.high_water;
+
+    return node;
+}
+
+MemoryStats CollectMemoryStats(const World& world, render::ChunkMeshGenerator& mesh_gen, const LightEngine& light, const assets::TextureArray& textures, const RegionCache* cache) {
+    MemoryStats stats = {};
+
+    stats.world = world.GetMemoryStats();
+    stats.meshes = mesh_gen.GetMemoryStats();
+    stats.light_sections = light.GetSectionCount();
+    stats.light_bytes = stats.light_sections * sizeof(LightSection);
+    stats.texture_layers = textures.GetLayerCount();
+    stats.texture_bytes = textures.GetMemoryUsage();
+
+    if (cache != nullptr) {
+        stats.region_cache_entries = cache->GetEntryCount();
+        stats.region_cache_bytes = cache->GetSize();
+    }
+
+    return stats;
+}
+
+void RenderMemoryStats(const MemoryStats& stats) {
+    const WorldMemoryStats& world = stats.world;
+    const render::MeshMemoryStats& meshes = stats.meshes;
+
+    ImGui::Text("Columns: %zu (%zu cached), %.1f MB", world.columns, world.cached_columns, ToMegabytes(world.column_bytes));
+    ImGui::Text("Sections: %zu (%zu uniform)", world.sections, world.uniform_sections);
+    ImGui::Text("Chunk pool: %zu live, %zu free, %zu peak", world.chunk_pool.live, world.chunk_pool.free, world.chunk_pool.high_water);
+    ImGui::Text("Column pool: %zu live, %zu free, %zu peak", world.column_pool.live, world.column_pool.free, world.column_pool.high_water);
+    ImGui::Text("Pending imports: %zu, retired: %zu", world.pending_imports, world.retired);
+    ImGui::Text("Dimension stash: %.1f MB", ToMegabytes(world.stashed_bytes));
+
+    ImGui::Separator();
+
+    ImGui::Text("Meshes: %zu, %.1f MB", meshes.meshes, ToMegabytes(meshes.mesh_bytes));
+    ImGui::Text("Stashed meshes: %zu, %.1f MB", meshes.stashed_meshes, ToMegabytes(meshes.stashed_mesh_bytes));
+    ImGui::Text("Queued chunks: %zu, builds: %zu", meshes.queued_chunks, meshes.queued_builds);
+    ImGui::Text("Pending uploads: %zu, %.1f MB", meshes.pending_uploads, ToMegabytes(meshes.pending_upload_bytes));
+    ImGui::Text("Build contexts: %.1f MB", ToMegabytes(meshes.context_bytes));
+    ImGui::Text("Mesh vertices: %zu, %zu as triangle lists", meshes.vertices, meshes.vertices / 4 * 6);
+    ImGui::Text("Uploaded: %llu vertices, %.1f MB, %.1f MB as triangle lists", (unsigned long long)meshes.uploaded_vertices,
+        ToMegabytes(meshes.uploaded_bytes), ToMegabytes(meshes.uploaded_bytes / 4 * 6));
+    ImGui::Text("Quad index buffer: %.1f MB", ToMegabytes(meshes.index_buffer_bytes));
+
+    ImGui::Text("Light sections: %zu, %.1f MB", stats.light_sections, ToMegabytes(stats.light_bytes));
+
+    ImGui::Separator();
+
+    ImGui::Text("Textures: %zu layers, %.1f MB", stats.texture_layers, ToMegabytes(stats.texture_bytes));
+    ImGui::Text("Region cache: %zu columns, %.1f MB", stats.region_cache_entries, ToMegabytes(stats.region_cache_bytes));
+}
+
+mc::json MemoryStatsToJson(const MemoryStats& stats) {
+    mc::json root;
+
+    mc::json world;
+    world["columns"] = stats.world.columns;
+    world["sections"] = stats.world.sections;
+    world["uniform_sections"] = stats.world.uniform_sections;
+    world["column_bytes"] = stats.world.column_bytes;
+    world["cached_columns"] = stats.world.cached_columns;
+    world["pending_imports"] = stats.world.pending_imports;
+    world["stashed_bytes"] = stats.world.stashed_bytes;
+    world["retired"] = stats.world.retired;
+    world["chunk_pool"] = PoolStatsToJson(stats.world.chunk_pool);
+    world["column_pool"] = PoolStatsToJson(stats.world.column_pool);
+    root["world"] = world;
+
+    mc::json meshes;
+    meshes["meshes"] = stats.meshes.meshes;
+    meshes["mesh_bytes"] = stats.meshes.mesh_bytes;
+    meshes["stashed_meshes"] = stats.meshes.stashed_meshes;
+    meshes["stashed_mesh_bytes"] = stats.meshes.stashed_mesh_bytes;
+    meshes["queued_chunks"] = stats.meshes.queued_chunks;
+    meshes["queued_builds"] = stats.meshes.queued_builds;
+    meshes["pending_uploads"] = stats.meshes.pending_uploads;
+    meshes["pending_upload_bytes"] = stats.meshes.pending_upload_bytes;
+    meshes["context_bytes"] = stats.meshes.context_bytes;
+    meshes["vertices"] = stats.meshes.vertices;
+    meshes["triangle_list_vertices"] = stats.meshes.vertices / 4 * 6;
+    meshes["index_buffer_bytes"] = stats.meshes.index_buffer_bytes;
+    meshes["uploaded_vertices"] = stats.meshes.uploaded_vertices;
+    meshes["uploaded_bytes"] = stats.meshes.uploaded_bytes;
+    meshes["triangle_list_uploaded_bytes"] = stats.meshes.uploaded_bytes / 4 * 6;
+    root["meshes"] = meshes;
+
+    mc::json light;
+    light["sections"] = stats.light_sections;
+    light["bytes"] = stats.light_bytes;
+    root["light"] = light;
+
+    mc::json textures;
+    textures["layers"] = stats.texture_layers;
+    textures["bytes"] = stats.texture_bytes;
+    root["textures"] = textures;
+
+    mc::json cache;
+    cache["entries"] = stats.region_cache_entries;
+    cache["bytes"] = stats.region_cache_bytes;
+    root["region_cache"] = cache;
+
+    return root;
+}
+
+bool WriteMemoryStats(const MemoryStats& stats, const std::string& path) {
+    std::ofstream out(path, std::ios::trunc);
+
+    if (!out.is_open()) return false;
+
+    out << MemoryStatsToJson(stats).dump(4) << std::endl;
+
+    return out.good();
+}
+
+} // ns terra
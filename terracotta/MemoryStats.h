@@ -0,0 +1,45 @@
+#ifndef TERRACOTTA_MEMORY_STATS_H_
+#define TERRACOTTA_MEMORY_STATS_H_
+
+#include <mclib/common/Json.h>
+
+#include "World.h"
+#include "render/ChunkMeshGenerator.h"
+
+#include <string>
+
+namespace terra {
+
+class LightEngine;
+class RegionCache;
+
+namespace assets {
+
+class TextureArray;
+
+} // ns assets
+
+// Where the client's memory goes, gathered from the world, the mesh generator, the textures and the region cache.
+struct MemoryStats {
+    WorldMemoryStats world;
+    render::MeshMemoryStats meshes;
+    std::size_t light_sections;
+    std::size_t light_bytes;
+    std::size_t texture_layers;
+    std::size_t texture_bytes;
+    std::size_t region_cache_entries;
+    u64 region_cache_bytes;
+};
+
+// The region cache can be null. Must be called on the main thread.
+MemoryStats CollectMemoryStats(const World& world, render::ChunkMeshGenerator& mesh_gen, const LightEngine& light, const assets::TextureArray& textures, const RegionCache* cache);
+
+// Adds the stats as text to the current ImGui window.
+void RenderMemoryStats(const MemoryStats& stats);
+
+mc::json MemoryStatsToJson(const MemoryStats& stats);
+bool WriteMemoryStats(const MemoryStats& stats, const std::string& path);
+
+} // ns terra
+
+#endif
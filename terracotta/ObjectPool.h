@@ -0,0 +1,231 @@
+#ifndef TERRACOTTA_OBJECT_POOL_H_
+#define TERRACOTTA_OBJECT_POOL_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace terra {
+
+struct PoolStats {
+    // Objects that are currently constructed.
+    std::size_t live;
+    // Slots that can be reused without allocating a new slab.
+    std::size_t free;
+    // The most objects that were ever live at once.
+    std::size_t high_water;
+};
+
+/**
+ * Allocates objects of one type out of fixed size slabs and recycles the slots of released objects.
+ * Slabs are only freed when the pool is destroyed, so the pool must outlive every object taken from it.
+ */
+template <typename T, std::size_t SlabSize = 64>
+class ObjectPool {
+private:
+    // MakeShared stores the shared_ptr control block and the object together in one slot.
+    // The control block is a few pointers and counters in front of the object, so slots leave room for it.
+    struct SharedStorage {
+        void* control[4];
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type object;
+    };
+
+    union Slot {
+        Slot* next;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+        SharedStorage shared;
+    };
+
+    std::mutex m_Mutex;
+    std::vector<std::unique_ptr<Slot[]>> m_Slabs;
+    Slot* m_FreeList;
+    std::size_t m_Live;
+    std::size_t m_Free;
+    std::size_t m_HighWater;
+
+    void* AcquireSlot() {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+
+        if (m_FreeList == nullptr) {
+            std::unique_ptr<Slot[]> slab(new Slot[SlabSize]);
+
+            for (std::size_t i = 0; i < SlabSize; ++i) {
+                slab[i].next = m_FreeList;
+                m_FreeList = &slab[i];
+            }
+
+            m_Slabs.push_back(std::move(slab));
+            m_Free += SlabSize;
+        }
+
+        Slot* slot = m_FreeList;
+        m_FreeList = slot->next;
+
+        --m_Free;
+        ++m_Live;
+        m_HighWater = std::max(m_HighWater, m_Live);
+
+        return slot;
+    }
+
+    void ReleaseSlot(void* memory) {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+
+        Slot* slot = static_cast<Slot*>(memory);
+
+        slot->next = m_FreeList;
+        m_FreeList = slot;
+
+        ++m_Free;
+        --m_Live;
+    }
+
+public:
+    // Allocates the single object allocation of std::allocate_shared from the pool.
+    template <typename U>
+    class Allocator {
+    public:
+        using value_type = U;
+
+        explicit Allocator(ObjectPool* pool) : m_Pool(pool) { }
+
+        template <typename Other>
+        Allocator(const Allocator<Other>& other) : m_Pool(other.m_Pool) { }
+
+        U* allocate(std::size_t count) {
+            static_assert(sizeof(U) <= sizeof(Slot) && alignof(U) <= alignof(Slot), "The shared_ptr control block doesn't fit in a pool slot.");
+
+            if (count != 1) throw std::bad_alloc();
+
+            return static_cast<U*>(m_Pool->AcquireSlot());
+        }
+
+        void deallocate(U* memory, std::size_t) {
+            m_Pool->ReleaseSlot(memory);
+        }
+
+        template <typename Other>
+        bool operator==(const Allocator<Other>& other) const { return m_Pool == other.m_Pool; }
+        template <typename Other>
+        bool operator!=(const Allocator<Other>& other) const { return m_Pool != other.m_Pool; }
+
+    private:
+        ObjectPool* m_Pool;
+
+        template <typename Other>
+        friend class Allocator;
+    };
+
+    ObjectPool() : m_FreeList(nullptr), m_Live(0), m_Free(0), m_HighWater(0) { }
+
+    ObjectPool(const ObjectPool& other) = delete;
+    ObjectPool& operator=(const ObjectPool& other) = delete;
+
+    template <typename... Args>
+    T* Acquire(Args&&... args) {
+        void* memory = AcquireSlot();
+
+        try {
+            return new (memory) T(std::forward<Args>(args)...);
+        } catch (...) {
+            ReleaseSlot(memory);
+            throw;
+        }
+    }
+
+    void Release(T* object) {
+        if (object == nullptr) return;
+
+        object->~T();
+        ReleaseSlot(object);
+    }
+
+    // Creates a shared_ptr that returns the object to this pool when the last reference is dropped.
+    // The object and its reference counts share one slot, so this doesn't allocate unless the pool grows.
+    template <typename... Args>
+    std::shared_ptr<T> MakeShared(Args&&... args) {
+        return std::allocate_shared<T>(Allocator<T>(this), std::forward<Args>(args)...);
+    }
+
+    PoolStats GetStats() {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+
+        return PoolStats{ m_Live, m_Free, m_HighWater };
+    }
+};
+
+/**
+ * Keeps the storage of released vectors so new vectors can reuse it instead of allocating.
+ * Vectors are kept in buckets by power of two capacity and each bucket holds at most MaxPerBucket of them.
+ */
+template <typename T, std::size_t MaxPerBucket = 256>
+class VectorPool {
+private:
+    enum { BucketCount = 32 };
+
+    std::mutex m_Mutex;
+    std::vector<std::vector<T>> m_Buckets[BucketCount];
+
+    static std::size_t GetBucket(std::size_t capacity, bool round_up) {
+        std::size_t bucket = 0;
+
+        while (bucket + 1 < BucketCount && (1ULL << (bucket + 1)) <= capacity) {
+            ++bucket;
+        }
+
+        if (round_up && (1ULL << bucket) < capacity) {
+            ++bucket;
+        }
+
+        return bucket;
+    }
+
+public:
+    VectorPool() = default;
+
+    VectorPool(const VectorPool& other) = delete;
+    VectorPool& operator=(const VectorPool& other) = delete;
+
+    // Gets an empty vector with room for at least capacity elements.
+    std::vector<T> Acquire(std::size_t capacity) {
+        std::size_t bucket = GetBucket(capacity, true);
+        std::vector<T> vector;
+
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            std::vector<std::vector<T>>& free = m_Buckets[bucket];
+
+            if (!free.empty()) {
+                vector = std::move(free.back());
+                free.pop_back();
+                return vector;
+            }
+        }
+
+        vector.reserve(static_cast<std::size_t>(1ULL << bucket));
+        return vector;
+    }
+
+    void Release(std::vector<T>&& vector) {
+        if (vector.capacity() == 0) return;
+
+        vector.clear();
+
+        std::size_t bucket = GetBucket(vector.capacity(), false);
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        std::vector<std::vector<T>>& free = m_Buckets[bucket];
+
+        if (free.size() < MaxPerBucket) {
+            free.push_back(std::move(vector));
+        }
+    }
+};
+
+} // ns terra
+
+#endif
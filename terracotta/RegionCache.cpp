@@ -0,0 +1,501 @@
+#include "RegionCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace terra {
+namespace {
+
+enum { ColumnMagic = 0x43435254 }; // "TRCC"
+enum { FormatVersion = 1 };
+
+struct ColumnHeader {
+    u32 magic;
+    u16 version;
+    // Set bits have a section stored for the chunk.
+    u16 sectionmask;
+    s32 x;
+    s32 z;
+    u8 skylight;
+    u8 reserved[7];
+};
+
+struct SectionHeader {
+    u16 palette_size;
+    u8 bits_per_block;
+    u8 reserved[5];
+};
+
+static_assert(sizeof(ColumnHeader) % 8 == 0, "Column header must keep the sections aligned.");
+static_assert(sizeof(SectionHeader) == 8, "Section header must keep the palette aligned.");
+
+// Maps a whole file read only. Closed files map to nothing.
+class MappedFile {
+public:
+    MappedFile(const std::string& path) : m_Data(nullptr), m_Size(0) {
+#ifdef _WIN32
+        m_File = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        m_Mapping = nullptr;
+
+        if (m_File == INVALID_HANDLE_VALUE) return;
+
+        LARGE_INTEGER size;
+
+        if (!GetFileSizeEx(m_File, &size) || size.QuadPart == 0) return;
+
+        m_Mapping = CreateFileMappingA(m_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (m_Mapping == nullptr) return;
+
+        void* data = MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0);
+        if (data == nullptr) return;
+
+        m_Data = static_cast<const u8*>(data);
+        m_Size = static_cast<std::size_t>(size.QuadPart);
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+
+        if (fd < 0) return;
+
+        struct stat info;
+
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* data = mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+            if (data != MAP_FAILED) {
+                m_Data = static_cast<const u8*>(data);
+                m_Size = static_cast<std::size_t>(info.st_size);
+            }
+        }
+
+        // The mapping stays valid after the descriptor is closed.
+        close(fd);
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (m_Data) UnmapViewOfFile(m_Data);
+        if (m_Mapping) CloseHandle(m_Mapping);
+        if (m_File != INVALID_HANDLE_VALUE) CloseHandle(m_File);
+#else
+        if (m_Data) munmap(const_cast<u8*>(m_Data), m_Size);
+#endif
+    }
+
+    MappedFile(const MappedFile& other) = delete;
+    MappedFile& operator=(const MappedFile& other) = delete;
+
+    const u8* GetData() const { return m_Data; }
+    std::size_t GetSize() const { return m_Size; }
+
+private:
+    const u8* m_Data;
+    std::size_t m_Size;
+#ifdef _WIN32
+    HANDLE m_File;
+    HANDLE m_Mapping;
+#endif
+};
+
+// Renames over an existing file, which rename doesn't do on Windows.
+bool RenameOver(const std::string& from, const std::string& to) {
+#ifdef _WIN32
+    std::remove(to.c_str());
+#endif
+    return std::rename(from.c_str(), to.c_str()) == 0;
+}
+
+std::size_t GetPaletteBytes(std::size_t palette_size) {
+    return ((palette_size * sizeof(u32) + 7) / 8) * 8;
+}
+
+template <typename T>
+void Append(std::vector<u8>& out, const T* data, std::size_t count) {
+    const u8* bytes = reinterpret_cast<const u8*>(data);
+
+    out.insert(out.end(), bytes, bytes + count * sizeof(T));
+}
+
+std::vector<u8> WriteColumn(s32 x, s32 z, bool skylight, const std::array<ChunkPtr, ChunkColumn::ChunksPerColumn>& chunks) {
+    std::vector<u8> out;
+
+    ColumnHeader header = {};
+    header.magic = ColumnMagic;
+    header.version = FormatVersion;
+    header.x = x;
+    header.z = z;
+    header.skylight = skylight ? 1 : 0;
+
+    for (s32 i = 0; i < ChunkColumn::ChunksPerColumn; ++i) {
+        if (chunks[i] != nullptr) {
+            header.sectionmask |= 1 << i;
+        }
+    }
+
+    Append(out, &header, 1);
+
+    for (s32 i = 0; i < ChunkColumn::ChunksPerColumn; ++i) {
+        const ChunkPtr& chunk = chunks[i];
+
+        if (chunk == nullptr) continue;
+
+        SectionHeader section = {};
+        section.palette_size = static_cast<u16>(chunk->GetPaletteSize());
+        section.bits_per_block = chunk->GetBitsPerBlock();
+
+        Append(out, &section, 1);
+
+        std::vector<u32> palette(GetPaletteBytes(section.palette_size) / sizeof(u32), 0);
+
+        for (std::size_t j = 0; j < chunk->GetPaletteSize(); ++j) {
+            palette[j] = chunk->GetPaletteEntry(j)->GetType();
+        }
+
+        Append(out, palette.data(), palette.size());
+
+        const std::vector<u64>& data = chunk->GetPackedData();
+
+        Append(out, data.data(), data.size());
+    }
+
+    return out;
+}
+
+// Builds one chunk out of the mapped section at offset. Returns null if the section isn't valid.
+ChunkPtr ReadChunk(const u8* data, std::size_t size, std::size_t& offset) {
+    if (size - offset < sizeof(SectionHeader)) return nullptr;
+
+    SectionHeader section;
+    std::memcpy(&section, data + offset, sizeof(section));
+    offset += sizeof(section);
+
+    std::size_t palette_size = section.palette_size;
+    u8 bits_per_block = section.bits_per_block;
+
+    if (palette_size == 0 || palette_size > 16 * 16 * 16 || bits_per_block != Chunk::GetRequiredBits(palette_size)) return nullptr;
+
+    std::size_t palette_bytes = GetPaletteBytes(palette_size);
+    std::size_t data_words = 16 * 16 * 16 * bits_per_block / 64;
+
+    if (size - offset < palette_bytes + data_words * sizeof(u64)) return nullptr;
+
+    // Offsets are multiples of 8 from the start of the page aligned mapping.
+    const u32* ids = reinterpret_cast<const u32*>(data + offset);
+    const u64* words = reinterpret_cast<const u64*>(data + offset + palette_bytes);
+
+    offset += palette_bytes + data_words * sizeof(u64);
+
+    std::vector<mc::block::BlockPtr> palette;
+    palette.reserve(palette_size);
+
+    for (std::size_t i = 0; i < palette_size; ++i) {
+        mc::block::BlockPtr block = mc::block::BlockRegistry::GetInstance()->GetBlock(ids[i]);
+
+        if (block == nullptr) return nullptr;
+
+        palette.push_back(block);
+    }
+
+    if (bits_per_block > 0) {
+        const std::size_t indices_per_word = 64 / bits_per_block;
+        const u64 mask = (1ULL << bits_per_block) - 1;
+
+        for (std::size_t word = 0; word < data_words; ++word) {
+            for (std::size_t i = 0; i < indices_per_word; ++i) {
+                if (((words[word] >> (i * bits_per_block)) & mask) >= palette_size) return nullptr;
+            }
+        }
+    }
+
+    return MakeChunk(std::move(palette), bits_per_block, words);
+}
+
+ChunkColumnPtr ReadColumn(const u8* data, std::size_t size) {
+    if (data == nullptr || size < sizeof(ColumnHeader)) return nullptr;
+
+    ColumnHeader header;
+    std::memcpy(&header, data, sizeof(header));
+
+    if (header.magic != ColumnMagic || header.version != FormatVersion) return nullptr;
+
+    mc::world::ChunkColumnMetadata meta;
+    meta.x = header.x;
+    meta.z = header.z;
+    meta.sectionmask = header.sectionmask;
+    meta.continuous = true;
+    meta.skylight = header.skylight != 0;
+
+    ChunkColumnPtr column = GetChunkColumnPool().MakeShared(ChunkColumnMetadata(meta));
+    std::size_t offset = sizeof(header);
+
+    for (s32 i = 0; i < ChunkColumn::ChunksPerColumn; ++i) {
+        if (!(header.sectionmask & (1 << i))) continue;
+
+        ChunkPtr chunk = ReadChunk(data, size, offset);
+
+        if (chunk == nullptr) return nullptr;
+
+        (*column)[i] = chunk;
+    }
+
+    column->BuildHeightmaps();
+
+    return column;
+}
+
+} // ns
+
+RegionCache::RegionCache(const std::string& directory, u64 max_size)
+    : m_Directory(directory),
+      m_MaxSize(max_size),
+      m_Size(0),
+      m_IndexDirty(false),
+      m_Writing(true)
+{
+#ifdef _WIN32
+    _mkdir(directory.c_str());
+#else
+    mkdir(directory.c_str(), 0755);
+#endif
+
+    LoadIndex();
+
+    m_Writer = std::thread(&RegionCache::WriterUpdate, this);
+}
+
+RegionCache::~RegionCache() {
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Writing = false;
+    }
+
+    m_WriteCV.notify_all();
+    m_Writer.join();
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    if (m_IndexDirty) {
+        SaveIndex();
+    }
+}
+
+std::string RegionCache::GetEntryName(const std::string& server, s32 dimension, s32 chunk_x, s32 chunk_z) {
+    std::string name;
+
+    for (char c : server) {
+        bool allowed = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-';
+
+        name += allowed ? c : '_';
+    }
+
+    return name + "." + std::to_string(dimension) + "." + std::to_string(chunk_x) + "." + std::to_string(chunk_z) + ".col";
+}
+
+bool RegionCache::Contains(const std::string& entry) const {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    return m_Entries.find(entry) != m_Entries.end();
+}
+
+ChunkColumnPtr RegionCache::Load(const std::string& entry) {
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+
+        auto iter = m_Entries.find(entry);
+
+        if (iter == m_Entries.end()) return nullptr;
+
+        Touch(iter->second);
+    }
+
+    ChunkColumnPtr column;
+
+    {
+        MappedFile file(GetPath(entry));
+
+        column = ReadColumn(file.GetData(), file.GetSize());
+    }
+
+    if (column == nullptr) {
+        // The file is missing or damaged, so stop offering it.
+        std::lock_guard<std::mutex> lock(m_Mutex);
+
+        auto iter = m_Entries.find(entry);
+
+        if (iter != m_Entries.end()) {
+            m_Size -= iter->second.size;
+            m_RecentEntries.erase(iter->second.recent);
+            m_Entries.erase(iter);
+            m_IndexDirty = true;
+        }
+
+        std::remove(GetPath(entry).c_str());
+    }
+
+    return column;
+}
+
+void RegionCache::Store(const std::string& entry, const ChunkColumn& column) {
+    const ChunkColumnMetadata& meta = column.GetMetadata();
+    PendingWrite write{ entry, meta.x, meta.z, meta.skylight, {} };
+
+    for (s32 i = 0; i < ChunkColumn::ChunksPerColumn; ++i) {
+        write.chunks[i] = column[i];
+
+        if (write.chunks[i] != nullptr) {
+            write.chunks[i]->Publish();
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_PendingWrites.push_back(std::move(write));
+    }
+
+    m_WriteCV.notify_one();
+}
+
+u64 RegionCache::GetSize() const {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Size;
+}
+
+std::size_t RegionCache::GetEntryCount() const {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Entries.size();
+}
+
+void RegionCache::Touch(Entry& entry) {
+    m_RecentEntries.splice(m_RecentEntries.begin(), m_RecentEntries, entry.recent);
+    m_IndexDirty = true;
+}
+
+void RegionCache::Evict() {
+    while (m_Size > m_MaxSize && !m_RecentEntries.empty()) {
+        const std::string& name = m_RecentEntries.back();
+        auto iter = m_Entries.find(name);
+
+        std::remove(GetPath(name).c_str());
+
+        m_Size -= iter->second.size;
+        m_Entries.erase(iter);
+        m_RecentEntries.pop_back();
+        m_IndexDirty = true;
+    }
+}
+
+void RegionCache::LoadIndex() {
+    std::ifstream in(GetPath("index.txt"));
+    std::string name;
+    u64 size;
+
+    // The index lists the entries and their sizes from the most to the least recently used.
+    while (in >> name >> size) {
+        if (m_Entries.find(name) != m_Entries.end()) continue;
+
+        m_RecentEntries.push_back(name);
+        m_Entries.emplace(name, Entry{ size, std::prev(m_RecentEntries.end()) });
+        m_Size += size;
+    }
+
+    // The size limit may have been lowered since the last run.
+    Evict();
+}
+
+void RegionCache::SaveIndex() {
+    std::string path = GetPath("index.txt");
+    std::string temp = path + ".tmp";
+
+    {
+        std::ofstream out(temp, std::ios::trunc);
+
+        for (const std::string& name : m_RecentEntries) {
+            out << name << ' ' << m_Entries[name].size << '\n';
+        }
+
+        if (!out.good()) return;
+    }
+
+    if (RenameOver(temp, path)) {
+        m_IndexDirty = false;
+    }
+}
+
+void RegionCache::WriterUpdate() {
+    while (true) {
+        PendingWrite write;
+
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+
+            m_WriteCV.wait(lock, [this] { return !m_Writing || !m_PendingWrites.empty(); });
+
+            // Everything that was stored before shutting down is still written.
+            if (m_PendingWrites.empty()) return;
+
+            write = std::move(m_PendingWrites.front());
+            m_PendingWrites.pop_front();
+        }
+
+        std::vector<u8> data = WriteColumn(write.x, write.z, write.skylight, write.chunks);
+
+        std::string path = GetPath(write.entry);
+        std::string temp = path + ".tmp";
+        bool written = false;
+
+        {
+            std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+
+            out.write(reinterpret_cast<const char*>(data.data()), data.size());
+            written = out.good();
+        }
+
+        // Columns are written to a temporary file first, so a loader never maps a partially written one.
+        written = written && RenameOver(temp, path);
+
+        if (!written) {
+            std::remove(temp.c_str());
+        }
+
+        std::lock_guard<std::mutex> lock(m_Mutex);
+
+        if (written) {
+            auto iter = m_Entries.find(write.entry);
+
+            if (iter == m_Entries.end()) {
+                m_RecentEntries.push_front(write.entry);
+                m_Entries.emplace(write.entry, Entry{ data.size(), m_RecentEntries.begin() });
+            } else {
+                m_Size -= iter->second.size;
+                iter->second.size = data.size();
+                Touch(iter->second);
+            }
+
+            m_Size += data.size();
+            m_IndexDirty = true;
+
+            Evict();
+        }
+
+        // Save once a burst of writes is done, so the index is rarely out of date if the process doesn't exit cleanly.
+        if (m_PendingWrites.empty() && m_IndexDirty) {
+            SaveIndex();
+        }
+    }
+}
+
+} // ns terra
@@ -0,0 +1,96 @@
+#ifndef TERRACOTTA_REGION_CACHE_H_
+#define TERRACOTTA_REGION_CACHE_H_
+
+#include "Chunk.h"
+
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace terra {
+
+/**
+ * Keeps chunk columns that were received from servers on disk, so they can be shown right away after reconnecting or respawning.
+ * Each column is stored in its own file in the cache directory, named after the server, dimension and chunk coordinates.
+ * The cache is kept under a size limit by deleting the least recently used columns.
+ *
+ * A file is a ColumnHeader followed by a section for every chunk in its section mask. A section is a SectionHeader,
+ * the palette as block ids padded to 8 bytes and the packed indices in the same layout as Chunk uses.
+ * Everything is 8 byte aligned, so files are read by mapping them into memory and building the chunks straight from the mapping.
+ */
+class RegionCache {
+public:
+    RegionCache(const std::string& directory, u64 max_size);
+    ~RegionCache();
+
+    RegionCache(const RegionCache& other) = delete;
+    RegionCache& operator=(const RegionCache& other) = delete;
+
+    // Gets the name that a column is cached under. The server is usually the address and port.
+    static std::string GetEntryName(const std::string& server, s32 dimension, s32 chunk_x, s32 chunk_z);
+
+    bool Contains(const std::string& entry) const;
+
+    // Reads a cached column. Returns null if it isn't cached or the file isn't valid. Can be called from any thread.
+    ChunkColumnPtr Load(const std::string& entry);
+
+    /**
+     * Keeps the chunks of the column and serializes them on the cache's writer thread, so storing doesn't copy any blocks.
+     * The chunks are published, which makes the world copy them before changing them. Block entities aren't cached.
+     */
+    void Store(const std::string& entry, const ChunkColumn& column);
+
+    u64 GetSize() const;
+    std::size_t GetEntryCount() const;
+
+private:
+    struct Entry {
+        u64 size;
+        // Position in m_RecentEntries.
+        std::list<std::string>::iterator recent;
+    };
+
+    struct PendingWrite {
+        std::string entry;
+        s32 x;
+        s32 z;
+        bool skylight;
+        std::array<ChunkPtr, ChunkColumn::ChunksPerColumn> chunks;
+    };
+
+    std::string m_Directory;
+    u64 m_MaxSize;
+
+    mutable std::mutex m_Mutex;
+    std::unordered_map<std::string, Entry> m_Entries;
+    // Most recently used first.
+    std::list<std::string> m_RecentEntries;
+    u64 m_Size;
+    bool m_IndexDirty;
+
+    std::condition_variable m_WriteCV;
+    std::deque<PendingWrite> m_PendingWrites;
+    bool m_Writing;
+    std::thread m_Writer;
+
+    std::string GetPath(const std::string& entry) const { return m_Directory + "/" + entry; }
+
+    // Marks the entry as the most recently used one. m_Mutex must be held.
+    void Touch(Entry& entry);
+    // Deletes the least recently used columns until the cache fits. m_Mutex must be held.
+    void Evict();
+
+    void LoadIndex();
+    void SaveIndex();
+    void WriterUpdate();
+};
+
+} // ns terra
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef TERRACOTTA_SNAPSHOT_MAP_H_
+#define TERRACOTTA_SNAPSHOT_MAP_H_
+
+#include "World.h"
+
+#include <array>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace terra {
+
+/**
+ * An immutable map from column coordinates to values that shares its unchanged parts with the version it was made from.
+ * Columns are grouped into square regions. A new version copies the table of regions and only the regions that have a
+ * changed column, so publishing a few changed columns doesn't copy every loaded one.
+ */
+template <typename T>
+class SnapshotMap {
+public:
+    enum { RegionShift = 3, RegionSize = 1 << RegionShift };
+
+    // A null value erases the column.
+    using Change = std::pair<ChunkCoord, const T*>;
+
+    SnapshotMap() : m_Size(0) { }
+
+    // Applies the changes on top of previous, which can be null for an empty map. Previous isn't modified.
+    SnapshotMap(const SnapshotMap* previous, const std::vector<Change>& changes) : m_Size(0) {
+        std::unordered_map<ChunkCoord, std::shared_ptr<Region>> copies;
+
+        if (previous != nullptr) {
+            m_Regions = previous->m_Regions;
+            m_Size = previous->m_Size;
+        }
+
+        for (const Change& change : changes) {
+            ChunkCoord region_coord(change.first.first >> RegionShift, change.first.second >> RegionShift);
+            auto copy = copies.find(region_coord);
+
+            // Each changed region is copied once and every change to it goes into that copy.
+            if (copy == copies.end()) {
+                auto iter = m_Regions.find(region_coord);
+                std::shared_ptr<Region> region = iter != m_Regions.end() ? std::make_shared<Region>(*iter->second) : std::make_shared<Region>();
+
+                copy = copies.emplace(region_coord, std::move(region)).first;
+            }
+
+            Region& region = *copy->second;
+            std::size_t index = GetIndex(change.first.first, change.first.second);
+
+            m_Size -= region.count;
+            region.Set(index, change.second);
+            m_Size += region.count;
+        }
+
+        for (auto& kv : copies) {
+            if (kv.second->count == 0) {
+                m_Regions.erase(kv.first);
+            } else {
+                m_Regions[kv.first] = std::move(kv.second);
+            }
+        }
+    }
+
+    // Returns null if the column isn't in the map.
+    const T* Find(s32 chunk_x, s32 chunk_z) const {
+        auto iter = m_Regions.find(ChunkCoord(chunk_x >> RegionShift, chunk_z >> RegionShift));
+
+        if (iter == m_Regions.end()) return nullptr;
+
+        const Region& region = *iter->second;
+        std::size_t index = GetIndex(chunk_x, chunk_z);
+
+        return region.present[index] ? &region.Get(index) : nullptr;
+    }
+
+    std::size_t GetSize() const { return m_Size; }
+
+private:
+    // Values are constructed in place only where present is set, so T doesn't need a default constructor.
+    class Region {
+    public:
+        Region() : count(0) { present.fill(false); }
+
+        Region(const Region& other) : present(other.present), count(other.count) {
+            for (std::size_t i = 0; i < present.size(); ++i) {
+                if (present[i]) new (&values[i]) T(other.Get(i));
+            }
+        }
+
+        Region& operator=(const Region& other) = delete;
+
+        ~Region() {
+            for (std::size_t i = 0; i < present.size(); ++i) {
+                if (present[i]) Get(i).~T();
+            }
+        }
+
+        const T& Get(std::size_t index) const { return *reinterpret_cast<const T*>(&values[index]); }
+        T& Get(std::size_t index) { return *reinterpret_cast<T*>(&values[index]); }
+
+        void Set(std::size_t index, const T* value) {
+            if (present[index]) {
+                Get(index).~T();
+                present[index] = false;
+                --count;
+            }
+
+            if (value != nullptr) {
+                new (&values[index]) T(*value);
+                present[index] = true;
+                ++count;
+            }
+        }
+
+        std::array<typename std::aligned_storage<sizeof(T), alignof(T)>::type, RegionSize * RegionSize> values;
+        std::array<bool, RegionSize * RegionSize> present;
+        std::size_t count;
+    };
+
+    static std::size_t GetIndex(s32 chunk_x, s32 chunk_z) {
+        return ((chunk_z & (RegionSize - 1)) << RegionShift) | (chunk_x & (RegionSize - 1));
+    }
+
+    // Regions are shared with the versions before and after this one and are never changed once they are in a map.
+    std::unordered_map<ChunkCoord, std::shared_ptr<const Region>> m_Regions;
+    std::size_t m_Size;
+};
+
+} // ns terra
+
+#endif
@@ -1,10 +1,31 @@
 #include "World.h"
+#include "EpochManager.h"
+#include "RegionCache.h"
+#include "WorldSnapshot.h"
+
+#include <algorithm>
 
 namespace terra {
 
-World::World(mc::protocol::packets::PacketDispatcher* dispatcher)
-    : mc::protocol::packets::PacketHandler(dispatcher)
+World::World(mc::protocol::packets::PacketDispatcher* dispatcher, JobSystem* jobs)
+    : mc::protocol::packets::PacketHandler(dispatcher),
+      m_Jobs(jobs),
+      m_RegionCache(nullptr),
+      m_Dimension(0),
+      m_CacheLoadPending(true),
+      m_DimensionStashLimit(DefaultDimensionStashLimit),
+      m_StashMemory(0),
+      m_StashHits(0),
+      m_StashMisses(0),
+      m_StashEvictions(0),
+      m_Snapshot(nullptr),
+      m_GridMask(0),
+      m_ViewDistance(0),
+      m_CenterX(0),
+      m_CenterZ(0)
 {
+    SetViewDistance(DefaultViewDistance);
+
     dispatcher->RegisterHandler(mc::protocol::State::Play, mc::protocol::play::MultiBlockChange, this);
     dispatcher->RegisterHandler(mc::protocol::State::Play, mc::protocol::play::BlockChange, this);
     dispatcher->RegisterHandler(mc::protocol::State::Play, mc::protocol::play::ChunkData, this);
@@ -12,69 +33,254 @@ World::World(mc::protocol::packets::PacketDispatcher* dispatcher)
     dispatcher->RegisterHandler(mc::protocol::State::Play, mc::protocol::play::Explosion, this);
     dispatcher->RegisterHandler(mc::protocol::State::Play, mc::protocol::play::UpdateBlockEntity, this);
     dispatcher->RegisterHandler(mc::protocol::State::Play, mc::protocol::play::Respawn, this);
+    dispatcher->RegisterHandler(mc::protocol::State::Play, mc::protocol::play::JoinGame, this);
+    dispatcher->RegisterHandler(mc::protocol::State::Play, mc::protocol::play::PlayerPositionAndLook, this);
 }
 
 World::~World() {
+    m_ImportToken.Cancel();
+    m_Jobs->Wait(m_ImportToken);
+
+    for (auto& kv : m_Chunks) {
+        StoreColumn(kv.first, kv.second);
+    }
+
+    delete m_Snapshot.exchange(nullptr);
+    m_Chunks.clear();
+    m_Grid.clear();
+    GetEpochManager().Collect();
+
     GetDispatcher()->UnregisterHandler(this);
 }
 
-bool World::SetBlock(mc::Vector3i position, u32 blockData) {
-    ChunkColumnPtr chunk = GetChunk(position);
-    if (!chunk) return false;
+void World::SetViewDistance(s32 distance) {
+    // Leave a margin of one column because servers can send a ring past the view distance.
+    s32 width = (std::max(distance, 0) + 1) * 2 + 1;
+    s32 size = 1;
+
+    while (size < width + 1) {
+        size *= 2;
+    }
+
+    m_GridMask = size - 1;
+    m_ViewDistance = std::max(distance, 0);
+    RebuildGrid();
+}
+
+void World::SetCenter(const mc::Vector3i& pos) {
+    s32 chunk_x = (s32)(pos.x >> 4);
+    s32 chunk_z = (s32)(pos.z >> 4);
+
+    if (chunk_x == m_CenterX && chunk_z == m_CenterZ) return;
+
+    s32 old_x = m_CenterX;
+    s32 old_z = m_CenterZ;
+    s32 width = (m_GridMask / 2) * 2 + 1;
+
+    m_CenterX = chunk_x;
+    m_CenterZ = chunk_z;
+
+    // Moving across a chunk border only changes the slots along the edges. A jump past the whole window changes all of them.
+    if (std::abs(chunk_x - old_x) >= width || std::abs(chunk_z - old_z) >= width) {
+        RebuildGrid();
+    } else {
+        UpdateGridWindow(old_x, old_z);
+    }
 
-    mc::Vector3i relative(position);
+    UnloadCachedColumns();
+}
 
-    relative.x %= 16;
-    relative.z %= 16;
+void World::UpdateGridWindow(s32 old_x, s32 old_z) {
+    s32 radius = m_GridMask / 2;
+    s32 min_x = m_CenterX - radius;
+    s32 max_x = m_CenterX + radius;
 
-    if (relative.x < 0)
-        relative.x += 16;
-    if (relative.z < 0)
-        relative.z += 16;
+    for (s32 z = m_CenterZ - radius; z <= m_CenterZ + radius; ++z) {
+        if (std::abs(z - old_z) > radius) {
+            // The whole row entered the window.
+            for (s32 x = min_x; x <= max_x; ++x) {
+                FillGridSlot(x, z);
+            }
+            continue;
+        }
 
-    std::size_t index = (std::size_t)position.y / 16;
-    if ((*chunk)[index] == nullptr) {
-        ChunkPtr section = std::make_shared<Chunk>();
+        // Only the sides of the row that weren't in the old window.
+        for (s32 x = min_x; x <= std::min(old_x - radius - 1, max_x); ++x) {
+            FillGridSlot(x, z);
+        }
 
-        (*chunk)[index] = section;
+        for (s32 x = std::max(old_x + radius + 1, min_x); x <= max_x; ++x) {
+            FillGridSlot(x, z);
+        }
     }
+}
+
+void World::FillGridSlot(s32 chunk_x, s32 chunk_z) {
+    auto iter = m_Chunks.find(ChunkCoord(chunk_x, chunk_z));
+
+    // If nothing is loaded at the coordinate, the slot keeps the column that left the window, which still speeds up its lookups.
+    if (iter == m_Chunks.end() || iter->second == nullptr) return;
 
-    relative.y %= 16;
-    (*chunk)[index]->SetBlock(relative, mc::block::BlockRegistry::GetInstance()->GetBlock(blockData));
-    return true;
+    GetGridSlot(chunk_x, chunk_z) = GridSlot{ chunk_x, chunk_z, iter->second };
+}
+
+void World::RebuildGrid() {
+    m_Grid.assign((m_GridMask + 1) * (m_GridMask + 1), GridSlot{ 0, 0, nullptr });
+
+    for (auto& kv : m_Chunks) {
+        if (kv.second == nullptr) continue;
+
+        GridSlot& slot = GetGridSlot(kv.first.first, kv.first.second);
+
+        if (slot.column == nullptr || IsInGridWindow(kv.first.first, kv.first.second)) {
+            slot = GridSlot{ kv.first.first, kv.first.second, kv.second };
+        }
+    }
+}
+
+void World::SetColumn(const ChunkCoord& coord, ChunkColumnPtr column) {
+    m_Chunks[coord] = column;
+    m_ChangedColumns.insert(coord);
+
+    GridSlot& slot = GetGridSlot(coord.first, coord.second);
+
+    if (slot.column != nullptr && slot.x == coord.first && slot.z == coord.second) {
+        slot.column = column;
+    } else if (column != nullptr && (slot.column == nullptr || IsInGridWindow(coord.first, coord.second))) {
+        slot = GridSlot{ coord.first, coord.second, column };
+    }
+}
+
+void World::RemoveColumn(const ChunkCoord& coord) {
+    m_Chunks.erase(coord);
+    m_ChangedColumns.insert(coord);
+
+    GridSlot& slot = GetGridSlot(coord.first, coord.second);
+
+    if (slot.x == coord.first && slot.z == coord.second) {
+        slot.column = nullptr;
+    }
+}
+
+void World::Transaction::SetBlock(const mc::Vector3i& position, mc::block::BlockPtr block) {
+    if (position.y < 0 || position.y >= 16 * ChunkColumn::ChunksPerColumn) return;
+
+    ChunkColumn* column = m_World.GetColumn(position);
+    if (column == nullptr) return;
+
+    mc::Vector3i relative(position.x & 15, position.y, position.z & 15);
+    mc::block::BlockPtr oldBlock = column->GetBlock(relative);
+
+    if (block == nullptr || oldBlock->GetType() == block->GetType()) return;
+
+    column->RemoveBlockEntity(position);
+    column->SetBlock(relative, block);
+    m_World.m_ChangedColumns.insert(ChunkCoord((s32)(position.x >> 4), (s32)(position.z >> 4)));
+
+    m_Changes.push_back(BlockChange{ position, block, oldBlock });
+}
+
+void World::Transaction::Commit() {
+    if (m_Changes.empty()) return;
+
+    auto get_section = [](const BlockChange& change) {
+        return mc::Vector3i(change.position.x >> 4, change.position.y >> 4, change.position.z >> 4);
+    };
+
+    BlockChangeBatch batch;
+
+    std::stable_sort(m_Changes.begin(), m_Changes.end(), [&get_section](const BlockChange& first, const BlockChange& second) {
+        mc::Vector3i a = get_section(first);
+        mc::Vector3i b = get_section(second);
+
+        if (a.x != b.x) return a.x < b.x;
+        if (a.z != b.z) return a.z < b.z;
+        return a.y < b.y;
+    });
+
+    batch.changes = std::move(m_Changes);
+    m_Changes.clear();
+
+    for (std::size_t i = 0; i < batch.changes.size(); ++i) {
+        mc::Vector3i section = get_section(batch.changes[i]);
+
+        if (batch.sections.empty() || !(batch.sections.back().chunk == section)) {
+            batch.sections.push_back(BlockChangeBatch::Section{ section, i, i });
+        }
+
+        batch.sections.back().end = i + 1;
+    }
+
+    m_World.NotifyListeners(&WorldListener::OnBlockChangeBatch, batch);
 }
 
 void World::HandlePacket(mc::protocol::packets::in::ExplosionPacket* packet) {
     mc::Vector3d position = packet->GetPosition();
 
-    for (mc::Vector3s offset : packet->GetAffectedBlocks()) {
-        mc::Vector3d absolute = position + ToVector3d(offset);
+    Defer([this, position, offsets = packet->GetAffectedBlocks()]() {
+        mc::block::BlockPtr air = mc::block::BlockRegistry::GetInstance()->GetBlock(0);
+        Transaction transaction(*this);
 
-        mc::block::BlockPtr oldBlock = GetBlock(mc::ToVector3i(absolute));
+        for (mc::Vector3s offset : offsets) {
+            mc::Vector3d absolute = position + ToVector3d(offset);
 
-        // Set all affected blocks to air
-        SetBlock(ToVector3i(absolute), 0);
+            // Set all affected blocks to air
+            transaction.SetBlock(ToVector3i(absolute), air);
+        }
 
-        mc::block::BlockPtr newBlock = mc::block::BlockRegistry::GetInstance()->GetBlock(0);
-        NotifyListeners(&WorldListener::OnBlockChange, ToVector3i(absolute), newBlock, oldBlock);
-    }
+        transaction.Commit();
+    });
 }
 
 void World::HandlePacket(mc::protocol::packets::in::ChunkDataPacket* packet) {
     mc::world::ChunkColumnPtr lib_column = packet->GetChunkColumn();
-
-    ChunkColumnPtr col = std::make_shared<ChunkColumn>(*lib_column);
-    const ChunkColumnMetadata& meta = col->GetMetadata();
-    ChunkCoord key(meta.x, meta.z);
+    const mc::world::ChunkColumnMetadata& meta = lib_column->GetMetadata();
 
     if (meta.continuous && meta.sectionmask == 0) {
-        m_Chunks[key] = nullptr;
+        ChunkCoord key(meta.x, meta.z);
+
+        Defer([this, key]() {
+            m_CachedColumns.erase(key);
+            SetColumn(key, nullptr);
+        });
         return;
     }
 
+    // mclib keeps modifying its own column on this thread, so the import works on a deep copy.
+    auto source = std::make_shared<mc::world::ChunkColumn>(meta);
+
+    for (s32 i = 0; i < ChunkColumn::ChunksPerColumn; ++i) {
+        if ((*lib_column)[i] != nullptr) {
+            (*source)[i] = std::make_shared<mc::world::Chunk>(*(*lib_column)[i]);
+        }
+    }
+
+    // A cached column that is still being read would be replaced by this one right away, so it's dropped when it finishes.
+    if (meta.continuous) {
+        ChunkCoord key(meta.x, meta.z);
+
+        if (m_Chunks.find(key) == m_Chunks.end()) {
+            m_CachedColumns.erase(key);
+        }
+    }
+
+    auto import = std::make_shared<ColumnImport>();
+    import->source = source;
+
+    m_PendingOperations.push_back(PendingOperation{ import, nullptr });
+
+    SubmitImport(import);
+}
+
+void World::CommitColumn(const ChunkColumnPtr& col) {
+    const ChunkColumnMetadata& meta = col->GetMetadata();
+    ChunkCoord key(meta.x, meta.z);
+
     auto iter = m_Chunks.find(key);
 
     if (!meta.continuous) {
+        if (iter == m_Chunks.end() || iter->second == nullptr) return;
+
         // This isn't an entire column of chunks, so just update the existing chunk column with the provided chunks.
         for (s16 i = 0; i < ChunkColumn::ChunksPerColumn; ++i) {
             // The section mask says whether or not there is data in this chunk.
@@ -82,9 +288,14 @@ void World::HandlePacket(mc::protocol::packets::in::ChunkDataPacket* packet) {
                 (*iter->second)[i] = (*col)[i];
             }
         }
+
+        iter->second->BuildHeightmaps();
+        m_ChangedColumns.insert(key);
     } else {
         // This is an entire column of chunks, so just replace the entire column with the new one.
-        m_Chunks[key] = col;
+        // It also replaces the cached version of the column if there is one.
+        m_CachedColumns.erase(key);
+        SetColumn(key, col);
     }
 
 
@@ -97,126 +308,480 @@ void World::HandlePacket(mc::protocol::packets::in::ChunkDataPacket* packet) {
 
 void World::HandlePacket(mc::protocol::packets::in::MultiBlockChangePacket* packet) {
     mc::Vector3i chunkStart(packet->GetChunkX() * 16, 0, packet->GetChunkZ() * 16);
-    auto iter = m_Chunks.find(ChunkCoord(packet->GetChunkX(), packet->GetChunkZ()));
-    if (iter == m_Chunks.end()) 
-        return;
 
-    ChunkColumnPtr chunk = iter->second;
-    if (!chunk)
-        return;
+    Defer([this, chunkStart, changes = packet->GetBlockChanges()]() {
+        Transaction transaction(*this);
 
-    const auto& changes = packet->GetBlockChanges();
-    for (const auto& change : changes) {
-        mc::Vector3i relative(change.x, change.y, change.z);
+        for (const auto& change : changes) {
+            mc::Vector3i relative(change.x, change.y, change.z);
+            mc::block::BlockPtr newBlock = mc::block::BlockRegistry::GetInstance()->GetBlock(change.blockData);
 
-        std::size_t index = change.y / 16;
-        mc::block::BlockPtr oldBlock = mc::block::BlockRegistry::GetInstance()->GetBlock(0);
-        if ((*chunk)[index] == nullptr) {
-            ChunkPtr section = std::make_shared<Chunk>();
-
-            (*chunk)[index] = section;
-        } else {
-            oldBlock = chunk->GetBlock(relative);
+            transaction.SetBlock(chunkStart + relative, newBlock);
         }
 
-        mc::block::BlockPtr newBlock = mc::block::BlockRegistry::GetInstance()->GetBlock(change.blockData);
-
-        mc::Vector3i blockChangePos = chunkStart + relative;
-
-        relative.y %= 16;
-        if (newBlock->GetType() != oldBlock->GetType()) {
-            chunk->RemoveBlockEntity(chunkStart + relative);
-            (*chunk)[index]->SetBlock(relative, newBlock);
-            NotifyListeners(&WorldListener::OnBlockChange, blockChangePos, newBlock, oldBlock);
-        }
-    }
+        transaction.Commit();
+    });
 }
 
 void World::HandlePacket(mc::protocol::packets::in::BlockChangePacket* packet) {
     mc::block::BlockPtr newBlock = mc::block::BlockRegistry::GetInstance()->GetBlock((u16)packet->GetBlockId());
-    auto pos = packet->GetPosition();
-    mc::block::BlockPtr oldBlock = GetBlock(pos);
 
-    SetBlock(packet->GetPosition(), packet->GetBlockId());
+    SetBlock(packet->GetPosition(), newBlock);
+}
 
-    NotifyListeners(&WorldListener::OnBlockChange, packet->GetPosition(), newBlock, oldBlock);
+void World::SetBlock(const mc::Vector3i& position, mc::block::BlockPtr block) {
+    Defer([this, position, block]() {
+        Transaction transaction(*this);
 
-    ChunkColumnPtr col = GetChunk(pos);
-    if (col) {
-        col->RemoveBlockEntity(packet->GetPosition());
-    }
+        transaction.SetBlock(position, block);
+        transaction.Commit();
+    });
 }
 
 void World::HandlePacket(mc::protocol::packets::in::UpdateBlockEntityPacket* packet) {
     mc::Vector3i pos = packet->GetPosition();
+    mc::block::BlockEntityPtr entity = packet->GetBlockEntity();
 
-    ChunkColumnPtr col = GetChunk(pos);
+    Defer([this, pos, entity]() {
+        ChunkColumn* col = GetColumn(pos);
 
-    if (!col) return;
+        if (!col) return;
 
-    col->RemoveBlockEntity(pos);
+        col->RemoveBlockEntity(pos);
 
-    mc::block::BlockEntityPtr entity = packet->GetBlockEntity();
-    if (entity)
-        col->AddBlockEntity(entity);
+        if (entity)
+            col->AddBlockEntity(entity);
+    });
 }
 
 void World::HandlePacket(mc::protocol::packets::in::UnloadChunkPacket* packet) {
     ChunkCoord coord(packet->GetChunkX(), packet->GetChunkZ());
 
-    auto iter = m_Chunks.find(coord);
+    Defer([this, coord]() {
+        auto iter = m_Chunks.find(coord);
 
-    if (iter == m_Chunks.end()) 
-        return;
+        if (iter == m_Chunks.end())
+            return;
 
-    ChunkColumnPtr chunk = iter->second;
-    NotifyListeners(&WorldListener::OnChunkUnload, chunk);
+        ChunkColumnPtr chunk = iter->second;
+        NotifyListeners(&WorldListener::OnChunkUnload, chunk);
 
-    m_Chunks.erase(iter);
+        StoreColumn(coord, chunk);
+        m_CachedColumns.erase(coord);
+        RemoveColumn(coord);
+    });
 }
 
 // Clear all chunks because the server will resend the chunks after this.
 void World::HandlePacket(mc::protocol::packets::in::RespawnPacket* packet) {
-    for (auto entry : m_Chunks) {
-        ChunkColumnPtr chunk = entry.second;
+    // Anything that is still waiting to be committed belongs to the old dimension.
+    m_PendingOperations.clear();
+    m_CacheImports.clear();
 
-        NotifyListeners(&WorldListener::OnChunkUnload, chunk);
+    // Imports that already started are waited on here, because the destructor only waits on the current token.
+    m_ImportToken.Cancel();
+    m_Jobs->Wait(m_ImportToken);
+    m_ImportToken = JobToken();
+
+    for (auto& entry : m_Chunks) {
+        StoreColumn(entry.first, entry.second);
+    }
+
+    StashDimension();
+
+    m_Dimension = packet->GetDimension();
+    m_CacheLoadPending = true;
+
+    RestoreDimension();
+    EvictDimensions();
+}
+
+void World::StashDimension() {
+    std::vector<ChunkColumnPtr> columns;
+    std::size_t memory = 0;
+
+    for (auto& entry : m_Chunks) {
+        m_ChangedColumns.insert(entry.first);
+
+        if (entry.second == nullptr) continue;
+
+        columns.push_back(entry.second);
+        memory += entry.second->GetMemoryUsage();
+    }
+
+    NotifyListeners(&WorldListener::OnDimensionStash, m_Dimension, columns);
+
+    if (m_DimensionStashLimit > 0) {
+        m_StashedDimensions.push_front(DimensionStash{ m_Dimension, std::move(m_Chunks), memory });
+        m_StashMemory += memory;
+    } else {
+        // Listeners still see the dimension being left, so they can drop their work for it along with its data.
+        NotifyListeners(&WorldListener::OnDimensionEvict, m_Dimension);
     }
 
     m_Chunks.clear();
+    m_CachedColumns.clear();
+    RebuildGrid();
 }
 
-ChunkColumnPtr World::GetChunk(const mc::Vector3i& pos) const {
-    s32 chunk_x = (s32)std::floor(pos.x / 16.0);
-    s32 chunk_z = (s32)std::floor(pos.z / 16.0);
+void World::RestoreDimension() {
+    auto iter = std::find_if(m_StashedDimensions.begin(), m_StashedDimensions.end(), [this](const DimensionStash& stash) {
+        return stash.dimension == m_Dimension;
+    });
 
-    ChunkCoord key(chunk_x, chunk_z);
+    if (iter == m_StashedDimensions.end()) {
+        ++m_StashMisses;
+        return;
+    }
 
-    auto iter = m_Chunks.find(key);
+    ++m_StashHits;
+
+    DimensionStash stash = std::move(*iter);
+
+    m_StashedDimensions.erase(iter);
+    m_StashMemory -= stash.memory;
+
+    std::vector<ChunkColumnPtr> columns;
+
+    // The server resends the columns that are in view, so the restored ones are treated like cached columns until then.
+    for (auto& entry : stash.columns) {
+        m_CachedColumns.insert(entry.first);
+        m_ChangedColumns.insert(entry.first);
+
+        if (entry.second != nullptr) {
+            columns.push_back(entry.second);
+        }
+    }
+
+    m_Chunks = std::move(stash.columns);
+    RebuildGrid();
+
+    NotifyListeners(&WorldListener::OnDimensionRestore, m_Dimension, columns);
+}
+
+void World::EvictDimensions() {
+    while (m_StashMemory > m_DimensionStashLimit && !m_StashedDimensions.empty()) {
+        DimensionStash& stash = m_StashedDimensions.back();
+
+        NotifyListeners(&WorldListener::OnDimensionEvict, stash.dimension);
+
+        m_StashMemory -= stash.memory;
+        ++m_StashEvictions;
+        m_StashedDimensions.pop_back();
+    }
+}
+
+void World::SetDimensionStashLimit(std::size_t limit) {
+    m_DimensionStashLimit = limit;
+    EvictDimensions();
+}
+
+WorldMemoryStats World::GetMemoryStats() const {
+    WorldMemoryStats stats = {};
+
+    for (const auto& kv : m_Chunks) {
+        if (kv.second == nullptr) continue;
+
+        ++stats.columns;
+        stats.sections += kv.second->GetChunkCount();
+        stats.uniform_sections += kv.second->GetUniformChunkCount();
+        stats.column_bytes += kv.second->GetMemoryUsage();
+    }
+
+    for (const PendingOperation& operation : m_PendingOperations) {
+        if (operation.import) {
+            ++stats.pending_imports;
+        }
+    }
+
+    stats.pending_imports += m_CacheImports.size();
+
+    stats.cached_columns = m_CachedColumns.size();
+    stats.stashed_bytes = m_StashMemory;
+    stats.retired = GetEpochManager().GetRetiredCount();
+    stats.chunk_pool = GetChunkPool().GetStats();
+    stats.column_pool = GetChunkColumnPool().GetStats();
+
+    return stats;
+}
+
+DimensionStashStats World::GetDimensionStashStats() const {
+    return DimensionStashStats{ m_StashedDimensions.size(), m_StashMemory, m_StashHits, m_StashMisses, m_StashEvictions };
+}
+
+void World::HandlePacket(mc::protocol::packets::in::JoinGamePacket* packet) {
+    m_Dimension = packet->GetDimension();
+    m_CacheLoadPending = true;
+}
+
+void World::HandlePacket(mc::protocol::packets::in::PlayerPositionAndLookPacket* packet) {
+    if (!m_CacheLoadPending || m_RegionCache == nullptr) return;
+
+    m_CacheLoadPending = false;
+
+    // The first position after joining or respawning is absolute.
+    mc::Vector3i position = ToVector3i(packet->GetPosition());
+
+    LoadCachedColumns((s32)(position.x >> 4), (s32)(position.z >> 4));
+}
+
+void World::SetRegionCache(RegionCache* cache, const std::string& server) {
+    m_RegionCache = cache;
+    m_CacheServer = server;
+}
+
+void World::LoadCachedColumns(s32 chunk_x, s32 chunk_z) {
+    std::vector<std::pair<ChunkCoord, std::string>> entries;
+
+    for (s32 z = chunk_z - m_ViewDistance; z <= chunk_z + m_ViewDistance; ++z) {
+        for (s32 x = chunk_x - m_ViewDistance; x <= chunk_x + m_ViewDistance; ++x) {
+            ChunkCoord coord(x, z);
+
+            if (m_Chunks.find(coord) != m_Chunks.end() || m_CachedColumns.find(coord) != m_CachedColumns.end()) continue;
+
+            std::string entry = RegionCache::GetEntryName(m_CacheServer, m_Dimension, x, z);
+
+            if (m_RegionCache->Contains(entry)) {
+                entries.emplace_back(coord, std::move(entry));
+            }
+        }
+    }
+
+    std::sort(entries.begin(), entries.end(), [chunk_x, chunk_z](const std::pair<ChunkCoord, std::string>& first, const std::pair<ChunkCoord, std::string>& second) {
+        s32 first_x = first.first.first - chunk_x;
+        s32 first_z = first.first.second - chunk_z;
+        s32 second_x = second.first.first - chunk_x;
+        s32 second_z = second.first.second - chunk_z;
+
+        return first_x * first_x + first_z * first_z < second_x * second_x + second_z * second_z;
+    });
+
+    if (entries.empty()) return;
+
+    for (auto& entry : entries) {
+        auto import = std::make_shared<ColumnImport>();
+
+        import->cache_entry = std::move(entry.second);
+        import->coord = entry.first;
+
+        m_CachedColumns.insert(entry.first);
+        m_CacheImports.push_back(import);
+        SubmitImport(import);
+    }
+}
+
+void World::UnloadCachedColumns() {
+    for (auto iter = m_CachedColumns.begin(); iter != m_CachedColumns.end();) {
+        if (IsInGridWindow(iter->first, iter->second)) {
+            ++iter;
+            continue;
+        }
+
+        // Columns that are still loading are dropped when they are committed.
+        auto column = m_Chunks.find(*iter);
+
+        if (column != m_Chunks.end()) {
+            NotifyListeners(&WorldListener::OnChunkUnload, column->second);
+            RemoveColumn(*iter);
+        }
+
+        iter = m_CachedColumns.erase(iter);
+    }
+}
+
+void World::StoreColumn(const ChunkCoord& coord, const ChunkColumnPtr& column) {
+    if (m_RegionCache == nullptr || column == nullptr) return;
+    // The cache already has the latest version of columns that the server never sent.
+    if (m_CachedColumns.find(coord) != m_CachedColumns.end()) return;
+
+    m_RegionCache->Store(RegionCache::GetEntryName(m_CacheServer, m_Dimension, coord.first, coord.second), *column);
+}
+
+void World::CommitCachedColumn(const ChunkCoord& coord, const ChunkColumnPtr& col) {
+    auto iter = m_CachedColumns.find(coord);
+
+    // The server sent the column or it went out of view while it was loading.
+    if (iter == m_CachedColumns.end()) return;
+
+    if (col == nullptr || m_Chunks.find(coord) != m_Chunks.end()) {
+        m_CachedColumns.erase(iter);
+        return;
+    }
+
+    SetColumn(coord, col);
+
+    const ChunkColumnMetadata& meta = col->GetMetadata();
+
+    for (s32 i = 0; i < ChunkColumn::ChunksPerColumn; ++i) {
+        NotifyListeners(&WorldListener::OnChunkLoad, (*col)[i], meta, i);
+    }
+}
+
+void World::Defer(std::function<void()> operation) {
+    if (m_PendingOperations.empty()) {
+        operation();
+        return;
+    }
 
-    if (iter == m_Chunks.end()) return nullptr;
+    m_PendingOperations.push_back(PendingOperation{ nullptr, std::move(operation) });
+}
+
+void World::ProcessImports(std::chrono::steady_clock::duration budget) {
+    auto start = std::chrono::steady_clock::now();
+
+    for (auto iter = m_CacheImports.begin(); iter != m_CacheImports.end();) {
+        if (std::chrono::steady_clock::now() - start >= budget) return;
+
+        if (!(*iter)->done.load(std::memory_order_acquire)) {
+            ++iter;
+            continue;
+        }
+
+        std::shared_ptr<ColumnImport> import = std::move(*iter);
+
+        iter = m_CacheImports.erase(iter);
+        CommitCachedColumn(import->coord, import->result);
+    }
+
+    while (!m_PendingOperations.empty()) {
+        PendingOperation& operation = m_PendingOperations.front();
+
+        if (operation.import) {
+            if (!operation.import->done.load(std::memory_order_acquire)) break;
+
+            std::shared_ptr<ColumnImport> import = std::move(operation.import);
+
+            m_PendingOperations.pop_front();
+
+            CommitColumn(import->result);
+        } else {
+            std::function<void()> apply = std::move(operation.apply);
+
+            m_PendingOperations.pop_front();
+            apply();
+        }
+
+        if (std::chrono::steady_clock::now() - start >= budget) break;
+    }
+}
+
+void World::PublishSnapshot() {
+    const WorldSnapshot* current = m_Snapshot.load(std::memory_order_acquire);
 
-    return iter->second;
+    if (current == nullptr || !m_ChangedColumns.empty()) {
+        // Only the changed columns are captured. The rest of the new snapshot is shared with the current one.
+        const WorldSnapshot* previous = m_Snapshot.exchange(new WorldSnapshot(current, m_Chunks, m_ChangedColumns), std::memory_order_acq_rel);
+
+        if (previous != nullptr) {
+            GetEpochManager().Retire([previous]() {
+                delete previous;
+            });
+        }
+
+        m_ChangedColumns.clear();
+    }
+
+    GetEpochManager().Collect();
+}
+
+void World::SubmitImport(std::shared_ptr<ColumnImport> import) {
+    // Imports hold up every operation queued behind them, so they go ahead of the mesh builds.
+    m_Jobs->Submit([this, import] {
+        RunImport(*import);
+    }, JobPriority::High, m_ImportToken);
+}
+
+void World::RunImport(ColumnImport& import) {
+    if (import.cache_entry.empty()) {
+        import.result = GetChunkColumnPool().MakeShared(*import.source);
+        import.source = nullptr;
+    } else {
+        import.result = m_RegionCache->Load(import.cache_entry);
+    }
+    import.done.store(true, std::memory_order_release);
+}
+
+ChunkColumnPtr World::GetChunk(const mc::Vector3i& pos) const {
+    const ChunkColumnPtr* column = FindColumn((s32)(pos.x >> 4), (s32)(pos.z >> 4));
+
+    if (column == nullptr) return nullptr;
+
+    return *column;
 }
 
 mc::block::BlockPtr World::GetBlock(const mc::Vector3i& pos) const {
-    ChunkColumnPtr col = GetChunk(pos);
+    ChunkColumn* col = GetColumn(pos);
 
     if (!col) return mc::block::BlockRegistry::GetInstance()->GetBlock(0);
 
-    s64 chunk_x = pos.x % 16;
-    s64 chunk_z = pos.z % 16;
+    return col->GetBlock(mc::Vector3i(pos.x & 15, pos.y, pos.z & 15));
+}
 
-    if (chunk_x < 0)
-        chunk_x += 16;
-    if (chunk_z < 0)
-        chunk_z += 16;
+std::size_t World::GetChunkCount() const {
+    std::size_t count = 0;
 
-    return col->GetBlock(mc::Vector3i(chunk_x, pos.y, chunk_z));
+    for (auto iter = m_Chunks.begin(); iter != m_Chunks.end(); ++iter) {
+        if (iter->second == nullptr) continue;
+        count += iter->second->GetChunkCount();
+    }
+
+    return count;
+}
+
+std::size_t World::GetUniformChunkCount() const {
+    std::size_t count = 0;
+
+    for (auto iter = m_Chunks.begin(); iter != m_Chunks.end(); ++iter) {
+        if (iter->second == nullptr) continue;
+        count += iter->second->GetUniformChunkCount();
+    }
+
+    return count;
+}
+
+bool World::IsSolid(const mc::Vector3i& pos) const {
+    ChunkColumn* col = GetColumn(pos);
+
+    if (!col) return false;
+
+    return col->IsSolid(mc::Vector3i(pos.x & 15, pos.y, pos.z & 15));
+}
+
+void World::CollectSolidBoxes(const mc::AABB& bounds, std::vector<mc::AABB>& boxes) const {
+    mc::Vector3i min = GetBlockMin(bounds);
+
+    min.y -= 1;
+
+    ForEachChunkInRange(min, GetBlockMax(bounds),
+        [&bounds, &boxes](const Chunk& chunk, const mc::Vector3i& base, const mc::Vector3i& chunk_min, const mc::Vector3i& chunk_max) {
+            chunk.ForEachSolidBlockInRange(chunk_min, chunk_max, [&](const mc::Vector3i& position, mc::block::BlockPtr block) {
+                mc::AABB box = block->GetBoundingBox(base + position);
+
+                if (box.Intersects(bounds)) {
+                    boxes.push_back(box);
+                }
+            });
+        });
+}
+
+s32 World::GetHighestSolidBlock(s32 x, s32 z) const {
+    ChunkColumn* col = GetColumn(x >> 4, z >> 4);
+
+    if (!col) return -1;
+
+    return col->GetHighestSolidBlock(x & 15, z & 15);
+}
+
+s32 World::GetHighestOpaqueBlock(s32 x, s32 z) const {
+    ChunkColumn* col = GetColumn(x >> 4, z >> 4);
+
+    if (!col) return -1;
+
+    return col->GetHighestOpaqueBlock(x & 15, z & 15);
 }
 
 mc::block::BlockEntityPtr World::GetBlockEntity(mc::Vector3i pos) const {
-    ChunkColumnPtr col = GetChunk(pos);
+    ChunkColumn* col = GetColumn(pos);
 
     if (!col) return nullptr;
 
@@ -225,14 +790,19 @@ mc::block::BlockEntityPtr World::GetBlockEntity(mc::Vector3i pos) const {
 
 std::vector<mc::block::BlockEntityPtr> World::GetBlockEntities() const {
     std::vector<mc::block::BlockEntityPtr> blockEntities;
+    std::size_t count = 0;
 
     for (auto iter = m_Chunks.begin(); iter != m_Chunks.end(); ++iter) {
         if (iter->second == nullptr) continue;
-        std::vector<mc::block::BlockEntityPtr> chunkBlockEntities = iter->second->GetBlockEntities();
-        if (chunkBlockEntities.empty()) continue;
-        blockEntities.insert(blockEntities.end(), chunkBlockEntities.begin(), chunkBlockEntities.end());
+        count += iter->second->GetBlockEntityCount();
     }
 
+    blockEntities.reserve(count);
+
+    ForEachBlockEntity([&blockEntities](const mc::block::BlockEntityPtr& entity) {
+        blockEntities.push_back(entity);
+    });
+
     return blockEntities;
 }
 
@@ -3,11 +3,22 @@
 
 #include <mclib/protocol/packets/PacketHandler.h>
 #include <mclib/protocol/packets/PacketDispatcher.h>
+#include <mclib/common/AABB.h>
 #include <mclib/util/ObserverSubject.h>
 
 #include "Chunk.h"
+#include "JobSystem.h"
 
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace terra {
 
@@ -26,21 +37,112 @@ template <> struct hash<terra::ChunkCoord> {
         return seed;
     }
 };
+
+template <> struct hash<mc::Vector3i> {
+    std::size_t operator()(const mc::Vector3i& s) const noexcept {
+        std::size_t seed = 3;
+        for (int i = 0; i < 3; ++i) {
+            seed ^= s[i] + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+        }
+        return seed;
+    }
+};
 } // ns std
 
 namespace terra {
 
+class RegionCache;
+class WorldSnapshot;
+
+struct BlockChange {
+    mc::Vector3i position;
+    mc::block::BlockPtr newBlock;
+    mc::block::BlockPtr oldBlock;
+};
+
+// All of the block changes from one packet.
+struct BlockChangeBatch {
+    // A chunk section and the range of changes inside of it.
+    struct Section {
+        // Chunk coordinates of the section, y is the section index in the column.
+        mc::Vector3i chunk;
+        std::size_t begin;
+        std::size_t end;
+    };
+
+    // Changes are ordered so the changes of each section are contiguous, keeping the packet order inside of a section.
+    std::vector<BlockChange> changes;
+    std::vector<Section> sections;
+};
+
 class WorldListener {
 public:
     // yIndex is the chunk section index of the column, 0 means bottom chunk, 15 means top
     virtual void OnChunkLoad(ChunkPtr chunk, const ChunkColumnMetadata& meta, u16 yIndex) { }
     virtual void OnChunkUnload(ChunkColumnPtr chunk) { }
     virtual void OnBlockChange(mc::Vector3i position, mc::block::BlockPtr newBlock, mc::block::BlockPtr oldBlock) { }
+    // Called once for every packet that changes blocks. Forwards each change to OnBlockChange unless it's overridden.
+    virtual void OnBlockChangeBatch(const BlockChangeBatch& batch) {
+        for (const BlockChange& change : batch.changes) {
+            OnBlockChange(change.position, change.newBlock, change.oldBlock);
+        }
+    }
+
+    /**
+     * Called on respawn with the loaded columns of the dimension that is left, before they are moved into the dimension stash.
+     * Listeners can keep their own data for the dimension until it's restored or evicted. It's evicted right away if the
+     * stash is disabled. Unloads every column unless it's overridden.
+     */
+    virtual void OnDimensionStash(s32 dimension, const std::vector<ChunkColumnPtr>& columns) {
+        for (const ChunkColumnPtr& column : columns) {
+            OnChunkUnload(column);
+        }
+    }
+
+    // Called when a stashed dimension is entered again and its columns are loaded back. Loads every chunk unless it's overridden.
+    virtual void OnDimensionRestore(s32 dimension, const std::vector<ChunkColumnPtr>& columns) {
+        for (const ChunkColumnPtr& column : columns) {
+            for (u16 i = 0; i < ChunkColumn::ChunksPerColumn; ++i) {
+                OnChunkLoad((*column)[i], column->GetMetadata(), i);
+            }
+        }
+    }
+
+    // Called when a stashed dimension is dropped to stay under the stash memory limit.
+    virtual void OnDimensionEvict(s32 dimension) { }
+};
+
+struct DimensionStashStats {
+    std::size_t dimensions;
+    std::size_t memory;
+    u64 hits;
+    u64 misses;
+    u64 evictions;
+};
+
+struct WorldMemoryStats {
+    std::size_t columns;
+    std::size_t sections;
+    std::size_t uniform_sections;
+    // Bytes used by the loaded columns, their chunks and block entity lists.
+    std::size_t column_bytes;
+    // Loaded columns that came from the region cache or the dimension stash and weren't sent by the server yet.
+    std::size_t cached_columns;
+    std::size_t pending_imports;
+    std::size_t stashed_bytes;
+    // Data that snapshot readers could still be using.
+    std::size_t retired;
+    PoolStats chunk_pool;
+    PoolStats column_pool;
 };
 
 class World : public mc::protocol::packets::PacketHandler, public mc::util::ObserverSubject<WorldListener> {
 public:
-    World(mc::protocol::packets::PacketDispatcher* dispatcher);
+    enum { DefaultViewDistance = 16 };
+    enum { DefaultDimensionStashLimit = 256 * 1024 * 1024 };
+
+    // Columns are imported by jobs on the job system, which must outlive the world.
+    World(mc::protocol::packets::PacketDispatcher* dispatcher, JobSystem* jobs);
     ~World();
 
     World(const World& rhs) = delete;
@@ -55,25 +157,320 @@ public:
     void HandlePacket(mc::protocol::packets::in::ExplosionPacket* packet);
     void HandlePacket(mc::protocol::packets::in::UpdateBlockEntityPacket* packet);
     void HandlePacket(mc::protocol::packets::in::RespawnPacket* packet);
+    void HandlePacket(mc::protocol::packets::in::JoinGamePacket* packet);
+    void HandlePacket(mc::protocol::packets::in::PlayerPositionAndLookPacket* packet);
+
+    /**
+     * Columns are stored in the cache when they are unloaded, on respawn and when the world is destroyed.
+     * After joining or respawning, the cached columns around the first position are loaded until the server sends them,
+     * and cached columns that the server never sent are unloaded once they are outside of the view distance.
+     * Must be set before any packets arrive and the cache must outlive the world. Null disables caching.
+     */
+    void SetRegionCache(RegionCache* cache, const std::string& server);
+
+    /**
+     * The columns of a dimension are kept in memory after respawning into another one, and they are loaded back
+     * if that dimension is entered again, until the server resends them. The least recently left dimensions are
+     * dropped once the stashed columns use more than limit bytes. A limit of 0 disables the stash.
+     */
+    void SetDimensionStashLimit(std::size_t limit);
+    DimensionStashStats GetDimensionStashStats() const;
+
+    // Walks every loaded column, so it's meant for debug output. Must be called on the main thread.
+    WorldMemoryStats GetMemoryStats() const;
+
+    /**
+     * Chunk columns are converted on worker threads. This commits the finished ones to the world in packet order,
+     * along with any world packets that arrived after them, and sends OnChunkLoad as each column is committed.
+     * Columns read from the region cache are committed first, in whatever order they finish.
+     * Stops after the budget is used up or when the next column isn't converted yet. Must be called on the main thread.
+     */
+    void ProcessImports(std::chrono::steady_clock::duration budget);
+
+    // Adds a converted column to the world like a column from the server and sends OnChunkLoad for its chunks.
+    // Must be called on the main thread.
+    void CommitColumn(const ChunkColumnPtr& col);
+
+    // Publishes a new snapshot if the world changed since the last one and reclaims data that readers no longer use.
+    // Must be called on the main thread, usually once per frame.
+    void PublishSnapshot();
+
+    /**
+     * Gets the latest published snapshot, which can be null before the first one. Can be called from any thread,
+     * but only while holding an EpochManager::ReadGuard from GetEpochManager(). The snapshot is valid until the guard is released.
+     */
+    const WorldSnapshot* GetSnapshot() const { return m_Snapshot.load(std::memory_order_acquire); }
 
     /**
      * Pos can be any world position inside of the chunk
      */
     ChunkColumnPtr GetChunk(const mc::Vector3i& pos) const;
 
+    /**
+     * Columns within the view distance of the center are looked up through a grid that wraps around on chunk coordinates.
+     * Columns outside of it are still found through the hash map, so these only affect lookup speed.
+     */
+    void SetViewDistance(s32 distance);
+    // Pos can be any world position, usually the player's.
+    void SetCenter(const mc::Vector3i& pos);
+
     mc::block::BlockPtr GetBlock(const mc::Vector3i& pos) const;
+    // Changes one block the same way as a block change packet, after anything that is waiting to be committed.
+    // Must be called on the main thread.
+    void SetBlock(const mc::Vector3i& position, mc::block::BlockPtr block);
+    // Tests the chunk's solid mask instead of looking up the block. Unloaded positions are not solid.
+    bool IsSolid(const mc::Vector3i& pos) const;
+
+    // Gets the y of the highest solid or opaque block at the world x, z. Returns -1 if there is none or the column isn't loaded.
+    s32 GetHighestSolidBlock(s32 x, s32 z) const;
+    s32 GetHighestOpaqueBlock(s32 x, s32 z) const;
 
     mc::block::BlockEntityPtr GetBlockEntity(mc::Vector3i pos) const;
     // Gets all of the known block entities in loaded chunks
     std::vector<mc::block::BlockEntityPtr> GetBlockEntities() const;
 
+    // Calls callback(const mc::block::BlockEntityPtr&) for every block entity in loaded chunks without copying them.
+    template <typename Callback>
+    void ForEachBlockEntity(Callback&& callback) const {
+        for (auto iter = m_Chunks.begin(); iter != m_Chunks.end(); ++iter) {
+            if (iter->second == nullptr) continue;
+            iter->second->ForEachBlockEntity(callback);
+        }
+    }
+
+    // Calls callback(const mc::block::BlockEntityPtr&) for every block entity whose block position is inside of bounds.
+    // Only the columns that overlap the bounds are visited.
+    template <typename Callback>
+    void ForEachBlockEntityInAABB(const mc::AABB& bounds, Callback&& callback) const {
+        mc::Vector3i min = GetBlockMin(bounds);
+        mc::Vector3i max = GetBlockMax(bounds);
+
+        for (s64 chunk_z = min.z >> 4; chunk_z <= max.z >> 4; ++chunk_z) {
+            for (s64 chunk_x = min.x >> 4; chunk_x <= max.x >> 4; ++chunk_x) {
+                ChunkColumn* column = GetColumn((s32)chunk_x, (s32)chunk_z);
+
+                if (column == nullptr) continue;
+
+                column->ForEachBlockEntityInRange(min, max, callback);
+            }
+        }
+    }
+
+    /**
+     * Calls callback(const mc::Vector3i& position, mc::block::BlockPtr block) for every non-air block whose position is inside of bounds.
+     * Only the loaded sections that overlap the bounds are visited and empty ones are skipped without looking at their blocks.
+     */
+    template <typename Callback>
+    void ForEachBlock(const mc::AABB& bounds, Callback&& callback) const {
+        ForEachChunkInRange(GetBlockMin(bounds), GetBlockMax(bounds),
+            [&callback](const Chunk& chunk, const mc::Vector3i& base, const mc::Vector3i& min, const mc::Vector3i& max) {
+                chunk.ForEachBlockInRange(min, max, [&callback, &base](const mc::Vector3i& position, mc::block::BlockPtr block) {
+                    callback(base + position, block);
+                });
+            });
+    }
+
+    /**
+     * Appends the bounding boxes of the solid blocks that intersect bounds to boxes. Blocks below the bounds are included
+     * since some of them, like fences, are taller than one block. Allocates nothing if boxes has enough capacity.
+     */
+    void CollectSolidBoxes(const mc::AABB& bounds, std::vector<mc::AABB>& boxes) const;
+
+    // Number of loaded chunk sections and how many of them are stored as a single uniform block.
+    std::size_t GetChunkCount() const;
+    std::size_t GetUniformChunkCount() const;
+
     const std::unordered_map<ChunkCoord, ChunkColumnPtr>::const_iterator begin() const { return m_Chunks.begin(); }
     const std::unordered_map<ChunkCoord, ChunkColumnPtr>::const_iterator end() const { return m_Chunks.end(); }
 
 private:
+    friend class WorldCursor;
+
+    struct GridSlot {
+        s32 x;
+        s32 z;
+        ChunkColumnPtr column;
+    };
+
+    struct ColumnImport {
+        mc::world::ChunkColumnPtr source;
+        // Set when the column is read from the region cache instead of converted from source.
+        std::string cache_entry;
+        ChunkCoord coord;
+        ChunkColumnPtr result;
+        std::atomic<bool> done{ false };
+    };
+
+    // Either a column import or an operation from a packet that arrived while an earlier import was pending.
+    struct PendingOperation {
+        std::shared_ptr<ColumnImport> import;
+        std::function<void()> apply;
+    };
+
+    std::deque<PendingOperation> m_PendingOperations;
+    // Columns read from the region cache are committed as soon as they are read instead of in packet order,
+    // so they never hold up the columns and block changes from the server.
+    std::vector<std::shared_ptr<ColumnImport>> m_CacheImports;
+
+    JobSystem* m_Jobs;
+    // Replaced when the dimension changes, so the imports of the old dimension can be cancelled.
+    JobToken m_ImportToken;
+
+    // Runs the operation now unless something is waiting to be committed, in which case it's queued behind it.
+    void Defer(std::function<void()> operation);
+    // Col is null if the cache couldn't read it.
+    void CommitCachedColumn(const ChunkCoord& coord, const ChunkColumnPtr& col);
+    void SubmitImport(std::shared_ptr<ColumnImport> import);
+    void RunImport(ColumnImport& import);
+
+    RegionCache* m_RegionCache;
+    std::string m_CacheServer;
+    s32 m_Dimension;
+    // Set after joining or respawning until the first position arrives.
+    bool m_CacheLoadPending;
+    // Columns that are loaded or being loaded from the region cache and haven't been sent by the server yet.
+    std::unordered_set<ChunkCoord> m_CachedColumns;
+
+    // Queues imports for the cached columns in view of the chunk coordinates, nearest first.
+    void LoadCachedColumns(s32 chunk_x, s32 chunk_z);
+    // Unloads the cached columns that are outside of the grid window now.
+    void UnloadCachedColumns();
+    // Stores the column in the region cache if it came from the server.
+    void StoreColumn(const ChunkCoord& coord, const ChunkColumnPtr& column);
+
+    struct DimensionStash {
+        s32 dimension;
+        std::unordered_map<ChunkCoord, ChunkColumnPtr> columns;
+        std::size_t memory;
+    };
+
+    // Most recently left first.
+    std::deque<DimensionStash> m_StashedDimensions;
+    std::size_t m_DimensionStashLimit;
+    std::size_t m_StashMemory;
+    u64 m_StashHits;
+    u64 m_StashMisses;
+    u64 m_StashEvictions;
+
+    // Moves the loaded columns into the stash for the current dimension.
+    void StashDimension();
+    // Loads the columns of the current dimension back if they are stashed.
+    void RestoreDimension();
+    // Drops the least recently left dimensions until the stash fits in the limit.
+    void EvictDimensions();
+
+    std::atomic<const WorldSnapshot*> m_Snapshot;
+    // Set when a column or chunk changed since the last published snapshot.
+    // Columns that were loaded, unloaded or changed since the last snapshot.
+    std::unordered_set<ChunkCoord> m_ChangedColumns;
+
+    // Owns every loaded column. The grid only mirrors the ones near the center.
     std::unordered_map<ChunkCoord, ChunkColumnPtr> m_Chunks;
 
-    bool SetBlock(mc::Vector3i position, u32 blockData);
+    // Square grid with a power of two side, indexed by chunk coordinates & m_GridMask.
+    std::vector<GridSlot> m_Grid;
+    s32 m_GridMask;
+    s32 m_ViewDistance;
+    s32 m_CenterX;
+    s32 m_CenterZ;
+
+    // Applies block changes to the world as they are made and notifies the listeners once when committed.
+    class Transaction {
+    public:
+        Transaction(World& world) : m_World(world) { }
+
+        Transaction(const Transaction& other) = delete;
+        Transaction& operator=(const Transaction& other) = delete;
+
+        // Changes the block and drops its block entity if the block type changes. Unloaded positions are ignored.
+        void SetBlock(const mc::Vector3i& position, mc::block::BlockPtr block);
+        void Commit();
+
+    private:
+        World& m_World;
+        std::vector<BlockChange> m_Changes;
+    };
+
+    // No two coordinates inside of the window share a grid slot, so a loaded column inside of it is always in its slot.
+    bool IsInGridWindow(s32 chunk_x, s32 chunk_z) const {
+        s32 radius = m_GridMask / 2;
+
+        return std::abs(chunk_x - m_CenterX) <= radius && std::abs(chunk_z - m_CenterZ) <= radius;
+    }
+
+    GridSlot& GetGridSlot(s32 chunk_x, s32 chunk_z) {
+        return m_Grid[(chunk_z & m_GridMask) * (m_GridMask + 1) + (chunk_x & m_GridMask)];
+    }
+
+    // Returns the stored pointer to the column at the chunk coordinates or null if it isn't loaded.
+    const ChunkColumnPtr* FindColumn(s32 chunk_x, s32 chunk_z) const {
+        const GridSlot& slot = m_Grid[(chunk_z & m_GridMask) * (m_GridMask + 1) + (chunk_x & m_GridMask)];
+
+        if (slot.x == chunk_x && slot.z == chunk_z && slot.column != nullptr) return &slot.column;
+        if (IsInGridWindow(chunk_x, chunk_z)) return nullptr;
+
+        auto iter = m_Chunks.find(ChunkCoord(chunk_x, chunk_z));
+
+        if (iter == m_Chunks.end()) return nullptr;
+        return &iter->second;
+    }
+
+    // Returns the loaded column at the chunk coordinates without touching the reference count.
+    ChunkColumn* GetColumn(s32 chunk_x, s32 chunk_z) const {
+        const ChunkColumnPtr* column = FindColumn(chunk_x, chunk_z);
+
+        return column ? column->get() : nullptr;
+    }
+
+    ChunkColumn* GetColumn(const mc::Vector3i& pos) const {
+        return GetColumn((s32)(pos.x >> 4), (s32)(pos.z >> 4));
+    }
+
+    static mc::Vector3i GetBlockMin(const mc::AABB& bounds) {
+        return mc::Vector3i((s64)std::floor(bounds.min.x), (s64)std::floor(bounds.min.y), (s64)std::floor(bounds.min.z));
+    }
+
+    static mc::Vector3i GetBlockMax(const mc::AABB& bounds) {
+        return mc::Vector3i((s64)std::floor(bounds.max.x), (s64)std::floor(bounds.max.y), (s64)std::floor(bounds.max.z));
+    }
+
+    /**
+     * Calls callback(const Chunk& chunk, const mc::Vector3i& base, const mc::Vector3i& min, const mc::Vector3i& max) for every
+     * loaded non-empty chunk that overlaps the block range [min, max]. Base is the world position of the chunk and the range
+     * passed to the callback is the part of it inside of the chunk, relative to base.
+     */
+    template <typename Callback>
+    void ForEachChunkInRange(const mc::Vector3i& min, const mc::Vector3i& max, Callback&& callback) const {
+        s64 min_y = std::max<s64>(min.y, 0);
+        s64 max_y = std::min<s64>(max.y, 16 * ChunkColumn::ChunksPerColumn - 1);
+
+        if (min_y > max_y) return;
+
+        for (s64 chunk_z = min.z >> 4; chunk_z <= max.z >> 4; ++chunk_z) {
+            for (s64 chunk_x = min.x >> 4; chunk_x <= max.x >> 4; ++chunk_x) {
+                ChunkColumn* column = GetColumn((s32)chunk_x, (s32)chunk_z);
+
+                if (column == nullptr) continue;
+
+                for (s64 chunk_y = min_y >> 4; chunk_y <= max_y >> 4; ++chunk_y) {
+                    if (column->IsChunkEmpty((std::size_t)chunk_y)) continue;
+
+                    mc::Vector3i base(chunk_x * 16, chunk_y * 16, chunk_z * 16);
+                    mc::Vector3i chunk_min(std::max<s64>(min.x - base.x, 0), std::max<s64>(min_y - base.y, 0), std::max<s64>(min.z - base.z, 0));
+                    mc::Vector3i chunk_max(std::min<s64>(max.x - base.x, 15), std::min<s64>(max_y - base.y, 15), std::min<s64>(max.z - base.z, 15));
+
+                    callback(*(*column)[(std::size_t)chunk_y], base, chunk_min, chunk_max);
+                }
+            }
+        }
+    }
+
+    void SetColumn(const ChunkCoord& coord, ChunkColumnPtr column);
+    void RemoveColumn(const ChunkCoord& coord);
+    void RebuildGrid();
+    // Fills the slots of the coordinates that entered the grid window when the center moved from old_x, old_z.
+    void UpdateGridWindow(s32 old_x, s32 old_z);
+    void FillGridSlot(s32 chunk_x, s32 chunk_z);
 };
 
 } // ns terra
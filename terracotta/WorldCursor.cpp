@@ -0,0 +1,72 @@
+#include "WorldCursor.h"
+
+namespace terra {
+
+WorldCursor::WorldCursor(const World& world, const mc::Vector3i& position)
+    : m_World(&world),
+      m_Position(position),
+      m_ChunkX((s32)(position.x >> 4)),
+      m_ChunkY((s32)(position.y >> 4)),
+      m_ChunkZ((s32)(position.z >> 4)),
+      m_Column(world.GetColumn(m_ChunkX, m_ChunkZ)),
+      m_Chunk(nullptr),
+      m_Air(mc::block::BlockRegistry::GetInstance()->GetBlock(0))
+{
+    if (m_Column != nullptr && m_ChunkY >= 0 && m_ChunkY < ChunkColumn::ChunksPerColumn) {
+        m_Chunk = (*m_Column)[m_ChunkY].get();
+    }
+}
+
+void WorldCursor::MoveTo(const mc::Vector3i& position) {
+    s32 chunk_x = (s32)(position.x >> 4);
+    s32 chunk_y = (s32)(position.y >> 4);
+    s32 chunk_z = (s32)(position.z >> 4);
+
+    m_Position = position;
+
+    if (chunk_x == m_ChunkX && chunk_y == m_ChunkY && chunk_z == m_ChunkZ) return;
+
+    if (chunk_x != m_ChunkX || chunk_z != m_ChunkZ) {
+        m_ChunkX = chunk_x;
+        m_ChunkZ = chunk_z;
+        m_Column = m_World->GetColumn(chunk_x, chunk_z);
+    }
+
+    m_ChunkY = chunk_y;
+    m_Chunk = nullptr;
+
+    if (m_Column != nullptr && chunk_y >= 0 && chunk_y < ChunkColumn::ChunksPerColumn) {
+        m_Chunk = (*m_Column)[chunk_y].get();
+    }
+}
+
+WorldCursor WorldCursor::Neighbor(block::BlockFace face) const {
+    WorldCursor result(*this);
+
+    switch (face) {
+    case block::BlockFace::North:
+        result.Offset(0, 0, -1);
+        break;
+    case block::BlockFace::East:
+        result.Offset(1, 0, 0);
+        break;
+    case block::BlockFace::South:
+        result.Offset(0, 0, 1);
+        break;
+    case block::BlockFace::West:
+        result.Offset(-1, 0, 0);
+        break;
+    case block::BlockFace::Up:
+        result.Offset(0, 1, 0);
+        break;
+    case block::BlockFace::Down:
+        result.Offset(0, -1, 0);
+        break;
+    default:
+        break;
+    }
+
+    return result;
+}
+
+} // ns terra
@@ -0,0 +1,74 @@
+#ifndef TERRACOTTA_WORLD_CURSOR_H_
+#define TERRACOTTA_WORLD_CURSOR_H_
+
+#include "World.h"
+#include "block/BlockFace.h"
+
+namespace terra {
+
+/**
+ * Points at a block position in a World and caches the column and chunk that contain it.
+ * Moving inside of the same chunk doesn't touch the world, so walking over neighbouring blocks is cheap.
+ * The cursor holds raw pointers, so it must not be kept across changes to the loaded columns.
+ */
+class WorldCursor {
+public:
+    WorldCursor(const World& world, const mc::Vector3i& position);
+
+    const mc::Vector3i& GetPosition() const { return m_Position; }
+
+    void MoveTo(const mc::Vector3i& position);
+
+    WorldCursor& Offset(s64 dx, s64 dy, s64 dz) {
+        MoveTo(mc::Vector3i(m_Position.x + dx, m_Position.y + dy, m_Position.z + dz));
+        return *this;
+    }
+
+    // Returns a new cursor pointing at the block next to this one.
+    WorldCursor Neighbor(block::BlockFace face) const;
+
+    // True when the column at the position is loaded. Positions above or below the world are in loaded columns.
+    bool IsLoaded() const { return m_Column != nullptr; }
+
+    // Returns air when the position isn't loaded or is outside of the world.
+    mc::block::BlockPtr GetBlock() const {
+        if (m_Chunk == nullptr) return m_Air;
+
+        return m_Chunk->GetBlock(mc::Vector3i(m_Position.x & 15, m_Position.y & 15, m_Position.z & 15));
+    }
+
+    bool IsSolid() const {
+        if (m_Chunk == nullptr) return false;
+
+        return m_Chunk->IsSolid(mc::Vector3i(m_Position.x & 15, m_Position.y & 15, m_Position.z & 15));
+    }
+
+    // Returns the block when it's solid and null otherwise.
+    mc::block::BlockPtr GetSolidBlock() const {
+        if (m_Chunk == nullptr) return nullptr;
+
+        return m_Chunk->GetSolidBlock(mc::Vector3i(m_Position.x & 15, m_Position.y & 15, m_Position.z & 15));
+    }
+
+    bool IsOpaqueCube() const {
+        if (m_Chunk == nullptr) return false;
+
+        return m_Chunk->IsOpaqueCube(mc::Vector3i(m_Position.x & 15, m_Position.y & 15, m_Position.z & 15));
+    }
+
+private:
+    const World* m_World;
+    mc::Vector3i m_Position;
+
+    s32 m_ChunkX;
+    s32 m_ChunkY;
+    s32 m_ChunkZ;
+    ChunkColumn* m_Column;
+    Chunk* m_Chunk;
+
+    mc::block::BlockPtr m_Air;
+};
+
+} // ns terra
+
+#endif
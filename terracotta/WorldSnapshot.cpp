@@ -0,0 +1,65 @@
+#include "WorldSnapshot.h"
+
+namespace terra {
+
+SnapshotMap<WorldSnapshot::Column> WorldSnapshot::CaptureColumns(const WorldSnapshot* previous, const std::unordered_map<ChunkCoord, ChunkColumnPtr>& columns,
+    const std::unordered_set<ChunkCoord>& changed)
+{
+    std::vector<Column> captured;
+    std::vector<SnapshotMap<Column>::Change> changes;
+
+    // The changes point into captured, so it can't grow while they are added.
+    captured.reserve(changed.size());
+    changes.reserve(changed.size());
+
+    for (const ChunkCoord& coord : changed) {
+        auto iter = columns.find(coord);
+
+        if (iter == columns.end() || iter->second == nullptr) {
+            changes.emplace_back(coord, nullptr);
+            continue;
+        }
+
+        Column column{ iter->second->GetMetadata(), {} };
+
+        for (s32 i = 0; i < ChunkColumn::ChunksPerColumn; ++i) {
+            const ChunkPtr& chunk = (*iter->second)[i];
+
+            if (chunk != nullptr) {
+                chunk->Publish();
+            }
+
+            column.chunks[i] = chunk.get();
+        }
+
+        captured.push_back(column);
+        changes.emplace_back(coord, &captured.back());
+    }
+
+    return SnapshotMap<Column>(previous != nullptr ? &previous->m_Columns : nullptr, changes);
+}
+
+WorldSnapshot::WorldSnapshot(const WorldSnapshot* previous, const std::unordered_map<ChunkCoord, ChunkColumnPtr>& columns, const std::unordered_set<ChunkCoord>& changed)
+    : m_Columns(CaptureColumns(previous, columns, changed))
+{
+}
+
+mc::block::BlockPtr WorldSnapshot::GetBlock(const mc::Vector3i& pos) const {
+    static const mc::block::BlockPtr air = mc::block::BlockRegistry::GetInstance()->GetBlock(0);
+
+    const Chunk* chunk = GetChunk((s32)(pos.x >> 4), (s32)(pos.y >> 4), (s32)(pos.z >> 4));
+
+    if (chunk == nullptr) return air;
+
+    return chunk->GetBlock(mc::Vector3i(pos.x & 15, pos.y & 15, pos.z & 15));
+}
+
+bool WorldSnapshot::IsSolid(const mc::Vector3i& pos) const {
+    const Chunk* chunk = GetChunk((s32)(pos.x >> 4), (s32)(pos.y >> 4), (s32)(pos.z >> 4));
+
+    if (chunk == nullptr) return false;
+
+    return chunk->IsSolid(mc::Vector3i(pos.x & 15, pos.y & 15, pos.z & 15));
+}
+
+} // ns terra
@@ -0,0 +1,66 @@
+#ifndef TERRACOTTA_WORLD_SNAPSHOT_H_
+#define TERRACOTTA_WORLD_SNAPSHOT_H_
+
+#include "SnapshotMap.h"
+#include "World.h"
+
+#include <array>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace terra {
+
+/**
+ * An immutable view of the loaded chunks that can be read from any thread.
+ * Readers get it from World::GetSnapshot while holding an EpochManager::ReadGuard, and it stays valid until the guard is released.
+ * Every chunk in it is published, so the world copies a chunk before changing it instead of writing to it.
+ * Each snapshot is made from the previous one and only captures the columns that changed since then.
+ */
+class WorldSnapshot {
+public:
+    struct Column {
+        ChunkColumnMetadata meta;
+        // Null chunks are fully air.
+        std::array<const Chunk*, ChunkColumn::ChunksPerColumn> chunks;
+    };
+
+    /**
+     * Captures the changed columns on top of previous and publishes their chunks. Changed columns that aren't in columns
+     * are removed. Previous can be null for the first snapshot. Must be called by the thread that changes the world.
+     */
+    WorldSnapshot(const WorldSnapshot* previous, const std::unordered_map<ChunkCoord, ChunkColumnPtr>& columns, const std::unordered_set<ChunkCoord>& changed);
+
+    WorldSnapshot(const WorldSnapshot& other) = delete;
+    WorldSnapshot& operator=(const WorldSnapshot& other) = delete;
+
+    // Returns null if the column isn't loaded.
+    const Column* GetColumn(s32 chunk_x, s32 chunk_z) const {
+        return m_Columns.Find(chunk_x, chunk_z);
+    }
+
+    // Returns null if the chunk is air, outside of the world or the column isn't loaded.
+    const Chunk* GetChunk(s32 chunk_x, s32 chunk_y, s32 chunk_z) const {
+        if (chunk_y < 0 || chunk_y >= ChunkColumn::ChunksPerColumn) return nullptr;
+
+        const Column* column = GetColumn(chunk_x, chunk_z);
+
+        if (column == nullptr) return nullptr;
+        return column->chunks[chunk_y];
+    }
+
+    // Returns air for positions that aren't loaded.
+    mc::block::BlockPtr GetBlock(const mc::Vector3i& pos) const;
+    bool IsSolid(const mc::Vector3i& pos) const;
+
+    std::size_t GetColumnCount() const { return m_Columns.GetSize(); }
+
+private:
+    SnapshotMap<Column> m_Columns;
+
+    static SnapshotMap<Column> CaptureColumns(const WorldSnapshot* previous, const std::unordered_map<ChunkCoord, ChunkColumnPtr>& columns,
+        const std::unordered_set<ChunkCoord>& changed);
+};
+
+} // ns terra
+
+#endif
@@ -6,6 +6,9 @@
 #include <fstream>
 #include <iostream>
 #include <algorithm>
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <glm/gtc/quaternion.hpp>
 
 #include "stb_image.h"
 
@@ -14,9 +17,16 @@ namespace assets {
 
 void AssetCache::SetMaxBlockId(std::size_t id) {
     m_BlockStates.resize(id + 1);
-    m_VariantCache.resize(id + 1);
+    m_StateProperties.clear();
+    m_StateProperties.resize(id + 1);
+}
+
+void AssetCache::SetStateProperties(u32 block_id, const BlockStateProperties& properties) {
+    if (block_id >= m_StateProperties.size()) {
+        m_StateProperties.resize(block_id + 1);
+    }
 
-    std::fill(m_VariantCache.begin(), m_VariantCache.end(), nullptr);
+    m_StateProperties[block_id] = properties;
 }
 
 terra::block::BlockState* AssetCache::GetBlockState(u32 block_id) const {
@@ -75,16 +85,243 @@ void AssetCache::AddVariantModel(std::unique_ptr<block::BlockVariant> variant) {
     m_BlockVariants[variant->GetBlock()->GetName()].push_back(std::move(variant));
 }
 
-block::BlockVariant* AssetCache::GetVariant(mc::block::BlockPtr block) {
-    block::BlockVariant* variant = m_VariantCache[block->GetType()];
+block::BlockVariant* AssetCache::GetVariant(mc::block::BlockPtr block) const {
+    return GetVariant(block->GetType());
+}
+
+// Light levels of the blocks that emit light. Blocks that only emit light while lit are listed in kLitEmission.
+static u8 GetLightEmission(const std::string& name, const block::BlockState* state) {
+    static const std::unordered_map<std::string, u8> kEmission = {
+        { "minecraft:beacon", 15 },
+        { "minecraft:conduit", 15 },
+        { "minecraft:end_gateway", 15 },
+        { "minecraft:end_portal", 15 },
+        { "minecraft:fire", 15 },
+        { "minecraft:glowstone", 15 },
+        { "minecraft:jack_o_lantern", 15 },
+        { "minecraft:lava", 15 },
+        { "minecraft:sea_lantern", 15 },
+        { "minecraft:end_rod", 14 },
+        { "minecraft:torch", 14 },
+        { "minecraft:wall_torch", 14 },
+        { "minecraft:nether_portal", 11 },
+        { "minecraft:ender_chest", 7 },
+        { "minecraft:magma_block", 3 },
+        { "minecraft:brewing_stand", 1 },
+        { "minecraft:brown_mushroom", 1 },
+        { "minecraft:dragon_egg", 1 },
+        { "minecraft:end_portal_frame", 1 },
+    };
+
+    static const std::unordered_map<std::string, u8> kLitEmission = {
+        { "minecraft:redstone_lamp", 15 },
+        { "minecraft:furnace", 13 },
+        { "minecraft:redstone_ore", 9 },
+        { "minecraft:redstone_torch", 7 },
+        { "minecraft:redstone_wall_torch", 7 },
+    };
+
+    auto iter = kEmission.find(name);
+
+    if (iter != kEmission.end()) return iter->second;
+
+    iter = kLitEmission.find(name);
+
+    if (iter != kLitEmission.end() && state != nullptr && state->GetProperty("lit") == "true") {
+        return iter->second;
+    }
+
+    return 0;
+}
+
+static bool IsFullCube(block::BlockModel& model) {
+    for (const auto& element : model.GetElements()) {
+        if (!element.IsFullExtent() || element.GetRotation().angle != 0) return false;
+
+        for (std::size_t i = 0; i < 6; ++i) {
+            const block::RenderableFace& renderable = element.GetFace(static_cast<block::BlockFace>(i));
+
+            if (renderable.face == block::BlockFace::None) continue;
+            if (renderable.uv_from != glm::vec2(0, 0) || renderable.uv_to != glm::vec2(1, 1)) return false;
+        }
+    }
+
+    return true;
+}
+
+static void ApplyRotations(glm::vec3& bottom_left, glm::vec3& bottom_right, glm::vec3& top_left, glm::vec3& top_right, const glm::vec3& rotations, glm::vec3 offset = glm::vec3(0.5, 0.5, 0.5)) {
+    glm::quat quat(1, 0, 0, 0);
+
+    const float kToRads = (float)M_PI / 180.0f;
+
+    if (rotations.z != 0) {
+        quat = glm::rotate(quat, kToRads * rotations.z, glm::vec3(0.0f, 0.0f, 1.0f));
+    }
+
+    if (rotations.y != 0) {
+        quat = glm::rotate(quat, kToRads * -rotations.y, glm::vec3(0.0f, 1.0f, 0.0f));
+    }
+
+    if (rotations.x != 0) {
+        quat = glm::rotate(quat, kToRads * rotations.x, glm::vec3(1.0f, 0.0f, 0.0f));
+    }
+
+    if (rotations.x != 0 || rotations.y != 0 || rotations.z != 0) {
+        bottom_left = glm::vec3(quat * glm::vec4(bottom_left - offset, 1.0)) + offset;
+        bottom_right = glm::vec3(quat * glm::vec4(bottom_right - offset, 1.0)) + offset;
+        top_left = glm::vec3(quat * glm::vec4(top_left - offset, 1.0)) + offset;
+        top_right = glm::vec3(quat * glm::vec4(top_right - offset, 1.0)) + offset;
+    }
+}
+
+// TODO: Rescaling?
+static void ApplyRotations(glm::vec3& bottom_left, glm::vec3& bottom_right, glm::vec3& top_left, glm::vec3& top_right, const glm::vec3& variant_rotation, const block::ElementRotation& rotation) {
+    glm::vec3 rotations(rotation.angle, rotation.angle, rotation.angle);
+
+    glm::quat quat(1, 0, 0, 0);
 
-    if (variant == nullptr) {
-        variant = GetVariantFromProperties(block->GetName(), GetBlockState(block->GetType())->GetVariant());
+    const float kToRads = (float)M_PI / 180.0f;
 
-        m_VariantCache[block->GetType()] = variant;
+    if (variant_rotation.z != 0) {
+        quat = glm::rotate(quat, kToRads * variant_rotation.z, glm::vec3(0.0f, 0.0f, 1.0f));
     }
 
-    return variant;
+    if (variant_rotation.y != 0) {
+        quat = glm::rotate(quat, kToRads * -variant_rotation.y, glm::vec3(0.0f, 1.0f, 0.0f));
+    }
+
+    if (variant_rotation.x != 0) {
+        quat = glm::rotate(quat, kToRads * variant_rotation.x, glm::vec3(1.0f, 0.0f, 0.0f));
+    }
+    
+    if (rotation.rescale) {
+        rotations = rotations * (1.0f / std::cos(3.14159f / 4.0f) - 1.0f);
+    }
+
+    // Hadamard product to get just the one axis rotation
+    rotations = rotations * (quat * rotation.axis);
+
+    ApplyRotations(bottom_left, bottom_right, top_left, top_right, rotations, quat * (rotation.origin - glm::vec3(0.5, 0.5, 0.5)) + glm::vec3(0.5, 0.5, 0.5));
+}
+
+static u8 GetOpaqueFaces(block::BlockVariant& variant, const TextureArray& textures) {
+    block::BlockModel* model = variant.GetModel();
+    if (model == nullptr || variant.HasRotation()) return 0;
+
+    u8 faces = 0;
+
+    for (const auto& element : model->GetElements()) {
+        if (!element.IsFullExtent()) continue;
+
+        for (std::size_t i = 0; i < 6; ++i) {
+            if (!textures.IsTransparent(element.GetFace(static_cast<block::BlockFace>(i)).texture)) {
+                faces |= 1 << i;
+            }
+        }
+    }
+
+    return faces;
+}
+
+static u8 GetNeverCullFaces(block::BlockVariant& variant) {
+    if (variant.HasRotation()) return 0x3F;
+
+    block::BlockModel* model = variant.GetModel();
+    if (model == nullptr) return 0;
+
+    u8 faces = 0;
+
+    for (const auto& element : model->GetElements()) {
+        for (std::size_t i = 0; i < 6; ++i) {
+            if (element.GetFace(static_cast<block::BlockFace>(i)).cull_face == block::BlockFace::None) {
+                faces |= 1 << i;
+            }
+        }
+    }
+
+    return faces;
+}
+
+static glm::vec3 SelectCorner(const glm::vec3& from, const glm::vec3& to, const glm::vec3& select) {
+    return glm::vec3(select.x != 0 ? to.x : from.x, select.y != 0 ? to.y : from.y, select.z != 0 ? to.z : from.z);
+}
+
+static void BakeQuads(block::BlockVariant& variant) {
+    block::BlockModel* model = variant.GetModel();
+
+    for (std::size_t face_index = 0; face_index < 6; ++face_index) {
+        const block::BlockFace face = static_cast<block::BlockFace>(face_index);
+        std::vector<block::BakedQuad> quads;
+
+        if (model != nullptr) {
+            for (const auto& element : model->GetElements()) {
+                const block::RenderableFace& renderable = element.GetFace(face);
+
+                if (renderable.face != face) continue;
+
+                block::BakedQuad quad;
+
+                for (std::size_t i = 0; i < 4; ++i) {
+                    const block::FaceCorner& corner = block::kFaceCorners[face_index][i];
+                    const glm::vec2& uv_from = renderable.uv_from;
+                    const glm::vec2& uv_to = renderable.uv_to;
+
+                    quad.positions[i] = SelectCorner(element.GetFrom(), element.GetTo(), corner.position);
+                    quad.uvs[i] = glm::vec2(corner.uv.x != 0 ? uv_to.x : uv_from.x, corner.uv.y != 0 ? uv_to.y : uv_from.y);
+                }
+
+                glm::vec3* positions = quad.positions;
+
+                ApplyRotations(positions[0], positions[1], positions[3], positions[2], variant.GetRotations());
+                ApplyRotations(positions[0], positions[1], positions[3], positions[2], variant.GetRotations(), element.GetRotation());
+
+                quad.texture = renderable.texture;
+                quad.tint = static_cast<u8>(renderable.tint_index + 1);
+                quad.shade = element.ShouldShade();
+                quad.cull_face = renderable.cull_face;
+
+                quads.push_back(quad);
+            }
+        }
+
+        variant.SetQuads(face, std::move(quads));
+    }
+}
+
+void AssetCache::BuildStateProperties() {
+    mc::block::BlockRegistry* registry = mc::block::BlockRegistry::GetInstance();
+
+    for (auto& kv : m_BlockVariants) {
+        for (auto& variant : kv.second) {
+            BakeQuads(*variant);
+        }
+    }
+
+    for (u32 id = 0; id < m_StateProperties.size(); ++id) {
+        BlockStateProperties& properties = m_StateProperties[id];
+        mc::block::BlockPtr block = registry->GetBlock(id);
+        block::BlockState* state = GetBlockState(id);
+
+        properties = BlockStateProperties();
+
+        if (block == nullptr) continue;
+
+        properties.solid = block->IsSolid();
+        properties.light_emission = GetLightEmission(block->GetName(), state);
+
+        if (state == nullptr) continue;
+
+        properties.variant = GetVariantFromProperties(block->GetName(), state->GetVariant());
+
+        if (properties.variant != nullptr) {
+            block::BlockModel* model = properties.variant->GetModel();
+
+            properties.empty = model == nullptr || model->GetElements().empty();
+            properties.full_cube = !properties.empty && !properties.variant->HasRotation() && IsFullCube(*model);
+            properties.opaque_faces = GetOpaqueFaces(*properties.variant, m_TextureArray);
+            properties.never_cull_faces = GetNeverCullFaces(*properties.variant);
+        }
+    }
 }
 
 } // ns assets
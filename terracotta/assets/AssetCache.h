@@ -17,6 +17,25 @@ namespace assets {
 
 class ZipArchive;
 
+// Per block state data that the mesh workers need, resolved once after the assets are loaded.
+struct BlockStateProperties {
+    block::BlockVariant* variant = nullptr;
+    bool solid = false;
+    // Set when the state has no model elements, so it never generates geometry.
+    bool empty = true;
+    // Block light level that the state emits, from 0 to 15.
+    u8 light_emission = 0;
+    // Set when every element is an unrotated full cube whose faces use the whole texture, so greedy meshing can merge its faces.
+    bool full_cube = false;
+    // One bit per BlockFace that is fully covered by an opaque element, so it hides the face of the neighbor that touches it.
+    u8 opaque_faces = 0;
+    // One bit per BlockFace that has to be drawn even when the neighbor is opaque, because the state is rotated or the face has no cull face.
+    u8 never_cull_faces = 0;
+
+    bool IsOpaque(block::BlockFace face) const { return (opaque_faces & (1 << static_cast<int>(face))) != 0; }
+    bool NeverCulls(block::BlockFace face) const { return (never_cull_faces & (1 << static_cast<int>(face))) != 0; }
+};
+
 class AssetCache {
 public:
     AssetCache() { }
@@ -30,7 +49,19 @@ public:
     TextureHandle AddTexture(const std::string& path, const std::string& data);
 
     void AddVariantModel(std::unique_ptr<block::BlockVariant> variant);
-    block::BlockVariant* GetVariant(mc::block::BlockPtr block);
+    block::BlockVariant* GetVariant(mc::block::BlockPtr block) const;
+    block::BlockVariant* GetVariant(u32 block_id) const { return GetStateProperties(block_id).variant; }
+
+    // Fills the dense state table. Must be called after the block states and variants are loaded.
+    void BuildStateProperties();
+    // Replaces the properties of one state, growing the table if needed. Lets states be set up without loading the assets.
+    void SetStateProperties(u32 block_id, const BlockStateProperties& properties);
+    const BlockStateProperties& GetStateProperties(u32 block_id) const {
+        static const BlockStateProperties kMissing;
+
+        if (block_id >= m_StateProperties.size()) return kMissing;
+        return m_StateProperties[block_id];
+    }
 
     std::vector<block::BlockModel*> GetBlockModels(const std::string& find);
     block::BlockModel* GetBlockModel(const std::string& path);
@@ -41,7 +72,8 @@ private:
 
     // Maps block id to the BlockState
     std::vector<std::unique_ptr<terra::block::BlockState>> m_BlockStates;
-    std::vector<terra::block::BlockVariant*> m_VariantCache;
+    // Maps block id to the resolved properties of that state
+    std::vector<BlockStateProperties> m_StateProperties;
 
     // Maps model path to a BlockModel
     std::unordered_map<std::string, std::unique_ptr<terra::block::BlockModel>> m_BlockModels;
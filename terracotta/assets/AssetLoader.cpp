@@ -1,7 +1,11 @@
 #include "AssetLoader.h"
 #include "AssetCache.h"
 #include "zip/ZipArchive.h"
+
+// The image loader is only used here, so its implementation is compiled with the loader.
+#define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
+
 #include "../block/BlockModel.h"
 #include "../block/BlockVariant.h"
 
@@ -93,6 +97,8 @@ bool AssetLoader::LoadArchive(const std::string& archive_path, const std::string
         }
     }
 
+    m_Cache.BuildStateProperties();
+
     return true;
 }
 
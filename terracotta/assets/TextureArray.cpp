@@ -75,11 +75,7 @@ void BoxFilterMipmap(std::vector<unsigned char>& previous, std::vector<unsigned
     }
 }
 
-TextureArray::TextureArray() {
-    glActiveTexture(GL_TEXTURE0);
-    glGenTextures(1, &m_TextureId);
-    glBindTexture(GL_TEXTURE_2D_ARRAY, m_TextureId);
-
+TextureArray::TextureArray() : m_TextureId(0), m_GPUMemory(0) {
     memset(m_Transparency, 0, sizeof(m_Transparency));
 }
 
@@ -108,10 +104,17 @@ TextureHandle TextureArray::Append(const std::string& filename, const std::strin
 }
 
 void TextureArray::Generate() {
+    // The texture is only created here, so the textures can be collected without a GL context.
+    if (m_TextureId == 0) {
+        glActiveTexture(GL_TEXTURE0);
+        glGenTextures(1, &m_TextureId);
+    }
+
     glBindTexture(GL_TEXTURE_2D_ARRAY, m_TextureId);
 
-    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    // Greedy meshed quads span several blocks and repeat the texture across them.
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
     glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -126,6 +129,8 @@ void TextureArray::Generate() {
     glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGBA8, 16, 16, size);
     glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, 16, 16, size, GL_RGBA, GL_UNSIGNED_BYTE, &m_TextureData[0]);
 
+    m_GPUMemory = m_TextureData.size();
+
     std::vector<unsigned char> mipmap_data(m_TextureData);
 
     GLsizei dim = 16;
@@ -139,6 +144,7 @@ void TextureArray::Generate() {
         mipmap_data = std::vector<unsigned char>(data_size);
 
         BoxFilterMipmap(previous, mipmap_data, dim);
+        m_GPUMemory += data_size;
 
         glTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, 0, dim, dim, size, GL_RGBA, GL_UNSIGNED_BYTE, mipmap_data.data());
     }
@@ -23,8 +23,13 @@ public:
 
     void Generate();
     void Bind();
+
+    std::size_t GetLayerCount() const { return m_Textures.size(); }
+    // Bytes of texture data waiting for Generate plus the size of the generated texture with its mipmaps.
+    std::size_t GetMemoryUsage() const { return m_TextureData.capacity() + m_GPUMemory; }
 private:
     unsigned int m_TextureId;
+    std::size_t m_GPUMemory;
 
     std::vector<unsigned char> m_TextureData;
     std::unordered_map<std::string, TextureHandle> m_Textures;
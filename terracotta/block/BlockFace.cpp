@@ -5,6 +5,21 @@
 namespace terra {
 namespace block {
 
+const FaceCorner kFaceCorners[6][4] = {
+    // North
+    { { glm::vec3(1, 0, 0), glm::vec2(0, 1) }, { glm::vec3(0, 0, 0), glm::vec2(1, 1) }, { glm::vec3(0, 1, 0), glm::vec2(1, 0) }, { glm::vec3(1, 1, 0), glm::vec2(0, 0) } },
+    // East
+    { { glm::vec3(1, 0, 1), glm::vec2(0, 1) }, { glm::vec3(1, 0, 0), glm::vec2(1, 1) }, { glm::vec3(1, 1, 0), glm::vec2(1, 0) }, { glm::vec3(1, 1, 1), glm::vec2(0, 0) } },
+    // South
+    { { glm::vec3(0, 0, 1), glm::vec2(0, 1) }, { glm::vec3(1, 0, 1), glm::vec2(1, 1) }, { glm::vec3(1, 1, 1), glm::vec2(1, 0) }, { glm::vec3(0, 1, 1), glm::vec2(0, 0) } },
+    // West
+    { { glm::vec3(0, 0, 0), glm::vec2(0, 1) }, { glm::vec3(0, 0, 1), glm::vec2(1, 1) }, { glm::vec3(0, 1, 1), glm::vec2(1, 0) }, { glm::vec3(0, 1, 0), glm::vec2(0, 0) } },
+    // Up
+    { { glm::vec3(0, 1, 0), glm::vec2(0, 0) }, { glm::vec3(0, 1, 1), glm::vec2(0, 1) }, { glm::vec3(1, 1, 1), glm::vec2(1, 1) }, { glm::vec3(1, 1, 0), glm::vec2(1, 0) } },
+    // Down
+    { { glm::vec3(1, 0, 0), glm::vec2(1, 1) }, { glm::vec3(1, 0, 1), glm::vec2(1, 0) }, { glm::vec3(0, 0, 1), glm::vec2(0, 0) }, { glm::vec3(0, 0, 0), glm::vec2(0, 1) } },
+};
+
 const std::string face_strings[] = {
     "North", "East", "South", "West", "Up", "Down"
 };
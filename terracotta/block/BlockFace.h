@@ -2,6 +2,7 @@
 #define TERRACOTTA_BLOCK_BLOCKFACE_H_
 
 #include <string>
+#include <glm/glm.hpp>
 
 namespace terra {
 namespace block {
@@ -17,6 +18,17 @@ enum class BlockFace {
     None
 };
 
+// A corner of a face of the unit cube. Each coordinate of the position selects an element's from (0) or to (1), and the uv
+// selects between a face's uv_from and uv_to. A full cube face uses them directly as its positions and uvs.
+struct FaceCorner {
+    glm::vec3 position;
+    glm::vec2 uv;
+};
+
+// The corners of every face, indexed by BlockFace, in bottom left, bottom right, top right, top left order.
+// Baked quads and the greedy mesher's merged faces both use them, so their textures line up.
+extern const FaceCorner kFaceCorners[6][4];
+
 const std::string& to_string(BlockFace face);
 BlockFace face_from_string(const std::string& str);
 BlockFace get_opposite_face(BlockFace face);
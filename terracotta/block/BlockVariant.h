@@ -11,6 +11,18 @@
 namespace terra {
 namespace block {
 
+// A model element face with the variant and element rotations already applied, relative to the block origin.
+struct BakedQuad {
+    // Bottom left, bottom right, top right, top left.
+    glm::vec3 positions[4];
+    glm::vec2 uvs[4];
+    assets::TextureHandle texture;
+    // The vertex tint, which is the model tint index plus one so that 0 is untinted.
+    u8 tint;
+    bool shade;
+    BlockFace cull_face;
+};
+
 class BlockVariant {
 public:
     BlockVariant(BlockModel* model, const std::string& properties, mc::block::BlockPtr block) : m_Model(model), m_Properties(properties), m_Block(block), m_Rotations(0, 0, 0), m_LockUV(true), m_HasRotation(false) { }
@@ -29,6 +41,10 @@ public:
         return m_HasRotation;
     }
 
+    // The quads of every element face that points in the face direction before rotation. Baked by the AssetCache after loading.
+    const std::vector<BakedQuad>& GetQuads(BlockFace face) const { return m_Quads[static_cast<std::size_t>(face)]; }
+    void SetQuads(BlockFace face, std::vector<BakedQuad> quads) { m_Quads[static_cast<std::size_t>(face)] = std::move(quads); }
+
 private:
     std::string m_Properties;
     BlockModel* m_Model;
@@ -36,6 +52,7 @@ private:
     glm::vec3 m_Rotations;
     bool m_LockUV;
     bool m_HasRotation;
+    std::vector<BakedQuad> m_Quads[6];
 };
 
 } // ns block
@@ -1,3 +1,4 @@
+#include <chrono>
 #include <iostream>
 #include <vector>
 #include <iterator>
@@ -23,29 +24,20 @@
 #include "lib/imgui/imgui_impl_glfw.h"
 #include "lib/imgui/imgui_impl_opengl3.h"
 
+#include "LightEngine.h"
+#include "MemoryStats.h"
+#include "RegionCache.h"
+#include "JobSystem.h"
 #include "World.h"
 
 #include <GLFW/glfw3.h>
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "assets/stb_image.h"
-
 GLuint CreateBlockVAO();
 GLFWwindow* InitializeWindow();
 
 std::unique_ptr<terra::GameWindow> g_GameWindow;
 std::unique_ptr<terra::assets::AssetCache> g_AssetCache;
 
-struct CubeVertex {
-    glm::vec3 position;
-    glm::vec3 normal;
-    glm::vec2 uv;
-    u32 texture_index;
-    glm::vec3 tint;
-
-    CubeVertex(glm::vec3 pos, glm::vec3 normal, glm::vec2 uv, u32 tex_index, glm::vec3 tint) : position(pos), normal(normal), uv(uv), texture_index(tex_index), tint(tint) { }
-};
-
 int main(int argc, char* argvp[]) {
     mc::protocol::Version version = mc::protocol::Version::Minecraft_1_13_2;
     mc::block::BlockRegistry::GetInstance()->RegisterVanillaBlocks(version);
@@ -60,6 +52,19 @@ int main(int argc, char* argvp[]) {
     std::string username = "terracotta";
     std::string password = "";
 
+    bool cache_enabled = true;
+    std::string cache_directory = "cache";
+    u64 cache_size_mb = 256;
+    u64 dimension_stash_mb = terra::World::DefaultDimensionStashLimit / (1024 * 1024);
+    s32 chunk_view_distance = terra::Game::DefaultViewDistance;
+    bool greedy_meshing = true;
+    // 0 picks a worker count from the number of hardware threads.
+    std::size_t job_workers = 0;
+
+    // Memory stats are written to this file periodically and on exit when it's set.
+    std::string memory_stats_path;
+    float memory_stats_interval = 10.0f;
+
     std::ifstream config_file("config.json");
 
     if (config_file.is_open()) {
@@ -80,6 +85,40 @@ int main(int argc, char* argvp[]) {
             server = login_node.value("server", "");
             port = login_node.value("port", static_cast<u16>(25565));
         }
+
+        mc::json cache_node = config_root.value("cache", mc::json());
+
+        if (cache_node.is_object()) {
+            cache_enabled = cache_node.value("enabled", true);
+            cache_directory = cache_node.value("directory", "cache");
+            cache_size_mb = cache_node.value("max_size_mb", static_cast<u64>(256));
+        }
+
+        mc::json world_node = config_root.value("world", mc::json());
+
+        if (world_node.is_object()) {
+            dimension_stash_mb = world_node.value("dimension_stash_mb", dimension_stash_mb);
+            chunk_view_distance = world_node.value("view_distance", chunk_view_distance);
+        }
+
+        mc::json render_node = config_root.value("render", mc::json());
+
+        if (render_node.is_object()) {
+            greedy_meshing = render_node.value("greedy_meshing", true);
+        }
+
+        mc::json jobs_node = config_root.value("jobs", mc::json());
+
+        if (jobs_node.is_object()) {
+            job_workers = jobs_node.value("workers", static_cast<std::size_t>(0));
+        }
+
+        mc::json debug_node = config_root.value("debug", mc::json());
+
+        if (debug_node.is_object()) {
+            memory_stats_path = debug_node.value("memory_stats_path", "");
+            memory_stats_interval = debug_node.value("memory_stats_interval", 10.0f);
+        }
     }
 
     std::cout << "Checking layers" << std::endl;
@@ -123,6 +162,7 @@ int main(int argc, char* argvp[]) {
     GLuint view_uniform = shader.GetUniform("view");
     GLuint proj_uniform = shader.GetUniform("projection");
     GLuint sampler_uniform = shader.GetUniform("texarray");
+    GLuint chunk_offset_uniform = shader.GetUniform("chunkOffset");
 
     glUniform1i(sampler_uniform, 0);
 
@@ -135,7 +175,7 @@ int main(int argc, char* argvp[]) {
 
     mc::protocol::packets::PacketDispatcher dispatcher;
     terra::Camera camera(glm::vec3(0.0f, 0.0f, 9.0f), fov, aspect_ratio, 0.1f, view_distance);
-    terra::Game game(&dispatcher, *g_GameWindow, camera);
+    terra::Game game(&dispatcher, *g_GameWindow, camera, chunk_view_distance);
 
     try {
         std::cout << "Logging in." << std::endl;
@@ -148,18 +188,47 @@ int main(int argc, char* argvp[]) {
         return 1;
     }
 
-    terra::World world(game.GetNetworkClient().GetDispatcher());
+    // Declared before everything that submits jobs to it, which wait for their jobs when they are destroyed.
+    terra::JobSystem jobs(job_workers);
+
+    // Declared before the world so it's still around when the world stores its columns on destruction.
+    std::unique_ptr<terra::RegionCache> region_cache;
+
+    if (cache_enabled) {
+        region_cache = std::make_unique<terra::RegionCache>(cache_directory, cache_size_mb * 1024 * 1024);
+    }
+
+    terra::World world(game.GetNetworkClient().GetDispatcher(), &jobs);
+
+    if (region_cache) {
+        world.SetRegionCache(region_cache.get(), server + ":" + std::to_string(port));
+    }
+
+    world.SetDimensionStashLimit(static_cast<std::size_t>(dimension_stash_mb * 1024 * 1024));
+    // Size the lookup grid and the cache loads for the view distance that the server was asked for.
+    world.SetViewDistance(game.GetViewDistance());
 
-    auto mesh_gen = std::make_shared<terra::render::ChunkMeshGenerator>(&world, camera.GetPosition());
+    // The light engine must outlive the mesh generator, which reads its light.
+    auto light_engine = std::make_unique<terra::LightEngine>(&world);
+    auto mesh_gen = std::make_shared<terra::render::ChunkMeshGenerator>(&world, &jobs, camera.GetPosition());
+
+    mesh_gen->SetLightEngine(light_engine.get());
+    mesh_gen->SetGreedyMeshing(greedy_meshing);
 
     terra::ChatWindow chat(game.GetNetworkClient().GetDispatcher(), game.GetNetworkClient().GetConnection());
 
     game.CreatePlayer(&world);
 
+    auto last_memory_stats = std::chrono::steady_clock::now();
+
     while (!glfwWindowShouldClose(window)) {
         glfwPollEvents();
 
         game.Update();
+        world.ProcessImports(std::chrono::milliseconds(4));
+        world.SetCenter(mc::ToVector3i(game.GetPosition()));
+        world.PublishSnapshot();
+        light_engine->Update();
         
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
@@ -168,7 +237,10 @@ int main(int argc, char* argvp[]) {
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         auto&& camera = game.GetCamera();
-        glm::mat4 viewMatrix = camera.GetViewMatrix();
+        // Everything is drawn relative to the camera, so the view matrix only rotates.
+        glm::mat4 viewMatrix = camera.GetRotationMatrix();
+        mc::Vector3d eye = game.GetEyePosition();
+        glm::dvec3 camera_position(eye.x, eye.y, eye.z);
         terra::math::volumes::Frustum frustum = camera.GetFrustum();
 
         shader.Use();
@@ -188,16 +260,18 @@ int main(int argc, char* argvp[]) {
 
                 if (!frustum.Intersects(chunk_bounds)) continue;
 
-                mesh->Render(model_uniform);
+                mesh->Render(model_uniform, chunk_offset_uniform, camera_position);
             }
 
             glBindVertexArray(block_vao);
+            // Entities are positioned by their model matrix instead, which is also relative to the camera.
+            glUniform3f(chunk_offset_uniform, 0.0f, 0.0f, 0.0f);
 
             auto entity_manager = game.GetNetworkClient().GetEntityManager();
             for (auto f = entity_manager->begin(); f != entity_manager->end(); ++f) {
                 auto&& entity = f->second;
                 if (entity_manager->GetPlayerEntity() == entity) continue;
-                mc::Vector3d position = entity->GetPosition() + mc::Vector3d(0, 0.5, 0);
+                mc::Vector3d position = entity->GetPosition() + mc::Vector3d(0, 0.5, 0) - eye;
 
                 glm::mat4 model(1.0);
                 model = glm::translate(model, glm::vec3(position.x, position.y + 0.5, position.z));
@@ -218,6 +292,14 @@ int main(int argc, char* argvp[]) {
             
             ImGui::Text("%.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
 
+            terra::DimensionStashStats stash_stats = world.GetDimensionStashStats();
+            ImGui::Text("Dimension stash: %zu (%.1f MB), %llu hits, %llu misses, %llu evictions", stash_stats.dimensions, stash_stats.memory / (1024.0f * 1024.0f),
+                (unsigned long long)stash_stats.hits, (unsigned long long)stash_stats.misses, (unsigned long long)stash_stats.evictions);
+
+            if (ImGui::CollapsingHeader("Memory")) {
+                terra::RenderMemoryStats(terra::CollectMemoryStats(world, *mesh_gen, *light_engine, g_AssetCache->GetTextures(), region_cache.get()));
+            }
+
             ImGui::End();
         }
 
@@ -233,9 +315,19 @@ int main(int argc, char* argvp[]) {
         glfwSwapBuffers(window);
 
         mesh_gen->ProcessChunks();
+
+        if (!memory_stats_path.empty() && std::chrono::steady_clock::now() - last_memory_stats >= std::chrono::duration<float>(memory_stats_interval)) {
+            terra::WriteMemoryStats(terra::CollectMemoryStats(world, *mesh_gen, *light_engine, g_AssetCache->GetTextures(), region_cache.get()), memory_stats_path);
+            last_memory_stats = std::chrono::steady_clock::now();
+        }
+    }
+
+    if (!memory_stats_path.empty()) {
+        terra::WriteMemoryStats(terra::CollectMemoryStats(world, *mesh_gen, *light_engine, g_AssetCache->GetTextures(), region_cache.get()), memory_stats_path);
     }
 
     mesh_gen.reset();
+    light_engine.reset();
 
     return 0;
 }
@@ -246,73 +338,66 @@ GLuint CreateBlockVAO() {
     glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
 
-    GLfloat tex_index = 2;
-
-    GLfloat vertices[] = {
-        // Positions           // Normals           // Texture Coords // Texture Index // Tint
-        -0.5f, -0.5f, 0.5f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, tex_index, 0.0, 0.0, 0.0, // Front Bottom Left
-        0.5f, -0.5f, 0.5f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, tex_index, 0.0, 0.0, 0.0, // Front Bottom Right
-        0.5f, 0.5f, 0.5f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, tex_index, 0.0, 0.0, 0.0,// Front Top Right
-        0.5f, 0.5f, 0.5f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, tex_index, 0.0, 0.0, 0.0,// Front Top Right
-        -0.5f, 0.5f, 0.5f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f, tex_index, 0.0, 0.0, 0.0,// Front Top Left
-        -0.5f, -0.5f, 0.5f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, tex_index, 0.0, 0.0, 0.0,// Front Bottom Left
-
-        -0.5f, -0.5f, -0.5f, 0.0f, 0.0f, -1.0f, 0.0f, 0.0f, tex_index, 0.0, 0.0, 0.0,// Back Bottom Left
-        -0.5f, 0.5f, -0.5f, 0.0f, 0.0f, -1.0f, 0.0f, 1.0f, tex_index, 0.0, 0.0, 0.0,// Back Top Left
-        0.5f, 0.5f, -0.5f, 0.0f, 0.0f, -1.0f, 1.0f, 1.0f, tex_index, 0.0, 0.0, 0.0,// Back Top Right
-        0.5f, 0.5f, -0.5f, 0.0f, 0.0f, -1.0f, 1.0f, 1.0f, tex_index, 0.0, 0.0, 0.0,// Back Top Right
-        0.5f, -0.5f, -0.5f, 0.0f, 0.0f, -1.0f, 1.0f, 0.0f, tex_index, 0.0, 0.0, 0.0,// Back Bottom Right
-        -0.5f, -0.5f, -0.5f, 0.0f, 0.0f, -1.0f, 0.0f, 0.0f, tex_index, 0.0, 0.0, 0.0, // Back Bottom Left
-
-        -0.5f, 0.5f, 0.5f, -1.0f, 0.0f, 0.0f, 1.0f, 0.0f, tex_index, 0.0, 0.0, 0.0, // Front Top Left
-        -0.5f, 0.5f, -0.5f, -1.0f, 0.0f, 0.0f, 1.0f, 1.0f, tex_index, 0.0, 0.0, 0.0,// Back Top Left
-        -0.5f, -0.5f, -0.5f, -1.0f, 0.0f, 0.0f, 0.0f, 1.0f, tex_index, 0.0, 0.0, 0.0, // Back Bottom Left
-        -0.5f, -0.5f, -0.5f, -1.0f, 0.0f, 0.0f, 0.0f, 1.0f, tex_index, 0.0, 0.0, 0.0,// Back Bottom Left
-        -0.5f, -0.5f, 0.5f, -1.0f, 0.0f, 0.0f, 0.0f, 0.0f, tex_index, 0.0, 0.0, 0.0, // Front Bottom Left
-        -0.5f, 0.5f, 0.5f, -1.0f, 0.0f, 0.0f, 1.0f, 0.0f, tex_index, 0.0, 0.0, 0.0, // Front Top Left
-
-        0.5f, 0.5f, 0.5f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, tex_index, 0.0, 0.0, 0.0,// Front Top Right
-        0.5f, -0.5f, 0.5f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, tex_index, 0.0, 0.0, 0.0,// Front Bottom Right
-        0.5f, -0.5f, -0.5f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, tex_index, 0.0, 0.0, 0.0,// Back Bottom Right
-        0.5f, -0.5f, -0.5f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, tex_index, 0.0, 0.0, 0.0,// Back Bottom Right
-        0.5f, 0.5f, -0.5f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, tex_index, 0.0, 0.0, 0.0,// Back Top Right
-        0.5f, 0.5f, 0.5f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, tex_index, 0.0, 0.0, 0.0,// Front Top Right
-
-        -0.5f, -0.5f, -0.5f, 0.0f, -1.0f, 0.0f, 0.0f, 1.0f, tex_index, 0.0, 0.0, 0.0,// Back Bottom Left
-        0.5f, -0.5f, -0.5f, 0.0f, -1.0f, 0.0f, 1.0f, 1.0f, tex_index, 0.0, 0.0, 0.0,// Back Bottom Right
-        0.5f, -0.5f, 0.5f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, tex_index, 0.0, 0.0, 0.0,// Front Bottom Right
-        0.5f, -0.5f, 0.5f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, tex_index, 0.0, 0.0, 0.0,// Front Bottom Right
-        -0.5f, -0.5f, 0.5f, 0.0f, -1.0f, 0.0f, 0.0f, 0.0f, tex_index, 0.0, 0.0, 0.0,// Front Bottom Left
-        -0.5f, -0.5f, -0.5f, 0.0f, -1.0f, 0.0f, 0.0f, 1.0f, tex_index, 0.0, 0.0, 0.0,// Back Bottom Left
-
-        -0.5f, 0.5f, -0.5f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, tex_index, 0.0, 0.0, 0.0,// Back Top Left
-        -0.5f, 0.5f, 0.5f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, tex_index, 0.0, 0.0, 0.0,// Front Top Left
-        0.5f, 0.5f, 0.5f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, tex_index, 0.0, 0.0, 0.0,// Front Top Right
-        0.5f, 0.5f, 0.5f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, tex_index, 0.0, 0.0, 0.0,// Front Top Right
-        0.5f, 0.5f, -0.5f, 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, tex_index, 0.0, 0.0, 0.0,// Back Top Right
-        -0.5f, 0.5f, -0.5f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, tex_index, 0.0, 0.0, 0.0,// Back Top Left 
+    const u32 tex_index = 2;
+
+    const GLfloat cube[] = {
+        // Positions           // Texture Coords
+        -0.5f, -0.5f, 0.5f, 0.0f, 0.0f, // Front Bottom Left
+        0.5f, -0.5f, 0.5f, 1.0f, 0.0f, // Front Bottom Right
+        0.5f, 0.5f, 0.5f, 1.0f, 1.0f, // Front Top Right
+        0.5f, 0.5f, 0.5f, 1.0f, 1.0f, // Front Top Right
+        -0.5f, 0.5f, 0.5f, 0.0f, 1.0f, // Front Top Left
+        -0.5f, -0.5f, 0.5f, 0.0f, 0.0f, // Front Bottom Left
+
+        -0.5f, -0.5f, -0.5f, 0.0f, 0.0f, // Back Bottom Left
+        -0.5f, 0.5f, -0.5f, 0.0f, 1.0f, // Back Top Left
+        0.5f, 0.5f, -0.5f, 1.0f, 1.0f, // Back Top Right
+        0.5f, 0.5f, -0.5f, 1.0f, 1.0f, // Back Top Right
+        0.5f, -0.5f, -0.5f, 1.0f, 0.0f, // Back Bottom Right
+        -0.5f, -0.5f, -0.5f, 0.0f, 0.0f, // Back Bottom Left
+
+        -0.5f, 0.5f, 0.5f, 1.0f, 0.0f, // Front Top Left
+        -0.5f, 0.5f, -0.5f, 1.0f, 1.0f, // Back Top Left
+        -0.5f, -0.5f, -0.5f, 0.0f, 1.0f, // Back Bottom Left
+        -0.5f, -0.5f, -0.5f, 0.0f, 1.0f, // Back Bottom Left
+        -0.5f, -0.5f, 0.5f, 0.0f, 0.0f, // Front Bottom Left
+        -0.5f, 0.5f, 0.5f, 1.0f, 0.0f, // Front Top Left
+
+        0.5f, 0.5f, 0.5f, 1.0f, 0.0f, // Front Top Right
+        0.5f, -0.5f, 0.5f, 0.0f, 0.0f, // Front Bottom Right
+        0.5f, -0.5f, -0.5f, 0.0f, 1.0f, // Back Bottom Right
+        0.5f, -0.5f, -0.5f, 0.0f, 1.0f, // Back Bottom Right
+        0.5f, 0.5f, -0.5f, 1.0f, 1.0f, // Back Top Right
+        0.5f, 0.5f, 0.5f, 1.0f, 0.0f, // Front Top Right
+
+        -0.5f, -0.5f, -0.5f, 0.0f, 1.0f, // Back Bottom Left
+        0.5f, -0.5f, -0.5f, 1.0f, 1.0f, // Back Bottom Right
+        0.5f, -0.5f, 0.5f, 1.0f, 0.0f, // Front Bottom Right
+        0.5f, -0.5f, 0.5f, 1.0f, 0.0f, // Front Bottom Right
+        -0.5f, -0.5f, 0.5f, 0.0f, 0.0f, // Front Bottom Left
+        -0.5f, -0.5f, -0.5f, 0.0f, 1.0f, // Back Bottom Left
+
+        -0.5f, 0.5f, -0.5f, 0.0f, 1.0f, // Back Top Left
+        -0.5f, 0.5f, 0.5f, 0.0f, 0.0f, // Front Top Left
+        0.5f, 0.5f, 0.5f, 1.0f, 0.0f, // Front Top Right
+        0.5f, 0.5f, 0.5f, 1.0f, 0.0f, // Front Top Right
+        0.5f, 0.5f, -0.5f, 1.0f, 1.0f, // Back Top Right
+        -0.5f, 0.5f, -0.5f, 0.0f, 1.0f, // Back Top Left
     };
 
+    std::vector<terra::render::Vertex> vertices;
+
+    for (std::size_t i = 0; i < sizeof(cube) / sizeof(*cube); i += 5) {
+        // Entities aren't lit or occluded yet, so they get full sky light and no ambient occlusion.
+        vertices.emplace_back(glm::vec3(cube[i], cube[i + 1], cube[i + 2]), glm::vec2(cube[i + 3], cube[i + 4]), tex_index, 0, 3, 0xF0);
+    }
+
     GLuint vbo;
     glGenBuffers(1, &vbo);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-    // Position
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(CubeVertex), (void*)offsetof(CubeVertex, position));
-    glEnableVertexAttribArray(0);
-
-    // TextureCoord
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(CubeVertex), (void*)offsetof(CubeVertex, uv));
-    glEnableVertexAttribArray(1);
-
-    // TextureCoord
-    glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, sizeof(CubeVertex), (void*)offsetof(CubeVertex, texture_index));
-    glEnableVertexAttribArray(2);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(terra::render::Vertex) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
 
-    // Tint
-    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(CubeVertex), (void*)offsetof(CubeVertex, tint));
-    glEnableVertexAttribArray(3);
+    terra::render::SetVertexAttributes();
     
     return vao;
 }
@@ -9,10 +9,12 @@
 namespace terra {
 namespace render {
 
-ChunkMesh::ChunkMesh(unsigned int vao, unsigned int vbo, GLsizei vertex_count) 
+ChunkMesh::ChunkMesh(unsigned int vao, unsigned int vbo, GLsizei vertex_count, std::size_t buffer_size, const glm::dvec3& offset) 
     : m_VAO(vao), 
       m_VBO(vbo), 
-      m_VertexCount(vertex_count) 
+      m_VertexCount(vertex_count),
+      m_BufferSize(buffer_size),
+      m_Offset(offset)
 {
 
 }
@@ -21,25 +23,33 @@ ChunkMesh::ChunkMesh(const ChunkMesh& other) {
     this->m_VAO = other.m_VAO;
     this->m_VBO = other.m_VBO;
     this->m_VertexCount = other.m_VertexCount;
+    this->m_BufferSize = other.m_BufferSize;
+    this->m_Offset = other.m_Offset;
 }
 
 ChunkMesh& ChunkMesh::operator=(const ChunkMesh& other) {
     this->m_VAO = other.m_VAO;
     this->m_VBO = other.m_VBO;
     this->m_VertexCount = other.m_VertexCount;
+    this->m_BufferSize = other.m_BufferSize;
+    this->m_Offset = other.m_Offset;
 
     return *this;
 }
 
-void ChunkMesh::Render(unsigned int model_uniform) {
+void ChunkMesh::Render(unsigned int model_uniform, unsigned int offset_uniform, const glm::dvec3& camera_position) {
     static const glm::mat4 modelMatrix(1.0);
 
     glBindVertexArray(m_VAO);
     g_AssetCache->GetTextures().Bind();
 
     glUniformMatrix4fv(model_uniform, 1, GL_FALSE, glm::value_ptr(modelMatrix));
+    glm::vec3 offset(m_Offset - camera_position);
 
-    glDrawArrays(GL_TRIANGLES, 0, m_VertexCount);
+    glUniform3fv(offset_uniform, 1, glm::value_ptr(offset));
+
+    // Each quad is four vertices and six indices in the shared quad index buffer that the VAO has bound.
+    glDrawElements(GL_TRIANGLES, m_VertexCount / 4 * 6, GL_UNSIGNED_INT, nullptr);
 
     GLenum error;
 
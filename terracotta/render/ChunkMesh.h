@@ -3,23 +3,33 @@
 
 #include "Shader.h"
 #include <cstddef>
+#include <glm/glm.hpp>
 
 namespace terra {
 namespace render {
 
 class ChunkMesh {
 public:
-    ChunkMesh(unsigned int vao, unsigned int vbo, GLsizei vertex_count);
+    // Offset is the world position of the chunk, which the vertex positions are relative to.
+    ChunkMesh(unsigned int vao, unsigned int vbo, GLsizei vertex_count, std::size_t buffer_size, const glm::dvec3& offset);
     ChunkMesh(const ChunkMesh& other);
     ChunkMesh& operator=(const ChunkMesh& other);
 
-    void Render(unsigned int model_uniform);
+    // The offset uniform is set to the chunk position relative to the camera. It's subtracted in double precision,
+    // so the float that's uploaded stays small and precise far from the world origin.
+    void Render(unsigned int model_uniform, unsigned int offset_uniform, const glm::dvec3& camera_position);
     void Destroy();
 
+    GLsizei GetVertexCount() const { return m_VertexCount; }
+    // Bytes of vertex data stored on the GPU.
+    std::size_t GetMemoryUsage() const { return m_BufferSize; }
+
 private:
     unsigned int m_VAO;
     unsigned int m_VBO;
     GLsizei m_VertexCount;
+    std::size_t m_BufferSize;
+    glm::dvec3 m_Offset;
 };
 
 } // ns render
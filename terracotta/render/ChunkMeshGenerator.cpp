@@ -1,6 +1,8 @@
 #include "ChunkMeshGenerator.h"
 
 #include "../assets/AssetCache.h"
+#include "../EpochManager.h"
+#include "../WorldSnapshot.h"
 #include "../math/TypeUtil.h"
 #include "../block/BlockModel.h"
 #include "../block/BlockState.h"
@@ -9,76 +11,261 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <iostream>
 #include <algorithm>
-#include <thread>
-#define _USE_MATH_DEFINES
-#include <math.h>
-#include <glm/gtc/quaternion.hpp>
 
 namespace terra {
 namespace render {
 
-ChunkMeshGenerator::ChunkMeshGenerator(terra::World* world, const glm::vec3& camera_position) : m_World(world), m_ChunkBuildQueue(ChunkMeshBuildComparator(camera_position)) {
-    world->RegisterListener(this);
+// A corner of a full cube face, in the order of block::kFaceCorners.
+struct CubeFaceCorner {
+    // The neighbors that shade the corner, relative to the block.
+    mc::Vector3i side1;
+    mc::Vector3i side2;
+    mc::Vector3i corner;
+};
+
+struct CubeFace {
+    mc::Vector3i normal;
+    // The axes that the texture u and v run along. The remaining axis is the normal.
+    int u_axis;
+    int v_axis;
+    CubeFaceCorner corners[4];
+};
+
+// The normal, texture axes and corner neighbors of each face, indexed by BlockFace.
+static const CubeFace kCubeFaces[] = {
+    // North
+    { mc::Vector3i(0, 0, -1), 0, 1, {
+        { mc::Vector3i(1, 0, -1), mc::Vector3i(0, -1, -1), mc::Vector3i(1, -1, -1) },
+        { mc::Vector3i(0, -1, -1), mc::Vector3i(-1, 0, -1), mc::Vector3i(-1, -1, -1) },
+        { mc::Vector3i(0, 1, -1), mc::Vector3i(-1, 0, -1), mc::Vector3i(-1, 1, -1) },
+        { mc::Vector3i(0, 1, -1), mc::Vector3i(1, 0, -1), mc::Vector3i(1, 1, -1) },
+    } },
+    // East
+    { mc::Vector3i(1, 0, 0), 2, 1, {
+        { mc::Vector3i(1, 0, 1), mc::Vector3i(1, -1, 0), mc::Vector3i(1, -1, 1) },
+        { mc::Vector3i(1, -1, 0), mc::Vector3i(1, 0, -1), mc::Vector3i(1, -1, -1) },
+        { mc::Vector3i(1, 1, 0), mc::Vector3i(1, 0, -1), mc::Vector3i(1, 1, -1) },
+        { mc::Vector3i(1, 1, 0), mc::Vector3i(1, 0, 1), mc::Vector3i(1, 1, 1) },
+    } },
+    // South
+    { mc::Vector3i(0, 0, 1), 0, 1, {
+        { mc::Vector3i(-1, 0, 1), mc::Vector3i(0, -1, 1), mc::Vector3i(-1, -1, 1) },
+        { mc::Vector3i(1, 0, 1), mc::Vector3i(0, -1, 1), mc::Vector3i(1, -1, 1) },
+        { mc::Vector3i(0, 1, 1), mc::Vector3i(1, 0, 1), mc::Vector3i(1, 1, 1) },
+        { mc::Vector3i(0, 1, 1), mc::Vector3i(-1, 0, 1), mc::Vector3i(-1, 1, 1) },
+    } },
+    // West
+    { mc::Vector3i(-1, 0, 0), 2, 1, {
+        { mc::Vector3i(-1, -1, 0), mc::Vector3i(-1, 0, -1), mc::Vector3i(-1, -1, -1) },
+        { mc::Vector3i(-1, -1, 0), mc::Vector3i(-1, 0, 1), mc::Vector3i(-1, -1, 1) },
+        { mc::Vector3i(-1, 1, 0), mc::Vector3i(-1, 0, 1), mc::Vector3i(-1, 1, 1) },
+        { mc::Vector3i(-1, 1, 0), mc::Vector3i(-1, 0, -1), mc::Vector3i(-1, 1, -1) },
+    } },
+    // Up
+    { mc::Vector3i(0, 1, 0), 0, 2, {
+        { mc::Vector3i(-1, 1, 0), mc::Vector3i(0, 1, -1), mc::Vector3i(-1, 1, -1) },
+        { mc::Vector3i(-1, 1, 0), mc::Vector3i(0, 1, 1), mc::Vector3i(-1, 1, 1) },
+        { mc::Vector3i(1, 1, 0), mc::Vector3i(0, 1, 1), mc::Vector3i(1, 1, 1) },
+        { mc::Vector3i(1, 1, 0), mc::Vector3i(0, 1, -1), mc::Vector3i(1, 1, -1) },
+    } },
+    // Down
+    { mc::Vector3i(0, -1, 0), 0, 2, {
+        { mc::Vector3i(1, -1, 0), mc::Vector3i(0, -1, -1), mc::Vector3i(1, -1, -1) },
+        { mc::Vector3i(1, -1, 0), mc::Vector3i(0, -1, 1), mc::Vector3i(1, -1, 1) },
+        { mc::Vector3i(-1, -1, 0), mc::Vector3i(0, -1, 1), mc::Vector3i(-1, -1, 1) },
+        { mc::Vector3i(-1, -1, 0), mc::Vector3i(0, -1, -1), mc::Vector3i(-1, -1, -1) },
+    } },
+};
+
+// Maps the solidity of the 3x3 blocks in front of a face to the packed occlusion of its corners, indexed by BlockFace.
+// Bit (u + 1) + (v + 1) * 3 of the index is the block at offset u and v along the face axes.
+struct OcclusionTable {
+    u8 occlusion[6][512];
+
+    OcclusionTable() {
+        for (std::size_t face_index = 0; face_index < 6; ++face_index) {
+            const CubeFace& cube_face = kCubeFaces[face_index];
+
+            auto is_solid = [&cube_face](u32 neighborhood, const mc::Vector3i& offset) {
+                int bit = (offset[cube_face.u_axis] + 1) + (offset[cube_face.v_axis] + 1) * 3;
+
+                return static_cast<int>((neighborhood >> bit) & 1);
+            };
+
+            for (u32 neighborhood = 0; neighborhood < 512; ++neighborhood) {
+                u8 packed = 0;
+
+                for (std::size_t i = 0; i < 4; ++i) {
+                    const CubeFaceCorner& corner = cube_face.corners[i];
+                    int value1 = is_solid(neighborhood, corner.side1);
+                    int value2 = is_solid(neighborhood, corner.side2);
+                    int value_corner = is_solid(neighborhood, corner.corner);
+                    int value = (value1 && value2) ? 0 : 3 - (value1 + value2 + value_corner);
+
+                    packed |= static_cast<u8>(value << (i * 2));
+                }
+
+                occlusion[face_index][neighborhood] = packed;
+            }
+        }
+    }
+};
 
-    m_Working = true;
-    unsigned int count = std::thread::hardware_concurrency() - 1;
+static const OcclusionTable kOcclusionTable;
 
-    std::cout << "Creating " << count << " mesh worker threads." << std::endl;
+void ChunkMeshBuildContext::BuildSolidity() {
+    for (std::size_t row = 0; row < 18 * 18; ++row) {
+        const u16* blocks = chunk_data + row * 18;
+        u32 bits = 0;
+
+        for (u32 x = 0; x < 18; ++x) {
+            // Unloaded blocks map to the missing state properties, which aren't solid.
+            bits |= static_cast<u32>(g_AssetCache->GetStateProperties(blocks[x]).solid) << x;
+        }
 
-    for (unsigned int i = 0; i < count; ++i) {
-        m_Workers.emplace_back(&ChunkMeshGenerator::WorkerUpdate, this);
+        solid_rows[row] = bits;
     }
 }
 
-ChunkMeshGenerator::~ChunkMeshGenerator() {
-    m_Working = false;
+u8 ChunkMeshBuildContext::GetFaceOcclusion(const mc::Vector3i& pos, block::BlockFace face) const {
+    const std::size_t face_index = static_cast<std::size_t>(face);
+    const CubeFace& cube_face = kCubeFaces[face_index];
+    // The block in front of the face, in chunk_data coordinates.
+    const mc::Vector3i front = pos - world_position + cube_face.normal + mc::Vector3i(1, 1, 1);
+    u32 neighborhood = 0;
+
+    if (cube_face.u_axis == 0) {
+        // The u axis runs along the rows, so each row of the neighborhood is three adjacent bits.
+        for (int v = -1; v <= 1; ++v) {
+            mc::Vector3i row = front;
 
-    m_BuildCV.notify_all();
+            row[cube_face.v_axis] += v;
+
+            neighborhood |= ((solid_rows[row.y * 18 + row.z] >> (row.x - 1)) & 7) << ((v + 1) * 3);
+        }
+    } else {
+        for (int v = -1; v <= 1; ++v) {
+            for (int u = -1; u <= 1; ++u) {
+                mc::Vector3i offset = front;
 
-    for (auto& worker : m_Workers) {
-        worker.join();
+                offset[cube_face.u_axis] += u;
+                offset[cube_face.v_axis] += v;
+
+                neighborhood |= ((solid_rows[offset.y * 18 + offset.z] >> offset.x) & 1) << ((u + 1) + (v + 1) * 3);
+            }
+        }
     }
 
-    m_World->UnregisterListener(this);
+    return kOcclusionTable.occlusion[face_index][neighborhood];
 }
 
-void ChunkMeshGenerator::OnBlockChange(mc::Vector3i position, mc::block::BlockPtr newBlock, mc::block::BlockPtr oldBlock) {
-    terra::ChunkColumnPtr column = m_World->GetChunk(position);
-    const mc::Vector3i chunk_base(column->GetMetadata().x * 16, (position.y / 16) * 16, column->GetMetadata().z * 16);
-    int chunk_x = column->GetMetadata().x;
-    int chunk_y = static_cast<int>(position.y / 16);
-    int chunk_z = column->GetMetadata().z;
+// A visible full cube face in a greedy meshing slice. Block 0 is air, which never has faces, so it marks an empty cell.
+struct GreedyFace {
+    u16 block;
+    u8 light;
+    // The ambient occlusion of the four corners, two bits each.
+    u8 ambient_occlusion;
 
-    auto iter = m_ChunkMeshes.find(chunk_base);
+    bool operator==(const GreedyFace& other) const {
+        return block == other.block && light == other.light && ambient_occlusion == other.ambient_occlusion;
+    }
 
-    if (iter == m_ChunkMeshes.end()) {
-        GenerateMesh(chunk_x, chunk_y, chunk_z);
-        return;
+    // Occlusion that changes across the face is interpolated per block, so only faces with flat occlusion can be merged.
+    bool IsMergeable() const {
+        return ambient_occlusion == 0x00 || ambient_occlusion == 0x55 || ambient_occlusion == 0xAA || ambient_occlusion == 0xFF;
     }
+};
+
+void SetVertexAttributes() {
+    // Position
+    glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
+    glEnableVertexAttribArray(0);
+
+    // TextureIndex
+    glVertexAttribIPointer(1, 1, GL_UNSIGNED_SHORT, sizeof(Vertex), (void*)offsetof(Vertex, texture_index));
+    glEnableVertexAttribArray(1);
+
+    // Texture coordinates, tint, ambient occlusion and light
+    glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, sizeof(Vertex), (void*)offsetof(Vertex, data));
+    glEnableVertexAttribArray(2);
+}
 
-    // TODO: Incremental update somehow?
-    EnqueueBuildWork(chunk_x, chunk_y, chunk_z);
+ChunkMeshGenerator::ChunkMeshGenerator(terra::World* world, terra::JobSystem* jobs, const glm::vec3& camera_position)
+    : m_ChunkBuildQueue(ChunkMeshBuildComparator(camera_position)),
+      m_World(world),
+      m_Jobs(jobs),
+      m_LightEngine(nullptr),
+      m_GreedyMeshing(true),
+      m_Generation(0),
+      m_MeshBytes(0),
+      m_StashedMeshBytes(0),
+      m_UploadedVertices(0),
+      m_UploadedBytes(0),
+      m_QuadIndexBuffer(0),
+      m_QuadIndexCapacity(0)
+{
+    world->RegisterListener(this);
 
-    if (position.x % 16 == 0) {
-        EnqueueBuildWork(chunk_x - 1, chunk_y, chunk_z);
-    } else if (position.x % 16 == 15) {
-        EnqueueBuildWork(chunk_x + 1, chunk_y, chunk_z);
+    for (std::size_t i = 0; i < jobs->GetWorkerCount(); ++i) {
+        m_Contexts.push_back(std::make_unique<ChunkMeshBuildContext>());
     }
+}
+
+ChunkMeshGenerator::~ChunkMeshGenerator() {
+    m_BuildToken.Cancel();
+    m_Jobs->Wait(m_BuildToken);
 
-    if (position.y % 16 == 0) {
-        EnqueueBuildWork(chunk_x, chunk_y - 1, chunk_z);
-    } else if (position.y % 16 == 15) {
-        EnqueueBuildWork(chunk_x, chunk_y + 1, chunk_z);
+    m_World->UnregisterListener(this);
+
+    if (m_QuadIndexBuffer != 0) {
+        glDeleteBuffers(1, &m_QuadIndexBuffer);
     }
+}
 
-    if (position.z % 16 == 0) {
-        EnqueueBuildWork(chunk_x, chunk_y, chunk_z - 1);
-    } else if (position.z % 16 == 15) {
+void ChunkMeshGenerator::OnBlockChangeBatch(const terra::BlockChangeBatch& batch) {
+    // The light engine reports the changed sections and the neighbors on their borders once it has relit them.
+    if (m_LightEngine != nullptr) return;
+
+    for (const auto& section : batch.sections) {
+        s64 chunk_x = section.chunk.x;
+        s64 chunk_y = section.chunk.y;
+        s64 chunk_z = section.chunk.z;
+
+        auto iter = m_ChunkMeshes.find(mc::Vector3i(chunk_x * 16, chunk_y * 16, chunk_z * 16));
+
+        // TODO: Incremental update somehow?
         EnqueueBuildWork(chunk_x, chunk_y, chunk_z);
+
+        // The neighbors are already queued if this section didn't have a mesh yet.
+        if (iter == m_ChunkMeshes.end()) continue;
+
+        // Rebuild each neighbor once if any change in this section is on the border shared with it.
+        bool borders[6] = {};
+
+        for (std::size_t i = section.begin; i < section.end; ++i) {
+            const mc::Vector3i& position = batch.changes[i].position;
+
+            borders[0] |= (position.x & 15) == 0;
+            borders[1] |= (position.x & 15) == 15;
+            borders[2] |= (position.y & 15) == 0;
+            borders[3] |= (position.y & 15) == 15;
+            borders[4] |= (position.z & 15) == 0;
+            borders[5] |= (position.z & 15) == 15;
+        }
+
+        if (borders[0]) EnqueueBuildWork(chunk_x - 1, chunk_y, chunk_z);
+        if (borders[1]) EnqueueBuildWork(chunk_x + 1, chunk_y, chunk_z);
+        if (borders[2]) EnqueueBuildWork(chunk_x, chunk_y - 1, chunk_z);
+        if (borders[3]) EnqueueBuildWork(chunk_x, chunk_y + 1, chunk_z);
+        if (borders[4]) EnqueueBuildWork(chunk_x, chunk_y, chunk_z - 1);
+        if (borders[5]) EnqueueBuildWork(chunk_x, chunk_y, chunk_z + 1);
     }
 }
 
 void ChunkMeshGenerator::OnChunkLoad(terra::ChunkPtr chunk, const terra::ChunkColumnMetadata& meta, u16 index_y) {
+    // The light engine reports the chunk and its neighbors once it has lit them.
+    if (m_LightEngine != nullptr) return;
+
     EnqueueBuildWork(meta.x, index_y, meta.z);
 
     EnqueueBuildWork(meta.x - 1, index_y, meta.z);
@@ -92,95 +279,78 @@ void ChunkMeshGenerator::OnChunkLoad(terra::ChunkPtr chunk, const terra::ChunkCo
 void ChunkMeshGenerator::EnqueueBuildWork(long chunk_x, int chunk_y, long chunk_z) {
     mc::Vector3i position(chunk_x * 16, chunk_y * 16, chunk_z * 16);
 
-    auto iter = std::find(m_ChunkPushQueue.begin(), m_ChunkPushQueue.end(), position);
-
-    if (iter == m_ChunkPushQueue.end()) {
+    if (m_ChunkPushSet.insert(position).second) {
         m_ChunkPushQueue.push_back(position);
     }
 }
 
-void ChunkMeshGenerator::WorkerUpdate() {
-    while (m_Working) {
-        if (m_ChunkBuildQueue.Empty()) {
-            std::unique_lock<std::mutex> lock(m_QueueMutex);
-            m_BuildCV.wait(lock);
-        }
+void ChunkMeshGenerator::BuildNextChunk() {
+    int worker_index = m_Jobs->GetWorkerIndex();
+    if (worker_index < 0) return;
 
-        std::shared_ptr<ChunkMeshBuildContext> ctx;
+    ChunkMeshBuildContext& ctx = *m_Contexts[worker_index];
 
-        {
-            std::lock_guard<std::mutex> lock(m_QueueMutex);
+    {
+        std::lock_guard<std::mutex> lock(m_QueueMutex);
 
-            if (m_ChunkBuildQueue.Empty()) continue;
+        // The queue is cleared when the dimension changes, which leaves its jobs nothing to build.
+        if (m_ChunkBuildQueue.Empty()) return;
 
-            ctx = m_ChunkBuildQueue.Pop();
-        }
+        ChunkMeshBuildRequest request = m_ChunkBuildQueue.Pop();
 
-        GenerateMesh(*ctx);
+        ctx.world_position = request.world_position;
+        ctx.generation = request.generation;
     }
-}
-
-void ChunkMeshGenerator::ProcessChunks() {
-    const std::size_t kMaxMeshesPerFrame = 64;
-
-    // Push any new chunks that were added this frame into the work queue
-    for (std::size_t i = 0; i < kMaxMeshesPerFrame && !m_ChunkPushQueue.empty(); ++i) {
-        mc::Vector3i chunk_base = m_ChunkPushQueue.front();
-        m_ChunkPushQueue.pop_front();
 
-        auto ctx = std::make_shared<ChunkMeshBuildContext>();
-
-        ctx->world_position = chunk_base;
-        mc::Vector3i offset_y(0, chunk_base.y, 0);
+    {
+        // The snapshot is only read while the guard is held. Building doesn't touch the world.
+        terra::EpochManager::ReadGuard guard(terra::GetEpochManager());
+        const terra::WorldSnapshot* snapshot = m_World->GetSnapshot();
 
-        terra::ChunkColumnPtr columns[3][3];
+        if (snapshot == nullptr) return;
 
-        columns[1][1] = m_World->GetChunk(chunk_base);
+        FillContext(*snapshot, m_LightEngine ? m_LightEngine->GetSnapshot() : nullptr, ctx);
+    }
 
-        // Cache the world data for this chunk so it can be pushed to another thread and built.
-        for (s64 y = 0; y < 18; ++y) {
-            for (s64 z = 0; z < 18; ++z) {
-                for (s64 x = 0; x < 18; ++x) {
-                    mc::Vector3i offset(x - 1, y - 1, z - 1);
-                    mc::block::BlockPtr block = nullptr;
+    GenerateMesh(ctx);
+}
 
-                    std::size_t x_index = (s64)std::floor(offset.x / 16.0) + 1;
-                    std::size_t z_index = (s64)std::floor(offset.z / 16.0) + 1;
-                    auto& column = columns[x_index][z_index];
+void ChunkMeshGenerator::ProcessChunks() {
+    const std::size_t kMaxMeshesPerFrame = 64;
 
-                    if (column == nullptr) {
-                        column = m_World->GetChunk(chunk_base + offset);
-                    }
+    if (m_LightEngine != nullptr) {
+        m_LightEngine->TakeDirtySections(m_LightDirtySections);
 
-                    if (column != nullptr) {
-                        mc::Vector3i lookup = offset + offset_y;
+        for (const mc::Vector3i& section : m_LightDirtySections) {
+            EnqueueBuildWork(section.x, (int)section.y, section.z);
+        }
 
-                        if (lookup.x < 0) {
-                            lookup.x += 16;
-                        } else if (lookup.x > 15) {
-                            lookup.x -= 16;
-                        }
+        m_LightDirtySections.clear();
+    }
 
-                        if (lookup.z < 0) {
-                            lookup.z += 16;
-                        } else if (lookup.z > 15) {
-                            lookup.z -= 16;
-                        }
+    // Push any new chunks that were added this frame into the work queue
+    for (std::size_t i = 0; i < kMaxMeshesPerFrame && !m_ChunkPushQueue.empty(); ++i) {
+        mc::Vector3i chunk_base = m_ChunkPushQueue.front();
+        m_ChunkPushQueue.pop_front();
+        m_ChunkPushSet.erase(chunk_base);
 
-                        block = column->GetBlock(lookup);
-                    }
+        terra::ChunkPtr chunk = GetChunk(chunk_base);
+        mc::block::BlockPtr uniform_block = chunk ? chunk->GetUniformBlock() : nullptr;
 
-                    ctx->chunk_data[y * 18 * 18 + z * 18 + x] = block;
-                }
-            }
+        // Chunks that can't contain any geometry don't need a snapshot or a worker to build them.
+        if (chunk == nullptr || chunk->IsEmpty() || (uniform_block != nullptr && IsEmptyBlock(uniform_block))) {
+            std::lock_guard<std::mutex> lock(m_PushMutex);
+            m_VertexPushes.push_back(std::make_unique<VertexPush>(chunk_base, m_Generation, std::make_unique<std::vector<Vertex>>()));
+            continue;
         }
 
+        // The worker copies the world data out of the snapshot that is published before this runs.
         {
             std::lock_guard<std::mutex> lock(m_QueueMutex);
-            m_ChunkBuildQueue.Push(ctx);
+            m_ChunkBuildQueue.Push(ChunkMeshBuildRequest(chunk_base, m_Generation));
         }
 
-        m_BuildCV.notify_one();
+        m_Jobs->Submit([this] { BuildNextChunk(); }, terra::JobPriority::Normal, m_BuildToken);
     }
 
     std::vector<std::unique_ptr<VertexPush>> pushes;
@@ -192,12 +362,17 @@ void ChunkMeshGenerator::ProcessChunks() {
     }
 
     for (auto&& push : pushes) {
+        // Built from a dimension that was left after the build started.
+        if (push->generation != m_Generation) continue;
+
         DestroyChunk(push->pos.x / 16, push->pos.y / 16, push->pos.z / 16);
 
         auto&& vertices = push->vertices;
 
         if (vertices->empty()) continue;
 
+        ReserveQuadIndices(vertices->size() / 4);
+
         GLuint vao = 0;
 
         glGenVertexArrays(1, &vao);
@@ -210,25 +385,9 @@ void ChunkMeshGenerator::ProcessChunks() {
         glBindBuffer(GL_ARRAY_BUFFER, vbo);
         glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertices->size(), &(*vertices)[0], GL_STATIC_DRAW);
 
-        // Position
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
-        glEnableVertexAttribArray(0);
-
-        // TextureCoord
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, uv));
-        glEnableVertexAttribArray(1);
-
-        // TextureIndex
-        glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, sizeof(Vertex), (void*)offsetof(Vertex, texture_index));
-        glEnableVertexAttribArray(2);
-
-        // Tint
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, tint));
-        glEnableVertexAttribArray(3);
+        SetVertexAttributes();
 
-        // Ambient occlusion
-        glVertexAttribIPointer(4, 1, GL_UNSIGNED_BYTE, sizeof(Vertex), (void*)offsetof(Vertex, ambient_occlusion));
-        glEnableVertexAttribArray(4);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_QuadIndexBuffer);
 
         GLenum error;
 
@@ -236,122 +395,98 @@ void ChunkMeshGenerator::ProcessChunks() {
             std::cout << "OpenGL error when creating mesh: " << error << std::endl;
         }
 
-        std::unique_ptr<terra::render::ChunkMesh> mesh = std::make_unique<terra::render::ChunkMesh>(vao, vbo, vertices->size());
+        std::unique_ptr<terra::render::ChunkMesh> mesh = std::make_unique<terra::render::ChunkMesh>(vao, vbo, vertices->size(), sizeof(Vertex) * vertices->size(), glm::dvec3(push->pos.x, push->pos.y, push->pos.z));
 
+        m_MeshBytes += mesh->GetMemoryUsage();
+        m_UploadedVertices += vertices->size();
+        m_UploadedBytes += mesh->GetMemoryUsage();
         m_ChunkMeshes[push->pos] = std::move(mesh);
     }
 }
 
-int ChunkMeshGenerator::GetAmbientOcclusion(ChunkMeshBuildContext& context, const mc::Vector3i& side1, const mc::Vector3i& side2, const mc::Vector3i& corner) {
-    int value1, value2, value_corner;
+void ChunkMeshGenerator::ReserveQuadIndices(std::size_t quads) {
+    // Enough for most chunks, so the buffer rarely grows.
+    const std::size_t kInitialQuads = 16384;
 
-    auto bs1 = context.GetBlock(side1);
-    auto bs2 = context.GetBlock(side2);
-    auto bsc = context.GetBlock(corner);
+    if (quads <= m_QuadIndexCapacity) return;
 
-    value1 = bs1 && bs1->IsSolid();
-    value2 = bs2 && bs2->IsSolid();
-    value_corner = bsc && bsc->IsSolid();
+    std::size_t capacity = std::max(std::max(quads, m_QuadIndexCapacity * 2), kInitialQuads);
+    std::vector<u32> indices;
 
-    if (value1 && value2) {
-        return 0;
-    }
+    indices.reserve(capacity * 6);
 
-    return 3 - (value1 + value2 + value_corner);
-}
+    for (u32 i = 0; i < capacity; ++i) {
+        u32 base = i * 4;
 
-bool ChunkMeshGenerator::IsOccluding(terra::block::BlockVariant* from_variant, terra::block::BlockFace face, mc::block::BlockPtr test_block) {
-    if (test_block == nullptr) return true;
-    if (from_variant->HasRotation()) return false;
+        indices.push_back(base);
+        indices.push_back(base + 1);
+        indices.push_back(base + 2);
 
-    for (auto& element : from_variant->GetModel()->GetElements()) {
-        if (element.GetFace(face).cull_face == block::BlockFace::None) {
-            return false;
-        }
+        indices.push_back(base + 2);
+        indices.push_back(base + 3);
+        indices.push_back(base);
     }
 
-    terra::block::BlockVariant* variant = g_AssetCache->GetVariant(test_block);
-    if (variant == nullptr) return false;
-
-    if (variant->HasRotation()) return false;
+    if (m_QuadIndexBuffer == 0) {
+        glGenBuffers(1, &m_QuadIndexBuffer);
+    }
 
-    terra::block::BlockModel* model = variant->GetModel();
-    if (model == nullptr) return false;
+    // The element buffer binding is part of the bound vertex array, so unbind it to keep it from being changed.
+    glBindVertexArray(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_QuadIndexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(u32) * indices.size(), indices.data(), GL_STATIC_DRAW);
 
-    bool is_full = false;
+    m_QuadIndexCapacity = capacity;
+}
 
-    block::BlockFace opposite = block::get_opposite_face(face);
-    auto& textures = g_AssetCache->GetTextures();
-    for (auto& element : model->GetElements()) {
-        auto opposite_face = element.GetFace(opposite);
-        bool transparent = textures.IsTransparent(opposite_face.texture);
-        bool full_extent = element.IsFullExtent();
+u8 ChunkMeshGenerator::GetFaceLight(ChunkMeshBuildContext& context, const mc::Vector3i& pos, const mc::Vector3i& neighbor) {
+    u8 light = context.GetLight(pos);
+    u8 neighbor_light = context.GetLight(neighbor);
 
-        if (full_extent && !transparent) {
-            is_full = true;
-        }
-    }
-    
-    return is_full;
+    return std::max(light & 0xF0, neighbor_light & 0xF0) | std::max(light & 0x0F, neighbor_light & 0x0F);
 }
 
-std::ostream& operator<<(std::ostream& out, const glm::vec3& vec) {
-    return out << "(" << vec.x << ", " << vec.y << ", " << vec.z << ")";
-}
+bool ChunkMeshGenerator::IsOccluding(u16 from_block, terra::block::BlockFace face, u16 test_block) {
+    // The face of the neighbor that touches each face, indexed by BlockFace.
+    static const block::BlockFace kOppositeFaces[] = {
+        block::BlockFace::South, block::BlockFace::West, block::BlockFace::North,
+        block::BlockFace::East, block::BlockFace::Down, block::BlockFace::Up
+    };
 
-void ApplyRotations(glm::vec3& bottom_left, glm::vec3& bottom_right, glm::vec3& top_left, glm::vec3& top_right, const glm::vec3& rotations, glm::vec3 offset = glm::vec3(0.5, 0.5, 0.5)) {
-    glm::quat quat(1, 0, 0, 0);
+    if (test_block == ChunkMeshBuildContext::UnloadedBlock) return true;
+    if (g_AssetCache->GetStateProperties(from_block).NeverCulls(face)) return false;
 
-    const float kToRads = (float)M_PI / 180.0f;
+    return g_AssetCache->GetStateProperties(test_block).IsOpaque(kOppositeFaces[static_cast<std::size_t>(face)]);
+}
 
-    if (rotations.z != 0) {
-        quat = glm::rotate(quat, kToRads * rotations.z, glm::vec3(0.0f, 0.0f, 1.0f));
-    }
+bool ChunkMeshGenerator::IsEmptyBlock(mc::block::BlockPtr block) {
+    return g_AssetCache->GetStateProperties(block->GetType()).empty;
+}
 
-    if (rotations.y != 0) {
-        quat = glm::rotate(quat, kToRads * -rotations.y, glm::vec3(0.0f, 1.0f, 0.0f));
-    }
+bool ChunkMeshGenerator::IsSelfOccluding(mc::block::BlockPtr block) {
+    const u16 id = static_cast<u16>(block->GetType());
+    if (g_AssetCache->GetVariant(id) == nullptr) return false;
 
-    if (rotations.x != 0) {
-        quat = glm::rotate(quat, kToRads * rotations.x, glm::vec3(1.0f, 0.0f, 0.0f));
+    for (std::size_t i = 0; i < 6; ++i) {
+        if (!IsOccluding(id, static_cast<block::BlockFace>(i), id)) {
+            return false;
+        }
     }
 
-    if (rotations.x != 0 || rotations.y != 0 || rotations.z != 0) {
-        bottom_left = glm::vec3(quat * glm::vec4(bottom_left - offset, 1.0)) + offset;
-        bottom_right = glm::vec3(quat * glm::vec4(bottom_right - offset, 1.0)) + offset;
-        top_left = glm::vec3(quat * glm::vec4(top_left - offset, 1.0)) + offset;
-        top_right = glm::vec3(quat * glm::vec4(top_right - offset, 1.0)) + offset;
-    }
+    return true;
 }
 
-// TODO: Rescaling?
-void ApplyRotations(glm::vec3& bottom_left, glm::vec3& bottom_right, glm::vec3& top_left, glm::vec3& top_right, const glm::vec3& variant_rotation, const block::ElementRotation& rotation) {
-    glm::vec3 rotations(rotation.angle, rotation.angle, rotation.angle);
-
-    glm::quat quat(1, 0, 0, 0);
+terra::ChunkPtr ChunkMeshGenerator::GetChunk(const mc::Vector3i& chunk_base) {
+    if (chunk_base.y < 0 || chunk_base.y >= 16 * terra::ChunkColumn::ChunksPerColumn) return nullptr;
 
-    const float kToRads = (float)M_PI / 180.0f;
+    terra::ChunkColumnPtr column = m_World->GetChunk(chunk_base);
+    if (column == nullptr) return nullptr;
 
-    if (variant_rotation.z != 0) {
-        quat = glm::rotate(quat, kToRads * variant_rotation.z, glm::vec3(0.0f, 0.0f, 1.0f));
-    }
-
-    if (variant_rotation.y != 0) {
-        quat = glm::rotate(quat, kToRads * -variant_rotation.y, glm::vec3(0.0f, 1.0f, 0.0f));
-    }
-
-    if (variant_rotation.x != 0) {
-        quat = glm::rotate(quat, kToRads * variant_rotation.x, glm::vec3(1.0f, 0.0f, 0.0f));
-    }
-    
-    if (rotation.rescale) {
-        rotations = rotations * (1.0f / std::cos(3.14159f / 4.0f) - 1.0f);
-    }
-
-    // Hadamard product to get just the one axis rotation
-    rotations = rotations * (quat * rotation.axis);
+    return (*column)[chunk_base.y / 16];
+}
 
-    ApplyRotations(bottom_left, bottom_right, top_left, top_right, rotations, quat * (rotation.origin - glm::vec3(0.5, 0.5, 0.5)) + glm::vec3(0.5, 0.5, 0.5));
+std::ostream& operator<<(std::ostream& out, const glm::vec3& vec) {
+    return out << "(" << vec.x << ", " << vec.y << ", " << vec.z << ")";
 }
 
 // TODO: Calculate occlusion under rotation
@@ -361,404 +496,396 @@ void ChunkMeshGenerator::GenerateMesh(ChunkMeshBuildContext& context) {
 
     vertices->reserve(12500);
 
-    static const glm::vec3 kTints[] = {
-        glm::vec3(1.0, 1.0, 1.0),
-        glm::vec3(137 / 255.0, 191 / 255.0, 98 / 255.0), // Grass
-        glm::vec3(0.22, 0.60, 0.21), // Leaves
-    };
+    GenerateVertices(context, *vertices);
+
+    std::unique_ptr<VertexPush> push = std::make_unique<VertexPush>(context.world_position, context.generation, std::move(vertices));
+
+    std::lock_guard<std::mutex> lock(m_PushMutex);
+    m_VertexPushes.push_back(std::move(push));
+}
+
+void ChunkMeshGenerator::GenerateVertices(ChunkMeshBuildContext& context, std::vector<Vertex>& vertices) {
+    context.BuildSolidity();
+
+    if (m_GreedyMeshing) {
+        GenerateGreedyFaces(context, vertices);
+    }
 
     // Sweep through the blocks and generate vertices for the mesh
     for (int y = 0; y < 16; ++y) {
         for (int z = 0; z < 16; ++z) {
             for (int x = 0; x < 16; ++x) {
-                mc::Vector3i mc_pos = context.world_position + mc::Vector3i(x, y, z);
-
-                mc::block::BlockPtr block = context.GetBlock(mc_pos);
-                if (block == nullptr) continue;
-
-                terra::block::BlockVariant* variant = g_AssetCache->GetVariant(block);
-                if (variant == nullptr) continue;
+                // Skip over the interior blocks because they are fully occluded by their neighbors.
+                if (context.shell_only && x == 1 && y > 0 && y < 15 && z > 0 && z < 15) {
+                    x = 15;
+                }
 
-                terra::block::BlockModel* model = variant->GetModel();
-                if (model == nullptr || model->GetElements().empty()) continue;
+                mc::Vector3i mc_pos = context.world_position + mc::Vector3i(x, y, z);
 
-                const glm::vec3 base = terra::math::VecToGLM(mc_pos);
+                u16 block = context.GetBlock(mc_pos);
+                if (block == ChunkMeshBuildContext::UnloadedBlock) continue;
 
-                mc::block::BlockPtr above = context.GetBlock(mc_pos + mc::Vector3i(0, 1, 0));
-                if (!IsOccluding(variant, block::BlockFace::Up, above)) {
-                    // Render the top face of the current block.
-                    int obl = 3, obr = 3, otl = 3, otr = 3;
+                const assets::BlockStateProperties& properties = g_AssetCache->GetStateProperties(block);
+                if (properties.empty) continue;
+                if (m_GreedyMeshing && properties.full_cube) continue;
 
-                    if (!variant->HasRotation()) {
-                        obl = GetAmbientOcclusion(context, mc_pos + mc::Vector3i(-1, 1, 0), mc_pos + mc::Vector3i(0, 1, -1), mc_pos + mc::Vector3i(-1, 1, -1));
-                        obr = GetAmbientOcclusion(context, mc_pos + mc::Vector3i(-1, 1, 0), mc_pos + mc::Vector3i(0, 1, 1), mc_pos + mc::Vector3i(-1, 1, 1));
-                        otl = GetAmbientOcclusion(context, mc_pos + mc::Vector3i(1, 1, 0), mc_pos + mc::Vector3i(0, 1, -1), mc_pos + mc::Vector3i(1, 1, -1));
-                        otr = GetAmbientOcclusion(context, mc_pos + mc::Vector3i(1, 1, 0), mc_pos + mc::Vector3i(0, 1, 1), mc_pos + mc::Vector3i(1, 1, 1));
-                    }
+                terra::block::BlockVariant* variant = properties.variant;
 
-                    for (const auto& element : model->GetElements()) {
-                        block::RenderableFace renderable = element.GetFace(block::BlockFace::Up);
-                        if (renderable.face == block::BlockFace::Up) {
-                            assets::TextureHandle texture = renderable.texture;
+                const glm::vec3 base = terra::math::VecToGLM(mc_pos - context.world_position);
 
-                            const auto& from = element.GetFrom();
-                            const auto& to = element.GetTo();
+                for (std::size_t face_index = 0; face_index < 6; ++face_index) {
+                    const block::BlockFace face = static_cast<block::BlockFace>(face_index);
+                    const std::vector<block::BakedQuad>& quads = variant->GetQuads(face);
 
-                            glm::vec3 bottom_left = glm::vec3(from.x, to.y, from.z);
-                            glm::vec3 bottom_right = glm::vec3(from.x, to.y, to.z);
-                            glm::vec3 top_left = glm::vec3(to.x, to.y, from.z);
-                            glm::vec3 top_right = glm::vec3(to.x, to.y, to.z);
+                    if (quads.empty()) continue;
 
-                            ApplyRotations(bottom_left, bottom_right, top_left, top_right, variant->GetRotations());
-                            ApplyRotations(bottom_left, bottom_right, top_left, top_right, variant->GetRotations(), element.GetRotation());
+                    const CubeFace& cube_face = kCubeFaces[face_index];
+                    const mc::Vector3i neighbor = mc_pos + cube_face.normal;
 
-                            bottom_left += base;
-                            bottom_right += base;
-                            top_left += base;
-                            top_right += base;
+                    if (IsOccluding(block, face, context.GetBlock(neighbor))) continue;
 
-                            const glm::vec3& tint = kTints[renderable.tint_index + 1];
+                    const int kUnshaded[4] = { 3, 3, 3, 3 };
+                    int occlusion[4] = { 3, 3, 3, 3 };
+                    u8 face_light = GetFaceLight(context, mc_pos, neighbor);
 
-                            glm::vec2 bl_uv(renderable.uv_from.x, renderable.uv_from.y);
-                            glm::vec2 br_uv(renderable.uv_from.x, renderable.uv_to.y);
-                            glm::vec2 tr_uv(renderable.uv_to.x, renderable.uv_to.y);
-                            glm::vec2 tl_uv(renderable.uv_to.x, renderable.uv_from.y);
+                    if (!variant->HasRotation()) {
+                        u8 packed = context.GetFaceOcclusion(mc_pos, face);
 
-                            int cobl = 3, cobr = 3, cotl = 3, cotr = 3;
-                            if (element.ShouldShade()) {
-                                cobl = obl; cobr = obr; cotl = otl; cotr = otr;
-                            }
+                        for (std::size_t i = 0; i < 4; ++i) {
+                            occlusion[i] = (packed >> (i * 2)) & 3;
+                        }
+                    }
 
-                            vertices->emplace_back(bottom_left, bl_uv, texture, tint, cobl);
-                            vertices->emplace_back(bottom_right, br_uv, texture, tint, cobr);
-                            vertices->emplace_back(top_right, tr_uv, texture, tint, cotr);
+                    for (const block::BakedQuad& quad : quads) {
+                        const int* ao = quad.shade ? occlusion : kUnshaded;
 
-                            vertices->emplace_back(top_right, tr_uv, texture, tint, cotr);
-                            vertices->emplace_back(top_left, tl_uv, texture, tint, cotl);
-                            vertices->emplace_back(bottom_left, bl_uv, texture, tint, cobl);
-                        }
+                        vertices.emplace_back(base + quad.positions[0], quad.uvs[0], quad.texture, quad.tint, ao[0], face_light);
+                        vertices.emplace_back(base + quad.positions[1], quad.uvs[1], quad.texture, quad.tint, ao[1], face_light);
+                        vertices.emplace_back(base + quad.positions[2], quad.uvs[2], quad.texture, quad.tint, ao[2], face_light);
+                        vertices.emplace_back(base + quad.positions[3], quad.uvs[3], quad.texture, quad.tint, ao[3], face_light);
                     }
                 }
+            }
+        }
+    }
+}
 
-                mc::block::BlockPtr below = context.GetBlock(mc_pos - mc::Vector3i(0, 1, 0));
-                if (!IsOccluding(variant, block::BlockFace::Down, below)) {
-                    // Render the bottom face of the current block.
-                    int obl = 3, obr = 3, otl = 3, otr = 3;
+void ChunkMeshGenerator::GenerateGreedyFaces(ChunkMeshBuildContext& context, std::vector<Vertex>& vertices) {
+    GreedyFace mask[16 * 16];
 
-                    if (!variant->HasRotation()) {
-                        obl = GetAmbientOcclusion(context, mc_pos + mc::Vector3i(1, -1, 0), mc_pos + mc::Vector3i(0, -1, -1), mc_pos + mc::Vector3i(1, -1, -1));
-                        obr = GetAmbientOcclusion(context, mc_pos + mc::Vector3i(1, -1, 0), mc_pos + mc::Vector3i(0, -1, 1), mc_pos + mc::Vector3i(1, -1, 1));
-                        otl = GetAmbientOcclusion(context, mc_pos + mc::Vector3i(-1, -1, 0), mc_pos + mc::Vector3i(0, -1, -1), mc_pos + mc::Vector3i(-1, -1, -1));
-                        otr = GetAmbientOcclusion(context, mc_pos + mc::Vector3i(-1, -1, 0), mc_pos + mc::Vector3i(0, -1, 1), mc_pos + mc::Vector3i(-1, -1, 1));
-                    }
+    for (std::size_t face_index = 0; face_index < 6; ++face_index) {
+        const block::BlockFace face = static_cast<block::BlockFace>(face_index);
+        const CubeFace& cube_face = kCubeFaces[face_index];
+        const int u_axis = cube_face.u_axis;
+        const int v_axis = cube_face.v_axis;
+        const int normal_axis = 3 - u_axis - v_axis;
+        const bool positive = cube_face.normal[normal_axis] > 0;
 
-                    for (const auto& element : model->GetElements()) {
-                        block::RenderableFace renderable = element.GetFace(block::BlockFace::Down);
+        for (int slice = 0; slice < 16; ++slice) {
+            // Every face of a shell only chunk that doesn't point out of it is occluded by the same block.
+            if (context.shell_only && slice != (positive ? 15 : 0)) continue;
 
-                        if (renderable.face == block::BlockFace::Down) {
-                            assets::TextureHandle texture = renderable.texture;
+            bool any_faces = false;
 
-                            const auto& from = element.GetFrom();
-                            const auto& to = element.GetTo();
+            for (int v = 0; v < 16; ++v) {
+                for (int u = 0; u < 16; ++u) {
+                    GreedyFace& cell = mask[v * 16 + u];
+                    mc::Vector3i offset;
 
-                            glm::vec3 bottom_left = glm::vec3(to.x, from.y, from.z);
-                            glm::vec3 bottom_right = glm::vec3(to.x, from.y, to.z);
-                            glm::vec3 top_left = glm::vec3(from.x, from.y, from.z);
-                            glm::vec3 top_right = glm::vec3(from.x, from.y, to.z);
+                    offset[normal_axis] = slice;
+                    offset[u_axis] = u;
+                    offset[v_axis] = v;
 
-                            ApplyRotations(bottom_left, bottom_right, top_left, top_right, variant->GetRotations());
-                            ApplyRotations(bottom_left, bottom_right, top_left, top_right, variant->GetRotations(), element.GetRotation());
+                    mc::Vector3i mc_pos = context.world_position + offset;
 
-                            bottom_left += base;
-                            bottom_right += base;
-                            top_left += base;
-                            top_right += base;
+                    cell.block = 0;
 
-                            const glm::vec3& tint = kTints[renderable.tint_index + 1];
+                    u16 block = context.GetBlock(mc_pos);
+                    if (block == ChunkMeshBuildContext::UnloadedBlock) continue;
 
-                            glm::vec2 bl_uv(renderable.uv_to.x, renderable.uv_to.y);
-                            glm::vec2 br_uv(renderable.uv_to.x, renderable.uv_from.y);
-                            glm::vec2 tr_uv(renderable.uv_from.x, renderable.uv_from.y);
-                            glm::vec2 tl_uv(renderable.uv_from.x, renderable.uv_to.y);
+                    const assets::BlockStateProperties& properties = g_AssetCache->GetStateProperties(block);
+                    if (!properties.full_cube) continue;
 
-                            int cobl = 3, cobr = 3, cotl = 3, cotr = 3;
-                            if (element.ShouldShade()) {
-                                cobl = obl; cobr = obr; cotl = otl; cotr = otr;
-                            }
+                    if (IsOccluding(block, face, context.GetBlock(mc_pos + cube_face.normal))) continue;
 
-                            vertices->emplace_back(bottom_left, bl_uv, texture, tint, cobl);
-                            vertices->emplace_back(bottom_right, br_uv, texture, tint, cobr);
-                            vertices->emplace_back(top_right, tr_uv, texture, tint, cotr);
+                    cell.block = block;
+                    cell.light = GetFaceLight(context, mc_pos, mc_pos + cube_face.normal);
+                    cell.ambient_occlusion = context.GetFaceOcclusion(mc_pos, face);
 
-                            vertices->emplace_back(top_right, tr_uv, texture, tint, cotr);
-                            vertices->emplace_back(top_left, tl_uv, texture, tint, cotl);
-                            vertices->emplace_back(bottom_left, bl_uv, texture, tint, cobl);
-                        }
-                    }
+                    any_faces = true;
                 }
+            }
 
-                mc::block::BlockPtr north = context.GetBlock(mc_pos + mc::Vector3i(0, 0, -1));
-                if (!IsOccluding(variant, block::BlockFace::North, north)) {
-                    // Render the north face of the current block.
-                    int obl = 3, obr = 3, otl = 3, otr = 3;
+            if (!any_faces) continue;
 
-                    if (!variant->HasRotation()) {
-                        obl = GetAmbientOcclusion(context, mc_pos + mc::Vector3i(1, 0, -1), mc_pos + mc::Vector3i(0, -1, -1), mc_pos + mc::Vector3i(1, -1, -1));
-                        obr = GetAmbientOcclusion(context, mc_pos + mc::Vector3i(0, -1, -1), mc_pos + mc::Vector3i(-1, 0, -1), mc_pos + mc::Vector3i(-1, -1, -1));
-                        otl = GetAmbientOcclusion(context, mc_pos + mc::Vector3i(0, 1, -1), mc_pos + mc::Vector3i(1, 0, -1), mc_pos + mc::Vector3i(1, 1, -1));
-                        otr = GetAmbientOcclusion(context, mc_pos + mc::Vector3i(0, 1, -1), mc_pos + mc::Vector3i(-1, 0, -1), mc_pos + mc::Vector3i(-1, 1, -1));
+            for (int v = 0; v < 16; ++v) {
+                for (int u = 0; u < 16; ) {
+                    const GreedyFace current = mask[v * 16 + u];
+
+                    if (current.block == 0) {
+                        ++u;
+                        continue;
                     }
 
-                    for (const auto& element : model->GetElements()) {
-                        block::RenderableFace renderable = element.GetFace(block::BlockFace::North);
+                    int width = 1;
+                    int height = 1;
 
-                        if (renderable.face == block::BlockFace::North) {
-                            assets::TextureHandle texture = renderable.texture;
+                    if (current.IsMergeable()) {
+                        while (u + width < 16 && mask[v * 16 + u + width] == current) {
+                            ++width;
+                        }
 
-                            const auto& from = element.GetFrom();
-                            const auto& to = element.GetTo();
+                        for (; v + height < 16; ++height) {
+                            bool row_matches = true;
 
-                            glm::vec3 bottom_left = glm::vec3(to.x, from.y, from.z);
-                            glm::vec3 bottom_right = glm::vec3(from.x, from.y, from.z);
-                            glm::vec3 top_left = glm::vec3(to.x, to.y, from.z);
-                            glm::vec3 top_right = glm::vec3(from.x, to.y, from.z);
+                            for (int i = 0; i < width && row_matches; ++i) {
+                                row_matches = mask[(v + height) * 16 + u + i] == current;
+                            }
 
-                            ApplyRotations(bottom_left, bottom_right, top_left, top_right, variant->GetRotations());
-                            ApplyRotations(bottom_left, bottom_right, top_left, top_right, variant->GetRotations(), element.GetRotation());
+                            if (!row_matches) break;
+                        }
+                    }
 
-                            bottom_left += base;
-                            bottom_right += base;
-                            top_left += base;
-                            top_right += base;
+                    for (int j = 0; j < height; ++j) {
+                        for (int i = 0; i < width; ++i) {
+                            mask[(v + j) * 16 + u + i].block = 0;
+                        }
+                    }
 
-                            const glm::vec3& tint = kTints[renderable.tint_index + 1];
+                    mc::Vector3i offset;
 
-                            glm::vec2 bl_uv(renderable.uv_from.x, renderable.uv_to.y);
-                            glm::vec2 br_uv(renderable.uv_to.x, renderable.uv_to.y);
-                            glm::vec2 tr_uv(renderable.uv_to.x, renderable.uv_from.y);
-                            glm::vec2 tl_uv(renderable.uv_from.x, renderable.uv_from.y);
+                    offset[normal_axis] = slice;
+                    offset[u_axis] = u;
+                    offset[v_axis] = v;
 
-                            int cobl = 3, cobr = 3, cotl = 3, cotr = 3;
-                            if (element.ShouldShade()) {
-                                cobl = obl; cobr = obr; cotl = otl; cotr = otr;
-                            }
+                    const glm::vec3 base = terra::math::VecToGLM(offset);
+                    glm::vec3 scale(1, 1, 1);
 
-                            vertices->emplace_back(bottom_left, bl_uv, texture, tint, cobl);
-                            vertices->emplace_back(bottom_right, br_uv, texture, tint, cobr);
-                            vertices->emplace_back(top_right, tr_uv, texture, tint, cotr);
+                    scale[u_axis] = (float)width;
+                    scale[v_axis] = (float)height;
 
-                            vertices->emplace_back(top_right, tr_uv, texture, tint, cotr);
-                            vertices->emplace_back(top_left, tl_uv, texture, tint, cotl);
-                            vertices->emplace_back(bottom_left, bl_uv, texture, tint, cobl);
-                        }
+                    glm::vec3 positions[4];
+                    glm::vec2 uvs[4];
+                    int occlusion[4];
+
+                    for (std::size_t i = 0; i < 4; ++i) {
+                        const block::FaceCorner& corner = block::kFaceCorners[face_index][i];
+
+                        positions[i] = base + corner.position * scale;
+                        // The texture repeats once per block across the merged quad.
+                        uvs[i] = corner.uv * glm::vec2(width, height);
+                        occlusion[i] = (current.ambient_occlusion >> (i * 2)) & 3;
                     }
-                }
 
-                mc::block::BlockPtr south = context.GetBlock(mc_pos + mc::Vector3i(0, 0, 1));
-                if (!IsOccluding(variant, block::BlockFace::South, south)) {
-                    // Render the south face of the current block.
-                    int obl = 3, obr = 3, otl = 3, otr = 3;
+                    for (const block::BakedQuad& quad : g_AssetCache->GetVariant(current.block)->GetQuads(face)) {
+                        const int shade[4] = { 3, 3, 3, 3 };
+                        const int* ao = quad.shade ? occlusion : shade;
 
-                    if (!variant->HasRotation()) {
-                        obl = GetAmbientOcclusion(context, mc_pos + mc::Vector3i(-1, 0, 1), mc_pos + mc::Vector3i(0, -1, 1), mc_pos + mc::Vector3i(-1, -1, 1));
-                        obr = GetAmbientOcclusion(context, mc_pos + mc::Vector3i(1, 0, 1), mc_pos + mc::Vector3i(0, -1, 1), mc_pos + mc::Vector3i(1, -1, 1));
-                        otl = GetAmbientOcclusion(context, mc_pos + mc::Vector3i(0, 1, 1), mc_pos + mc::Vector3i(-1, 0, 1), mc_pos + mc::Vector3i(-1, 1, 1));
-                        otr = GetAmbientOcclusion(context, mc_pos + mc::Vector3i(0, 1, 1), mc_pos + mc::Vector3i(1, 0, 1), mc_pos + mc::Vector3i(1, 1, 1));
+                        vertices.emplace_back(positions[0], uvs[0], quad.texture, quad.tint, ao[0], current.light);
+                        vertices.emplace_back(positions[1], uvs[1], quad.texture, quad.tint, ao[1], current.light);
+                        vertices.emplace_back(positions[2], uvs[2], quad.texture, quad.tint, ao[2], current.light);
+                        vertices.emplace_back(positions[3], uvs[3], quad.texture, quad.tint, ao[3], current.light);
                     }
 
-                    for (const auto& element : model->GetElements()) {
-                        block::RenderableFace renderable = element.GetFace(block::BlockFace::South);
+                    u += width;
+                }
+            }
+        }
+    }
+}
 
-                        if (renderable.face == block::BlockFace::South) {
-                            assets::TextureHandle texture = renderable.texture;
+void ChunkMeshGenerator::GenerateMesh(s64 chunk_x, s64 chunk_y, s64 chunk_z) {
+    ChunkMeshBuildContext ctx;
 
-                            const auto& from = element.GetFrom();
-                            const auto& to = element.GetTo();
+    ctx.world_position = mc::Vector3i(chunk_x * 16, chunk_y * 16, chunk_z * 16);
+    ctx.generation = m_Generation;
 
-                            glm::vec3 bottom_left = glm::vec3(from.x, from.y, to.z);
-                            glm::vec3 bottom_right = glm::vec3(to.x, from.y, to.z);
-                            glm::vec3 top_left = glm::vec3(from.x, to.y, to.z);
-                            glm::vec3 top_right = glm::vec3(to.x, to.y, to.z);
+    {
+        terra::EpochManager::ReadGuard guard(terra::GetEpochManager());
+        const terra::WorldSnapshot* snapshot = m_World->GetSnapshot();
 
-                            ApplyRotations(bottom_left, bottom_right, top_left, top_right, variant->GetRotations());
-                            ApplyRotations(bottom_left, bottom_right, top_left, top_right, variant->GetRotations(), element.GetRotation());
+        if (snapshot == nullptr) return;
 
-                            bottom_left += base;
-                            bottom_right += base;
-                            top_left += base;
-                            top_right += base;
+        FillContext(*snapshot, m_LightEngine ? m_LightEngine->GetSnapshot() : nullptr, ctx);
+    }
 
-                            const glm::vec3& tint = kTints[renderable.tint_index + 1];
+    GenerateMesh(ctx);
+}
 
-                            glm::vec2 bl_uv(renderable.uv_from.x, renderable.uv_to.y);
-                            glm::vec2 br_uv(renderable.uv_to.x, renderable.uv_to.y);
-                            glm::vec2 tr_uv(renderable.uv_to.x, renderable.uv_from.y);
-                            glm::vec2 tl_uv(renderable.uv_from.x, renderable.uv_from.y);
+void ChunkMeshGenerator::FillContext(const terra::WorldSnapshot& snapshot, const terra::LightSnapshot* light, ChunkMeshBuildContext& context) {
+    const mc::Vector3i start = context.world_position - mc::Vector3i(1, 1, 1);
+    const s32 base_x = (s32)(context.world_position.x >> 4);
+    const s32 base_z = (s32)(context.world_position.z >> 4);
 
-                            int cobl = 3, cobr = 3, cotl = 3, cotr = 3;
-                            if (element.ShouldShade()) {
-                                cobl = obl; cobr = obr; cotl = otl; cotr = otr;
-                            }
+    // The border only reaches into the 3x3 columns around the chunk, so look each of them up once.
+    const terra::WorldSnapshot::Column* columns[3][3];
+    const terra::LightSnapshot::Column* light_columns[3][3];
 
-                            vertices->emplace_back(bottom_left, bl_uv, texture, tint, cobl);
-                            vertices->emplace_back(bottom_right, br_uv, texture, tint, cobr);
-                            vertices->emplace_back(top_right, tr_uv, texture, tint, cotr);
+    for (s32 z = 0; z < 3; ++z) {
+        for (s32 x = 0; x < 3; ++x) {
+            columns[z][x] = snapshot.GetColumn(base_x + x - 1, base_z + z - 1);
+            light_columns[z][x] = light ? light->GetColumn(base_x + x - 1, base_z + z - 1) : nullptr;
+        }
+    }
 
-                            vertices->emplace_back(top_right, tr_uv, texture, tint, cotr);
-                            vertices->emplace_back(top_left, tl_uv, texture, tint, cotl);
-                            vertices->emplace_back(bottom_left, bl_uv, texture, tint, cobl);
-                        }
-                    }
-                }
+    // Decided from the same snapshot the blocks are copied from, since the live chunk may have changed since the request.
+    const s64 base_y = context.world_position.y >> 4;
+    const terra::Chunk* center = columns[1][1] != nullptr && base_y >= 0 && base_y < terra::ChunkColumn::ChunksPerColumn ? columns[1][1]->chunks[base_y] : nullptr;
+    mc::block::BlockPtr uniform_block = center ? center->GetUniformBlock() : nullptr;
 
-                mc::block::BlockPtr east = context.GetBlock(mc_pos + mc::Vector3i(1, 0, 0));
-                if (!IsOccluding(variant, block::BlockFace::East, east)) {
-                    // Render the east face of the current block.
-                    int obl = 3, obr = 3, otl = 3, otr = 3;
+    context.shell_only = uniform_block != nullptr && IsSelfOccluding(uniform_block);
 
-                    if (!variant->HasRotation()) {
-                        obl = GetAmbientOcclusion(context, mc_pos + mc::Vector3i(1, 0, 1), mc_pos + mc::Vector3i(1, -1, 0), mc_pos + mc::Vector3i(1, -1, 1));
-                        obr = GetAmbientOcclusion(context, mc_pos + mc::Vector3i(1, -1, 0), mc_pos + mc::Vector3i(1, 0, -1), mc_pos + mc::Vector3i(1, -1, -1));
-                        otl = GetAmbientOcclusion(context, mc_pos + mc::Vector3i(1, 1, 0), mc_pos + mc::Vector3i(1, 0, 1), mc_pos + mc::Vector3i(1, 1, 1));
-                        otr = GetAmbientOcclusion(context, mc_pos + mc::Vector3i(1, 1, 0), mc_pos + mc::Vector3i(1, 0, -1), mc_pos + mc::Vector3i(1, 1, -1));
-                    }
+    for (s64 y = 0; y < 18; ++y) {
+        const s64 world_y = start.y + y;
+        const s64 chunk_y = world_y >> 4;
+        const bool in_world = chunk_y >= 0 && chunk_y < terra::ChunkColumn::ChunksPerColumn;
 
-                    for (const auto& element : model->GetElements()) {
-                        block::RenderableFace renderable = element.GetFace(block::BlockFace::East);
+        for (s64 z = 0; z < 18; ++z) {
+            const s64 world_z = start.z + z;
+            const s64 column_z = (world_z >> 4) - base_z + 1;
 
-                        if (renderable.face == block::BlockFace::East) {
-                            assets::TextureHandle texture = renderable.texture;
+            for (s64 x = 0; x < 18; ++x) {
+                const s64 world_x = start.x + x;
+                const s64 column_x = (world_x >> 4) - base_x + 1;
+                const terra::WorldSnapshot::Column* column = columns[column_z][column_x];
+                u16 block = ChunkMeshBuildContext::UnloadedBlock;
 
-                            const auto& from = element.GetFrom();
-                            const auto& to = element.GetTo();
+                if (column != nullptr) {
+                    // Missing chunks in a loaded column are air, and so is everything above or below the world.
+                    block = 0;
 
-                            glm::vec3 bottom_left = glm::vec3(to.x, from.y, to.z);
-                            glm::vec3 bottom_right = glm::vec3(to.x, from.y, from.z);
-                            glm::vec3 top_left = glm::vec3(to.x, to.y, to.z);
-                            glm::vec3 top_right = glm::vec3(to.x, to.y, from.z);
+                    const terra::Chunk* chunk = in_world ? column->chunks[chunk_y] : nullptr;
+
+                    if (chunk != nullptr) {
+                        block = static_cast<u16>(chunk->GetBlock(mc::Vector3i(world_x & 15, world_y & 15, world_z & 15))->GetType());
+                    }
+                }
 
-                            ApplyRotations(bottom_left, bottom_right, top_left, top_right, variant->GetRotations());
-                            ApplyRotations(bottom_left, bottom_right, top_left, top_right, variant->GetRotations(), element.GetRotation());
+                context.chunk_data[y * 18 * 18 + z * 18 + x] = block;
+                context.light_data[y * 18 * 18 + z * 18 + x] = terra::LightSnapshot::GetLight(light_columns[column_z][column_x], mc::Vector3i(world_x, world_y, world_z));
+            }
+        }
+    }
+}
 
-                            bottom_left += base;
-                            bottom_right += base;
-                            top_left += base;
-                            top_right += base;
+void ChunkMeshGenerator::OnChunkUnload(terra::ChunkColumnPtr chunk) {
+    if (chunk == nullptr) return;
 
-                            const glm::vec3& tint = kTints[renderable.tint_index + 1];
+    for (int y = 0; y < 16; ++y) {
+        DestroyChunk(chunk->GetMetadata().x, y, chunk->GetMetadata().z);
+    }
+}
 
-                            glm::vec2 bl_uv(renderable.uv_from.x, renderable.uv_to.y);
-                            glm::vec2 br_uv(renderable.uv_to.x, renderable.uv_to.y);
-                            glm::vec2 tr_uv(renderable.uv_to.x, renderable.uv_from.y);
-                            glm::vec2 tl_uv(renderable.uv_from.x, renderable.uv_from.y);
+MeshMemoryStats ChunkMeshGenerator::GetMemoryStats() {
+    MeshMemoryStats stats = {};
 
-                            int cobl = 3, cobr = 3, cotl = 3, cotr = 3;
-                            if (element.ShouldShade()) {
-                                cobl = obl; cobr = obr; cotl = otl; cotr = otr;
-                            }
+    stats.meshes = m_ChunkMeshes.size();
+    stats.mesh_bytes = m_MeshBytes;
+    stats.stashed_mesh_bytes = m_StashedMeshBytes;
 
-                            vertices->emplace_back(bottom_left, bl_uv, texture, tint, cobl);
-                            vertices->emplace_back(bottom_right, br_uv, texture, tint, cobr);
-                            vertices->emplace_back(top_right, tr_uv, texture, tint, cotr);
+    for (const auto& kv : m_StashedMeshes) {
+        stats.stashed_meshes += kv.second.size();
+    }
 
-                            vertices->emplace_back(top_right, tr_uv, texture, tint, cotr);
-                            vertices->emplace_back(top_left, tl_uv, texture, tint, cotl);
-                            vertices->emplace_back(bottom_left, bl_uv, texture, tint, cobl);
-                        }
-                    }
-                }
+    stats.queued_chunks = m_ChunkPushQueue.size();
 
-                mc::block::BlockPtr west = context.GetBlock(mc_pos + mc::Vector3i(-1, 0, 0));
-                if (!IsOccluding(variant, block::BlockFace::West, west)) {
-                    // Render the west face of the current block.
-                    int obl = 3, obr = 3, otl = 3, otr = 3;
+    {
+        std::lock_guard<std::mutex> lock(m_QueueMutex);
+        stats.queued_builds = m_ChunkBuildQueue.GetData().size();
+    }
 
-                    if (!variant->HasRotation()) {
-                        obl = GetAmbientOcclusion(context, mc_pos + mc::Vector3i(-1, -1, 0), mc_pos + mc::Vector3i(-1, 0, -1), mc_pos + mc::Vector3i(-1, -1, -1));
-                        obr = GetAmbientOcclusion(context, mc_pos + mc::Vector3i(-1, -1, 0), mc_pos + mc::Vector3i(-1, 0, 1), mc_pos + mc::Vector3i(-1, -1, 1));
-                        otl = GetAmbientOcclusion(context, mc_pos + mc::Vector3i(-1, 1, 0), mc_pos + mc::Vector3i(-1, 0, -1), mc_pos + mc::Vector3i(-1, 1, -1));
-                        otr = GetAmbientOcclusion(context, mc_pos + mc::Vector3i(-1, 1, 0), mc_pos + mc::Vector3i(-1, 0, 1), mc_pos + mc::Vector3i(-1, 1, 1));
-                    }
+    {
+        std::lock_guard<std::mutex> lock(m_PushMutex);
 
-                    for (const auto& element : model->GetElements()) {
-                        block::RenderableFace renderable = element.GetFace(block::BlockFace::West);
+        stats.pending_uploads = m_VertexPushes.size();
 
-                        if (renderable.face == block::BlockFace::West) {
-                            assets::TextureHandle texture = renderable.texture;
+        for (const auto& push : m_VertexPushes) {
+            stats.pending_upload_bytes += push->vertices->size() * sizeof(Vertex);
+        }
+    }
 
-                            const auto& from = element.GetFrom();
-                            const auto& to = element.GetTo();
+    stats.context_bytes = m_Contexts.size() * sizeof(ChunkMeshBuildContext);
 
-                            glm::vec3 bottom_left = glm::vec3(from.x, from.y, from.z);
-                            glm::vec3 bottom_right = glm::vec3(from.x, from.y, to.z);
-                            glm::vec3 top_left = glm::vec3(from.x, to.y, from.z);
-                            glm::vec3 top_right = glm::vec3(from.x, to.y, to.z);
+    for (const auto& kv : m_ChunkMeshes) {
+        stats.vertices += kv.second->GetVertexCount();
+    }
 
-                            ApplyRotations(bottom_left, bottom_right, top_left, top_right, variant->GetRotations());
-                            ApplyRotations(bottom_left, bottom_right, top_left, top_right, variant->GetRotations(), element.GetRotation());
+    stats.index_buffer_bytes = m_QuadIndexCapacity * 6 * sizeof(u32);
+    stats.uploaded_vertices = m_UploadedVertices;
+    stats.uploaded_bytes = m_UploadedBytes;
 
-                            bottom_left += base;
-                            bottom_right += base;
-                            top_left += base;
-                            top_right += base;
+    return stats;
+}
 
-                            const glm::vec3& tint = kTints[renderable.tint_index + 1];
+void ChunkMeshGenerator::OnDimensionStash(s32 dimension, const std::vector<terra::ChunkColumnPtr>& columns) {
+    OnDimensionEvict(dimension);
 
-                            glm::vec2 bl_uv(renderable.uv_from.x, renderable.uv_to.y);
-                            glm::vec2 br_uv(renderable.uv_to.x, renderable.uv_to.y);
-                            glm::vec2 tr_uv(renderable.uv_to.x, renderable.uv_from.y);
-                            glm::vec2 tl_uv(renderable.uv_from.x, renderable.uv_from.y);
+    m_StashedMeshes[dimension] = std::move(m_ChunkMeshes);
+    m_ChunkMeshes.clear();
 
-                            int cobl = 3, cobr = 3, cotl = 3, cotr = 3;
-                            if (element.ShouldShade()) {
-                                cobl = obl; cobr = obr; cotl = otl; cotr = otr;
-                            }
+    m_StashedMeshBytes += m_MeshBytes;
+    m_MeshBytes = 0;
 
-                            vertices->emplace_back(bottom_left, bl_uv, texture, tint, cobl);
-                            vertices->emplace_back(bottom_right, br_uv, texture, tint, cobr);
-                            vertices->emplace_back(top_right, tr_uv, texture, tint, cotr);
+    // Anything waiting to be built belongs to the dimension that is left. It's queued again if the dimension is restored.
+    // Jobs that already took a request still push their mesh, which ProcessChunks drops by its generation.
+    ++m_Generation;
 
-                            vertices->emplace_back(top_right, tr_uv, texture, tint, cotr);
-                            vertices->emplace_back(top_left, tl_uv, texture, tint, cotl);
-                            vertices->emplace_back(bottom_left, bl_uv, texture, tint, cobl);
-                        }
-                    }
-                }
-            }
-        }
-    }
+    m_ChunkPushQueue.clear();
+    m_ChunkPushSet.clear();
 
-    std::unique_ptr<VertexPush> push = std::make_unique<VertexPush>(context.world_position, std::move(vertices));
+    {
+        std::lock_guard<std::mutex> lock(m_QueueMutex);
+        m_ChunkBuildQueue.GetData().clear();
+    }
 
     std::lock_guard<std::mutex> lock(m_PushMutex);
-    m_VertexPushes.push_back(std::move(push));
+    m_VertexPushes.clear();
 }
 
-void ChunkMeshGenerator::GenerateMesh(s64 chunk_x, s64 chunk_y, s64 chunk_z) {
-    ChunkMeshBuildContext ctx;
+void ChunkMeshGenerator::OnDimensionRestore(s32 dimension, const std::vector<terra::ChunkColumnPtr>& columns) {
+    auto iter = m_StashedMeshes.find(dimension);
 
-    ctx.world_position = mc::Vector3i(chunk_x * 16, chunk_y * 16, chunk_z * 16);
+    if (iter == m_StashedMeshes.end()) {
+        WorldListener::OnDimensionRestore(dimension, columns);
+        return;
+    }
+
+    auto& meshes = iter->second;
+
+    for (const terra::ChunkColumnPtr& column : columns) {
+        const terra::ChunkColumnMetadata& meta = column->GetMetadata();
 
-    for (int y = 0; y < 18; ++y) {
-        for (int z = 0; z < 18; ++z) {
-            for (int x = 0; x < 18; ++x) {
-                mc::Vector3i offset(x - 1, y - 1, z - 1);
-                mc::block::BlockPtr block = m_World->GetBlock(ctx.world_position + offset);
+        for (s32 y = 0; y < terra::ChunkColumn::ChunksPerColumn; ++y) {
+            mc::Vector3i key(meta.x * 16, y * 16, meta.z * 16);
+            auto mesh = meshes.find(key);
 
-                ctx.chunk_data[y * 18 * 18 + z * 18 + x] = block;
+            if (mesh != meshes.end()) {
+                m_MeshBytes += mesh->second->GetMemoryUsage();
+                m_StashedMeshBytes -= mesh->second->GetMemoryUsage();
+                m_ChunkMeshes[key] = std::move(mesh->second);
+                meshes.erase(mesh);
+            } else if (!column->IsChunkEmpty(y)) {
+                // The build was still pending when the dimension was stashed.
+                EnqueueBuildWork(meta.x, y, meta.z);
             }
         }
     }
 
-    GenerateMesh(ctx);
+    // Whatever is left belongs to columns that weren't kept.
+    OnDimensionEvict(dimension);
 }
 
-void ChunkMeshGenerator::OnChunkUnload(terra::ChunkColumnPtr chunk) {
-    if (chunk == nullptr) return;
+void ChunkMeshGenerator::OnDimensionEvict(s32 dimension) {
+    auto iter = m_StashedMeshes.find(dimension);
 
-    for (int y = 0; y < 16; ++y) {
-        DestroyChunk(chunk->GetMetadata().x, y, chunk->GetMetadata().z);
+    if (iter == m_StashedMeshes.end()) return;
+
+    for (auto& kv : iter->second) {
+        m_StashedMeshBytes -= kv.second->GetMemoryUsage();
+        kv.second->Destroy();
     }
+
+    m_StashedMeshes.erase(iter);
 }
 
 void ChunkMeshGenerator::DestroyChunk(s64 chunk_x, s64 chunk_y, s64 chunk_z) {
@@ -766,6 +893,7 @@ void ChunkMeshGenerator::DestroyChunk(s64 chunk_x, s64 chunk_y, s64 chunk_z) {
 
     auto iter = m_ChunkMeshes.find(key);
     if (iter != m_ChunkMeshes.end()) {
+        m_MeshBytes -= iter->second->GetMemoryUsage();
         iter->second->Destroy();
         m_ChunkMeshes.erase(key);
     }
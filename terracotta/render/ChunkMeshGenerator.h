@@ -3,31 +3,22 @@
 
 #include "ChunkMesh.h"
 #include <unordered_map>
+#include <unordered_set>
 #include <memory>
 #include <vector>
 #include <utility>
 #include <mclib/common/Vector.h>
 #include <glm/glm.hpp>
+#include "../JobSystem.h"
+#include "../LightEngine.h"
 #include "../World.h"
 #include "../PriorityQueue.h"
 #include "../block/BlockFace.h"
 #include "../block/BlockVariant.h"
 #include <mutex>
-#include <thread>
-#include <condition_variable>
 #include <deque>
-
-namespace std {
-template <> struct hash<mc::Vector3i> {
-    std::size_t operator()(const mc::Vector3i& s) const noexcept {
-        std::size_t seed = 3;
-        for (int i = 0; i < 3; ++i) {
-            seed ^= s[i] + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-        }
-        return seed;
-    }
-};
-}
+#include <algorithm>
+#include <cmath>
 
 namespace terra {
 namespace block {
@@ -38,46 +29,158 @@ class BlockModel;
 
 namespace render {
 
+/**
+ * A 12 byte vertex that block.vert decodes. Positions are fixed point and relative to the chunk, and the shader adds
+ * the chunk offset uniform back to them. Positions can be slightly outside of the chunk for rotated elements.
+ */
 struct Vertex {
-    glm::vec3 position;
-    glm::vec2 uv;
-    u32 texture_index;
-    glm::vec3 tint;
-    unsigned char ambient_occlusion;
-
-    Vertex(glm::vec3 pos, glm::vec2 uv, u32 tex_index, glm::vec3 tint, int ambient_occlusion)
-        : position(pos), uv(uv), texture_index(tex_index), tint(tint), ambient_occlusion(static_cast<unsigned char>(ambient_occlusion))
+    // Positions are stored as (position + PositionBias) * PositionScale, so they cover [-8, 24) in 1/2048 steps.
+    enum { PositionScale = 2048, PositionBias = 8 };
+    // Texture coordinates are stored in 10 bits each in 1/32 steps, enough to repeat a texture across a chunk.
+    enum { UVScale = 32, UVMax = 1023 };
+
+    u16 position[3];
+    u16 texture_index;
+    // The u and v coordinates in bits 0-19, the tint palette index in bits 20-21, ambient occlusion in bits 22-23
+    // and the light in bits 24-31, with sky light in the high nibble and block light in the low nibble.
+    u32 data;
+
+    // Tint index 0 is untinted and the others are the colors in the tint palette of block.vert.
+    Vertex(const glm::vec3& pos, const glm::vec2& uv, u32 tex_index, u8 tint_index, int ambient_occlusion, u8 light)
+        : texture_index(static_cast<u16>(tex_index))
     {
+        for (int i = 0; i < 3; ++i) {
+            float fixed = std::round((pos[i] + PositionBias) * PositionScale);
+
+            position[i] = static_cast<u16>(std::min(std::max(fixed, 0.0f), 65535.0f));
+        }
+
+        u32 u = static_cast<u32>(std::min(std::max(std::round(uv.x * UVScale), 0.0f), (float)UVMax));
+        u32 v = static_cast<u32>(std::min(std::max(std::round(uv.y * UVScale), 0.0f), (float)UVMax));
+
+        data = u | (v << 10) | ((tint_index & 3u) << 20) | ((static_cast<u32>(ambient_occlusion) & 3u) << 22) | (static_cast<u32>(light) << 24);
     }
 };
 
+static_assert(sizeof(Vertex) == 12, "Vertex must stay packed");
+
+// Sets up the attributes of the bound vertex array for a buffer of Vertex.
+void SetVertexAttributes();
+
 struct ChunkMeshBuildContext {
-    // Store the chunk data and a border around the chunk
-    mc::block::BlockPtr chunk_data[18 * 18 * 18];
+    // Block id stored for positions in chunks that aren't loaded.
+    enum { UnloadedBlock = 0xFFFF };
+
+    // Store the block ids of the chunk and a border around the chunk
+    u16 chunk_data[18 * 18 * 18];
+    // The light of the same positions, packed the same way as LightSnapshot::GetLight.
+    u8 light_data[18 * 18 * 18];
+    // Bit x of row y * 18 + z is set when the block at that position in chunk_data is solid. Built from chunk_data by BuildSolidity.
+    u32 solid_rows[18 * 18];
     mc::Vector3i world_position;
+    // Set when the chunk is uniformly filled with a block that occludes itself, so only the outer shell can have visible faces.
+    // FillContext decides it from the snapshot it copies the blocks from.
+    bool shell_only = false;
+    // The generator's dimension generation when the build was requested. The mesh is dropped if the dimension changed since.
+    u32 generation = 0;
 
-    mc::block::BlockPtr GetBlock(const mc::Vector3i& world_pos) {
+    u16 GetBlock(const mc::Vector3i& world_pos) const {
         mc::Vector3i::value_type x = world_pos.x - world_position.x + 1;
         mc::Vector3i::value_type y = world_pos.y - world_position.y + 1;
         mc::Vector3i::value_type z = world_pos.z - world_position.z + 1;
 
         return chunk_data[y * 18 * 18 + z * 18 + x];
     }
+
+    u8 GetLight(const mc::Vector3i& world_pos) const {
+        mc::Vector3i::value_type x = world_pos.x - world_position.x + 1;
+        mc::Vector3i::value_type y = world_pos.y - world_position.y + 1;
+        mc::Vector3i::value_type z = world_pos.z - world_position.z + 1;
+
+        return light_data[y * 18 * 18 + z * 18 + x];
+    }
+
+    bool IsSolid(const mc::Vector3i& world_pos) const {
+        mc::Vector3i::value_type x = world_pos.x - world_position.x + 1;
+        mc::Vector3i::value_type y = world_pos.y - world_position.y + 1;
+        mc::Vector3i::value_type z = world_pos.z - world_position.z + 1;
+
+        return (solid_rows[y * 18 + z] >> x) & 1;
+    }
+
+    void BuildSolidity();
+
+    // Returns the ambient occlusion of the four corners of a full cube face, two bits each in the order of the face corners.
+    // Reads the solidity bits of the 3x3 blocks in front of the face and looks the result up in a table, so BuildSolidity
+    // must have been called.
+    u8 GetFaceOcclusion(const mc::Vector3i& pos, block::BlockFace face) const;
+};
+
+// A chunk waiting to be built. Workers fill the build context from the latest world snapshot when they take it.
+struct ChunkMeshBuildRequest {
+    mc::Vector3i world_position;
+    u32 generation;
+
+    ChunkMeshBuildRequest(const mc::Vector3i& world_position, u32 generation)
+        : world_position(world_position), generation(generation) { }
+};
+
+struct MeshMemoryStats {
+    std::size_t meshes;
+    // Bytes of vertex buffers on the GPU.
+    std::size_t mesh_bytes;
+    std::size_t stashed_meshes;
+    std::size_t stashed_mesh_bytes;
+    // Chunks waiting to be sent to the workers and waiting for a worker.
+    std::size_t queued_chunks;
+    std::size_t queued_builds;
+    // Built meshes waiting to be uploaded and the size of their vertices.
+    std::size_t pending_uploads;
+    std::size_t pending_upload_bytes;
+    // The build contexts owned by the workers.
+    std::size_t context_bytes;
+    // Vertices in the meshes above. Quads are indexed, so drawing them as triangle lists would take 6 / 4 as many.
+    std::size_t vertices;
+    std::size_t index_buffer_bytes;
+    // Totals of every mesh uploaded so far.
+    u64 uploaded_vertices;
+    u64 uploaded_bytes;
 };
 
 class ChunkMeshGenerator : public terra::WorldListener {
 public:
     using iterator = std::unordered_map<mc::Vector3i, std::unique_ptr<terra::render::ChunkMesh>>::iterator;
 
-    ChunkMeshGenerator(terra::World* world, const glm::vec3& camera_position);
+    // Chunks are built by jobs on the job system, which must outlive the generator.
+    ChunkMeshGenerator(terra::World* world, terra::JobSystem* jobs, const glm::vec3& camera_position);
     ~ChunkMeshGenerator();
 
-    void OnBlockChange(mc::Vector3i position, mc::block::BlockPtr newBlock, mc::block::BlockPtr oldBlock) override;
+    void OnBlockChangeBatch(const terra::BlockChangeBatch& batch) override;
     void OnChunkLoad(terra::ChunkPtr chunk, const terra::ChunkColumnMetadata& meta, u16 index_y) override;
     void OnChunkUnload(terra::ChunkColumnPtr chunk) override;
-
+    void OnDimensionStash(s32 dimension, const std::vector<terra::ChunkColumnPtr>& columns) override;
+    void OnDimensionRestore(s32 dimension, const std::vector<terra::ChunkColumnPtr>& columns) override;
+    void OnDimensionEvict(s32 dimension) override;
+
+    /**
+     * Meshes are lit with the light engine's light. Loaded and changed chunks are built once the engine has lit them, and chunks
+     * are rebuilt when their light changes. Must be set before any chunks are loaded and the engine must outlive the generator.
+     */
+    void SetLightEngine(terra::LightEngine* light_engine) { m_LightEngine = light_engine; }
+
+    /**
+     * Merges the coplanar faces of full cube blocks that share a state, light and flat ambient occlusion into larger quads
+     * that repeat the texture. Other blocks are always built one face at a time. Must be set before any chunks are built.
+     */
+    void SetGreedyMeshing(bool enabled) { m_GreedyMeshing = enabled; }
+
+    // Builds the chunk on the calling thread from the last published world snapshot.
     void GenerateMesh(s64 chunk_x, s64 chunk_y, s64 chunk_z);
+    // Builds the chunk in the context and queues its vertices to be uploaded by ProcessChunks.
     void GenerateMesh(ChunkMeshBuildContext& context);
+    // Appends the vertices of the chunk in the context without uploading them. Every quad is four vertices in bottom left,
+    // bottom right, top right, top left order, drawn with the shared quad index buffer. Per block faces come in BlockFace order.
+    void GenerateVertices(ChunkMeshBuildContext& context, std::vector<Vertex>& vertices);
     void DestroyChunk(s64 chunk_x, s64 chunk_y, s64 chunk_z);
 
     iterator begin() { return m_ChunkMeshes.begin(); }
@@ -85,15 +188,18 @@ public:
 
     void ProcessChunks();
 
+    // Must be called on the main thread.
+    MeshMemoryStats GetMemoryStats();
+
 private:
     struct ChunkMeshBuildComparator {
         const glm::vec3& position;
 
         ChunkMeshBuildComparator(const glm::vec3& position) : position(position) { }
 
-        bool operator()(const std::shared_ptr<ChunkMeshBuildContext>& first_ctx, const std::shared_ptr<ChunkMeshBuildContext>& second_ctx) {
-            mc::Vector3i first = first_ctx->world_position;
-            mc::Vector3i second = second_ctx->world_position;
+        bool operator()(const ChunkMeshBuildRequest& first_request, const ChunkMeshBuildRequest& second_request) {
+            mc::Vector3i first = first_request.world_position;
+            mc::Vector3i second = second_request.world_position;
 
             glm::vec3 f(first.x, 0, first.z);
             glm::vec3 s(second.x, 0, second.z);
@@ -107,30 +213,66 @@ private:
 
     struct VertexPush {
         mc::Vector3i pos;
+        u32 generation;
         std::unique_ptr<std::vector<Vertex>> vertices;
 
-        VertexPush(const mc::Vector3i& pos, std::unique_ptr<std::vector<Vertex>> vertices) : pos(pos), vertices(std::move(vertices)) { }
+        VertexPush(const mc::Vector3i& pos, u32 generation, std::unique_ptr<std::vector<Vertex>> vertices)
+            : pos(pos), generation(generation), vertices(std::move(vertices)) { }
     };
 
-    int GetAmbientOcclusion(ChunkMeshBuildContext& context, const mc::Vector3i& side1, const mc::Vector3i& side2, const mc::Vector3i& corner);
-    bool IsOccluding(terra::block::BlockVariant* from_variant, terra::block::BlockFace face, mc::block::BlockPtr test_block);
-    void WorkerUpdate();
+    // Faces are lit by the brighter of the block and the neighbor that they face for each kind of light.
+    u8 GetFaceLight(ChunkMeshBuildContext& context, const mc::Vector3i& pos, const mc::Vector3i& neighbor);
+    // Returns true if the face of from_block is hidden by test_block. Both are looked up in the state face masks.
+    bool IsOccluding(u16 from_block, terra::block::BlockFace face, u16 test_block);
+    // Returns true if the block doesn't generate any geometry.
+    bool IsEmptyBlock(mc::block::BlockPtr block);
+    // Returns true if a block surrounded by itself on every side has no visible faces.
+    bool IsSelfOccluding(mc::block::BlockPtr block);
+    terra::ChunkPtr GetChunk(const mc::Vector3i& chunk_base);
+    // Builds the visible faces of the full cube blocks in the context, one slice at a time for each face direction.
+    void GenerateGreedyFaces(ChunkMeshBuildContext& context, std::vector<Vertex>& vertices);
+    // Copies the block ids and light around context.world_position out of the snapshots. Light can be null.
+    void FillContext(const terra::WorldSnapshot& snapshot, const terra::LightSnapshot* light, ChunkMeshBuildContext& context);
+    // Builds the closest chunk in the build queue. Runs as a job, one for each request that is pushed into the queue.
+    void BuildNextChunk();
     void EnqueueBuildWork(long chunk_x, int chunk_y, long chunk_z);
+    // Grows the shared quad index buffer so it can draw at least quads quads. Must be called on the main thread.
+    void ReserveQuadIndices(std::size_t quads);
 
     std::mutex m_QueueMutex;
-    PriorityQueue<std::shared_ptr<ChunkMeshBuildContext>, ChunkMeshBuildComparator> m_ChunkBuildQueue;
+    PriorityQueue<ChunkMeshBuildRequest, ChunkMeshBuildComparator> m_ChunkBuildQueue;
     std::deque<mc::Vector3i> m_ChunkPushQueue;
-    std::condition_variable m_BuildCV;
+    // Mirrors m_ChunkPushQueue so duplicate requests are rejected without scanning it.
+    std::unordered_set<mc::Vector3i> m_ChunkPushSet;
 
     terra::World* m_World;
+    terra::JobSystem* m_Jobs;
+    terra::JobToken m_BuildToken;
+    // One reused build context for each job worker, indexed by worker index.
+    std::vector<std::unique_ptr<ChunkMeshBuildContext>> m_Contexts;
+    terra::LightEngine* m_LightEngine;
+    bool m_GreedyMeshing;
+    // Reused to take the sections that the light engine changed.
+    std::vector<mc::Vector3i> m_LightDirtySections;
 
     std::mutex m_PushMutex;
     std::vector<std::unique_ptr<VertexPush>> m_VertexPushes;
+    // Incremented when the dimension is stashed, so builds that were already running for the old one are dropped.
+    // Only used on the main thread. Workers get it through the build requests.
+    u32 m_Generation;
 
     std::unordered_map<mc::Vector3i, std::unique_ptr<terra::render::ChunkMesh>> m_ChunkMeshes;
-
-    bool m_Working;
-    std::vector<std::thread> m_Workers;
+    // The meshes of the dimensions that the world keeps in its dimension stash.
+    std::unordered_map<s32, std::unordered_map<mc::Vector3i, std::unique_ptr<terra::render::ChunkMesh>>> m_StashedMeshes;
+    // Sum of the buffer sizes of the meshes above, kept up to date as meshes are created and destroyed.
+    std::size_t m_MeshBytes;
+    std::size_t m_StashedMeshBytes;
+    u64 m_UploadedVertices;
+    u64 m_UploadedBytes;
+
+    // Every mesh VAO binds this buffer, which is grown in place so the VAOs never have to be updated.
+    unsigned int m_QuadIndexBuffer;
+    std::size_t m_QuadIndexCapacity;
 };
 
 } // ns render
@@ -0,0 +1,296 @@
+#include "Test.h"
+
+#include "Chunk.h"
+
+#include <array>
+#include <random>
+
+namespace {
+
+using BlockArray = std::array<mc::block::BlockPtr, 16 * 16 * 16>;
+
+mc::block::BlockPtr GetBlock(u32 id) {
+    return mc::block::BlockRegistry::GetInstance()->GetBlock(id);
+}
+
+// Fills a section with up to block_types different blocks, mostly the first one like the stone of a lower section.
+BlockArray MakeSection(std::size_t block_types, u32 seed) {
+    std::mt19937 random(seed);
+    BlockArray blocks;
+
+    for (std::size_t i = 0; i < blocks.size(); ++i) {
+        u32 type = random() % 8 == 0 ? static_cast<u32>(random() % block_types) : 0;
+
+        blocks[i] = GetBlock(1 + type);
+    }
+
+    return blocks;
+}
+
+terra::ChunkPtr MakeChunk(const BlockArray& blocks) {
+    terra::ChunkPtr chunk = terra::MakeChunk();
+
+    for (s32 y = 0; y < 16; ++y) {
+        for (s32 z = 0; z < 16; ++z) {
+            for (s32 x = 0; x < 16; ++x) {
+                chunk->SetBlock(mc::Vector3i(x, y, z), blocks[y * 256 + z * 16 + x]);
+            }
+        }
+    }
+
+    return chunk;
+}
+
+// Random positions shared by both layouts so they do the same work.
+std::vector<mc::Vector3i> MakePositions(std::size_t count) {
+    std::mt19937 random(7);
+    std::vector<mc::Vector3i> positions;
+
+    positions.reserve(count);
+
+    for (std::size_t i = 0; i < count; ++i) {
+        positions.emplace_back(random() % 16, random() % 16, random() % 16);
+    }
+
+    return positions;
+}
+
+const std::size_t kBlockTypeCounts[] = { 1, 2, 4, 16, 300 };
+
+// Builds mclib columns shaped like terrain: mixed stone sections at the bottom, a few blocks near the surface and air above.
+std::vector<mc::world::ChunkColumnPtr> MakeServerColumns(std::size_t count) {
+    std::vector<mc::world::ChunkColumnPtr> columns;
+
+    for (std::size_t i = 0; i < count; ++i) {
+        mc::world::ChunkColumnMetadata metadata = {};
+
+        metadata.x = static_cast<s32>(i);
+        metadata.sectionmask = 0xFF;
+        metadata.continuous = true;
+        metadata.skylight = true;
+
+        auto column = std::make_shared<mc::world::ChunkColumn>(metadata);
+
+        for (std::size_t section = 0; section < 8; ++section) {
+            BlockArray blocks = MakeSection(section < 6 ? 16 : 4, static_cast<u32>(i * 16 + section));
+            auto chunk = std::make_shared<mc::world::Chunk>();
+
+            for (s32 index = 0; index < 16 * 16 * 16; ++index) {
+                // The top half of the surface section is air.
+                mc::block::BlockPtr block = section == 7 && index >= 2048 ? GetBlock(0) : blocks[index];
+
+                chunk->SetBlock(mc::Vector3i(index & 15, index >> 8, (index >> 4) & 15), block);
+            }
+
+            (*column)[section] = chunk;
+        }
+
+        columns.push_back(column);
+    }
+
+    return columns;
+}
+
+// How columns were converted before the bulk import: every block goes through Chunk::SetBlock.
+terra::ChunkColumnPtr ConvertPerBlock(const mc::world::ChunkColumn& source) {
+    auto column = std::make_shared<terra::ChunkColumn>(terra::ChunkColumnMetadata(source.GetMetadata()));
+
+    for (std::size_t section = 0; section < terra::ChunkColumn::ChunksPerColumn; ++section) {
+        if (source[section] == nullptr) continue;
+
+        terra::ChunkPtr chunk = terra::MakeChunk();
+
+        for (s32 y = 0; y < 16; ++y) {
+            for (s32 z = 0; z < 16; ++z) {
+                for (s32 x = 0; x < 16; ++x) {
+                    mc::block::BlockPtr block = source[section]->GetBlock(mc::Vector3i(x, y, z));
+
+                    chunk->SetBlock(mc::Vector3i(x, y, z), block != nullptr ? block : GetBlock(0));
+                }
+            }
+        }
+
+        (*column)[section] = chunk;
+    }
+
+    column->BuildHeightmaps();
+    return column;
+}
+
+} // ns
+
+TERRA_TEST(ChunkMatchesBlockArray) {
+    for (std::size_t block_types : kBlockTypeCounts) {
+        BlockArray blocks = MakeSection(block_types, static_cast<u32>(block_types));
+        terra::ChunkPtr chunk = MakeChunk(blocks);
+
+        for (s32 i = 0; i < 16 * 16 * 16; ++i) {
+            TERRA_CHECK(chunk->GetBlock(mc::Vector3i(i & 15, i >> 8, (i >> 4) & 15)) == blocks[i]);
+        }
+
+        TERRA_CHECK(chunk->GetBitsPerBlock() == terra::Chunk::GetRequiredBits(chunk->GetPaletteSize()));
+    }
+
+    // A chunk with one block never allocates index storage.
+    terra::ChunkPtr uniform = terra::MakeChunk();
+
+    uniform->SetBlock(mc::Vector3i(3, 4, 5), GetBlock(0));
+    TERRA_CHECK(uniform->IsUniform());
+    TERRA_CHECK(uniform->GetPackedData().empty());
+}
+
+TERRA_BENCH(ChunkMemoryAndReads) {
+    const std::vector<mc::Vector3i> positions = MakePositions(1 << 16);
+
+    terra::test::Report("array layout memory", static_cast<double>(sizeof(BlockArray)), "bytes");
+
+    for (std::size_t block_types : kBlockTypeCounts) {
+        BlockArray blocks = MakeSection(block_types, static_cast<u32>(block_types));
+        terra::ChunkPtr chunk = MakeChunk(blocks);
+        std::string prefix = std::to_string(block_types) + " block types, ";
+
+        terra::test::Report(prefix + "palette memory", static_cast<double>(chunk->GetMemoryUsage()), "bytes");
+
+        double array_sequential = terra::test::Measure([&blocks]() {
+            std::size_t count = 0;
+
+            for (s32 y = 0; y < 16; ++y) {
+                for (s32 z = 0; z < 16; ++z) {
+                    for (s32 x = 0; x < 16; ++x) {
+                        count += blocks[y * 256 + z * 16 + x] != nullptr;
+                    }
+                }
+            }
+
+            terra::test::Consume(count);
+        });
+
+        double palette_sequential = terra::test::Measure([&chunk]() {
+            std::size_t count = 0;
+
+            for (s32 y = 0; y < 16; ++y) {
+                for (s32 z = 0; z < 16; ++z) {
+                    for (s32 x = 0; x < 16; ++x) {
+                        count += chunk->GetBlock(mc::Vector3i(x, y, z)) != nullptr;
+                    }
+                }
+            }
+
+            terra::test::Consume(count);
+        });
+
+        double array_random = terra::test::Measure([&blocks, &positions]() {
+            std::size_t count = 0;
+
+            for (const mc::Vector3i& position : positions) {
+                count += blocks[position.y * 256 + position.z * 16 + position.x] != nullptr;
+            }
+
+            terra::test::Consume(count);
+        });
+
+        double palette_random = terra::test::Measure([&chunk, &positions]() {
+            std::size_t count = 0;
+
+            for (const mc::Vector3i& position : positions) {
+                count += chunk->GetBlock(position) != nullptr;
+            }
+
+            terra::test::Consume(count);
+        });
+
+        const double sequential_reads = 16.0 * 16.0 * 16.0 / 1e6;
+        const double random_reads = positions.size() / 1e6;
+
+        terra::test::Report(prefix + "array sequential reads", sequential_reads / array_sequential, "M/s");
+        terra::test::Report(prefix + "palette sequential reads", sequential_reads / palette_sequential, "M/s");
+        terra::test::Report(prefix + "array random reads", random_reads / array_random, "M/s");
+        terra::test::Report(prefix + "palette random reads", random_reads / palette_random, "M/s");
+    }
+}
+
+TERRA_TEST(ColumnImportMatchesPerBlock) {
+    for (const mc::world::ChunkColumnPtr& source : MakeServerColumns(4)) {
+        terra::ChunkColumn bulk(*source);
+        terra::ChunkColumnPtr per_block = ConvertPerBlock(*source);
+
+        for (s32 y = 0; y < 16 * 8; ++y) {
+            for (s32 z = 0; z < 16; ++z) {
+                for (s32 x = 0; x < 16; ++x) {
+                    mc::Vector3i position(x, y, z);
+
+                    TERRA_CHECK(bulk.GetBlock(position) == per_block->GetBlock(position));
+                    TERRA_CHECK(bulk.IsSolid(position) == per_block->IsSolid(position));
+                }
+            }
+        }
+
+        for (s32 i = 0; i < 16 * 16; ++i) {
+            TERRA_CHECK(bulk.GetHighestSolidBlock(i & 15, i >> 4) == per_block->GetHighestSolidBlock(i & 15, i >> 4));
+        }
+    }
+}
+
+TERRA_TEST(ColumnAirInMissingSectionKeepsItMissing) {
+    mc::world::ChunkColumnMetadata metadata = {};
+    terra::ChunkColumn column((terra::ChunkColumnMetadata(metadata)));
+
+    column.SetBlock(mc::Vector3i(3, 100, 5), GetBlock(0));
+    TERRA_CHECK(column[100 / 16] == nullptr);
+
+    column.SetBlock(mc::Vector3i(3, 100, 5), GetBlock(1));
+    TERRA_CHECK(column[100 / 16] != nullptr);
+    TERRA_CHECK(column.GetBlock(mc::Vector3i(3, 100, 5)) == GetBlock(1));
+}
+
+TERRA_BENCH(ColumnImport) {
+    const std::vector<mc::world::ChunkColumnPtr> sources = MakeServerColumns(32);
+
+    double per_block = terra::test::Measure([&sources]() {
+        for (const mc::world::ChunkColumnPtr& source : sources) {
+            terra::test::Consume(ConvertPerBlock(*source)->GetChunkCount());
+        }
+    });
+
+    double bulk = terra::test::Measure([&sources]() {
+        for (const mc::world::ChunkColumnPtr& source : sources) {
+            terra::ChunkColumn column(*source);
+
+            terra::test::Consume(column.GetChunkCount());
+        }
+    });
+
+    terra::test::Report("per-block columns", sources.size() / per_block, "columns/s");
+    terra::test::Report("bulk import columns", sources.size() / bulk, "columns/s");
+}
+
+TERRA_TEST(UniformChunkMasks) {
+    mc::block::BlockPtr stone = GetBlock(1);
+    terra::Chunk uniform(std::vector<mc::block::BlockPtr>{ stone }, 0, nullptr);
+
+    TERRA_CHECK(uniform.IsUniform());
+    TERRA_CHECK(uniform.GetNonAirCount() == 16 * 16 * 16);
+    TERRA_CHECK(uniform.IsSolid(mc::Vector3i(15, 15, 15)));
+
+    // Uniform chunks don't own any mask storage.
+    terra::Chunk air;
+    TERRA_CHECK(air.IsEmpty());
+    TERRA_CHECK(!air.IsSolid(mc::Vector3i(0, 0, 0)));
+    TERRA_CHECK(air.GetMemoryUsage() < sizeof(terra::Chunk::BlockMask));
+
+    // The first different block gives the chunk its own masks, starting from the uniform ones.
+    terra::Chunk changed(uniform);
+    changed.SetBlock(mc::Vector3i(3, 4, 5), GetBlock(0));
+
+    TERRA_CHECK(!changed.IsUniform());
+    TERRA_CHECK(changed.GetNonAirCount() == 16 * 16 * 16 - 1);
+    TERRA_CHECK(!changed.IsSolid(mc::Vector3i(3, 4, 5)));
+    TERRA_CHECK(changed.IsSolid(mc::Vector3i(4, 4, 5)));
+    TERRA_CHECK(changed.GetSolidBlock(mc::Vector3i(4, 4, 5)) == stone);
+    TERRA_CHECK(changed.GetSolidBlock(mc::Vector3i(3, 4, 5)) == nullptr);
+    TERRA_CHECK(uniform.IsSolid(mc::Vector3i(3, 4, 5)));
+
+    terra::Chunk copy(changed);
+    TERRA_CHECK(!copy.IsSolid(mc::Vector3i(3, 4, 5)));
+    TERRA_CHECK(&copy.GetSolidMask() != &changed.GetSolidMask());
+}
@@ -0,0 +1,223 @@
+#include "Test.h"
+
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Spins until the condition holds, or gives up after ten seconds so a broken job system fails instead of hanging.
+template <typename Condition>
+bool SpinUntil(Condition&& condition) {
+    auto timeout = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() > timeout) return false;
+
+        std::this_thread::yield();
+    }
+
+    return true;
+}
+
+// Occupies a worker until it's released, so jobs can be queued up behind it.
+struct Blocker {
+    std::atomic<bool> started{ false };
+    std::atomic<bool> released{ false };
+
+    terra::JobSystem::Job MakeJob() {
+        return [this]() {
+            started = true;
+            SpinUntil([this] { return released.load(); });
+        };
+    }
+};
+
+} // ns
+
+TERRA_TEST(JobSystemRunsHigherPrioritiesFirst) {
+    terra::JobSystem jobs(1);
+    terra::JobToken token;
+    Blocker blocker;
+    std::vector<int> order;
+
+    jobs.Submit(blocker.MakeJob(), terra::JobPriority::Normal, token);
+    TERRA_CHECK(SpinUntil([&] { return blocker.started.load(); }));
+
+    // Queued behind the blocker in mixed order. The only worker runs them one at a time, so order needs no lock.
+    for (int i = 0; i < 4; ++i) {
+        jobs.Submit([&order, i] { order.push_back(20 + i); }, terra::JobPriority::Low, token);
+        jobs.Submit([&order, i] { order.push_back(10 + i); }, terra::JobPriority::Normal, token);
+        jobs.Submit([&order, i] { order.push_back(i); }, terra::JobPriority::High, token);
+    }
+
+    blocker.released = true;
+    jobs.Wait(token);
+
+    // Every priority before the next one, and the jobs of one priority in the order they were submitted.
+    const std::vector<int> expected = { 0, 1, 2, 3, 10, 11, 12, 13, 20, 21, 22, 23 };
+
+    TERRA_CHECK(order == expected);
+}
+
+TERRA_TEST(JobSystemStealsNestedJobs) {
+    terra::JobSystem jobs(4);
+    terra::JobToken token;
+    const int kChildren = 64;
+
+    std::atomic<int> finished{ 0 };
+    std::atomic<int> on_parent{ 0 };
+    std::atomic<bool> parent_done{ false };
+    int parent_index = -1;
+
+    jobs.Submit([&] {
+        parent_index = jobs.GetWorkerIndex();
+
+        // Jobs submitted from a job go to the queue of its worker, which stays busy here, so the others have to steal them.
+        for (int i = 0; i < kChildren; ++i) {
+            jobs.Submit([&] {
+                if (jobs.GetWorkerIndex() == parent_index) {
+                    ++on_parent;
+                }
+
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+                ++finished;
+            }, terra::JobPriority::Normal, token);
+        }
+
+        parent_done = SpinUntil([&] { return finished.load() == kChildren; });
+    }, terra::JobPriority::Normal, token);
+
+    // The children are counted on the token before the parent finishes, so this waits for them too.
+    jobs.Wait(token);
+
+    TERRA_CHECK(parent_done.load());
+    TERRA_CHECK(parent_index >= 0);
+    TERRA_CHECK(finished.load() == kChildren);
+    TERRA_CHECK(on_parent.load() == 0);
+}
+
+TERRA_TEST(JobSystemCancelWaitsForRunningJobs) {
+    terra::JobSystem jobs(4);
+    const int kJobs = 400;
+
+    for (int round = 0; round < 8; ++round) {
+        terra::JobToken token;
+        std::atomic<int> started{ 0 };
+        std::atomic<int> finished{ 0 };
+
+        for (int i = 0; i < kJobs; ++i) {
+            jobs.Submit([&] {
+                ++started;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                ++finished;
+            }, static_cast<terra::JobPriority>(i % 3), token);
+        }
+
+        TERRA_CHECK(SpinUntil([&] { return started.load() >= 8; }));
+
+        token.Cancel();
+        jobs.Wait(token);
+
+        // The jobs that were running when the token was cancelled have finished, and the rest never start.
+        int count = started.load();
+
+        TERRA_CHECK(finished.load() == count);
+        TERRA_CHECK(count < kJobs);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        TERRA_CHECK(started.load() == count);
+
+        // Jobs submitted after the token was cancelled are skipped too.
+        jobs.Submit([&] { ++started; }, terra::JobPriority::High, token);
+        jobs.Wait(token);
+
+        TERRA_CHECK(started.load() == count);
+    }
+}
+
+TERRA_TEST(JobSystemDestructionReleasesQueuedTokens) {
+    std::unique_ptr<terra::JobSystem> jobs = std::make_unique<terra::JobSystem>(1);
+    terra::JobToken token;
+    Blocker blocker;
+    const int kJobs = 100;
+
+    std::atomic<int> ran{ 0 };
+
+    jobs->Submit(blocker.MakeJob(), terra::JobPriority::High, token);
+    TERRA_CHECK(SpinUntil([&] { return blocker.started.load(); }));
+
+    for (int i = 0; i < kJobs; ++i) {
+        jobs->Submit([&ran] { ++ran; }, static_cast<terra::JobPriority>(i % 3), token);
+    }
+
+    // The job system is only freed after the blocker is released, long after the waiter is in Wait.
+    terra::JobSystem* system = jobs.get();
+    std::atomic<bool> waiting{ false };
+    std::thread waiter([system, &token, &waiting] {
+        waiting = true;
+        system->Wait(token);
+    });
+
+    TERRA_CHECK(SpinUntil([&] { return waiting.load(); }));
+
+    std::thread destroyer([&jobs] { jobs.reset(); });
+
+    // The destructor waits for the blocker. Once it's released, the jobs queued behind it are skipped.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    blocker.released = true;
+
+    destroyer.join();
+    // Hangs if a skipped job was never counted off the token.
+    waiter.join();
+
+    // The worker checks for shutdown before taking a job, and the destructor started long before the blocker finished.
+    TERRA_CHECK(ran.load() == 0);
+}
+
+TERRA_BENCH(JobSystemThroughput) {
+    const int kJobs = 100000;
+    std::atomic<std::size_t> sum{ 0 };
+
+    // One worker, and the default count but at least two so stealing is measured on small machines too.
+    for (std::size_t workers : { std::size_t(1), std::max<std::size_t>(2, terra::JobSystem::GetDefaultWorkerCount()) }) {
+        terra::JobSystem jobs(workers);
+
+        double submitted = terra::test::Measure([&] {
+            terra::JobToken token;
+
+            for (int i = 0; i < kJobs; ++i) {
+                jobs.Submit([&sum, i] { sum.fetch_add(i, std::memory_order_relaxed); }, terra::JobPriority::Normal, token);
+            }
+
+            jobs.Wait(token);
+        });
+
+        // One job fans out, so the jobs land on a single worker queue and the others steal them.
+        double nested = terra::test::Measure([&] {
+            terra::JobToken token;
+
+            jobs.Submit([&] {
+                for (int i = 0; i < kJobs; ++i) {
+                    jobs.Submit([&sum, i] { sum.fetch_add(i, std::memory_order_relaxed); }, terra::JobPriority::Normal, token);
+                }
+            }, terra::JobPriority::Normal, token);
+
+            jobs.Wait(token);
+        });
+
+        std::string name = std::to_string(workers) + (workers == 1 ? " worker" : " workers");
+
+        terra::test::Report(name + ", submitted from the main thread", submitted / kJobs * 1e9, "ns/job");
+        terra::test::Report(name + ", submitted from a job", nested / kJobs * 1e9, "ns/job");
+    }
+
+    terra::test::Consume(sum.load());
+}
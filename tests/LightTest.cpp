@@ -0,0 +1,164 @@
+#include "Test.h"
+
+#include "EpochManager.h"
+#include "JobSystem.h"
+#include "LightEngine.h"
+#include "World.h"
+#include "assets/AssetCache.h"
+
+#include <mclib/protocol/packets/PacketDispatcher.h>
+
+#include <chrono>
+#include <thread>
+
+namespace {
+
+// Stone up to y = 64 with open sky above it.
+terra::ChunkColumnPtr MakeTerrain(s32 x, s32 z) {
+    mc::world::ChunkColumnMetadata metadata = {};
+
+    metadata.x = x;
+    metadata.z = z;
+    metadata.continuous = true;
+    metadata.skylight = true;
+
+    terra::ChunkColumnPtr column = terra::GetChunkColumnPool().MakeShared(terra::ChunkColumnMetadata(metadata));
+    mc::block::BlockPtr stone = mc::block::BlockRegistry::GetInstance()->GetBlock("minecraft:stone");
+
+    for (std::size_t i = 0; i < 4; ++i) {
+        (*column)[i] = terra::MakeChunk(std::vector<mc::block::BlockPtr>{ stone }, 0, nullptr);
+    }
+
+    column->BuildHeightmaps();
+    return column;
+}
+
+mc::block::BlockPtr GetTorch() {
+    mc::block::BlockPtr torch = mc::block::BlockRegistry::GetInstance()->GetBlock("minecraft:torch");
+    terra::assets::BlockStateProperties properties;
+
+    properties.light_emission = 14;
+    g_AssetCache->SetStateProperties(torch->GetType(), properties);
+
+    return torch;
+}
+
+// The engine reports the sections it changed after it publishes, so that marks the end of the work that was handed to it.
+bool WaitForLight(terra::LightEngine& light, std::vector<mc::Vector3i>& sections) {
+    auto timeout = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+
+    sections.clear();
+
+    while (sections.empty()) {
+        if (std::chrono::steady_clock::now() > timeout) return false;
+
+        std::this_thread::yield();
+        light.TakeDirtySections(sections);
+    }
+
+    return true;
+}
+
+bool Contains(const std::vector<mc::Vector3i>& sections, const mc::Vector3i& section) {
+    for (const mc::Vector3i& entry : sections) {
+        if (entry == section) return true;
+    }
+
+    return false;
+}
+
+struct LightWorld {
+    mc::protocol::packets::PacketDispatcher dispatcher;
+    terra::JobSystem jobs;
+    terra::World world;
+    terra::LightEngine light;
+    std::vector<mc::Vector3i> sections;
+
+    LightWorld(s32 radius) : jobs(1), world(&dispatcher, &jobs), light(&world) {
+        for (s32 z = -radius; z <= radius; ++z) {
+            for (s32 x = -radius; x <= radius; ++x) {
+                world.CommitColumn(MakeTerrain(x, z));
+            }
+        }
+    }
+
+    bool Update() {
+        world.PublishSnapshot();
+        light.Update();
+
+        return WaitForLight(light, sections);
+    }
+
+    u8 GetLight(s64 x, s64 y, s64 z) {
+        terra::EpochManager::ReadGuard guard(terra::GetEpochManager());
+        const terra::LightSnapshot* snapshot = light.GetSnapshot();
+
+        return snapshot ? snapshot->GetLight(mc::Vector3i(x, y, z)) : 0;
+    }
+};
+
+} // ns
+
+TERRA_TEST(LightEngineRelightsBlockChanges) {
+    mc::block::BlockPtr torch = GetTorch();
+    mc::block::BlockPtr air = mc::block::BlockRegistry::GetInstance()->GetBlock(0);
+    mc::block::BlockPtr granite = mc::block::BlockRegistry::GetInstance()->GetBlock("minecraft:granite");
+
+    LightWorld world(1);
+
+    TERRA_CHECK(world.Update());
+    TERRA_CHECK(world.GetLight(8, 70, 8) == terra::MaxLightLevel << 4);
+    TERRA_CHECK(world.GetLight(8, 10, 8) == 0);
+
+    world.world.SetBlock(mc::Vector3i(8, 64, 8), torch);
+    TERRA_CHECK(world.Update());
+
+    // Block light drops by one for every step away from the torch, across column borders too.
+    TERRA_CHECK((world.GetLight(8, 64, 8) & 15) == 14);
+    TERRA_CHECK((world.GetLight(11, 64, 8) & 15) == 11);
+    TERRA_CHECK((world.GetLight(8, 64, 21) & 15) == 1);
+    TERRA_CHECK((world.GetLight(8, 64, 22) & 15) == 0);
+    TERRA_CHECK((world.GetLight(-4, 65, 8) & 15) == 1);
+    TERRA_CHECK(Contains(world.sections, mc::Vector3i(0, 4, 0)));
+    TERRA_CHECK(Contains(world.sections, mc::Vector3i(0, 4, 1)));
+
+    world.world.SetBlock(mc::Vector3i(8, 64, 8), air);
+    TERRA_CHECK(world.Update());
+
+    TERRA_CHECK((world.GetLight(8, 64, 8) & 15) == 0);
+    TERRA_CHECK((world.GetLight(11, 64, 8) & 15) == 0);
+    TERRA_CHECK((world.GetLight(-4, 65, 8) & 15) == 0);
+
+    // Swapping one opaque block for another doesn't change any light, but the section still has to be remeshed.
+    world.world.SetBlock(mc::Vector3i(20, 10, 5), granite);
+    TERRA_CHECK(world.Update());
+
+    TERRA_CHECK(Contains(world.sections, mc::Vector3i(1, 0, 0)));
+    TERRA_CHECK(world.GetLight(8, 70, 8) == terra::MaxLightLevel << 4);
+}
+
+TERRA_BENCH(LightRelight) {
+    mc::block::BlockPtr torch = GetTorch();
+    mc::block::BlockPtr air = mc::block::BlockRegistry::GetInstance()->GetBlock(0);
+
+    // Roughly the columns of a view distance of 6.
+    LightWorld world(6);
+
+    world.Update();
+
+    // The center column is replaced, so its old light is removed from the neighbors before it's lit again.
+    double load = terra::test::Measure([&]() {
+        world.world.CommitColumn(MakeTerrain(0, 0));
+        world.Update();
+    });
+
+    std::size_t count = 0;
+
+    double change = terra::test::Measure([&]() {
+        world.world.SetBlock(mc::Vector3i(8, 64, 8), (++count & 1) ? torch : air);
+        world.Update();
+    });
+
+    terra::test::Report("relight after loading a column", load * 1e3, "ms");
+    terra::test::Report("relight after placing or removing a torch", change * 1e3, "ms");
+}
@@ -0,0 +1,80 @@
+#include "Test.h"
+
+#include "assets/AssetCache.h"
+
+#include <mclib/block/Block.h>
+#include <mclib/protocol/Protocol.h>
+
+#include <cstring>
+#include <iostream>
+
+std::unique_ptr<terra::assets::AssetCache> g_AssetCache;
+
+namespace terra {
+namespace test {
+
+static std::size_t g_Failures = 0;
+static volatile std::size_t g_Sink = 0;
+
+std::vector<TestCase>& GetTestCases() {
+    static std::vector<TestCase> cases;
+    return cases;
+}
+
+void Fail(const char* file, int line, const char* expression) {
+    std::cerr << file << ":" << line << ": check failed: " << expression << std::endl;
+    ++g_Failures;
+}
+
+void Report(const std::string& name, double value, const char* unit) {
+    std::cout << "  " << name << ": " << value << " " << unit << std::endl;
+}
+
+void Consume(std::size_t value) {
+    g_Sink = g_Sink + value;
+}
+
+} // ns test
+} // ns terra
+
+// Runs the tests, or the benchmarks with --bench. Any other argument only runs the cases with that name.
+int main(int argc, char* argv[]) {
+    bool benchmark = false;
+    const char* filter = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--bench") == 0) {
+            benchmark = true;
+        } else {
+            filter = argv[i];
+        }
+    }
+
+    mc::block::BlockRegistry::GetInstance()->RegisterVanillaBlocks(mc::protocol::Version::Minecraft_1_13_2);
+
+    // The assets aren't loaded, so tests set the properties of the states they use with SetStateProperties.
+    g_AssetCache = std::make_unique<terra::assets::AssetCache>();
+
+    std::size_t run = 0;
+    std::size_t failed = 0;
+
+    for (const terra::test::TestCase& test_case : terra::test::GetTestCases()) {
+        if (test_case.benchmark != benchmark) continue;
+        if (filter != nullptr && std::strcmp(filter, test_case.name) != 0) continue;
+
+        std::size_t failures = terra::test::g_Failures;
+
+        std::cout << test_case.name << std::endl;
+        test_case.function();
+        ++run;
+
+        if (terra::test::g_Failures != failures) {
+            std::cout << test_case.name << " FAILED" << std::endl;
+            ++failed;
+        }
+    }
+
+    std::cout << run - failed << " of " << run << (benchmark ? " benchmarks" : " tests") << " passed." << std::endl;
+
+    return failed == 0 ? 0 : 1;
+}
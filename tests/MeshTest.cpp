@@ -0,0 +1,686 @@
+#include "Test.h"
+
+#include "JobSystem.h"
+#include "World.h"
+#include "assets/AssetCache.h"
+#include "render/ChunkMeshGenerator.h"
+
+#include <mclib/protocol/packets/PacketDispatcher.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <random>
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <glm/gtc/quaternion.hpp>
+
+namespace {
+
+using terra::block::BlockFace;
+using terra::render::ChunkMeshBuildContext;
+using terra::render::Vertex;
+
+// An element with every face textured and using the part of the texture that matches its extent.
+terra::block::BlockElement MakeElement(const glm::vec3& from, const glm::vec3& to, terra::assets::TextureHandle texture, bool cull) {
+    terra::block::BlockElement element(from, to);
+
+    for (std::size_t i = 0; i < 6; ++i) {
+        terra::block::RenderableFace renderable;
+
+        renderable.texture = texture;
+        renderable.tint_index = -1;
+        renderable.face = static_cast<BlockFace>(i);
+        renderable.cull_face = cull ? renderable.face : BlockFace::None;
+        renderable.uv_from = glm::vec2(from.x, from.y);
+        renderable.uv_to = glm::vec2(to.x, to.y);
+
+        element.AddFace(renderable);
+    }
+
+    return element;
+}
+
+// Swaps in an asset cache with hand made models for a few blocks, so the mesher can run without the game assets.
+class MeshAssets {
+public:
+    MeshAssets() : m_Previous(std::move(g_AssetCache)) {
+        g_AssetCache = std::make_unique<terra::assets::AssetCache>();
+
+        // A full cube, which the greedy mesher merges.
+        std::unique_ptr<terra::block::BlockModel> cube = std::make_unique<terra::block::BlockModel>();
+
+        cube->AddElement(MakeElement(glm::vec3(0, 0, 0), glm::vec3(1, 1, 1), 1, true));
+        AddBlock("minecraft:stone", std::move(cube), glm::vec3(0, 0, 0));
+
+        // A tinted full cube turned by the variant, so none of its faces are culled.
+        std::unique_ptr<terra::block::BlockModel> turned = std::make_unique<terra::block::BlockModel>();
+        terra::block::BlockElement turned_element = MakeElement(glm::vec3(0, 0, 0), glm::vec3(1, 1, 1), 2, true);
+
+        turned_element.GetFaces()[static_cast<std::size_t>(BlockFace::Up)].tint_index = 0;
+        turned->AddElement(turned_element);
+        AddBlock("minecraft:granite", std::move(turned), glm::vec3(90, 180, 0));
+
+        // A thin unshaded element tilted by its element rotation, like a torch on a wall.
+        std::unique_ptr<terra::block::BlockModel> torch = std::make_unique<terra::block::BlockModel>();
+        terra::block::BlockElement stick = MakeElement(glm::vec3(0.4375f, 0, 0.4375f), glm::vec3(0.5625f, 0.625f, 0.5625f), 3, false);
+
+        stick.SetShouldShade(false);
+        stick.GetRotation().origin = glm::vec3(0.5f, 0, 0.5f);
+        stick.GetRotation().axis = glm::vec3(0, 0, 1);
+        stick.GetRotation().angle = 22.5f;
+        torch->AddElement(stick);
+        AddBlock("minecraft:torch", std::move(torch), glm::vec3(0, 90, 0));
+
+        // A slab with a rescaled tilted top, which mixes culled and unculled faces in one model.
+        std::unique_ptr<terra::block::BlockModel> slab = std::make_unique<terra::block::BlockModel>();
+        terra::block::BlockElement top = MakeElement(glm::vec3(0.125f, 0.5f, 0.125f), glm::vec3(0.875f, 0.75f, 0.875f), 5, false);
+
+        top.GetRotation().origin = glm::vec3(0.5f, 0.5f, 0.5f);
+        top.GetRotation().axis = glm::vec3(1, 0, 0);
+        top.GetRotation().angle = -45.0f;
+        top.GetRotation().rescale = true;
+        slab->AddElement(MakeElement(glm::vec3(0, 0, 0), glm::vec3(1, 0.5f, 1), 4, true));
+        slab->AddElement(top);
+        AddBlock("minecraft:glowstone", std::move(slab), glm::vec3(0, 0, 0));
+
+        u32 max_id = 0;
+
+        for (u16 id : m_Blocks) {
+            max_id = std::max(max_id, (u32)id);
+        }
+
+        g_AssetCache->SetMaxBlockId(max_id);
+
+        for (u16 id : m_Blocks) {
+            g_AssetCache->AddBlockState(std::make_unique<terra::block::BlockState>(id));
+        }
+
+        g_AssetCache->BuildStateProperties();
+    }
+
+    ~MeshAssets() {
+        g_AssetCache = std::move(m_Previous);
+    }
+
+    // The state ids of the blocks above, starting with the full cube.
+    const std::vector<u16>& GetBlocks() const { return m_Blocks; }
+
+private:
+    void AddBlock(const char* name, std::unique_ptr<terra::block::BlockModel> model, const glm::vec3& rotations) {
+        mc::block::BlockPtr block = mc::block::BlockRegistry::GetInstance()->GetBlock(name);
+        std::unique_ptr<terra::block::BlockVariant> variant = std::make_unique<terra::block::BlockVariant>(model.get(), "", block);
+
+        variant->SetRotation(rotations);
+
+        g_AssetCache->AddBlockModel(name, std::move(model));
+        g_AssetCache->AddVariantModel(std::move(variant));
+        m_Blocks.push_back(static_cast<u16>(block->GetType()));
+    }
+
+    std::unique_ptr<terra::assets::AssetCache> m_Previous;
+    std::vector<u16> m_Blocks;
+};
+
+struct MeshWorld {
+    mc::protocol::packets::PacketDispatcher dispatcher;
+    terra::JobSystem jobs;
+    terra::World world;
+    glm::vec3 camera;
+    terra::render::ChunkMeshGenerator generator;
+
+    MeshWorld() : jobs(1), world(&dispatcher, &jobs), camera(0.0f), generator(&world, &jobs, camera) { }
+};
+
+// Fills the context with the blocks and air, blocks one in density, and random light. Some seeds leave a border unloaded.
+void FillSection(ChunkMeshBuildContext& context, const std::vector<u16>& blocks, u32 density, u32 seed) {
+    std::mt19937 random(seed);
+
+    context.world_position = mc::Vector3i(16 * (s32)(seed % 7) - 48, 64, -16 * (s32)(seed % 3));
+    context.shell_only = false;
+
+    for (s32 y = 0; y < 18; ++y) {
+        for (s32 z = 0; z < 18; ++z) {
+            for (s32 x = 0; x < 18; ++x) {
+                std::size_t index = y * 18 * 18 + z * 18 + x;
+                u16 block = random() % density == 0 ? blocks[random() % blocks.size()] : 0;
+
+                if (seed % 4 == 0 && x == 17) {
+                    block = ChunkMeshBuildContext::UnloadedBlock;
+                }
+
+                context.chunk_data[index] = block;
+                context.light_data[index] = static_cast<u8>(random());
+            }
+        }
+    }
+}
+
+// The mesher as it was before the face quads were baked at asset load, which rotated every element face while meshing
+// and looked up the solidity of three blocks for every face corner.
+namespace before_baking {
+
+void ApplyRotations(glm::vec3& bottom_left, glm::vec3& bottom_right, glm::vec3& top_left, glm::vec3& top_right, const glm::vec3& rotations, glm::vec3 offset = glm::vec3(0.5, 0.5, 0.5)) {
+    glm::quat quat(1, 0, 0, 0);
+
+    const float kToRads = (float)M_PI / 180.0f;
+
+    if (rotations.z != 0) {
+        quat = glm::rotate(quat, kToRads * rotations.z, glm::vec3(0.0f, 0.0f, 1.0f));
+    }
+
+    if (rotations.y != 0) {
+        quat = glm::rotate(quat, kToRads * -rotations.y, glm::vec3(0.0f, 1.0f, 0.0f));
+    }
+
+    if (rotations.x != 0) {
+        quat = glm::rotate(quat, kToRads * rotations.x, glm::vec3(1.0f, 0.0f, 0.0f));
+    }
+
+    if (rotations.x != 0 || rotations.y != 0 || rotations.z != 0) {
+        bottom_left = glm::vec3(quat * glm::vec4(bottom_left - offset, 1.0)) + offset;
+        bottom_right = glm::vec3(quat * glm::vec4(bottom_right - offset, 1.0)) + offset;
+        top_left = glm::vec3(quat * glm::vec4(top_left - offset, 1.0)) + offset;
+        top_right = glm::vec3(quat * glm::vec4(top_right - offset, 1.0)) + offset;
+    }
+}
+
+void ApplyRotations(glm::vec3& bottom_left, glm::vec3& bottom_right, glm::vec3& top_left, glm::vec3& top_right, const glm::vec3& variant_rotation, const terra::block::ElementRotation& rotation) {
+    glm::vec3 rotations(rotation.angle, rotation.angle, rotation.angle);
+
+    glm::quat quat(1, 0, 0, 0);
+
+    const float kToRads = (float)M_PI / 180.0f;
+
+    if (variant_rotation.z != 0) {
+        quat = glm::rotate(quat, kToRads * variant_rotation.z, glm::vec3(0.0f, 0.0f, 1.0f));
+    }
+
+    if (variant_rotation.y != 0) {
+        quat = glm::rotate(quat, kToRads * -variant_rotation.y, glm::vec3(0.0f, 1.0f, 0.0f));
+    }
+
+    if (variant_rotation.x != 0) {
+        quat = glm::rotate(quat, kToRads * variant_rotation.x, glm::vec3(1.0f, 0.0f, 0.0f));
+    }
+
+    if (rotation.rescale) {
+        rotations = rotations * (1.0f / std::cos(3.14159f / 4.0f) - 1.0f);
+    }
+
+    rotations = rotations * (quat * rotation.axis);
+
+    ApplyRotations(bottom_left, bottom_right, top_left, top_right, rotations, quat * (rotation.origin - glm::vec3(0.5, 0.5, 0.5)) + glm::vec3(0.5, 0.5, 0.5));
+}
+
+bool IsOccluding(terra::block::BlockVariant* from_variant, BlockFace face, u16 test_block) {
+    if (test_block == ChunkMeshBuildContext::UnloadedBlock) return true;
+    if (from_variant->HasRotation()) return false;
+
+    for (auto& element : from_variant->GetModel()->GetElements()) {
+        if (element.GetFace(face).cull_face == BlockFace::None) {
+            return false;
+        }
+    }
+
+    terra::block::BlockVariant* variant = g_AssetCache->GetVariant(test_block);
+    if (variant == nullptr || variant->HasRotation()) return false;
+
+    BlockFace opposite = terra::block::get_opposite_face(face);
+    bool is_full = false;
+
+    for (auto& element : variant->GetModel()->GetElements()) {
+        if (element.IsFullExtent() && !g_AssetCache->GetTextures().IsTransparent(element.GetFace(opposite).texture)) {
+            is_full = true;
+        }
+    }
+
+    return is_full;
+}
+
+int GetAmbientOcclusion(const ChunkMeshBuildContext& context, const mc::Vector3i& side1, const mc::Vector3i& side2, const mc::Vector3i& corner) {
+    int value1 = g_AssetCache->GetStateProperties(context.GetBlock(side1)).solid;
+    int value2 = g_AssetCache->GetStateProperties(context.GetBlock(side2)).solid;
+    int value_corner = g_AssetCache->GetStateProperties(context.GetBlock(corner)).solid;
+
+    if (value1 && value2) return 0;
+
+    return 3 - (value1 + value2 + value_corner);
+}
+
+// One face of the old mesher. Corners are in bottom left, bottom right, top right, top left order. Each position
+// component and uv picks the element's from (0) or to (1), and each corner is shaded by two sides and a corner block.
+struct Face {
+    mc::Vector3i normal;
+    glm::vec3 positions[4];
+    glm::vec2 uvs[4];
+    mc::Vector3i occluders[4][3];
+};
+
+// Indexed by BlockFace.
+const Face kFaces[] = {
+    // North
+    { mc::Vector3i(0, 0, -1),
+        { glm::vec3(1, 0, 0), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0), glm::vec3(1, 1, 0) },
+        { glm::vec2(0, 1), glm::vec2(1, 1), glm::vec2(1, 0), glm::vec2(0, 0) },
+        { { mc::Vector3i(1, 0, -1), mc::Vector3i(0, -1, -1), mc::Vector3i(1, -1, -1) }, { mc::Vector3i(0, -1, -1), mc::Vector3i(-1, 0, -1), mc::Vector3i(-1, -1, -1) },
+          { mc::Vector3i(0, 1, -1), mc::Vector3i(-1, 0, -1), mc::Vector3i(-1, 1, -1) }, { mc::Vector3i(0, 1, -1), mc::Vector3i(1, 0, -1), mc::Vector3i(1, 1, -1) } } },
+    // East
+    { mc::Vector3i(1, 0, 0),
+        { glm::vec3(1, 0, 1), glm::vec3(1, 0, 0), glm::vec3(1, 1, 0), glm::vec3(1, 1, 1) },
+        { glm::vec2(0, 1), glm::vec2(1, 1), glm::vec2(1, 0), glm::vec2(0, 0) },
+        { { mc::Vector3i(1, 0, 1), mc::Vector3i(1, -1, 0), mc::Vector3i(1, -1, 1) }, { mc::Vector3i(1, -1, 0), mc::Vector3i(1, 0, -1), mc::Vector3i(1, -1, -1) },
+          { mc::Vector3i(1, 1, 0), mc::Vector3i(1, 0, -1), mc::Vector3i(1, 1, -1) }, { mc::Vector3i(1, 1, 0), mc::Vector3i(1, 0, 1), mc::Vector3i(1, 1, 1) } } },
+    // South
+    { mc::Vector3i(0, 0, 1),
+        { glm::vec3(0, 0, 1), glm::vec3(1, 0, 1), glm::vec3(1, 1, 1), glm::vec3(0, 1, 1) },
+        { glm::vec2(0, 1), glm::vec2(1, 1), glm::vec2(1, 0), glm::vec2(0, 0) },
+        { { mc::Vector3i(-1, 0, 1), mc::Vector3i(0, -1, 1), mc::Vector3i(-1, -1, 1) }, { mc::Vector3i(1, 0, 1), mc::Vector3i(0, -1, 1), mc::Vector3i(1, -1, 1) },
+          { mc::Vector3i(0, 1, 1), mc::Vector3i(1, 0, 1), mc::Vector3i(1, 1, 1) }, { mc::Vector3i(0, 1, 1), mc::Vector3i(-1, 0, 1), mc::Vector3i(-1, 1, 1) } } },
+    // West
+    { mc::Vector3i(-1, 0, 0),
+        { glm::vec3(0, 0, 0), glm::vec3(0, 0, 1), glm::vec3(0, 1, 1), glm::vec3(0, 1, 0) },
+        { glm::vec2(0, 1), glm::vec2(1, 1), glm::vec2(1, 0), glm::vec2(0, 0) },
+        { { mc::Vector3i(-1, -1, 0), mc::Vector3i(-1, 0, -1), mc::Vector3i(-1, -1, -1) }, { mc::Vector3i(-1, -1, 0), mc::Vector3i(-1, 0, 1), mc::Vector3i(-1, -1, 1) },
+          { mc::Vector3i(-1, 1, 0), mc::Vector3i(-1, 0, 1), mc::Vector3i(-1, 1, 1) }, { mc::Vector3i(-1, 1, 0), mc::Vector3i(-1, 0, -1), mc::Vector3i(-1, 1, -1) } } },
+    // Up
+    { mc::Vector3i(0, 1, 0),
+        { glm::vec3(0, 1, 0), glm::vec3(0, 1, 1), glm::vec3(1, 1, 1), glm::vec3(1, 1, 0) },
+        { glm::vec2(0, 0), glm::vec2(0, 1), glm::vec2(1, 1), glm::vec2(1, 0) },
+        { { mc::Vector3i(-1, 1, 0), mc::Vector3i(0, 1, -1), mc::Vector3i(-1, 1, -1) }, { mc::Vector3i(-1, 1, 0), mc::Vector3i(0, 1, 1), mc::Vector3i(-1, 1, 1) },
+          { mc::Vector3i(1, 1, 0), mc::Vector3i(0, 1, 1), mc::Vector3i(1, 1, 1) }, { mc::Vector3i(1, 1, 0), mc::Vector3i(0, 1, -1), mc::Vector3i(1, 1, -1) } } },
+    // Down
+    { mc::Vector3i(0, -1, 0),
+        { glm::vec3(1, 0, 0), glm::vec3(1, 0, 1), glm::vec3(0, 0, 1), glm::vec3(0, 0, 0) },
+        { glm::vec2(1, 1), glm::vec2(1, 0), glm::vec2(0, 0), glm::vec2(0, 1) },
+        { { mc::Vector3i(1, -1, 0), mc::Vector3i(0, -1, -1), mc::Vector3i(1, -1, -1) }, { mc::Vector3i(1, -1, 0), mc::Vector3i(0, -1, 1), mc::Vector3i(1, -1, 1) },
+          { mc::Vector3i(-1, -1, 0), mc::Vector3i(0, -1, 1), mc::Vector3i(-1, -1, 1) }, { mc::Vector3i(-1, -1, 0), mc::Vector3i(0, -1, -1), mc::Vector3i(-1, -1, -1) } } },
+};
+
+glm::vec3 Select(const glm::vec3& from, const glm::vec3& to, const glm::vec3& select) {
+    return glm::vec3(select.x != 0 ? to.x : from.x, select.y != 0 ? to.y : from.y, select.z != 0 ? to.z : from.z);
+}
+
+// Builds every block one face at a time, in BlockFace order like the baked path. The old mesher went up, down, north,
+// south, east and west, but the vertices of each face are the same.
+void GenerateVertices(const ChunkMeshBuildContext& context, std::vector<Vertex>& vertices) {
+    for (int y = 0; y < 16; ++y) {
+        for (int z = 0; z < 16; ++z) {
+            for (int x = 0; x < 16; ++x) {
+                mc::Vector3i mc_pos = context.world_position + mc::Vector3i(x, y, z);
+
+                u16 block = context.GetBlock(mc_pos);
+                if (block == ChunkMeshBuildContext::UnloadedBlock) continue;
+
+                const terra::assets::BlockStateProperties& properties = g_AssetCache->GetStateProperties(block);
+                if (properties.empty) continue;
+
+                terra::block::BlockVariant* variant = properties.variant;
+                const glm::vec3 base((float)x, (float)y, (float)z);
+
+                for (std::size_t face_index = 0; face_index < 6; ++face_index) {
+                    const BlockFace face = static_cast<BlockFace>(face_index);
+                    const Face& old_face = kFaces[face_index];
+                    const mc::Vector3i neighbor = mc_pos + old_face.normal;
+
+                    if (IsOccluding(variant, face, context.GetBlock(neighbor))) continue;
+
+                    u8 light = context.GetLight(mc_pos);
+                    u8 neighbor_light = context.GetLight(neighbor);
+                    u8 face_light = std::max(light & 0xF0, neighbor_light & 0xF0) | std::max(light & 0x0F, neighbor_light & 0x0F);
+                    int occlusion[4] = { 3, 3, 3, 3 };
+
+                    if (!variant->HasRotation()) {
+                        for (std::size_t i = 0; i < 4; ++i) {
+                            const mc::Vector3i* occluders = old_face.occluders[i];
+
+                            occlusion[i] = GetAmbientOcclusion(context, mc_pos + occluders[0], mc_pos + occluders[1], mc_pos + occluders[2]);
+                        }
+                    }
+
+                    for (const auto& element : variant->GetModel()->GetElements()) {
+                        const terra::block::RenderableFace& renderable = element.GetFace(face);
+                        if (renderable.face != face) continue;
+
+                        glm::vec3 positions[4];
+                        glm::vec2 uvs[4];
+
+                        for (std::size_t i = 0; i < 4; ++i) {
+                            const glm::vec2& select = old_face.uvs[i];
+
+                            positions[i] = Select(element.GetFrom(), element.GetTo(), old_face.positions[i]);
+                            uvs[i] = glm::vec2(select.x != 0 ? renderable.uv_to.x : renderable.uv_from.x, select.y != 0 ? renderable.uv_to.y : renderable.uv_from.y);
+                        }
+
+                        ApplyRotations(positions[0], positions[1], positions[3], positions[2], variant->GetRotations());
+                        ApplyRotations(positions[0], positions[1], positions[3], positions[2], variant->GetRotations(), element.GetRotation());
+
+                        const u8 tint = static_cast<u8>(renderable.tint_index + 1);
+
+                        for (std::size_t i = 0; i < 4; ++i) {
+                            vertices.emplace_back(positions[i] + base, uvs[i], renderable.texture, tint, element.ShouldShade() ? occlusion[i] : 3, face_light);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+} // ns before_baking
+
+typedef std::array<Vertex, 4> Quad;
+
+glm::vec3 GetPosition(const Vertex& vertex) {
+    return glm::vec3(vertex.position[0], vertex.position[1], vertex.position[2]) / (float)Vertex::PositionScale - glm::vec3(Vertex::PositionBias);
+}
+
+glm::vec2 GetUV(const Vertex& vertex) {
+    return glm::vec2(vertex.data & 1023, (vertex.data >> 10) & 1023) / (float)Vertex::UVScale;
+}
+
+// Splits the quads that span several blocks back into one quad per block, with the texture coordinates of a single
+// repeat, and sorts them so meshes can be compared regardless of the order their faces were built in.
+std::vector<Quad> SplitQuads(const std::vector<Vertex>& vertices) {
+    std::vector<Quad> quads;
+
+    for (std::size_t i = 0; i + 3 < vertices.size(); i += 4) {
+        const Quad quad = { vertices[i], vertices[i + 1], vertices[i + 2], vertices[i + 3] };
+        // Corners are bottom left, bottom right, top right and top left.
+        const glm::vec3 origin = GetPosition(quad[0]);
+        const glm::vec3 u_edge = GetPosition(quad[1]) - origin;
+        const glm::vec3 v_edge = GetPosition(quad[3]) - origin;
+        const int width = (int)std::round(glm::length(u_edge));
+        const int height = (int)std::round(glm::length(v_edge));
+
+        if (width <= 1 && height <= 1) {
+            quads.push_back(quad);
+            continue;
+        }
+
+        const glm::vec2 uv_origin = GetUV(quad[0]);
+        const glm::vec2 uv_u = GetUV(quad[1]) - uv_origin;
+        const glm::vec2 uv_v = GetUV(quad[3]) - uv_origin;
+        const glm::vec2 corner_steps[4] = { glm::vec2(0, 0), glm::vec2(1, 0), glm::vec2(1, 1), glm::vec2(0, 1) };
+
+        for (int b = 0; b < height; ++b) {
+            for (int a = 0; a < width; ++a) {
+                glm::vec3 positions[4];
+                glm::vec2 uvs[4];
+                glm::vec2 uv_min(1024.0f);
+
+                for (std::size_t c = 0; c < 4; ++c) {
+                    const float s = (a + corner_steps[c].x) / width;
+                    const float t = (b + corner_steps[c].y) / height;
+
+                    positions[c] = origin + u_edge * s + v_edge * t;
+                    uvs[c] = uv_origin + uv_u * s + uv_v * t;
+                    uv_min = glm::min(uv_min, uvs[c]);
+                }
+
+                Quad split = quad;
+
+                for (std::size_t c = 0; c < 4; ++c) {
+                    const Vertex& corner = quad[c];
+                    u8 tint = (corner.data >> 20) & 3;
+                    int ambient_occlusion = (corner.data >> 22) & 3;
+                    u8 light = static_cast<u8>(corner.data >> 24);
+
+                    split[c] = Vertex(positions[c], uvs[c] - glm::floor(uv_min), corner.texture_index, tint, ambient_occlusion, light);
+                }
+
+                quads.push_back(split);
+            }
+        }
+    }
+
+    std::sort(quads.begin(), quads.end(), [](const Quad& first, const Quad& second) {
+        return std::memcmp(first.data(), second.data(), sizeof(Quad)) < 0;
+    });
+
+    return quads;
+}
+
+bool SameQuads(const std::vector<Quad>& first, const std::vector<Quad>& second) {
+    return first.size() == second.size() && std::memcmp(first.data(), second.data(), sizeof(Quad) * first.size()) == 0;
+}
+
+} // ns
+
+TERRA_TEST(MeshBakedQuadsMatchElementRotation) {
+    MeshAssets assets;
+    MeshWorld mesh;
+    std::unique_ptr<ChunkMeshBuildContext> context = std::make_unique<ChunkMeshBuildContext>();
+    std::vector<Vertex> vertices;
+    std::vector<Vertex> expected;
+
+    // The old mesher has no greedy path, so every block goes through the per block path that reads the baked quads.
+    mesh.generator.SetGreedyMeshing(false);
+
+    for (u32 seed = 0; seed < 16; ++seed) {
+        FillSection(*context, assets.GetBlocks(), 1 + seed % 4, seed);
+
+        vertices.clear();
+        expected.clear();
+
+        mesh.generator.GenerateVertices(*context, vertices);
+        before_baking::GenerateVertices(*context, expected);
+
+        TERRA_CHECK(!vertices.empty());
+        TERRA_CHECK(vertices.size() == expected.size());
+        TERRA_CHECK(vertices.size() != expected.size() || std::memcmp(vertices.data(), expected.data(), sizeof(Vertex) * vertices.size()) == 0);
+    }
+}
+
+TERRA_TEST(MeshGreedyFacesCoverPerBlockFaces) {
+    MeshAssets assets;
+    MeshWorld mesh;
+    std::unique_ptr<ChunkMeshBuildContext> context = std::make_unique<ChunkMeshBuildContext>();
+    std::vector<Vertex> greedy;
+    std::vector<Vertex> per_block;
+
+    // Mostly full cubes so there is something to merge, with random or even light.
+    std::vector<u16> blocks = assets.GetBlocks();
+
+    blocks.insert(blocks.end(), 6, blocks[0]);
+
+    for (u32 seed = 0; seed < 16; ++seed) {
+        FillSection(*context, blocks, 1 + seed % 4, seed);
+
+        if (seed % 2 == 0) {
+            std::memset(context->light_data, 0xF0, sizeof(context->light_data));
+        }
+
+        greedy.clear();
+        per_block.clear();
+
+        mesh.generator.SetGreedyMeshing(true);
+        mesh.generator.GenerateVertices(*context, greedy);
+        mesh.generator.SetGreedyMeshing(false);
+        mesh.generator.GenerateVertices(*context, per_block);
+
+        // Each merged quad stands for exactly the per block faces under it, with their texture, tint, light and occlusion.
+        TERRA_CHECK(!per_block.empty());
+        TERRA_CHECK(SameQuads(SplitQuads(greedy), SplitQuads(per_block)));
+
+        if (seed % 2 == 0) {
+            TERRA_CHECK(greedy.size() < per_block.size());
+        }
+    }
+
+    // A floor with even light except above one block, and a block on top that shades the faces around it.
+    const u16 stone = assets.GetBlocks()[0];
+
+    context->world_position = mc::Vector3i(0, 0, 0);
+    std::fill(std::begin(context->chunk_data), std::end(context->chunk_data), (u16)0);
+    std::memset(context->light_data, 0xF0, sizeof(context->light_data));
+
+    for (s32 z = 0; z < 16; ++z) {
+        for (s32 x = 0; x < 16; ++x) {
+            context->chunk_data[1 * 18 * 18 + (z + 1) * 18 + (x + 1)] = stone;
+        }
+    }
+
+    // Faces take the brighter of the light on both sides, so this adds block light instead of taking sky light away.
+    context->light_data[2 * 18 * 18 + 6 * 18 + 6] = 0xF7;
+    context->chunk_data[2 * 18 * 18 + 11 * 18 + 11] = stone;
+
+    greedy.clear();
+    per_block.clear();
+
+    mesh.generator.SetGreedyMeshing(true);
+    mesh.generator.GenerateVertices(*context, greedy);
+    mesh.generator.SetGreedyMeshing(false);
+    mesh.generator.GenerateVertices(*context, per_block);
+
+    TERRA_CHECK(SameQuads(SplitQuads(greedy), SplitQuads(per_block)));
+
+    // The top of the floor is merged, but not across the lit block or the shaded faces around the block on top.
+    std::size_t top_quads = 0;
+    bool lit_alone = false;
+
+    for (std::size_t i = 0; i + 3 < greedy.size(); i += 4) {
+        glm::vec3 low = GetPosition(greedy[i]);
+        glm::vec3 high = low;
+
+        for (std::size_t c = 1; c < 4; ++c) {
+            low = glm::min(low, GetPosition(greedy[i + c]));
+            high = glm::max(high, GetPosition(greedy[i + c]));
+        }
+
+        if (low.y != 1.0f || high.y != 1.0f) continue;
+
+        ++top_quads;
+
+        bool covers_lit = low.x <= 5.0f && high.x >= 6.0f && low.z <= 5.0f && high.z >= 6.0f;
+
+        if (covers_lit) {
+            lit_alone = high.x - low.x == 1.0f && high.z - low.z == 1.0f && (greedy[i].data >> 24) == 0xF7;
+        }
+    }
+
+    TERRA_CHECK(lit_alone);
+    // The shaded faces around the block on top can't be merged, so there are at least those eight and the lit one.
+    TERRA_CHECK(top_quads > 9);
+    TERRA_CHECK(top_quads < 16 * 16 - 1);
+}
+
+TERRA_BENCH(MeshBuild) {
+    MeshAssets assets;
+    MeshWorld mesh;
+    const std::size_t kSections = 32;
+    // Mostly solid sections like the ground, sparse ones like the surface and a few nearly empty ones above it.
+    const u32 kDensities[] = { 1, 1, 2, 4, 16, 64 };
+
+    // Mostly the full cube, like stone with the odd ore, torch or slab in it.
+    std::vector<u16> blocks = assets.GetBlocks();
+
+    blocks.insert(blocks.end(), 12, blocks[0]);
+
+    std::vector<std::unique_ptr<ChunkMeshBuildContext>> contexts;
+
+    for (u32 i = 0; i < kSections; ++i) {
+        contexts.push_back(std::make_unique<ChunkMeshBuildContext>());
+        FillSection(*contexts.back(), blocks, kDensities[i % 6], 100 + i);
+        // Even light like open terrain, so the greedy mesher can merge faces.
+        std::memset(contexts.back()->light_data, 0xF0, sizeof(contexts.back()->light_data));
+    }
+
+    std::vector<Vertex> vertices;
+    std::size_t vertex_count = 0;
+
+    auto build_all = [&]() {
+        vertex_count = 0;
+
+        for (auto& context : contexts) {
+            vertices.clear();
+            mesh.generator.GenerateVertices(*context, vertices);
+            vertex_count += vertices.size();
+        }
+
+        terra::test::Consume(vertex_count);
+    };
+
+    double greedy = terra::test::Measure(build_all);
+    std::size_t greedy_vertices = vertex_count;
+
+    mesh.generator.SetGreedyMeshing(false);
+
+    double per_block = terra::test::Measure(build_all);
+
+    terra::test::Report("greedy build per section", greedy / kSections * 1e6, "us");
+    terra::test::Report("greedy vertices per section", (double)greedy_vertices / kSections, "vertices");
+    terra::test::Report("per block build per section", per_block / kSections * 1e6, "us");
+    terra::test::Report("per block vertices per section", (double)vertex_count / kSections, "vertices");
+    terra::test::Report("per block throughput", vertex_count / per_block / 1e6, "M vertices/s");
+}
+
+TERRA_TEST(MeshFaceOcclusionMatchesCornerFormula) {
+    MeshAssets assets;
+    std::unique_ptr<ChunkMeshBuildContext> context = std::make_unique<ChunkMeshBuildContext>();
+    const u16 stone = assets.GetBlocks()[0];
+
+    auto set_block = [&context](s32 x, s32 y, s32 z, u16 block) {
+        context->chunk_data[(y + 1) * 18 * 18 + (z + 1) * 18 + (x + 1)] = block;
+    };
+
+    // Recorded cases with the corner values worked out by hand, packed two bits per corner in face corner order.
+    context->world_position = mc::Vector3i(-32, 16, 48);
+    std::fill(std::begin(context->chunk_data), std::end(context->chunk_data), (u16)0);
+
+    set_block(8, 8, 8, stone);
+    set_block(7, 9, 8, stone);
+    set_block(8, 9, 7, stone);
+    set_block(9, 7, 7, stone);
+    set_block(0, 0, 0, stone);
+    set_block(-1, -1, 0, stone);
+    set_block(0, -1, -1, stone);
+    context->BuildSolidity();
+
+    const mc::Vector3i center = context->world_position + mc::Vector3i(8, 8, 8);
+    const mc::Vector3i origin = context->world_position;
+
+    // Both sides of the first corner are solid, and one side of the second and fourth.
+    TERRA_CHECK(context->GetFaceOcclusion(center, BlockFace::Up) == (0 | 2 << 2 | 3 << 4 | 2 << 6));
+    // The corner block of the first corner is solid, and one side that the last two share.
+    TERRA_CHECK(context->GetFaceOcclusion(center, BlockFace::North) == (2 | 3 << 2 | 2 << 4 | 2 << 6));
+    TERRA_CHECK(context->GetFaceOcclusion(center, BlockFace::South) == 0xFF);
+    // The neighbors are in the border below and behind the section.
+    TERRA_CHECK(context->GetFaceOcclusion(origin, BlockFace::Down) == (2 | 3 << 2 | 2 << 4 | 0 << 6));
+
+    // Random sections against the corner formula, for every face of every block including the ones facing the border.
+    for (u32 seed = 0; seed < 16; ++seed) {
+        FillSection(*context, assets.GetBlocks(), 1 + seed % 4, seed);
+        context->BuildSolidity();
+
+        std::size_t mismatches = 0;
+
+        for (s32 y = 0; y < 16; ++y) {
+            for (s32 z = 0; z < 16; ++z) {
+                for (s32 x = 0; x < 16; ++x) {
+                    const mc::Vector3i pos = context->world_position + mc::Vector3i(x, y, z);
+
+                    for (std::size_t face_index = 0; face_index < 6; ++face_index) {
+                        const before_baking::Face& face = before_baking::kFaces[face_index];
+                        u8 expected = 0;
+
+                        for (std::size_t i = 0; i < 4; ++i) {
+                            const mc::Vector3i* occluders = face.occluders[i];
+                            int value = before_baking::GetAmbientOcclusion(*context, pos + occluders[0], pos + occluders[1], pos + occluders[2]);
+
+                            expected |= static_cast<u8>(value << (i * 2));
+                        }
+
+                        if (context->GetFaceOcclusion(pos, static_cast<BlockFace>(face_index)) != expected) {
+                            ++mismatches;
+                        }
+                    }
+                }
+            }
+        }
+
+        TERRA_CHECK(mismatches == 0);
+    }
+}
@@ -0,0 +1,106 @@
+#include "Test.h"
+
+#include "Chunk.h"
+#include "ObjectPool.h"
+
+#include <mclib/common/Types.h>
+
+namespace {
+
+struct Counted {
+    static int s_Live;
+
+    int value;
+
+    explicit Counted(int value) : value(value) { ++s_Live; }
+    ~Counted() { --s_Live; }
+};
+
+int Counted::s_Live = 0;
+
+} // ns
+
+TERRA_TEST(ObjectPoolMakeSharedUsesOneSlot) {
+    terra::ObjectPool<Counted, 4> pool;
+
+    {
+        std::shared_ptr<Counted> first = pool.MakeShared(1);
+        std::weak_ptr<Counted> weak = first;
+
+        TERRA_CHECK(first->value == 1);
+        TERRA_CHECK(Counted::s_Live == 1);
+        // The control block lives in the same slot as the object.
+        TERRA_CHECK(pool.GetStats().live == 1);
+
+        std::vector<std::shared_ptr<Counted>> objects;
+
+        for (int i = 0; i < 10; ++i) {
+            objects.push_back(pool.MakeShared(i));
+        }
+
+        TERRA_CHECK(pool.GetStats().live == 11);
+        TERRA_CHECK(pool.GetStats().free == 1);
+
+        objects.clear();
+        first.reset();
+
+        TERRA_CHECK(weak.expired());
+        TERRA_CHECK(Counted::s_Live == 0);
+        // The slot is released with the control block once the last weak reference is gone too.
+        TERRA_CHECK(pool.GetStats().live == 1);
+
+        weak.reset();
+        TERRA_CHECK(pool.GetStats().live == 0);
+    }
+
+    // Released slots are reused before the pool grows.
+    std::shared_ptr<Counted> again = pool.MakeShared(2);
+
+    TERRA_CHECK(pool.GetStats().live == 1);
+    TERRA_CHECK(pool.GetStats().free == 11);
+    TERRA_CHECK(pool.GetStats().high_water == 11);
+}
+
+TERRA_TEST(VectorPoolReusesStorage) {
+    terra::VectorPool<u64> pool;
+
+    std::vector<u64> first = pool.Acquire(100);
+    TERRA_CHECK(first.empty());
+    TERRA_CHECK(first.capacity() >= 100);
+
+    first.assign(100, 7);
+    const u64* storage = first.data();
+    pool.Release(std::move(first));
+
+    std::vector<u64> second = pool.Acquire(128);
+    TERRA_CHECK(second.empty());
+    TERRA_CHECK(second.data() == storage);
+
+    // Storage that is too small for the request is never handed out.
+    pool.Release(std::move(second));
+    std::vector<u64> larger = pool.Acquire(129);
+    TERRA_CHECK(larger.capacity() >= 129);
+    TERRA_CHECK(larger.data() != storage);
+}
+
+TERRA_TEST(MakeChunkAllocatesFromPools) {
+    terra::PoolStats chunks = terra::GetChunkPool().GetStats();
+    terra::PoolStats counts = terra::GetChunkRefCountPool().GetStats();
+
+    // Unpublished chunks go straight back to the pool, so both slots are free again once the pointer is dropped.
+    {
+        terra::ChunkPtr chunk = terra::MakeChunk();
+        std::weak_ptr<terra::Chunk> weak = chunk;
+
+        TERRA_CHECK(terra::GetChunkPool().GetStats().live == chunks.live + 1);
+        TERRA_CHECK(terra::GetChunkRefCountPool().GetStats().live == counts.live + 1);
+
+        chunk.reset();
+
+        // The chunk is released, but the weak reference keeps its control block.
+        TERRA_CHECK(terra::GetChunkPool().GetStats().live == chunks.live);
+        TERRA_CHECK(terra::GetChunkRefCountPool().GetStats().live == counts.live + 1);
+    }
+
+    TERRA_CHECK(terra::GetChunkRefCountPool().GetStats().live == counts.live);
+}
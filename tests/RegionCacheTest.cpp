@@ -0,0 +1,79 @@
+#include "Test.h"
+
+#include "RegionCache.h"
+
+#include <random>
+
+TERRA_TEST(RegionCacheStoresColumnOnWriter) {
+    const std::string directory = "region_cache_test";
+    const std::string entry = terra::RegionCache::GetEntryName("test", 0, 3, -7);
+
+    mc::world::ChunkColumnMetadata metadata = {};
+
+    metadata.x = 3;
+    metadata.z = -7;
+    metadata.continuous = true;
+    metadata.skylight = true;
+
+    terra::ChunkColumnPtr column = terra::GetChunkColumnPool().MakeShared(terra::ChunkColumnMetadata(metadata));
+    mc::block::BlockRegistry* registry = mc::block::BlockRegistry::GetInstance();
+    std::mt19937 random(7);
+
+    (*column)[0] = terra::MakeChunk(std::vector<mc::block::BlockPtr>{ registry->GetBlock(1) }, 0, nullptr);
+    (*column)[2] = terra::MakeChunk(std::vector<mc::block::BlockPtr>{ registry->GetBlock(0) }, 0, nullptr);
+
+    for (s32 i = 0; i < 2000; ++i) {
+        mc::Vector3i position(random() % 16, random() % 48, random() % 16);
+
+        column->SetBlock(position, registry->GetBlock(1 + random() % 20));
+    }
+
+    std::vector<mc::block::BlockPtr> expected;
+
+    for (s32 y = 0; y < 48; ++y) {
+        for (s32 z = 0; z < 16; ++z) {
+            for (s32 x = 0; x < 16; ++x) {
+                expected.push_back(column->GetBlock(mc::Vector3i(x, y, z)));
+            }
+        }
+    }
+
+    {
+        terra::RegionCache cache(directory, 1024 * 1024);
+
+        cache.Store(entry, *column);
+
+        // The writer serializes the chunks later, so changes after storing go to copies of them.
+        TERRA_CHECK((*column)[0]->IsPublished());
+        TERRA_CHECK((*column)[2]->IsPublished());
+
+        for (s32 i = 0; i < 2000; ++i) {
+            column->SetBlock(mc::Vector3i(random() % 16, random() % 48, random() % 16), registry->GetBlock(0));
+        }
+    }
+
+    terra::RegionCache cache(directory, 1024 * 1024);
+
+    TERRA_CHECK(cache.Contains(entry));
+
+    terra::ChunkColumnPtr loaded = cache.Load(entry);
+
+    TERRA_CHECK(loaded != nullptr);
+    if (loaded == nullptr) return;
+
+    TERRA_CHECK(loaded->GetMetadata().x == 3 && loaded->GetMetadata().z == -7);
+
+    for (s32 i = 0; i < terra::ChunkColumn::ChunksPerColumn; ++i) {
+        TERRA_CHECK(((*loaded)[i] == nullptr) == ((*column)[i] == nullptr));
+    }
+
+    std::size_t index = 0;
+
+    for (s32 y = 0; y < 48; ++y) {
+        for (s32 z = 0; z < 16; ++z) {
+            for (s32 x = 0; x < 16; ++x) {
+                TERRA_CHECK(loaded->GetBlock(mc::Vector3i(x, y, z)) == expected[index++]);
+            }
+        }
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef TERRACOTTA_TESTS_TEST_H_
+#define TERRACOTTA_TESTS_TEST_H_
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace terra {
+namespace test {
+
+using TestFunction = void(*)();
+
+struct TestCase {
+    const char* name;
+    TestFunction function;
+    bool benchmark;
+};
+
+// Every TERRA_TEST and TERRA_BENCH in the executable, in the order they were registered.
+std::vector<TestCase>& GetTestCases();
+
+struct TestRegistration {
+    TestRegistration(const char* name, TestFunction function, bool benchmark) {
+        GetTestCases().push_back(TestCase{ name, function, benchmark });
+    }
+};
+
+// Records a failed check. The test keeps running so every failure in it is reported.
+void Fail(const char* file, int line, const char* expression);
+
+// Prints one result line of a benchmark.
+void Report(const std::string& name, double value, const char* unit);
+
+// Runs the function repeatedly until at least the given time has passed and returns the seconds per call.
+template <typename Function>
+double Measure(Function&& function, double min_seconds = 0.25) {
+    using Clock = std::chrono::steady_clock;
+
+    std::size_t iterations = 0;
+    Clock::time_point start = Clock::now();
+    double elapsed = 0.0;
+
+    do {
+        function();
+        ++iterations;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < min_seconds);
+
+    return elapsed / iterations;
+}
+
+// Keeps the optimizer from removing a computation whose result is otherwise unused.
+void Consume(std::size_t value);
+
+} // ns test
+} // ns terra
+
+#define TERRA_TEST_REGISTER(name, benchmark) \
+    static void name(); \
+    static terra::test::TestRegistration name##_registration(#name, name, benchmark); \
+    static void name()
+
+#define TERRA_TEST(name) TERRA_TEST_REGISTER(name, false)
+#define TERRA_BENCH(name) TERRA_TEST_REGISTER(name, true)
+
+#define TERRA_CHECK(expression) \
+    do { \
+        if (!(expression)) terra::test::Fail(__FILE__, __LINE__, #expression); \
+    } while (0)
+
+#endif
@@ -0,0 +1,223 @@
+#include "Test.h"
+
+#include "EpochManager.h"
+#include "JobSystem.h"
+#include "World.h"
+#include "WorldSnapshot.h"
+
+#include <mclib/protocol/packets/PacketDispatcher.h>
+
+#include <map>
+#include <random>
+
+namespace {
+
+terra::ChunkColumnPtr MakeColumn(s32 x, s32 z, std::size_t sections) {
+    mc::world::ChunkColumnMetadata metadata = {};
+
+    metadata.x = x;
+    metadata.z = z;
+    metadata.continuous = true;
+    metadata.skylight = true;
+
+    terra::ChunkColumnPtr column = terra::GetChunkColumnPool().MakeShared(terra::ChunkColumnMetadata(metadata));
+    mc::block::BlockPtr stone = mc::block::BlockRegistry::GetInstance()->GetBlock(1);
+
+    for (std::size_t i = 0; i < sections; ++i) {
+        (*column)[i] = terra::MakeChunk(std::vector<mc::block::BlockPtr>{ stone }, 0, nullptr);
+    }
+
+    // Gives every column some non-uniform data so lookups touch packed storage.
+    column->SetBlock(mc::Vector3i(x & 15, 70, z & 15), stone);
+    column->BuildHeightmaps();
+    return column;
+}
+
+mc::Vector3i ChunkToBlock(s32 chunk_x, s32 chunk_z) {
+    return mc::Vector3i(static_cast<s64>(chunk_x) * 16 + 5, 64, static_cast<s64>(chunk_z) * 16 + 9);
+}
+
+} // ns
+
+TERRA_TEST(WorldGridFollowsCenter) {
+    mc::protocol::packets::PacketDispatcher dispatcher;
+    terra::JobSystem jobs(1);
+    terra::World world(&dispatcher, &jobs);
+    std::map<std::pair<s32, s32>, terra::ChunkColumnPtr> expected;
+    std::mt19937 random(3);
+
+    world.SetViewDistance(4);
+
+    for (s32 z = -20; z <= 20; ++z) {
+        for (s32 x = -20; x <= 20; ++x) {
+            if (random() % 3 == 0) continue;
+
+            terra::ChunkColumnPtr column = MakeColumn(x, z, 1);
+
+            expected[std::make_pair(x, z)] = column;
+            world.CommitColumn(column);
+        }
+    }
+
+    s32 center_x = 0;
+    s32 center_z = 0;
+
+    for (int step = 0; step < 200; ++step) {
+        // Mostly single chunk moves like walking, with an occasional teleport.
+        if (step % 25 == 24) {
+            center_x = static_cast<s32>(random() % 41) - 20;
+            center_z = static_cast<s32>(random() % 41) - 20;
+        } else {
+            center_x += static_cast<s32>(random() % 3) - 1;
+            center_z += static_cast<s32>(random() % 3) - 1;
+        }
+
+        world.SetCenter(ChunkToBlock(center_x, center_z));
+
+        for (s32 z = -24; z <= 24; ++z) {
+            for (s32 x = -24; x <= 24; ++x) {
+                auto iter = expected.find(std::make_pair(x, z));
+                terra::ChunkColumnPtr column = iter != expected.end() ? iter->second : nullptr;
+
+                TERRA_CHECK(world.GetChunk(ChunkToBlock(x, z)) == column);
+            }
+        }
+    }
+}
+
+TERRA_BENCH(WorldGetBlock) {
+    const s32 view_distance = terra::World::DefaultViewDistance;
+
+    mc::protocol::packets::PacketDispatcher dispatcher;
+    terra::JobSystem jobs(1);
+    terra::World world(&dispatcher, &jobs);
+
+    world.SetViewDistance(view_distance);
+
+    for (s32 z = -view_distance; z <= view_distance; ++z) {
+        for (s32 x = -view_distance; x <= view_distance; ++x) {
+            world.CommitColumn(MakeColumn(x, z, 5));
+        }
+    }
+
+    std::mt19937 random(11);
+    std::vector<mc::Vector3i> positions;
+    const s32 extent = (view_distance * 2 + 1) * 16;
+
+    for (std::size_t i = 0; i < (1 << 16); ++i) {
+        positions.emplace_back(static_cast<s32>(random() % extent) - view_distance * 16, random() % 96, static_cast<s32>(random() % extent) - view_distance * 16);
+    }
+
+    auto lookup = [&world, &positions]() {
+        std::size_t count = 0;
+
+        for (const mc::Vector3i& position : positions) {
+            count += world.GetBlock(position)->GetType();
+        }
+
+        terra::test::Consume(count);
+    };
+
+    world.SetCenter(mc::Vector3i(0, 64, 0));
+    double grid = terra::test::Measure(lookup);
+
+    // With the center far away, every loaded column is outside of the grid window and is found through the hash map.
+    world.SetCenter(mc::Vector3i(1 << 20, 64, 1 << 20));
+    double hash_map = terra::test::Measure(lookup);
+
+    terra::test::Report("grid GetBlock", positions.size() / grid / 1e6, "M/s");
+    terra::test::Report("hash map GetBlock", positions.size() / hash_map / 1e6, "M/s");
+}
+
+TERRA_TEST(SnapshotMapSharesUnchangedRegions) {
+    using Map = terra::SnapshotMap<int>;
+
+    int values[] = { 1, 2, 3 };
+    Map first(nullptr, { Map::Change(terra::ChunkCoord(0, 0), &values[0]), Map::Change(terra::ChunkCoord(100, -100), &values[1]) });
+    Map second(&first, { Map::Change(terra::ChunkCoord(1, 0), &values[2]), Map::Change(terra::ChunkCoord(100, -100), nullptr) });
+
+    TERRA_CHECK(first.GetSize() == 2);
+    TERRA_CHECK(*first.Find(0, 0) == 1);
+    TERRA_CHECK(*first.Find(100, -100) == 2);
+    TERRA_CHECK(first.Find(1, 0) == nullptr);
+
+    TERRA_CHECK(second.GetSize() == 2);
+    TERRA_CHECK(*second.Find(0, 0) == 1);
+    TERRA_CHECK(*second.Find(1, 0) == 3);
+    TERRA_CHECK(second.Find(100, -100) == nullptr);
+    TERRA_CHECK(second.Find(-1, -1) == nullptr);
+
+    Map third(&second, { Map::Change(terra::ChunkCoord(5000, 5000), &values[1]) });
+
+    // The region of (0, 0) didn't change, so both versions read the same value.
+    TERRA_CHECK(third.Find(0, 0) == second.Find(0, 0));
+    TERRA_CHECK(third.Find(1, 0) == second.Find(1, 0));
+    TERRA_CHECK(*third.Find(5000, 5000) == 2);
+}
+
+TERRA_TEST(WorldSnapshotCapturesChangedColumns) {
+    mc::protocol::packets::PacketDispatcher dispatcher;
+    terra::JobSystem jobs(1);
+    terra::World world(&dispatcher, &jobs);
+
+    for (s32 z = -10; z <= 10; ++z) {
+        for (s32 x = -10; x <= 10; ++x) {
+            world.CommitColumn(MakeColumn(x, z, 2));
+        }
+    }
+
+    world.PublishSnapshot();
+
+    terra::EpochManager::ReadGuard guard(terra::GetEpochManager());
+    const terra::WorldSnapshot* first = world.GetSnapshot();
+
+    TERRA_CHECK(first != nullptr);
+    TERRA_CHECK(first->GetColumnCount() == 21 * 21);
+
+    const terra::Chunk* untouched = first->GetChunk(-10, 0, -10);
+    const terra::Chunk* replaced = first->GetChunk(3, 1, 4);
+
+    TERRA_CHECK(first->GetChunk(3, 2, 4) == nullptr);
+
+    world.CommitColumn(MakeColumn(3, 4, 3));
+    world.PublishSnapshot();
+
+    const terra::WorldSnapshot* second = world.GetSnapshot();
+
+    TERRA_CHECK(second != first);
+    TERRA_CHECK(second->GetColumnCount() == 21 * 21);
+    TERRA_CHECK(second->GetChunk(-10, 0, -10) == untouched);
+    TERRA_CHECK(second->GetChunk(3, 1, 4) != replaced);
+    TERRA_CHECK(second->GetChunk(3, 2, 4) != nullptr);
+    TERRA_CHECK(first->GetChunk(3, 2, 4) == nullptr);
+
+    // Nothing changed, so the snapshot isn't replaced.
+    world.PublishSnapshot();
+    TERRA_CHECK(world.GetSnapshot() == second);
+}
+
+TERRA_BENCH(WorldPublishSnapshot) {
+    const s32 view_distance = terra::World::DefaultViewDistance;
+
+    mc::protocol::packets::PacketDispatcher dispatcher;
+    terra::JobSystem jobs(1);
+    terra::World world(&dispatcher, &jobs);
+
+    for (s32 z = -view_distance; z <= view_distance; ++z) {
+        for (s32 x = -view_distance; x <= view_distance; ++x) {
+            world.CommitColumn(MakeColumn(x, z, 5));
+        }
+    }
+
+    world.PublishSnapshot();
+
+    terra::ChunkColumnPtr column = MakeColumn(0, 0, 5);
+
+    double publish = terra::test::Measure([&]() {
+        world.CommitColumn(column);
+        world.PublishSnapshot();
+    });
+
+    terra::test::Report("loaded columns", static_cast<double>((view_distance * 2 + 1) * (view_distance * 2 + 1)), "");
+    terra::test::Report("publish after one column change", publish * 1e6, "us");
+}